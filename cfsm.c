@@ -27,6 +27,7 @@
 #include <err.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "mtemplate.h"
 #include "mobject.h"
@@ -35,19 +36,17 @@
 
 #include "cfsm.h"
 
-/* From cfsm_parse.y */
-extern FILE *yyin;
-extern int yyparse(void);
-extern void finalise_namespace(void);
-extern void setup_initial_namespace(void);
-extern struct mobject *fsm_namespace;
-
-/* Exported for use in cfsm_parse.y */
-const char *in_path = NULL;		/* Input pathname */
-char *header_name = NULL;		/* Header file name */
+/* Exported for use in cfsm_parse.y; read-only once parsing starts */
+int table_mode = TABLE_NONE;		/* Table-driven advance function */
+int vector_mode = 0;			/* Vector kernel for state arrays */
+int runtime_mode = 0;			/* Data only, for use with libcfsm */
+int fused_mode = 0;			/* One case per transition */
+int stats_mode = 0;			/* Per-thread statistics counters */
+int trace_mode = 0;			/* Per-thread transition trace rings */
+int cxx_mode = 0;			/* C++ header instead of C */
 
 static struct mtemplate *
-read_template(const char *template_dir, const char *template_name)
+read_template(const char *path)
 {
 	char *template;
 	size_t tlen;
@@ -56,19 +55,8 @@ read_template(const char *template_dir, const char *template_name)
 	int tfd;
 	struct mtemplate *ret;
 
-	if ((tlen = strlcpy(buf, template_dir, sizeof(buf))) >= sizeof(buf))
-		errx(1, "Template path too long");
-	if (tlen > 0 && buf[tlen - 1] != '/') {
-		if (tlen + 2 >= sizeof(buf))
-			errx(1, "Template path too long");
-		buf[tlen++] = '/';
-		buf[tlen++] = '\0';
-	}
-	if ((tlen = strlcat(buf, template_name, sizeof(buf))) >= sizeof(buf))
-		errx(1, "Template path too long");
-
-	if ((tfd = open(buf, O_RDONLY)) == -1)
-		err(1, "Unable to open template \"%s\" for reading", buf);
+	if ((tfd = open(path, O_RDONLY)) == -1)
+		err(1, "Unable to open template \"%s\" for reading", path);
 
 	template = NULL;
 	tlen = 0;
@@ -97,40 +85,338 @@ read_template(const char *template_dir, const char *template_name)
 	return ret;
 }
 
+/*
+ * Templates are read and parsed once however many FSMs are compiled, and
+ * are shared by the worker threads. A parsed template is only read while
+ * it is being run.
+ */
+struct cached_template {
+	char *path;
+	struct mtemplate *tmpl;
+};
+
+static struct cached_template *templates = NULL;
+static size_t ntemplates = 0;
+static pthread_mutex_t templates_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct mtemplate *
+get_template(const char *template_dir, const char *template_name)
+{
+	char buf[8192];
+	size_t i, tlen;
+	struct mtemplate *ret = NULL;
+
+	if ((tlen = strlcpy(buf, template_dir, sizeof(buf))) >= sizeof(buf))
+		errx(1, "Template path too long");
+	if (tlen > 0 && buf[tlen - 1] != '/') {
+		if (tlen + 2 >= sizeof(buf))
+			errx(1, "Template path too long");
+		buf[tlen++] = '/';
+		buf[tlen++] = '\0';
+	}
+	if ((tlen = strlcat(buf, template_name, sizeof(buf))) >= sizeof(buf))
+		errx(1, "Template path too long");
+
+	pthread_mutex_lock(&templates_lock);
+	for (i = 0; i < ntemplates; i++) {
+		if (strcmp(templates[i].path, buf) == 0) {
+			ret = templates[i].tmpl;
+			break;
+		}
+	}
+	if (ret == NULL) {
+		if ((templates = realloc(templates,
+		    (ntemplates + 1) * sizeof(*templates))) == NULL)
+			errx(1, "realloc(templates) failed");
+		if ((templates[ntemplates].path = strdup(buf)) == NULL)
+			errx(1, "strdup");
+		ret = templates[ntemplates++].tmpl = read_template(buf);
+	}
+	pthread_mutex_unlock(&templates_lock);
+	return ret;
+}
+
 static void
-render_template(const char *template_dir, const char *template_path,
-    const char *out_arg)
+free_templates(void)
 {
-	char err_buf[1024];
+	size_t i;
+
+	for (i = 0; i < ntemplates; i++) {
+		free(templates[i].path);
+		mtemplate_free(templates[i].tmpl);
+	}
+	free(templates);
+	templates = NULL;
+	ntemplates = 0;
+}
+
+/*
+ * An output to generate, all of which are rendered from the one parsed
+ * namespace.
+ */
+struct output {
+	const char *what;
+	const char *template_dir;
+	const char *template_path;
+	char *path;
+};
+
+/* An FSM description to compile and the outputs to generate from it */
+struct job {
+	const char *in_path;
+	char *header_name;		/* Header file name, or NULL */
+	const char *trace_path;		/* Trace dump to decode, or NULL */
+	struct output *outputs;
+	size_t noutputs;
+};
+
+static struct job *jobs = NULL;
+static size_t njobs = 0, next_job = 0;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+add_output(struct job *job, const char *what, const char *template_dir,
+    const char *template_path, const char *path)
+{
+	struct output *o;
+
+	if ((job->outputs = realloc(job->outputs,
+	    (job->noutputs + 1) * sizeof(*job->outputs))) == NULL)
+		errx(1, "realloc(outputs) failed");
+	o = &job->outputs[job->noutputs++];
+	o->what = what;
+	o->template_dir = template_dir;
+	o->template_path = template_path;
+	if ((o->path = strdup(path)) == NULL)
+		errx(1, "strdup");
+}
+
+/* Returns in_path with any ".fsm" suffix replaced by "suffix" */
+static char *
+derive_path(const char *in_path, const char *suffix)
+{
+	size_t len = strlen(in_path);
+	char *ret;
+
+	if (len > 4 && strcmp(in_path + len - 4, ".fsm") == 0)
+		len -= 4;
+	if (asprintf(&ret, "%.*s%s", (int)len, in_path, suffix) == -1)
+		errx(1, "asprintf failed");
+	return ret;
+}
+
+/* Read up to len bytes, stopping short only at end of file */
+static size_t
+read_full(int fd, char *buf, size_t len)
+{
+	size_t off;
+	ssize_t r;
+
+	for (off = 0; off < len; off += r) {
+		if ((r = read(fd, buf + off, len - off)) == -1) {
+			if (errno == EINTR || errno == EAGAIN) {
+				r = 0;
+				continue;
+			}
+			err(1, "read");
+		}
+		if (r == 0)
+			break;
+	}
+	return off;
+}
+
+/* Returns non-zero if the files at path_a and path_b have equal contents */
+static int
+same_contents(const char *path_a, const char *path_b)
+{
+	char buf_a[8192], buf_b[8192];
+	struct stat st_a, st_b;
+	int fd_a, fd_b, ret = 0;
+	size_t len;
+
+	if ((fd_a = open(path_a, O_RDONLY)) == -1)
+		err(1, "Unable to open \"%s\" for reading", path_a);
+	if ((fd_b = open(path_b, O_RDONLY)) == -1) {
+		if (errno != ENOENT)
+			err(1, "Unable to open \"%s\" for reading", path_b);
+		close(fd_a);
+		return 0;
+	}
+	if (fstat(fd_a, &st_a) == -1 || fstat(fd_b, &st_b) == -1)
+		err(1, "fstat");
+	if (st_a.st_size != st_b.st_size)
+		goto out;
+	do {
+		len = read_full(fd_a, buf_a, sizeof(buf_a));
+		if (read_full(fd_b, buf_b, sizeof(buf_b)) != len ||
+		    memcmp(buf_a, buf_b, len) != 0)
+			goto out;
+	} while (len != 0);
+	ret = 1;
+ out:
+	close(fd_a);
+	close(fd_b);
+	return ret;
+}
+
+/* The umask, read by main() before any render threads start */
+static mode_t output_umask = 022;
+
+/*
+ * Render a template to out_arg. Output is written to a temporary file
+ * alongside out_arg that then replaces it, unless out_arg already has
+ * the same contents; in that case it is left alone, so that its
+ * modification time does not trigger rebuilds of things that depend on
+ * it.
+ */
+static void
+render_template(struct mobject *ns, const char *template_dir,
+    const char *template_path, const char *out_arg, const char *what)
+{
+	char err_buf[1024], tmp_path[8192];
 	FILE *out_file = NULL;
 	struct mtemplate *tmpl;
+	int fd;
 
-	tmpl = read_template(template_dir, template_path);
+	tmpl = get_template(template_dir, template_path);
 	if (strcmp(out_arg, "-") == 0) {
-		out_file = stdout;
-		out_arg = "(stdout)";
-	} else if ((out_file = fopen(out_arg, "w")) == NULL)
-		err(1, "fopen(\"%s\", \"w\")", out_arg);
-	if (mtemplate_run_stdio(tmpl, fsm_namespace, out_file,
-		err_buf, sizeof(err_buf)) == -1)
+		warnx("Writing %s to \"%s\"", what, out_arg);
+		if (mtemplate_run_stdio(tmpl, ns, stdout,
+		    err_buf, sizeof(err_buf)) == -1)
+			errx(1, "mtemplate_run_stdio: %s", err_buf);
+		return;
+	}
+
+	if ((size_t)snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXXXXXX",
+	    out_arg) >= sizeof(tmp_path))
+		errx(1, "Output path too long");
+	if ((fd = mkstemp(tmp_path)) == -1)
+		err(1, "mkstemp(\"%s\")", tmp_path);
+	/* mkstemp creates the file 0600; make it as fopen(..., "w") would */
+	if (fchmod(fd, 0666 & ~output_umask) == -1 ||
+	    (out_file = fdopen(fd, "w")) == NULL) {
+		unlink(tmp_path);
+		err(1, "Unable to open \"%s\" for writing", tmp_path);
+	}
+	if (mtemplate_run_stdio(tmpl, ns, out_file,
+	    err_buf, sizeof(err_buf)) == -1) {
+		unlink(tmp_path);
 		errx(1, "mtemplate_run_stdio: %s", err_buf);
-	if (out_file != stdout)
-		fclose(out_file);
+	}
+	if (fclose(out_file) != 0) {
+		unlink(tmp_path);
+		err(1, "Unable to write \"%s\"", tmp_path);
+	}
+
+	if (same_contents(tmp_path, out_arg)) {
+		warnx("%s \"%s\" is unchanged", what, out_arg);
+		if (unlink(tmp_path) == -1)
+			err(1, "unlink(\"%s\")", tmp_path);
+		return;
+	}
+	warnx("Writing %s to \"%s\"", what, out_arg);
+	if (rename(tmp_path, out_arg) == -1) {
+		unlink(tmp_path);
+		err(1, "rename(\"%s\", \"%s\")", tmp_path, out_arg);
+	}
+}
+
+/* Parse one FSM description and generate all of its outputs */
+static void
+compile_fsm(struct job *job)
+{
+	struct cfsm_ctx *ctx;
+	const char *in_path = job->in_path;
+	FILE *in;
+	size_t i;
+
+	if (strcmp(in_path, "-") == 0) {
+		in = stdin;
+		in_path = "(stdin)";
+	} else if ((in = fopen(in_path, "r")) == NULL)
+		err(1, "Could not open \"%s\" for reading)", in_path);
+
+	ctx = cfsm_ctx_new(in_path, job->header_name);
+	if (parse_fsm(ctx, in) != 0)
+		errx(1, "Input file \"%s\" had errors", in_path);
+
+	if (in != stdin)
+		fclose(in);
+
+	finalise_namespace(ctx);
+
+	if (job->trace_path != NULL)
+		decode_trace(ctx, job->trace_path, stdout);
+
+	/* Everything is generated from the one parse */
+	for (i = 0; i < job->noutputs; i++) {
+		render_template(ctx->ns, job->outputs[i].template_dir,
+		    job->outputs[i].template_path, job->outputs[i].path,
+		    job->outputs[i].what);
+	}
+
+	cfsm_ctx_free(ctx);
+}
+
+/* Compile FSMs from the job list until there are none left */
+static void *
+worker(void *arg)
+{
+	struct job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&jobs_lock);
+		job = next_job < njobs ? &jobs[next_job++] : NULL;
+		pthread_mutex_unlock(&jobs_lock);
+		if (job == NULL)
+			return NULL;
+		compile_fsm(job);
+	}
 }
 
 static void
 usage(void)
 {
 	fprintf(stderr,
-"Usage: cfsm [-h] [-HCD] [-o output-file] fsm-file\n"
+"Usage: cfsm [-h] [-CdDFgLrSTV] [-e dense|sparse] [-G dot-file]\n"
+"            [-H header-file] [-m template-file]\n"
+"            [-M template-file:output-file]\n"
+"            [-o output-file] [-t template-dir] fsm-file\n"
+"       cfsm [-h] [-CdDFgLrSTV] [-e dense|sparse] [-j jobs] [-t template-dir]\n"
+"            fsm-file fsm-file ...\n"
+"       cfsm [-h] -X trace-file fsm-file\n"
 "Command line options:\n"
 "    -h               Display this help\n"
+"    -C               Generate a C++17 header instead of C source/header\n"
 "    -d               Generate C header file in addition to source file\n"
 "    -D               Only generate C header file (and not a source file)\n"
+"    -e encoding      Force \"dense\" or \"sparse\" transition table\n"
+"                     (implies -T)\n"
+"    -F               Generate a fused advance function with one case per\n"
+"                     transition and its callbacks inline\n"
 "    -g               Generate Graphviz dot file instead of C source/header\n"
+"    -G dot_file      Also generate a Graphviz dot file at dot_file\n"
+"    -H header_file   Also generate a C header file at header_file\n"
+"    -j jobs          Compile up to this many FSM files at once (default: 1)\n"
+"    -L               Generate per-thread transition trace rings\n"
 "    -m template_file \"Manual\" output mode using user-supplied template\n"
-"    -o output_file   Specify output file (default: fsm.[c|h|dot])\n"
-"    -t template_dir  Specify path to C and Graphviz templates\n");
+"    -M tmpl:out      Also render user-supplied template tmpl to out (may be\n"
+"                     repeated)\n"
+"    -o output_file   Specify output file (default: fsm.[c|h|hpp|dot])\n"
+"    -r               Generate only data and wrappers for the libcfsm runtime\n"
+"    -S               Generate per-thread transition, precondition failure\n"
+"                     and time-in-state statistics counters\n"
+"    -t template_dir  Specify path to C, C++ and Graphviz templates\n"
+"    -T               Generate a table-driven advance function, choosing\n"
+"                     the table encoding automatically by density\n"
+"    -V               Generate a vector kernel for arrays of FSM states\n"
+"                     (implies -e dense)\n"
+"    -X trace_file    Decode a trace dump made by the FSM to standard output\n"
+"                     instead of generating anything\n"
+"When several FSM files are given, the outputs for each are named after\n"
+"it, with its \".fsm\" suffix replaced by \".c\", \".h\", \".hpp\" or\n"
+"\".dot\".\n");
 }
 
 int
@@ -139,16 +425,31 @@ main(int argc, char **argv)
 	extern char *optarg;
 	extern int optind;
 	int ch;
-	const char *manual_arg = NULL, *out_arg = NULL, *out;
+	const char *manual_arg = NULL, *out_arg = NULL;
+	const char *dot_path = NULL, *header_path = NULL, *path;
+	const char *trace_path = NULL;
 	const char *template_dir = TEMPLATE_DIR;
 	int output_dot = 0, output_header = 0, output_src = 1;
-	size_t len;
-
-	while ((ch = getopt(argc, argv, "Dhdgm:o:t:")) != -1) {
+	char *cp, *what, *out, **manual_pairs = NULL;
+	size_t i, j, len, nmanual_pairs = 0;
+	u_long njobs_arg = 1;
+	pthread_t *threads;
+	struct job *job;
+	int r;
+
+	/* umask() can only be read by setting it, which threads would race */
+	output_umask = umask(0);
+	umask(output_umask);
+
+	while ((ch = getopt(argc, argv, "CDFG:H:LM:STVX:hde:gj:m:o:rt:")) != -1) {
 		switch (ch) {
 		case 'h':
 			usage();
 			exit(0);
+		case 'C':
+			output_src = 0;
+			cxx_mode = 1;
+			break;
 		case 'D':
 			output_src = 0;
 			output_header = 1;
@@ -156,20 +457,83 @@ main(int argc, char **argv)
 		case 'd':
 			output_header = 1;
 			break;
+		case 'e':
+			if (strcmp(optarg, "dense") == 0)
+				table_mode = TABLE_DENSE;
+			else if (strcmp(optarg, "sparse") == 0)
+				table_mode = TABLE_SPARSE;
+			else {
+				warnx("Unrecognised table encoding \"%s\"",
+				    optarg);
+				usage();
+				exit(1);
+			}
+			break;
+		case 'F':
+			fused_mode = 1;
+			break;
 		case 'g':
 			output_src = 0;
 			output_dot = 1;
 			break;
+		case 'G':
+			dot_path = optarg;
+			break;
+		case 'H':
+			header_path = optarg;
+			break;
+		case 'j':
+			njobs_arg = strtoul(optarg, &cp, 10);
+			if (*optarg == '\0' || *cp != '\0' || njobs_arg < 1 ||
+			    njobs_arg > 1024) {
+				warnx("Invalid number of jobs \"%s\"", optarg);
+				usage();
+				exit(1);
+			}
+			break;
+		case 'L':
+			trace_mode = 1;
+			break;
 		case 'm':
 			output_src = 0;
 			manual_arg = optarg;
 			break;
+		case 'M':
+			if ((cp = strchr(optarg, ':')) == NULL ||
+			    cp == optarg || cp[1] == '\0') {
+				warnx("Manual output \"%s\" is not of the form "
+				    "template-file:output-file", optarg);
+				usage();
+				exit(1);
+			}
+			if ((manual_pairs = realloc(manual_pairs,
+			    (nmanual_pairs + 1) *
+			    sizeof(*manual_pairs))) == NULL)
+				errx(1, "realloc(manual_pairs) failed");
+			manual_pairs[nmanual_pairs++] = optarg;
+			break;
 		case 'o':
 			out_arg = optarg;
 			break;
+		case 'r':
+			runtime_mode = 1;
+			break;
+		case 'S':
+			stats_mode = 1;
+			break;
 		case 't':
 			template_dir = optarg;
 			break;
+		case 'T':
+			if (table_mode == TABLE_NONE)
+				table_mode = TABLE_AUTO;
+			break;
+		case 'V':
+			vector_mode = 1;
+			break;
+		case 'X':
+			trace_path = optarg;
+			break;
 		default:
 			warnx("Unrecognised command line option");
 			usage();
@@ -180,14 +544,94 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc != 1) {
+	if (argc < 1) {
 		warnx("No FSM file specified");
 		usage();
 		exit(1);
 	}
 
-	if (output_dot + output_header + (manual_arg != NULL ? 1 : 0) > 1) {
-		warnx("Please select only one of -D, -g and -m");
+	if (argc > 1) {
+		if (out_arg != NULL || dot_path != NULL ||
+		    header_path != NULL || manual_arg != NULL ||
+		    nmanual_pairs != 0) {
+			warnx("Output paths (-o, -G, -H, -m and -M) may only "
+			    "be specified for a single FSM file");
+			usage();
+			exit(1);
+		}
+		for (i = 0; i < (size_t)argc; i++) {
+			if (strcmp(argv[i], "-") == 0) {
+				warnx("Standard input may only be read when "
+				    "compiling a single FSM file");
+				usage();
+				exit(1);
+			}
+		}
+	}
+
+	if (output_dot + output_header + cxx_mode +
+	    (manual_arg != NULL ? 1 : 0) > 1) {
+		warnx("Please select only one of -C, -d/-D, -g and -m");
+		usage();
+		exit(1);
+	}
+
+	/* The C++ header has a dense table and none of the C extras */
+	if (cxx_mode) {
+		if (table_mode != TABLE_NONE || vector_mode || runtime_mode ||
+		    fused_mode || stats_mode || trace_mode ||
+		    header_path != NULL) {
+			warnx("The C++ header (-C) may not be combined with "
+			    "-e, -F, -H, -L, -r, -S, -T or -V");
+			usage();
+			exit(1);
+		}
+		table_mode = TABLE_DENSE;
+	}
+
+	if (vector_mode) {
+		if (table_mode == TABLE_SPARSE) {
+			warnx("The vector kernel (-V) requires a dense "
+			    "transition table");
+			usage();
+			exit(1);
+		}
+		table_mode = TABLE_DENSE;
+	}
+
+	if (runtime_mode && table_mode != TABLE_NONE) {
+		warnx("The libcfsm runtime (-r) brings its own transition "
+		    "table and may not be combined with -T, -e or -V");
+		usage();
+		exit(1);
+	}
+
+	if (fused_mode && (runtime_mode || table_mode != TABLE_NONE)) {
+		warnx("The fused advance function (-F) may not be combined "
+		    "with -r, -T, -e or -V");
+		usage();
+		exit(1);
+	}
+
+	if (stats_mode && runtime_mode) {
+		warnx("Statistics (-S) are not available with the libcfsm "
+		    "runtime (-r)");
+		usage();
+		exit(1);
+	}
+
+	if (trace_mode && runtime_mode) {
+		warnx("Tracing (-L) is not available with the libcfsm "
+		    "runtime (-r)");
+		usage();
+		exit(1);
+	}
+
+	if (trace_path != NULL && (argc > 1 || out_arg != NULL ||
+	    dot_path != NULL || header_path != NULL || manual_arg != NULL ||
+	    nmanual_pairs != 0 || output_dot || output_header)) {
+		warnx("A trace dump (-X) is decoded against a single FSM file "
+		    "and nothing is generated");
 		usage();
 		exit(1);
 	}
@@ -198,69 +642,145 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (output_src && output_header && out_arg != NULL &&
-	    strcmp(out_arg, "-") == 0) {
+	if (output_src && output_header && header_path == NULL &&
+	    out_arg != NULL && strcmp(out_arg, "-") == 0) {
 		warnx("Cannot specify stdout output when generating both C "
 		    "source and header");
 		usage();
 		exit(1);
 	}
 
+	if ((jobs = calloc(argc, sizeof(*jobs))) == NULL)
+		errx(1, "calloc(jobs) failed");
+	njobs = argc;
+
+	/* Several FSMs: name every output after its input */
+	if (argc > 1) {
+		for (i = 0; i < njobs; i++) {
+			job = &jobs[i];
+			job->in_path = argv[i];
+			job->header_name = derive_path(argv[i],
+			    cxx_mode ? ".hpp" : ".h");
+			if (output_dot) {
+				out = derive_path(argv[i], ".dot");
+				add_output(job, "Graphviz dot", template_dir,
+				    TEMPLATE_GRAPHVIZ, out);
+				free(out);
+			}
+			if (output_src) {
+				out = derive_path(argv[i], ".c");
+				add_output(job, "C source", template_dir,
+				    runtime_mode ? TEMPLATE_C_RUNTIME :
+				    TEMPLATE_C_SOURCE, out);
+				free(out);
+			}
+			if (output_header) {
+				add_output(job, "C header", template_dir,
+				    TEMPLATE_C_HEADER, job->header_name);
+			}
+			if (cxx_mode) {
+				add_output(job, "C++ header", template_dir,
+				    TEMPLATE_CXX, job->header_name);
+			}
+		}
+		goto compile;
+	}
+
+	job = &jobs[0];
+	job->in_path = argv[0];
+	if (trace_path != NULL) {
+		job->trace_path = trace_path;
+		goto compile;
+	}
+
 	/* Synthesise a header path from the source path */
-	if (output_src && out_arg != NULL && (len = strlen(out_arg)) >= 2) {
+	if (header_path != NULL) {
+		output_header = 1;
+		if ((job->header_name = strdup(header_path)) == NULL)
+			errx(1, "strdup");
+	} else if (output_src && out_arg != NULL &&
+	    (len = strlen(out_arg)) >= 2) {
 		if (strcmp(out_arg + len - 2, ".c") == 0) {
-			if ((header_name = strdup(out_arg)) == NULL)
+			if ((job->header_name = strdup(out_arg)) == NULL)
 				errx(1, "strdup");
-			header_name[len - 1] = 'h';
+			job->header_name[len - 1] = 'h';
 		}
+	} else if (cxx_mode) {
+		/* Names the include guard after the C++ header */
+		if ((job->header_name = strdup(out_arg == NULL ?
+		    DEFAULT_OUT_CXX : out_arg)) == NULL)
+			errx(1, "strdup");
 	}
 
-	setup_initial_namespace();
-
-	in_path = argv[0];
-	if (strcmp(in_path, "-") == 0) {
-		yyin = stdin;
-		in_path = "(stdin)";
-	} else if ((yyin = fopen(in_path, "r")) == NULL)
-		err(1, "Could not open \"%s\" for reading)", in_path);
-
-	if (yyparse() != 0)
-		errx(1, "Input file \"%s\" had errors", in_path);
-
-	if (yyin != stdin)
-		fclose(yyin);
-
-	finalise_namespace();
-
-	if (output_dot) {
-		out = out_arg == NULL ? DEFAULT_OUT_DOT : out_arg;
-		warnx("Writing Graphviz dot to \"%s\"", out);
-		render_template(template_dir, TEMPLATE_GRAPHVIZ, out);
+	/* Work out what to generate, before parsing anything */
+	if (output_dot || dot_path != NULL) {
+		if (dot_path != NULL)
+			path = dot_path;
+		else
+			path = out_arg == NULL ? DEFAULT_OUT_DOT : out_arg;
+		add_output(job, "Graphviz dot", template_dir,
+		    TEMPLATE_GRAPHVIZ, path);
 	}
-
 	if (output_src) {
-		out = out_arg == NULL ? DEFAULT_OUT_C_SRC : out_arg;
-		warnx("Writing C source to \"%s\"", out);
-		render_template(template_dir, TEMPLATE_C_SOURCE, out);
+		path = out_arg == NULL ? DEFAULT_OUT_C_SRC : out_arg;
+		add_output(job, "C source", template_dir, runtime_mode ?
+		    TEMPLATE_C_RUNTIME : TEMPLATE_C_SOURCE, path);
 	}
-
 	if (output_header) {
-		if (header_name != NULL)
-			out = header_name;
+		if (job->header_name != NULL)
+			path = job->header_name;
 		else
-			out = out_arg == NULL ? DEFAULT_OUT_C_HDR : out_arg;
-		warnx("Writing C header to \"%s\"", out);
-		render_template(template_dir, TEMPLATE_C_HEADER, out);
+			path = out_arg == NULL ? DEFAULT_OUT_C_HDR : out_arg;
+		add_output(job, "C header", template_dir, TEMPLATE_C_HEADER,
+		    path);
+	}
+	if (cxx_mode) {
+		add_output(job, "C++ header", template_dir, TEMPLATE_CXX,
+		    job->header_name);
 	}
-
 	if (manual_arg != NULL) {
-		warnx("Rendering template \"%s\" to \"%s\"",
-		    manual_arg, out_arg);
-		render_template("", manual_arg, out_arg);
+		if (asprintf(&what, "template \"%s\" output",
+		    manual_arg) == -1)
+			errx(1, "asprintf failed");
+		add_output(job, what, "", manual_arg, out_arg);
+	}
+	for (i = 0; i < nmanual_pairs; i++) {
+		cp = strchr(manual_pairs[i], ':');
+		*cp++ = '\0';
+		if (asprintf(&what, "template \"%s\" output",
+		    manual_pairs[i]) == -1)
+			errx(1, "asprintf failed");
+		add_output(job, what, "", manual_pairs[i], cp);
+	}
+	free(manual_pairs);
+
+ compile:
+	if (njobs_arg > njobs)
+		njobs_arg = njobs;
+	if (njobs_arg <= 1)
+		worker(NULL);
+	else {
+		/* Any error is fatal to the whole run and names its file */
+		if ((threads = calloc(njobs_arg, sizeof(*threads))) == NULL)
+			errx(1, "calloc(threads) failed");
+		for (i = 0; i < njobs_arg; i++) {
+			if ((r = pthread_create(&threads[i], NULL,
+			    worker, NULL)) != 0)
+				errx(1, "pthread_create: %s", strerror(r));
+		}
+		for (i = 0; i < njobs_arg; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
 	}
 
-	if (header_name != NULL)
-		free(header_name);
+	for (i = 0; i < njobs; i++) {
+		for (j = 0; j < jobs[i].noutputs; j++)
+			free(jobs[i].outputs[j].path);
+		free(jobs[i].outputs);
+		free(jobs[i].header_name);
+	}
+	free(jobs);
+	free_templates();
 
 	return 0;
 }
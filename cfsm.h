@@ -20,13 +20,16 @@
 #define _CFSM_H
 
 #define TEMPLATE_C_SOURCE		"source.m"
+#define TEMPLATE_C_RUNTIME		"runtime.m"
 #define TEMPLATE_C_HEADER		"header.m"
 #define TEMPLATE_GRAPHVIZ		"graphviz.m"
+#define TEMPLATE_CXX			"cxx.m"
 
 /* Default output file names */
 #define DEFAULT_OUT_DOT			"fsm.dot"
 #define DEFAULT_OUT_C_SRC		"fsm.c"
 #define DEFAULT_OUT_C_HDR		"fsm.h"
+#define DEFAULT_OUT_CXX			"fsm.hpp"
 
 /* Default variable and function names, etc. */
 #define DEFAULT_HEADER			"fsm.h"
@@ -39,6 +42,66 @@
 #define DEFAULT_ADVANCE_FUNC		"fsm_advance"
 #define DEFAULT_STATE_NTOP_FUNC		"fsm_state_ntop"
 #define DEFAULT_EVENT_NTOP_FUNC		"fsm_event_ntop"
+#define DEFAULT_STATE_PTON_FUNC		"fsm_state_pton"
+#define DEFAULT_EVENT_PTON_FUNC		"fsm_event_pton"
 #define DEFAULT_CURRENT_STATE_FUNC	"fsm_current_state"
+#define DEFAULT_CAN_ADVANCE_FUNC	"fsm_can_advance"
+#define DEFAULT_VALID_EVENTS_FUNC	"fsm_valid_events"
+#define DEFAULT_STRERROR_FUNC		"fsm_strerror"
+
+/* Transition table modes */
+#define TABLE_NONE			0	/* Nested switch() statements */
+#define TABLE_AUTO			1	/* Pick encoding by density */
+#define TABLE_DENSE			2	/* Dense state x event array */
+#define TABLE_SPARSE			3	/* Row-displaced comb vector */
+#define TABLE_RUNTIME			4	/* Transition index for libcfsm */
+#define TABLE_FUSED			5	/* Per-transition cases, no table */
+
+struct mobject;
+struct cfsm_ir;
+
+/*
+ * Everything belonging to the compilation of one FSM description, from
+ * parsing through to rendering its outputs. Nothing here is shared, so
+ * several may be compiled at once.
+ */
+struct cfsm_ctx {
+	const char *in_path;		/* Input pathname */
+	char *header_name;		/* Header file name, or NULL */
+	u_int lnum;			/* Line number in input file */
+
+	/* The namespace that is used to fill in the templates */
+	struct mobject *ns;
+
+	/* The states, events and actions, as parsed */
+	struct cfsm_ir *ir;
+
+	/* Active event or state, or IR_NONE */
+	u_int current_state, current_event;
+
+	/* Temporary buffer to accumulate source-banner */
+	char *banner;
+	size_t banner_len;
+
+	/* Bitfields for arguments to provide to callback functions */
+	u_int trans_callback_args, event_callback_args;
+	u_int trans_precond_args, event_precond_args;
+
+	int event_specified;
+
+	/* Event delivered when a state times out, or IR_NONE */
+	u_int timeout_event;
+};
+
+/* cfsm_parse.y */
+struct cfsm_ctx *cfsm_ctx_new(const char *, const char *);
+void cfsm_ctx_free(struct cfsm_ctx *);
+void finalise_namespace(struct cfsm_ctx *);
+
+/* cfsm_lex.l */
+int parse_fsm(struct cfsm_ctx *, FILE *);
+
+/* cfsm_trace.c */
+void decode_trace(struct cfsm_ctx *, const char *, FILE *);
 
 #endif /* _CFSM_H */
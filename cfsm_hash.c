@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* $Id$ */
+
+/*
+ * Minimal perfect hashes over the state and event names, used by the
+ * generated string to enum functions. Names are first hashed into
+ * buckets; each bucket then gets a displacement that is either a seed
+ * that rehashes all of its names into free slots or, for buckets holding
+ * a single name, the slot itself stored as -(slot + 1). The hash function
+ * is in libcfsm/cfsm_name_hash.h and must match the one in source.m.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#include "mobject.h"
+
+#include "cfsm.h"
+#include "cfsm_ir.h"
+#include "libcfsm/cfsm_name_hash.h"
+
+/* Local prototypes */
+void setup_name_hashes(struct mobject *, struct cfsm_ir *);
+
+/* Give up on a bucket after trying this many seeds */
+#define MAX_SEED	(1 << 24)
+
+struct bucket {
+	size_t bucket;
+	size_t nkeys;
+	size_t *keys;		/* Points into a single array of all keys */
+};
+
+/* Sort buckets largest first, ties by bucket number for stable output */
+static int
+bucket_cmp(const void *a, const void *b)
+{
+	const struct bucket *ba = a, *bb = b;
+
+	if (ba->nkeys != bb->nkeys)
+		return ba->nkeys < bb->nkeys ? 1 : -1;
+	return ba->bucket < bb->bucket ? -1 : ba->bucket > bb->bucket;
+}
+
+static void
+build_hash(const char **names, size_t n, int32_t *disp, size_t *slots)
+{
+	struct bucket *buckets;
+	size_t i, j, k, slot, *tried, *hashes, *keys;
+	u_char *used;
+	uint32_t seed;
+
+	if ((buckets = calloc(n, sizeof(*buckets))) == NULL ||
+	    (tried = calloc(n, sizeof(*tried))) == NULL ||
+	    (hashes = calloc(n, sizeof(*hashes))) == NULL ||
+	    (keys = calloc(n, sizeof(*keys))) == NULL ||
+	    (used = calloc(n, 1)) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+
+	/* Count the names in each bucket, then lay the buckets out in keys */
+	for (i = 0; i < n; i++) {
+		buckets[i].bucket = i;
+		hashes[i] = name_hash(0, names[i]) % n;
+		buckets[hashes[i]].nkeys++;
+	}
+	for (i = j = 0; i < n; i++) {
+		buckets[i].keys = keys + j;
+		j += buckets[i].nkeys;
+		buckets[i].nkeys = 0;
+	}
+	for (i = 0; i < n; i++) {
+		j = hashes[i];
+		buckets[j].keys[buckets[j].nkeys++] = i;
+	}
+	qsort(buckets, n, sizeof(*buckets), bucket_cmp);
+
+	/* Find a seed that places every name in each bucket in a free slot */
+	for (i = 0; i < n && buckets[i].nkeys > 1; i++) {
+		for (seed = 1; seed < MAX_SEED; seed++) {
+			for (j = 0; j < buckets[i].nkeys; j++) {
+				slot = name_hash(seed,
+				    names[buckets[i].keys[j]]) % n;
+				for (k = 0; k < j; k++) {
+					if (tried[k] == slot)
+						break;
+				}
+				if (used[slot] || k < j)
+					break;
+				tried[j] = slot;
+			}
+			if (j == buckets[i].nkeys)
+				break;
+		}
+		if (seed >= MAX_SEED)
+			errx(1, "Unable to build perfect hash over names");
+		disp[buckets[i].bucket] = (int32_t)seed;
+		for (j = 0; j < buckets[i].nkeys; j++) {
+			used[tried[j]] = 1;
+			slots[tried[j]] = buckets[i].keys[j];
+		}
+	}
+
+	/* Remaining buckets hold at most one name; place them directly */
+	for (slot = 0; i < n; i++) {
+		if (buckets[i].nkeys == 0) {
+			disp[buckets[i].bucket] = 0;
+			continue;
+		}
+		while (used[slot])
+			slot++;
+		used[slot] = 1;
+		slots[slot] = buckets[i].keys[0];
+		disp[buckets[i].bucket] = -(int32_t)slot - 1;
+	}
+
+	free(buckets);
+	free(keys);
+	free(hashes);
+	free(tried);
+	free(used);
+}
+
+static void
+render_hash(struct mobject *ns, const char **names, size_t n,
+    const char *prefix)
+{
+	struct mobject *disp_array, *slot_array;
+	size_t i, *slots;
+	int32_t *disp;
+	char key[64], buf[32];
+
+	if (n == 0)
+		errx(1, "%s(%d): no %s names", __func__, __LINE__, prefix);
+	if ((slots = calloc(n, sizeof(*slots))) == NULL ||
+	    (disp = calloc(n, sizeof(*disp))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+
+	build_hash(names, n, disp, slots);
+
+	snprintf(key, sizeof(key), "%s_hash_size", prefix);
+	if (mdict_replace_si(ns, key, n) == NULL)
+		errx(1, "%s(%d): mdict_replace_si", __func__, __LINE__);
+
+	/* Each slot holds the name found there, which is also its enum */
+	snprintf(key, sizeof(key), "%s_hash_disp", prefix);
+	if ((disp_array = mdict_insert_sa(ns, key)) == NULL)
+		errx(1, "%s(%d): mdict_insert_sa", __func__, __LINE__);
+	snprintf(key, sizeof(key), "%s_hash_slots", prefix);
+	if ((slot_array = mdict_insert_sa(ns, key)) == NULL)
+		errx(1, "%s(%d): mdict_insert_sa", __func__, __LINE__);
+	for (i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "%d", disp[i]);
+		if (marray_append_s(disp_array, buf) == NULL ||
+		    marray_append_s(slot_array, names[slots[i]]) == NULL)
+			errx(1, "%s(%d): marray_append_s", __func__, __LINE__);
+	}
+
+	free(slots);
+	free(disp);
+}
+
+/*
+ * Build the hashes over the state names, in enum order followed by any
+ * merged states in declaration order, and over the event names.
+ */
+void
+setup_name_hashes(struct mobject *ns, struct cfsm_ir *ir)
+{
+	const char **names;
+	size_t i, n;
+
+	n = ir->nstates > ir->nevents ? ir->nstates : ir->nevents;
+	if ((names = calloc(n == 0 ? 1 : n, sizeof(*names))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+
+	for (n = 0; n < ir->nstate_order; n++)
+		names[n] = IR_STATE_NAME(ir, ir->state_order[n]);
+	for (i = 0; i < ir->nstates; i++) {
+		if (ir->states[i].alias_of != IR_NONE)
+			names[n++] = IR_STATE_NAME(ir, i);
+	}
+	render_hash(ns, names, n, "state");
+
+	for (n = 0; n < ir->nevents; n++)
+		names[n] = IR_EVENT_NAME(ir, ir->event_order[n]);
+	render_hash(ns, names, n, "event");
+
+	free(names);
+}
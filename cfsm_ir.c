@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* $Id$ */
+
+/*
+ * Construction of the intermediate representation during parsing, and
+ * rendering of it into the template namespace afterwards.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#include "mobject.h"
+
+#include "cfsm.h"
+#include "cfsm_ir.h"
+#include "libcfsm/cfsm_name_hash.h"
+
+/* Grow array "p" of "*alloc" items to hold at least "n" of "size" bytes */
+static void *
+grow(void *p, size_t *alloc, size_t n, size_t size)
+{
+	size_t nalloc;
+
+	if (n <= *alloc)
+		return p;
+	nalloc = *alloc == 0 ? 16 : *alloc;
+	while (nalloc < n) {
+		if (SIZE_MAX / 2 / size < nalloc)
+			errx(1, "%s(%d): too many items", __func__, __LINE__);
+		nalloc *= 2;
+	}
+	if ((p = realloc(p, nalloc * size)) == NULL)
+		errx(1, "%s(%d): realloc", __func__, __LINE__);
+	*alloc = nalloc;
+	return p;
+}
+
+static void
+hash_insert(struct cfsm_ir *ir, u_int id)
+{
+	size_t i;
+
+	for (i = name_hash(0, ir->names[id].name) & (ir->hash_size - 1);
+	    ir->hash[i] != 0; i = (i + 1) & (ir->hash_size - 1))
+		;
+	ir->hash[i] = id + 1;
+}
+
+struct cfsm_ir *
+ir_new(void)
+{
+	struct cfsm_ir *ir;
+
+	if ((ir = calloc(1, sizeof(*ir))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	ir->hash_size = 256;
+	if ((ir->hash = calloc(ir->hash_size, sizeof(*ir->hash))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	return ir;
+}
+
+void
+ir_free(struct cfsm_ir *ir)
+{
+	size_t i;
+
+	if (ir == NULL)
+		return;
+	for (i = 0; i < ir->nnames; i++)
+		free(ir->names[i].name);
+	for (i = 0; i < ir->nstates; i++) {
+		free(ir->states[i].moves);
+		free(ir->states[i].entry_preconds.ids);
+		free(ir->states[i].exit_preconds.ids);
+		free(ir->states[i].entry_callbacks.ids);
+		free(ir->states[i].exit_callbacks.ids);
+	}
+	for (i = 0; i < ir->nevents; i++) {
+		free(ir->events[i].preconds.ids);
+		free(ir->events[i].callbacks.ids);
+	}
+	for (i = 0; i < IR_NLISTS; i++)
+		free(ir->lists[i].ids);
+	free(ir->names);
+	free(ir->hash);
+	free(ir->states);
+	free(ir->events);
+	free(ir->state_order);
+	free(ir->event_order);
+	free(ir);
+}
+
+/* Returns the ID of "name", adding it to the name table if it is new */
+u_int
+ir_intern(struct cfsm_ir *ir, const char *name)
+{
+	size_t i;
+	u_int id;
+
+	for (i = name_hash(0, name) & (ir->hash_size - 1); ir->hash[i] != 0;
+	    i = (i + 1) & (ir->hash_size - 1)) {
+		if (strcmp(ir->names[ir->hash[i] - 1].name, name) == 0)
+			return ir->hash[i] - 1;
+	}
+	if (ir->nnames >= IR_IGNORE - 1)
+		errx(1, "%s(%d): too many names", __func__, __LINE__);
+
+	ir->names = grow(ir->names, &ir->anames, ir->nnames + 1,
+	    sizeof(*ir->names));
+	id = ir->nnames++;
+	if ((ir->names[id].name = strdup(name)) == NULL)
+		errx(1, "%s(%d): strdup", __func__, __LINE__);
+	ir->names[id].state = ir->names[id].event = IR_NONE;
+	ir->names[id].lists = 0;
+
+	/* Keep the hash at most half full */
+	if (ir->nnames * 2 > ir->hash_size) {
+		free(ir->hash);
+		ir->hash_size *= 2;
+		if ((ir->hash = calloc(ir->hash_size,
+		    sizeof(*ir->hash))) == NULL)
+			errx(1, "%s(%d): calloc", __func__, __LINE__);
+		for (id = 0; id < ir->nnames; id++)
+			hash_insert(ir, id);
+		return ir->nnames - 1;
+	}
+	hash_insert(ir, id);
+	return id;
+}
+
+/* Returns the new state, or IR_NONE if it has already been declared */
+u_int
+ir_state_create(struct cfsm_ir *ir, const char *name)
+{
+	struct ir_state *st;
+	u_int id = ir_intern(ir, name);
+
+	if (ir->names[id].state != IR_NONE)
+		return IR_NONE;
+	ir->states = grow(ir->states, &ir->astates, ir->nstates + 1,
+	    sizeof(*ir->states));
+	st = &ir->states[ir->nstates];
+	bzero(st, sizeof(*st));
+	st->name = id;
+	st->number = -1;
+	st->alias_of = IR_NONE;
+	ir->names[id].state = ir->nstates;
+	return ir->nstates++;
+}
+
+u_int
+ir_event_get_or_create(struct cfsm_ir *ir, const char *name)
+{
+	struct ir_event *ev;
+	u_int id = ir_intern(ir, name);
+
+	if (ir->names[id].event != IR_NONE)
+		return ir->names[id].event;
+	ir->events = grow(ir->events, &ir->aevents, ir->nevents + 1,
+	    sizeof(*ir->events));
+	ev = &ir->events[ir->nevents];
+	bzero(ev, sizeof(*ev));
+	ev->name = id;
+	ev->number = -1;
+	ev->last_state = IR_NONE;
+	ir->names[id].event = ir->nevents;
+	return ir->nevents++;
+}
+
+/*
+ * Set what state "s" does on event "e": move to the state named "next",
+ * or ignore the event if "next" is NULL. A later declaration for the same
+ * event replaces an earlier one. A state's moves are all declared in its
+ * own block, so the last move on each event is enough to find them.
+ */
+void
+ir_state_move(struct cfsm_ir *ir, u_int s, u_int e, const char *next)
+{
+	struct ir_state *st = &ir->states[s];
+	struct ir_event *ev = &ir->events[e];
+	struct ir_move *mv;
+
+	if (ev->last_state == s)
+		mv = &st->moves[ev->last_move];
+	else {
+		st->moves = grow(st->moves, &st->amoves, st->nmoves + 1,
+		    sizeof(*st->moves));
+		ev->last_state = s;
+		ev->last_move = st->nmoves;
+		mv = &st->moves[st->nmoves++];
+		mv->event = e;
+	}
+	mv->next_name = next == NULL ? IR_IGNORE : ir_intern(ir, next);
+	mv->next = IR_NONE;
+}
+
+/* Append name "id" to a list unless it is already there */
+void
+ir_list_add(struct ir_list *l, u_int id)
+{
+	size_t i;
+
+	for (i = 0; i < l->n; i++) {
+		if (l->ids[i] == id)
+			return;
+	}
+	l->ids = grow(l->ids, &l->alloc, l->n + 1, sizeof(*l->ids));
+	l->ids[l->n++] = id;
+}
+
+/* Add action "name" to a state's or event's list and to list "which" */
+void
+ir_add_action(struct cfsm_ir *ir, struct ir_list *l, int which,
+    const char *name)
+{
+	u_int id = ir_intern(ir, name);
+
+	ir_list_add(l, id);
+	if ((ir->names[id].lists & (1 << which)) != 0)
+		return;
+	ir->names[id].lists |= 1 << which;
+	l = &ir->lists[which];
+	l->ids = grow(l->ids, &l->alloc, l->n + 1, sizeof(*l->ids));
+	l->ids[l->n++] = id;
+}
+
+/* Returns the state that "s" was merged into, or "s" itself */
+u_int
+ir_state_rep(struct cfsm_ir *ir, u_int s)
+{
+	return ir->states[s].alias_of == IR_NONE ? s : ir->states[s].alias_of;
+}
+
+/* Render a list as a dict of its names, as the templates expect */
+static void
+render_list(struct cfsm_ir *ir, struct mobject *parent, const char *key,
+    struct ir_list *l)
+{
+	struct mobject *d;
+	size_t i;
+
+	if ((d = mdict_item_s(parent, key)) == NULL &&
+	    (d = mdict_insert_sd(parent, key)) == NULL)
+		errx(1, "%s(%d): mdict_insert_sd", __func__, __LINE__);
+	for (i = 0; i < l->n; i++) {
+		if (mdict_insert_si(d, IR_NAME(ir, l->ids[i]), 1) == NULL)
+			errx(1, "%s(%d): mdict_insert_si", __func__, __LINE__);
+	}
+}
+
+static struct mobject *
+ns_item(struct mobject *ns, const char *key)
+{
+	struct mobject *o;
+
+	if ((o = mdict_item_s(ns, key)) == NULL)
+		errx(1, "%s(%d): namespace lacks %s", __func__, __LINE__, key);
+	return o;
+}
+
+static void
+render_state(struct cfsm_ir *ir, struct mobject *states, u_int s,
+    u_int *seen)
+{
+	struct ir_state *st = &ir->states[s];
+	struct mobject *state, *events, *next_states;
+	const char *event;
+	size_t i;
+	u_int next;
+
+	if ((state = mdict_insert_sd(states, IR_STATE_NAME(ir, s))) == NULL ||
+	    mdict_insert_ss(state, "name", IR_STATE_NAME(ir, s)) == NULL ||
+	    mdict_insert_si(state, "is_initial", st->initial) == NULL ||
+	    mdict_insert_si(state, "number", st->number) == NULL ||
+	    mdict_insert_si(state, "indegree", st->indegree) == NULL ||
+	    mdict_insert_si(state, "timeout", st->timeout) == NULL ||
+	    (events = mdict_insert_sd(state, "events")) == NULL ||
+	    (next_states = mdict_insert_sd(state, "next_states")) == NULL)
+		errx(1, "%s(%d): set up state failed", __func__, __LINE__);
+
+	for (i = 0; i < st->nmoves; i++) {
+		event = IR_EVENT_NAME(ir, st->moves[i].event);
+		if ((next = st->moves[i].next) == IR_IGNORE) {
+			if (mdict_insert_sn(events, event) == NULL)
+				errx(1, "%s(%d): mdict_insert_sn",
+				    __func__, __LINE__);
+			continue;
+		}
+		next = ir_state_rep(ir, next);
+		if (mdict_insert_ss(events, event,
+		    IR_STATE_NAME(ir, next)) == NULL)
+			errx(1, "%s(%d): mdict_insert_ss", __func__, __LINE__);
+		if (seen[next] == s + 1)
+			continue;
+		seen[next] = s + 1;
+		if (mdict_insert_si(next_states,
+		    IR_STATE_NAME(ir, next), 1) == NULL)
+			errx(1, "%s(%d): mdict_insert_si", __func__, __LINE__);
+	}
+	render_list(ir, state, "entry_preconds", &st->entry_preconds);
+	render_list(ir, state, "exit_preconds", &st->exit_preconds);
+	render_list(ir, state, "entry_callbacks", &st->entry_callbacks);
+	render_list(ir, state, "exit_callbacks", &st->exit_callbacks);
+}
+
+/*
+ * Render the states, events and actions into the template namespace.
+ * States that were merged by minimisation appear only in
+ * "state_aliases" and "states_array", and transitions to them lead to
+ * the state they were merged into.
+ */
+void
+ir_render(struct cfsm_ir *ir, struct mobject *ns)
+{
+	struct mobject *states, *events, *event, *ordered, *aliases, *alias;
+	struct mobject *initial, *declared;
+	struct ir_state *st;
+	u_int *seen;
+	size_t i;
+
+	if ((seen = calloc(ir->nstates == 0 ? 1 : ir->nstates,
+	    sizeof(*seen))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	states = ns_item(ns, "states");
+	ordered = ns_item(ns, "states_ordered");
+	for (i = 0; i < ir->nstate_order; i++) {
+		if (marray_append_s(ordered,
+		    IR_STATE_NAME(ir, ir->state_order[i])) == NULL)
+			errx(1, "%s(%d): marray_append_s", __func__, __LINE__);
+		render_state(ir, states, ir->state_order[i], seen);
+	}
+	free(seen);
+
+	aliases = ns_item(ns, "state_aliases");
+	initial = ns_item(ns, "initial_states");
+	declared = ns_item(ns, "states_array");
+	for (i = 0; i < ir->nstates; i++) {
+		st = &ir->states[i];
+		if (marray_append_s(declared, IR_NAME(ir, st->name)) == NULL)
+			errx(1, "%s(%d): marray_append_s", __func__, __LINE__);
+		if (st->alias_of == IR_NONE) {
+			if (st->initial && marray_append_s(initial,
+			    IR_NAME(ir, st->name)) == NULL)
+				errx(1, "%s(%d): marray_append_s",
+				    __func__, __LINE__);
+			continue;
+		}
+		if ((alias = mdict_new()) == NULL ||
+		    marray_append(aliases, alias) == -1 ||
+		    mdict_insert_ss(alias, "name", IR_NAME(ir, st->name)) ==
+		    NULL || mdict_insert_ss(alias, "target",
+		    IR_STATE_NAME(ir, st->alias_of)) == NULL)
+			errx(1, "%s(%d): set up alias failed",
+			    __func__, __LINE__);
+	}
+
+	events = ns_item(ns, "events");
+	declared = ns_item(ns, "events_array");
+	for (i = 0; i < ir->nevents; i++) {
+		if (marray_append_s(declared, IR_EVENT_NAME(ir, i)) == NULL)
+			errx(1, "%s(%d): marray_append_s", __func__, __LINE__);
+		if ((event = mdict_insert_sd(events,
+		    IR_EVENT_NAME(ir, i))) == NULL ||
+		    mdict_insert_si(event, "number",
+		    ir->events[i].number) == NULL)
+			errx(1, "%s(%d): set up event failed",
+			    __func__, __LINE__);
+		render_list(ir, event, "preconds", &ir->events[i].preconds);
+		render_list(ir, event, "callbacks", &ir->events[i].callbacks);
+	}
+	ordered = ns_item(ns, "events_ordered");
+	for (i = 0; i < ir->nevents; i++) {
+		if (marray_append_s(ordered,
+		    IR_EVENT_NAME(ir, ir->event_order[i])) == NULL)
+			errx(1, "%s(%d): marray_append_s", __func__, __LINE__);
+	}
+
+	render_list(ir, ns, "event_callbacks", &ir->lists[IR_EVENT_CALLBACKS]);
+	render_list(ir, ns, "event_preconds", &ir->lists[IR_EVENT_PRECONDS]);
+	render_list(ir, ns, "transition_entry_callbacks",
+	    &ir->lists[IR_ENTRY_CALLBACKS]);
+	render_list(ir, ns, "transition_entry_preconds",
+	    &ir->lists[IR_ENTRY_PRECONDS]);
+	render_list(ir, ns, "transition_exit_callbacks",
+	    &ir->lists[IR_EXIT_CALLBACKS]);
+	render_list(ir, ns, "transition_exit_preconds",
+	    &ir->lists[IR_EXIT_PRECONDS]);
+}
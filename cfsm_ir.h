@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* $Id$ */
+
+/*
+ * Intermediate representation of a parsed FSM. Every name is interned
+ * once and states, events and actions refer to one another by integer
+ * ID, so building and checking a machine needs no string lookups. The
+ * mobject namespace used by the templates is rendered from it once
+ * parsing and checking are complete.
+ */
+
+#ifndef _CFSM_IR_H
+#define _CFSM_IR_H
+
+#define IR_NONE			((u_int)-1)	/* No such state/event */
+#define IR_IGNORE		((u_int)-2)	/* Next state when ignored */
+
+/* Lists of all actions of each kind, used for the prototypes */
+#define IR_EVENT_CALLBACKS	0
+#define IR_EVENT_PRECONDS	1
+#define IR_ENTRY_CALLBACKS	2
+#define IR_ENTRY_PRECONDS	3
+#define IR_EXIT_CALLBACKS	4
+#define IR_EXIT_PRECONDS	5
+#define IR_NLISTS		6
+
+/* An interned name and what it names */
+struct ir_name {
+	char *name;
+	u_int state;		/* State with this name, or IR_NONE */
+	u_int event;		/* Event with this name, or IR_NONE */
+	u_int lists;		/* Bitmask of the IR_* lists holding it */
+};
+
+/* Interned names, in order of first use and without duplicates */
+struct ir_list {
+	u_int *ids;
+	size_t n, alloc;
+};
+
+/* What a state does on an event */
+struct ir_move {
+	u_int event;
+	u_int next_name;	/* Name of the next state, or IR_IGNORE */
+	u_int next;		/* Next state once resolved, or IR_IGNORE */
+};
+
+struct ir_state {
+	u_int name;
+	int64_t number;		/* Enum value; -1 until assigned */
+	int initial;
+	u_int indegree;
+	u_int alias_of;		/* State merged into, or IR_NONE */
+	struct ir_move *moves;	/* In order of declaration */
+	size_t nmoves, amoves;
+	struct ir_list entry_preconds, exit_preconds;
+	struct ir_list entry_callbacks, exit_callbacks;
+	uint32_t timeout;	/* Milliseconds, or 0 if none */
+	u_int timeout_next;	/* Name of the state a timeout leads to */
+};
+
+struct ir_event {
+	u_int name;
+	int64_t number;		/* Enum value; -1 until assigned */
+	struct ir_list preconds, callbacks;
+	u_int last_state;	/* Last state to declare a move on the event */
+	size_t last_move;	/* and the index of that move */
+};
+
+struct cfsm_ir {
+	/* Name table and open-addressed hash of name ID + 1 */
+	struct ir_name *names;
+	size_t nnames, anames;
+	u_int *hash;
+	size_t hash_size;
+
+	struct ir_state *states;	/* In order of declaration */
+	size_t nstates, astates;
+	struct ir_event *events;	/* In order of first use */
+	size_t nevents, aevents;
+
+	/* States (less merged ones) and events in enum order */
+	u_int *state_order, *event_order;
+	size_t nstate_order;
+
+	struct ir_list lists[IR_NLISTS];
+};
+
+#define IR_NAME(ir, id)		((const char *)(ir)->names[id].name)
+#define IR_STATE_NAME(ir, s)	IR_NAME(ir, (ir)->states[s].name)
+#define IR_EVENT_NAME(ir, e)	IR_NAME(ir, (ir)->events[e].name)
+
+struct cfsm_ir *ir_new(void);
+void ir_free(struct cfsm_ir *);
+u_int ir_intern(struct cfsm_ir *, const char *);
+u_int ir_state_create(struct cfsm_ir *, const char *);
+u_int ir_event_get_or_create(struct cfsm_ir *, const char *);
+void ir_state_move(struct cfsm_ir *, u_int, u_int, const char *);
+void ir_list_add(struct ir_list *, u_int);
+void ir_add_action(struct cfsm_ir *, struct ir_list *, int, const char *);
+u_int ir_state_rep(struct cfsm_ir *, u_int);
+void ir_render(struct cfsm_ir *, struct mobject *);
+
+#endif /* _CFSM_IR_H */
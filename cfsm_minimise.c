@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* $Id$ */
+
+/*
+ * State minimisation by Hopcroft's partition refinement. States start out
+ * grouped by everything about them other than where their transitions
+ * lead: initial status, explicit number, preconditions and callbacks in
+ * order, and which events are accepted, ignored or invalid. Groups are
+ * then split until every state in a group moves to the same group on
+ * each event. Every group that ends up with more than one state is
+ * merged into its first declared state and the others become aliases.
+ *
+ * Explicitly numbered states are never merged, as their numbers must be
+ * kept.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#include "mobject.h"
+#include "strlcat.h"
+
+#include "cfsm.h"
+#include "cfsm_ir.h"
+
+/* Local prototypes */
+void minimise_states(struct cfsm_ir *);
+
+/* Kinds of cell in a state's transition row, other than a next state */
+#define CELL_INVALID	(-1)
+#define CELL_IGNORE	(-2)
+
+/* A state's move on one event; events with no move are invalid */
+struct mmove {
+	size_t event;
+	int next;		/* Next state, or CELL_IGNORE */
+};
+
+struct mstate {
+	size_t index;
+	struct ir_state *st;
+	struct mmove *moves;	/* Ordered by event */
+	size_t nmoves;
+};
+
+struct machine {
+	size_t nstates, nevents, nmoves;
+	struct mstate *states;	/* In declaration order */
+	struct mmove *moves;	/* Every state's moves, by state */
+};
+
+/* Incoming transition, for the inverse transition function */
+struct intrans {
+	size_t event;
+	size_t from;
+};
+
+/* Partition of the states into blocks of contiguous elements */
+struct partition {
+	size_t *elems;		/* States, grouped by block */
+	size_t *loc;		/* Position of each state in elems */
+	size_t *block;		/* Block of each state */
+	size_t *start, *end;	/* Extent of each block in elems */
+	size_t *marked;		/* Marked states, at the start of each block */
+	size_t nblocks;
+};
+
+static int
+mmove_cmp(const void *a, const void *b)
+{
+	const struct mmove *ma = a, *mb = b;
+
+	return ma->event < mb->event ? -1 : ma->event > mb->event;
+}
+
+/*
+ * Copy each state's moves, sorted by event. Only the moves are kept, so
+ * the machine takes space in proportion to the number of transitions
+ * rather than to states x events.
+ */
+static struct machine *
+machine_build(struct cfsm_ir *ir)
+{
+	struct machine *m;
+	struct mstate *ms;
+	struct ir_move *mv;
+	size_t i, j;
+
+	if ((m = calloc(1, sizeof(*m))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	m->nstates = ir->nstates;
+	m->nevents = ir->nevents;
+	for (i = 0; i < m->nstates; i++)
+		m->nmoves += ir->states[i].nmoves;
+	if ((m->states = calloc(m->nstates == 0 ? 1 : m->nstates,
+	    sizeof(*m->states))) == NULL ||
+	    (m->moves = calloc(m->nmoves == 0 ? 1 : m->nmoves,
+	    sizeof(*m->moves))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+
+	for (i = j = 0; i < m->nstates; i++) {
+		ms = &m->states[i];
+		ms->index = i;
+		ms->st = &ir->states[i];
+		ms->moves = &m->moves[j];
+		for (ms->nmoves = 0; ms->nmoves < ms->st->nmoves;
+		    ms->nmoves++) {
+			mv = &ms->st->moves[ms->nmoves];
+			ms->moves[ms->nmoves].event = mv->event;
+			ms->moves[ms->nmoves].next = mv->next == IR_IGNORE ?
+			    CELL_IGNORE : (int)mv->next;
+		}
+		qsort(ms->moves, ms->nmoves, sizeof(*ms->moves), mmove_cmp);
+		j += ms->nmoves;
+	}
+	return m;
+}
+
+static void
+machine_free(struct machine *m)
+{
+	free(m->moves);
+	free(m->states);
+	free(m);
+}
+
+/* What a move means for a state's signature: ignored or a transition */
+static int
+move_kind(const struct mmove *mv)
+{
+	return mv->next == CELL_IGNORE ? CELL_IGNORE : 0;
+}
+
+/* Compare two lists of interned names */
+static int
+list_cmp(const struct ir_list *a, const struct ir_list *b)
+{
+	size_t i;
+
+	if (a->n != b->n)
+		return a->n < b->n ? -1 : 1;
+	for (i = 0; i < a->n; i++) {
+		if (a->ids[i] != b->ids[i])
+			return a->ids[i] < b->ids[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Compare the preconditions, callbacks and timeouts of two states */
+static int
+actions_cmp(const struct ir_state *a, const struct ir_state *b)
+{
+	int r;
+
+	if (a->timeout != b->timeout)
+		return a->timeout < b->timeout ? -1 : 1;
+	if ((r = list_cmp(&a->entry_preconds, &b->entry_preconds)) != 0 ||
+	    (r = list_cmp(&a->exit_preconds, &b->exit_preconds)) != 0 ||
+	    (r = list_cmp(&a->entry_callbacks, &b->entry_callbacks)) != 0)
+		return r;
+	return list_cmp(&a->exit_callbacks, &b->exit_callbacks);
+}
+
+/*
+ * Order states by everything but the targets of their transitions, so
+ * that states that may be equivalent sort together.
+ */
+static int
+signature_cmp(const void *a, const void *b)
+{
+	const struct mstate *sa = *(const struct mstate * const *)a;
+	const struct mstate *sb = *(const struct mstate * const *)b;
+	size_t i, j, e;
+	int r, ka, kb;
+
+	if (sa->st->initial != sb->st->initial)
+		return sa->st->initial - sb->st->initial;
+	/* Numbered states stay in a group of their own */
+	if (sa->st->number != -1 || sb->st->number != -1) {
+		if (sa->st->number != sb->st->number)
+			return sa->st->number < sb->st->number ? -1 : 1;
+	}
+	if ((r = actions_cmp(sa->st, sb->st)) != 0)
+		return r;
+	/* Compare event by event, as invalid, ignored or a transition */
+	for (i = j = 0; i < sa->nmoves || j < sb->nmoves; ) {
+		if (j == sb->nmoves || (i < sa->nmoves &&
+		    sa->moves[i].event < sb->moves[j].event))
+			e = sa->moves[i].event;
+		else
+			e = sb->moves[j].event;
+		ka = i < sa->nmoves && sa->moves[i].event == e ?
+		    move_kind(&sa->moves[i++]) : CELL_INVALID;
+		kb = j < sb->nmoves && sb->moves[j].event == e ?
+		    move_kind(&sb->moves[j++]) : CELL_INVALID;
+		if (ka != kb)
+			return ka - kb;
+	}
+	/* Keep declaration order within a group */
+	return sa->index < sb->index ? -1 : 1;
+}
+
+static int
+signature_equal(struct machine *m, size_t a, size_t b)
+{
+	const struct mstate *sa = &m->states[a], *sb = &m->states[b];
+	size_t i;
+
+	if (sa->st->initial != sb->st->initial ||
+	    sa->st->number != sb->st->number ||
+	    actions_cmp(sa->st, sb->st) != 0 || sa->nmoves != sb->nmoves)
+		return 0;
+	for (i = 0; i < sa->nmoves; i++) {
+		if (sa->moves[i].event != sb->moves[i].event ||
+		    move_kind(&sa->moves[i]) != move_kind(&sb->moves[i]))
+			return 0;
+	}
+	return 1;
+}
+
+static int
+size_cmp(const void *a, const void *b)
+{
+	size_t sa = *(const size_t *)a, sb = *(const size_t *)b;
+
+	return sa < sb ? -1 : sa > sb;
+}
+
+static int
+intrans_cmp(const void *a, const void *b)
+{
+	const struct intrans *ta = a, *tb = b;
+
+	if (ta->event != tb->event)
+		return ta->event < tb->event ? -1 : 1;
+	return ta->from < tb->from ? -1 : ta->from > tb->from;
+}
+
+static void
+partition_init(struct partition *p, struct machine *m)
+{
+	struct mstate **sorted;
+	size_t i, n = m->nstates;
+
+	if ((p->elems = calloc(n, sizeof(*p->elems))) == NULL ||
+	    (p->loc = calloc(n, sizeof(*p->loc))) == NULL ||
+	    (p->block = calloc(n, sizeof(*p->block))) == NULL ||
+	    (p->start = calloc(n, sizeof(*p->start))) == NULL ||
+	    (p->end = calloc(n, sizeof(*p->end))) == NULL ||
+	    (p->marked = calloc(n, sizeof(*p->marked))) == NULL ||
+	    (sorted = calloc(n, sizeof(*sorted))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+
+	for (i = 0; i < n; i++)
+		sorted[i] = &m->states[i];
+	qsort(sorted, n, sizeof(*sorted), signature_cmp);
+	for (i = 0; i < n; i++)
+		p->elems[i] = sorted[i]->index;
+	free(sorted);
+
+	p->nblocks = 0;
+	for (i = 0; i < n; i++) {
+		if (i == 0 || !signature_equal(m, p->elems[i - 1],
+		    p->elems[i])) {
+			if (i != 0)
+				p->end[p->nblocks - 1] = i;
+			p->start[p->nblocks++] = i;
+		}
+		p->loc[p->elems[i]] = i;
+		p->block[p->elems[i]] = p->nblocks - 1;
+	}
+	if (n > 0)
+		p->end[p->nblocks - 1] = n;
+}
+
+static void
+partition_free(struct partition *p)
+{
+	free(p->elems);
+	free(p->loc);
+	free(p->block);
+	free(p->start);
+	free(p->end);
+	free(p->marked);
+}
+
+/* Move state "s" into the marked part of its block */
+static void
+partition_mark(struct partition *p, size_t s, size_t *touched,
+    size_t *ntouched)
+{
+	size_t b = p->block[s], i = p->loc[s], j, t;
+
+	j = p->start[b] + p->marked[b];
+	if (i < j)
+		return;		/* Already marked */
+	t = p->elems[j];
+	p->elems[j] = s;
+	p->elems[i] = t;
+	p->loc[s] = j;
+	p->loc[t] = i;
+	if (p->marked[b]++ == 0)
+		touched[(*ntouched)++] = b;
+}
+
+/*
+ * Refine the partition until it is stable, using the incoming transitions
+ * of each splitter block. Every initial block starts on the worklist;
+ * when a block is split, both halves are kept on the worklist if it was
+ * there already, otherwise only the smaller half is added.
+ */
+static void
+partition_refine(struct partition *p, struct machine *m)
+{
+	struct intrans *in, *gather;
+	struct mmove *mv;
+	size_t *instart, *work, *splitter, *touched;
+	size_t n = m->nstates, ntrans, nwork, ngather, nsplit, ntouched;
+	size_t i, j, s, t, b, nb;
+	u_char *inwork;
+
+	/* Incoming transitions, grouped by target state */
+	if ((instart = calloc(n + 1, sizeof(*instart))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (ntrans = i = 0; i < m->nmoves; i++) {
+		if (m->moves[i].next >= 0) {
+			instart[m->moves[i].next + 1]++;
+			ntrans++;
+		}
+	}
+	for (s = 0; s < n; s++)
+		instart[s + 1] += instart[s];
+	if ((in = calloc(ntrans == 0 ? 1 : ntrans, sizeof(*in))) == NULL ||
+	    (gather = calloc(ntrans == 0 ? 1 : ntrans,
+	    sizeof(*gather))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (s = 0; s < n; s++) {
+		for (i = 0; i < m->states[s].nmoves; i++) {
+			mv = &m->states[s].moves[i];
+			if (mv->next < 0)
+				continue;
+			t = mv->next;
+			in[instart[t]].event = mv->event;
+			in[instart[t]++].from = s;
+		}
+	}
+	/* instart[t] now holds the end of t's list; shift back */
+	for (s = n; s > 0; s--)
+		instart[s] = instart[s - 1];
+	instart[0] = 0;
+
+	if ((work = calloc(n, sizeof(*work))) == NULL ||
+	    (inwork = calloc(n, 1)) == NULL ||
+	    (splitter = calloc(n, sizeof(*splitter))) == NULL ||
+	    (touched = calloc(n, sizeof(*touched))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (nwork = 0; nwork < p->nblocks; nwork++) {
+		work[nwork] = nwork;
+		inwork[nwork] = 1;
+	}
+
+	while (nwork > 0) {
+		b = work[--nwork];
+		inwork[b] = 0;
+
+		/* Snapshot the splitter, as it may itself be split below */
+		for (nsplit = 0, i = p->start[b]; i < p->end[b]; i++)
+			splitter[nsplit++] = p->elems[i];
+		for (ngather = i = 0; i < nsplit; i++) {
+			t = splitter[i];
+			for (j = instart[t]; j < instart[t + 1]; j++)
+				gather[ngather++] = in[j];
+		}
+		qsort(gather, ngather, sizeof(*gather), intrans_cmp);
+
+		for (i = 0; i < ngather; i = j) {
+			/* Mark the predecessors on one event and split */
+			ntouched = 0;
+			for (j = i; j < ngather &&
+			    gather[j].event == gather[i].event; j++)
+				partition_mark(p, gather[j].from, touched,
+				    &ntouched);
+			while (ntouched > 0) {
+				b = touched[--ntouched];
+				if (p->marked[b] == p->end[b] - p->start[b]) {
+					p->marked[b] = 0;
+					continue;
+				}
+				nb = p->nblocks++;
+				p->start[nb] = p->start[b];
+				p->end[nb] = p->start[b] + p->marked[b];
+				p->start[b] = p->end[nb];
+				p->marked[b] = 0;
+				for (s = p->start[nb]; s < p->end[nb]; s++)
+					p->block[p->elems[s]] = nb;
+				if (inwork[b] || p->end[nb] - p->start[nb] <=
+				    p->end[b] - p->start[b]) {
+					work[nwork++] = nb;
+					inwork[nb] = 1;
+				} else {
+					work[nwork++] = b;
+					inwork[b] = 1;
+				}
+			}
+		}
+	}
+
+	free(instart);
+	free(in);
+	free(gather);
+	free(work);
+	free(inwork);
+	free(splitter);
+	free(touched);
+}
+
+/*
+ * Merge equivalent states. Each merged state gets its representative in
+ * "alias_of" and a report of the merges is printed.
+ */
+void
+minimise_states(struct cfsm_ir *ir)
+{
+	struct machine *m;
+	struct partition p;
+	size_t b, i, rep, nmerged = 0;
+	const char *name;
+	char *report;
+	size_t rlen;
+
+	m = machine_build(ir);
+	partition_init(&p, m);
+	partition_refine(&p, m);
+
+	for (b = 0; b < p.nblocks; b++) {
+		if (p.end[b] - p.start[b] < 2)
+			continue;
+		/* The first declared state in the block survives */
+		for (rep = m->nstates, i = p.start[b]; i < p.end[b]; i++) {
+			if (p.elems[i] < rep)
+				rep = p.elems[i];
+		}
+		rlen = 64;
+		if ((report = calloc(1, rlen)) == NULL)
+			errx(1, "%s(%d): calloc", __func__, __LINE__);
+		/* Report in declaration order */
+		qsort(p.elems + p.start[b], p.end[b] - p.start[b],
+		    sizeof(*p.elems), size_cmp);
+		for (i = p.start[b]; i < p.end[b]; i++) {
+			if (p.elems[i] == rep)
+				continue;
+			ir->states[p.elems[i]].alias_of = rep;
+			name = IR_STATE_NAME(ir, p.elems[i]);
+			rlen += strlen(name) + 2;
+			if ((report = realloc(report, rlen)) == NULL)
+				errx(1, "%s(%d): realloc", __func__, __LINE__);
+			if (*report != '\0')
+				strlcat(report, ", ", rlen);
+			strlcat(report, name, rlen);
+			nmerged++;
+		}
+		warnx("Merged equivalent states %s into %s", report,
+		    IR_STATE_NAME(ir, rep));
+		free(report);
+	}
+	warnx("Minimisation removed %zu of %zu states", nmerged, m->nstates);
+
+	partition_free(&p);
+	machine_free(m);
+}
@@ -32,66 +32,46 @@
 #include "strlcat.h"
 
 #include "cfsm.h"
+#include "cfsm_ir.h"
 
-extern char *yytext;
+/* An item to be numbered by assign_numbers() */
+struct numbering {
+	int64_t *number;
+	u_int id;
+	const char *name;
+};
 
 /* Local prototypes */
-int yyparse(void);
-void yyerror(const char *, ...);
-static const char *gen_cb_args(u_int);
-static const char *gen_cb_args_proto(u_int);
-static struct mobject *get_or_create_event(char *);
-static int create_action(char *, const char *, const char *, struct mobject *,
-    const char *, struct mobject *);
-void finalise_namespace(void);
-void setup_initial_namespace(void);
-
-/* From cfsm_lex.l */
-extern int yylex(void);
+void yyerror(struct cfsm_ctx *, void *, const char *, ...);
+static const char *gen_cb_args(u_int, char *, size_t);
+static const char *gen_cb_args_proto(struct cfsm_ctx *, u_int, char *, size_t);
+static u_int get_or_create_event(struct cfsm_ctx *, char *);
+static int set_item_number(struct cfsm_ctx *, void *, int64_t *,
+    const char *, const char *, u_int);
+static u_int *assign_numbers(struct cfsm_ctx *, struct numbering *, size_t,
+    const char *);
+static int create_action(struct cfsm_ctx *, void *, char *, const char *,
+    int);
+static void setup_initial_namespace(struct cfsm_ctx *);
+static void setup_stats_preconds(struct cfsm_ctx *);
 
 /* From cfsm.c */
-extern const char *in_path;
-extern char *header_name;
+extern int table_mode;
+extern int vector_mode;
+extern int runtime_mode;
+extern int fused_mode;
+extern int stats_mode;
+extern int trace_mode;
+extern int cxx_mode;
 
-/* Local variables */
+/* From cfsm_table.c */
+extern void setup_tables(struct mobject *, struct cfsm_ir *, int);
 
-/* Line number in input file */
-u_int lnum = 0;
+/* From cfsm_hash.c */
+extern void setup_name_hashes(struct mobject *, struct cfsm_ir *);
 
-/*
- * The representation of the FSM that is built during parsing and
- * subsequently used to fill in the template
- */
-struct mobject *fsm_namespace = NULL;
-
-/* Convenience pointers to commonly-used objects in the namespace */
-static struct mobject *fsm_initial_states = NULL;
-static struct mobject *fsm_states_array = NULL;
-static struct mobject *fsm_events_array = NULL;
-static struct mobject *fsm_states = NULL;
-static struct mobject *fsm_events = NULL;
-static struct mobject *fsm_event_callbacks = NULL;
-static struct mobject *fsm_event_preconds = NULL;
-static struct mobject *fsm_trans_entry_callbacks = NULL;
-static struct mobject *fsm_trans_entry_preconds = NULL;
-static struct mobject *fsm_trans_exit_callbacks = NULL;
-static struct mobject *fsm_trans_exit_preconds = NULL;
-
-/* Pointers to active event or state */
-static struct mobject *current_state;
-static struct mobject *current_event;
-
-/* Temporary buffer to accumulate source-banner */
-static size_t banner_len = 0;
-static char *banner = NULL;
-
-/* Bitfields for arguments to provide to callback functions */
-u_int trans_callback_args = 0;
-u_int event_callback_args = 0;
-u_int trans_precond_args = 0;
-u_int event_precond_args = 0;
-
-u_int event_specified = 0;
+/* From cfsm_minimise.c */
+extern void minimise_states(struct cfsm_ir *);
 
 #define CB_ARG_CTX		(1)
 #define CB_ARG_EVENT		(1<<1)
@@ -100,6 +80,11 @@ u_int event_specified = 0;
 
 %}
 
+%define api.pure
+%parse-param { struct cfsm_ctx *ctx }
+%parse-param { void *scanner }
+%lex-param { void *scanner }
+
 %token CTX EVENT NEW_STATE OLD_STATE NONE
 %token COMMA MOVETO BANNER_START BANNER_END
 %token ADVANCE_FUNC CURRENT_STATE_FUNC TRANSITION_ENTRY_PRECOND
@@ -109,23 +94,32 @@ u_int event_specified = 0;
 %token NEXT_STATE TRANSITION_ENTRY_CALLBACK
 %token EVENT_ADVANCE TRANSITION_EXIT_CALLBACK TRANSITION_PRECOND_ARGS
 %token SOURCE_BANNER_START SOURCE_BANNER_END STATE_NTOP_FUNC STATE_ENUM STATE 
-%token TRANSITION_CALLBACK_ARGS
+%token TRANSITION_CALLBACK_ARGS CAN_ADVANCE_FUNC VALID_EVENTS_FUNC
+%token STRERROR_FUNC ERROR_RECORDS STATE_PTON_FUNC EVENT_PTON_FUNC
+%token COMPACT_STORAGE MINIMISE_STATES EVENT_QUEUE MAILBOX
+%token TIMEOUT TIMEOUT_EVENT SNAPSHOT
 %token <string> ID BANNER_LINE NUMBER
 
-%type <n> callback_arg callback_arglist callback_args number
+%type <n> callback_arg callback_arglist callback_args number duration_unit
 
 %union {
 	char *string;
 	u_int n;
 };
 
+%{
+/* From cfsm_lex.l */
+extern int yylex(YYSTYPE *, void *);
+extern char *yyget_text(void *);
+%}
+
 %%
 
 directives:		| directives directive
 	;
 
 directive:		type_def | func_def | func_arg_def | 
-			state_def | event_def | banner
+			state_def | event_def | banner | option_def
 	;
 
 type_def:		state_enum_def | event_enum_def | fsm_struct_def
@@ -133,7 +127,10 @@ type_def:		state_enum_def | event_enum_def | fsm_struct_def
 
 func_def:		current_state_func_def | init_func_def |
 			free_func_def | advance_func_def |
-			state_ntop_func_def | event_ntop_func_def
+			state_ntop_func_def | event_ntop_func_def |
+			state_pton_func_def | event_pton_func_def |
+			can_advance_func_def | valid_events_func_def |
+			strerror_func_def
 	;
 
 func_arg_def:		event_precond_arg_def | trans_precond_arg_def |
@@ -143,7 +140,7 @@ func_arg_def:		event_precond_arg_def | trans_precond_arg_def |
 state_def:		state_decl | initial_state_def | on_event_def |
 			ignore_event_def  |
 			entry_callback_def | exit_callback_def |
-			entry_precond_def | exit_precond_def
+			entry_precond_def | exit_precond_def | timeout_def
 	;
 
 event_def:		event_decl | event_callback_def | event_precond_def
@@ -152,28 +149,33 @@ event_def:		event_decl | event_callback_def | event_precond_def
 banner:			banner_start banner_lines banner_end
 	;
 
+option_def:		error_records_def | compact_storage_def
+			| minimise_states_def | event_queue_def | mailbox_def
+			| timeout_event_def | snapshot_def
+	;
+
 state_enum_def:		STATE_ENUM ID {
-		if (mdict_replace_ss(fsm_namespace, "state_enum", $2) == NULL)
+		if (mdict_replace_ss(ctx->ns, "state_enum", $2) == NULL)
 			errx(1, "state_enum_def: mdict_replace_ss");
 		free($2);
 	}
 	;
 
 event_enum_def:		EVENT_ENUM ID {
-		if (mdict_replace_ss(fsm_namespace, "event_enum", $2) == NULL)
+		if (mdict_replace_ss(ctx->ns, "event_enum", $2) == NULL)
 			errx(1, "event_enum_def: mdict_replace_ss");
 		free($2);
 	}
 	;
 
 fsm_struct_def:		FSM_STRUCT ID {
-		if (mdict_replace_ss(fsm_namespace, "fsm_struct", $2) == NULL)
+		if (mdict_replace_ss(ctx->ns, "fsm_struct", $2) == NULL)
 			errx(1, "fsm_struct_def: mdict_replace_ss");
 	}
 	;
 
 current_state_func_def:	CURRENT_STATE_FUNC ID {
-		if (mdict_replace_ss(fsm_namespace, "current_state_func",
+		if (mdict_replace_ss(ctx->ns, "current_state_func",
 		    $2) == NULL)
 			errx(1, "current_state_func_def: mdict_replace_ss");
 		free($2);
@@ -181,28 +183,28 @@ current_state_func_def:	CURRENT_STATE_FUNC ID {
 	;
 
 init_func_def:		INIT_FUNC ID {
-		if (mdict_replace_ss(fsm_namespace, "init_func", $2) == NULL)
+		if (mdict_replace_ss(ctx->ns, "init_func", $2) == NULL)
 			errx(1, "init_func_def: mdict_replace_ss");
 		free($2);
 	}
 	;
 
 free_func_def:		FREE_FUNC ID {
-		if (mdict_replace_ss(fsm_namespace, "free_func", $2) == NULL)
+		if (mdict_replace_ss(ctx->ns, "free_func", $2) == NULL)
 			errx(1, "free_func_def: mdict_replace_ss");
 		free($2);
 	}
 	;
 
 advance_func_def:	ADVANCE_FUNC ID {
-		if (mdict_replace_ss(fsm_namespace, "advance_func", $2) == NULL)
+		if (mdict_replace_ss(ctx->ns, "advance_func", $2) == NULL)
 			errx(1, "advance_func_def: mdict_replace_ss");
 		free($2);
 	}
 	;
 
 state_ntop_func_def:	STATE_NTOP_FUNC ID {
-		if (mdict_replace_ss(fsm_namespace, "state_ntop_func",
+		if (mdict_replace_ss(ctx->ns, "state_ntop_func",
 		    $2) == NULL)
 			errx(1, "state_ntop_func_def: mdict_replace_ss");
 		free($2);
@@ -210,19 +212,119 @@ state_ntop_func_def:	STATE_NTOP_FUNC ID {
 	;
 
 event_ntop_func_def:	EVENT_NTOP_FUNC ID {
-		if (mdict_replace_ss(fsm_namespace, "event_ntop_func",
+		if (mdict_replace_ss(ctx->ns, "event_ntop_func",
 		    $2) == NULL)
 			errx(1, "event_ntop_func_def: mdict_replace_ss");
 		free($2);
 	}
 	;
 
+state_pton_func_def:	STATE_PTON_FUNC ID {
+		if (mdict_replace_ss(ctx->ns, "state_pton_func",
+		    $2) == NULL)
+			errx(1, "state_pton_func_def: mdict_replace_ss");
+		free($2);
+	}
+	;
+
+event_pton_func_def:	EVENT_PTON_FUNC ID {
+		if (mdict_replace_ss(ctx->ns, "event_pton_func",
+		    $2) == NULL)
+			errx(1, "event_pton_func_def: mdict_replace_ss");
+		free($2);
+	}
+	;
+
+can_advance_func_def:	CAN_ADVANCE_FUNC ID {
+		if (mdict_replace_ss(ctx->ns, "can_advance_func",
+		    $2) == NULL)
+			errx(1, "can_advance_func_def: mdict_replace_ss");
+		free($2);
+	}
+	;
+
+valid_events_func_def:	VALID_EVENTS_FUNC ID {
+		if (mdict_replace_ss(ctx->ns, "valid_events_func",
+		    $2) == NULL)
+			errx(1, "valid_events_func_def: mdict_replace_ss");
+		free($2);
+	}
+	;
+
+strerror_func_def:	STRERROR_FUNC ID {
+		if (mdict_replace_ss(ctx->ns, "strerror_func",
+		    $2) == NULL)
+			errx(1, "strerror_func_def: mdict_replace_ss");
+		free($2);
+	}
+	;
+
+error_records_def:	ERROR_RECORDS {
+		if (mdict_replace_si(ctx->ns, "error_records", 1) == NULL)
+			errx(1, "error_records_def: mdict_replace_si failed");
+	}
+	;
+
+compact_storage_def:	COMPACT_STORAGE {
+		if (mdict_replace_si(ctx->ns, "compact_storage",
+		    1) == NULL)
+			errx(1, "compact_storage_def: mdict_replace_si failed");
+	}
+	;
+
+snapshot_def:		SNAPSHOT {
+		if (mdict_replace_si(ctx->ns, "snapshot", 1) == NULL)
+			errx(1, "snapshot_def: mdict_replace_si failed");
+	}
+	;
+
+event_queue_def:	EVENT_QUEUE number {
+		if ($2 < 1 || $2 > 65535) {
+			yyerror(ctx, scanner,
+			    "event-queue length must be from 1 to 65535");
+			YYERROR;
+		}
+		if (mdict_replace_si(ctx->ns, "event_queue", $2) == NULL)
+			errx(1, "event_queue_def: mdict_replace_si failed");
+	}
+	;
+
+/* Slots are found by masking ever-increasing positions */
+mailbox_def:		MAILBOX number {
+		if ($2 < 2 || $2 > 65536 || ($2 & ($2 - 1)) != 0) {
+			yyerror(ctx, scanner, "mailbox size must be a power "
+			    "of two from 2 to 65536");
+			YYERROR;
+		}
+		if (mdict_replace_si(ctx->ns, "mailbox", $2) == NULL)
+			errx(1, "mailbox_def: mdict_replace_si failed");
+	}
+	;
+
+timeout_event_def:	TIMEOUT_EVENT ID {
+		if (ctx->timeout_event != IR_NONE) {
+			yyerror(ctx, scanner, "\"timeout-event\" already set");
+			free($2);
+			YYERROR;
+		}
+		ctx->timeout_event = get_or_create_event(ctx, $2);
+		free($2);
+	}
+	;
+
+minimise_states_def:	MINIMISE_STATES {
+		if (mdict_replace_si(ctx->ns, "minimise_states",
+		    1) == NULL)
+			errx(1, "minimise_states_def: mdict_replace_si failed");
+	}
+	;
+
 callback_arg:		EVENT		{ $$ = CB_ARG_EVENT; }
 			| NEW_STATE	{ $$ = CB_ARG_NEW_STATE; }
 			| OLD_STATE	{ $$ = CB_ARG_OLD_STATE; }
 			| CTX {
 		$$ = CB_ARG_CTX;
-		if (mdict_replace_si(fsm_namespace, "need_ctx", 1) == NULL)
+		if (mdict_replace_si(ctx->ns, "need_ctx", 1) == NULL)
 			errx(1, "ctx: mdict_replace_si failed");
 	}
 	;
@@ -236,125 +338,151 @@ callback_args:		NONE 		{ $$ = 0; }
 	;
 
 event_precond_arg_def:	EVENT_PRECOND_ARGS callback_args {
-		event_precond_args = $2;
+		ctx->event_precond_args = $2;
 	}
 	;
 
 trans_precond_arg_def:	TRANSITION_PRECOND_ARGS callback_args {
-		trans_precond_args = $2;
+		ctx->trans_precond_args = $2;
 	}
 	;
 
 event_callback_arg_def:	EVENT_CALLBACK_ARGS callback_args {
-		event_callback_args = $2;
+		ctx->event_callback_args = $2;
 	}
 	;
 
 trans_callback_arg_def:	TRANSITION_CALLBACK_ARGS callback_args {
-		trans_callback_args = $2;
+		ctx->trans_callback_args = $2;
 	}
 	;
 
 state_decl:		STATE ID {
-		current_event = NULL;
-		current_state = mdict_insert_sd(fsm_states, $2);
-		if (current_state == NULL) {
-			yyerror("state \"%s\" already defined", $2);
+		ctx->current_event = IR_NONE;
+		if ((ctx->current_state = ir_state_create(ctx->ir,
+		    $2)) == IR_NONE) {
+			yyerror(ctx, scanner, "state \"%s\" already defined",
+			    $2);
+			free($2);
+			YYERROR;
+		}
+		free($2);
+	}
+			| STATE ID '=' number {
+		ctx->current_event = IR_NONE;
+		if ((ctx->current_state = ir_state_create(ctx->ir,
+		    $2)) == IR_NONE) {
+			yyerror(ctx, scanner, "state \"%s\" already defined",
+			    $2);
+			free($2);
+			YYERROR;
+		}
+		if (set_item_number(ctx, scanner,
+		    &ctx->ir->states[ctx->current_state].number,
+		    "state", $2, $4) == -1) {
 			free($2);
 			YYERROR;
 		}
-		if (mdict_insert_ss(current_state, "name", $2) == NULL ||
-		    mdict_insert_sd(current_state, "events") == NULL ||
-		    mdict_insert_sd(current_state, "next_states") == NULL ||
-		    mdict_insert_sd(current_state, "exit_preconds") == NULL ||
-		    mdict_insert_sd(current_state, "entry_preconds") == NULL ||
-		    mdict_insert_sd(current_state, "exit_callbacks") == NULL ||
-		    mdict_insert_sd(current_state, "entry_callbacks") == NULL ||
-		    mdict_insert_si(current_state, "is_initial", 0) == NULL ||
-		    mdict_insert_si(current_state, "indegree", 0) == NULL ||
-		    marray_append_s(fsm_states_array, $2) == NULL)
-			errx(1, "state_decl: set up state failed");
 		free($2);
 	}
 	;
 
 initial_state_def:	INITIAL_STATE {
-		struct mobject *i;
-
-		if (current_state == NULL) {
-			yyerror("\"initial-state\" outside state block");
+		if (ctx->current_state == IR_NONE) {
+			yyerror(ctx, scanner,
+			    "\"initial-state\" outside state block");
 			YYERROR;
 		}
-		if ((i = mdict_item_s(current_state, "is_initial")) == NULL)
-			errx(1, "initial_state_def: state lacks is_initial");
-		if (mint_value(i) != 0) {
-			yyerror("\"initial-state\" already set for this state");
+		if (ctx->ir->states[ctx->current_state].initial) {
+			yyerror(ctx, scanner,
+			    "\"initial-state\" already set for this state");
 			YYERROR;
 		}
-		if (mdict_replace_si(current_state, "is_initial", 1) == NULL)
-			errx(1, "initial_state_def: mdict_replace_si failed");
-		if ((i = mdict_item_s(current_state, "name")) == NULL)
-			errx(1, "initial_state_def: state lacks name");
-		if ((i = mobject_deepcopy(i)) == NULL)
-			errx(1, "initial_state_def: mobject_deepcopy");
-		if (marray_append(fsm_initial_states, i) == -1)
-			errx(1, "initial_state_def: marray_append");
+		ctx->ir->states[ctx->current_state].initial = 1;
 	}
 	;
 
 on_event_def:		EVENT_ADVANCE ID MOVETO ID {
-		struct mobject *events, *next_states;
-
-		if (current_state == NULL) {
-			yyerror("\"on-event\" outside state block");
+		if (ctx->current_state == IR_NONE) {
+			yyerror(ctx, scanner,
+			    "\"on-event\" outside state block");
 			free($2);
 			free($4);
 			YYERROR;
 		}
-		if (get_or_create_event($2) == NULL) {
+		ir_state_move(ctx->ir, ctx->current_state,
+		    get_or_create_event(ctx, $2), $4);
+		free($2);
+		free($4);
+	}
+	;
+
+ignore_event_def:	IGNORE_EVENT ID {
+		if (ctx->current_state == IR_NONE) {
+			yyerror(ctx, scanner,
+			    "\"ignore-event\" outside state block");
 			free($2);
-			free($4);
 			YYERROR;
 		}
-		if ((events = mdict_item_s(current_state, "events")) == NULL)
-			errx(1, "on_event_def: state lacks events");
-		if (mdict_replace_ss(events, $2, $4) == NULL)
-			errx(1, "on_event_def: mdict_replace_ss failed");
-
-		if ((next_states = mdict_item_s(current_state,
-		    "next_states")) == NULL)
-			errx(1, "on_event_def: state lacks next_states");
-		if (mdict_replace_si(next_states, $4, 1) == NULL)
-			errx(1, "on_event_def: mdict_replace_si failed");
-
+		ir_state_move(ctx->ir, ctx->current_state,
+		    get_or_create_event(ctx, $2), NULL);
 		free($2);
-		free($4);
 	}
 	;
 
-ignore_event_def:	IGNORE_EVENT ID {
-		struct mobject *events;
+timeout_def:		TIMEOUT number duration_unit MOVETO ID {
+		struct ir_state *st;
 
-		if (current_state == NULL) {
-			yyerror("\"ignore-event\" outside state block");
-			free($2);
+		if (ctx->current_state == IR_NONE) {
+			yyerror(ctx, scanner,
+			    "\"timeout\" outside state block");
+			free($5);
 			YYERROR;
 		}
-		if (get_or_create_event($2) == NULL) {
-			free($2);
+		st = &ctx->ir->states[ctx->current_state];
+		if (st->timeout != 0) {
+			yyerror(ctx, scanner,
+			    "\"timeout\" already set for this state");
+			free($5);
 			YYERROR;
 		}
-		if ((events = mdict_item_s(current_state, "events")) == NULL)
-			errx(1, "on_event_def: state lacks events");
-		if (mdict_replace_sn(events, $2) == NULL)
-			errx(1, "on_event_def: mdict_replace_sn failed");
-		free($2);
+		if ($2 == 0 || $2 > 0xffffffff / $3) {
+			yyerror(ctx, scanner, "timeout must be from 1ms to "
+			    "4294967295ms");
+			free($5);
+			YYERROR;
+		}
+		st->timeout = $2 * $3;
+		st->timeout_next = ir_intern(ctx->ir, $5);
+		free($5);
+	}
+	;
+
+/* Multiplier to milliseconds */
+duration_unit:		/* empty */ {
+		$$ = 1;
+	}
+			| ID {
+		if (strcmp($1, "ms") == 0)
+			$$ = 1;
+		else if (strcmp($1, "s") == 0)
+			$$ = 1000;
+		else if (strcmp($1, "m") == 0)
+			$$ = 60 * 1000;
+		else if (strcmp($1, "h") == 0)
+			$$ = 60 * 60 * 1000;
+		else {
+			yyerror(ctx, scanner, "unknown time unit \"%s\"", $1);
+			free($1);
+			YYERROR;
+		}
+		free($1);
 	}
 	;
 
 entry_callback_def:	TRANSITION_ENTRY_CALLBACK ID {
-		if (create_action($2, "onentry-func", "state", current_state,
-		    "entry_callbacks", fsm_trans_entry_callbacks) == -1) {
+		if (create_action(ctx, scanner, $2, "onentry-func",
+		    IR_ENTRY_CALLBACKS) == -1) {
 			free($2);
 			YYERROR;
 		}
@@ -363,8 +491,8 @@ entry_callback_def:	TRANSITION_ENTRY_CALLBACK ID {
 	;
 
 exit_callback_def:	TRANSITION_EXIT_CALLBACK ID {
-		if (create_action($2, "onexit-func", "state", current_state,
-		    "exit_callbacks", fsm_trans_exit_callbacks) == -1) {
+		if (create_action(ctx, scanner, $2, "onexit-func",
+		    IR_EXIT_CALLBACKS) == -1) {
 			free($2);
 			YYERROR;
 		}
@@ -373,9 +501,8 @@ exit_callback_def:	TRANSITION_EXIT_CALLBACK ID {
 	;
 
 entry_precond_def:	TRANSITION_ENTRY_PRECOND ID {
-		if (create_action($2, "entry-precondition", "state",
-		    current_state, "entry_preconds", 
-		    fsm_trans_entry_preconds) == -1) {
+		if (create_action(ctx, scanner, $2, "entry-precondition",
+		    IR_ENTRY_PRECONDS) == -1) {
 			free($2);
 			YYERROR;
 		}
@@ -384,9 +511,8 @@ entry_precond_def:	TRANSITION_ENTRY_PRECOND ID {
 	;
 
 exit_precond_def:	TRANSITION_EXIT_PRECOND ID {
-		if (create_action($2, "exit-precondition", "state",
-		    current_state, "exit_preconds", 
-		    fsm_trans_exit_preconds) == -1) {
+		if (create_action(ctx, scanner, $2, "exit-precondition",
+		    IR_EXIT_PRECONDS) == -1) {
 			free($2);
 			YYERROR;
 		}
@@ -395,8 +521,16 @@ exit_precond_def:	TRANSITION_EXIT_PRECOND ID {
 	;
 
 event_decl:		EVENT ID {
-		current_state = NULL;
-		if ((current_event = get_or_create_event($2)) == NULL) {
+		ctx->current_state = IR_NONE;
+		ctx->current_event = get_or_create_event(ctx, $2);
+		free($2);
+	}
+			| EVENT ID '=' number {
+		ctx->current_state = IR_NONE;
+		ctx->current_event = get_or_create_event(ctx, $2);
+		if (set_item_number(ctx, scanner,
+		    &ctx->ir->events[ctx->current_event].number,
+		    "event", $2, $4) == -1) {
 			free($2);
 			YYERROR;
 		}
@@ -405,8 +539,8 @@ event_decl:		EVENT ID {
 	;
 
 event_callback_def:	EVENT_CALLBACK ID {
-		if (create_action($2, "event-callback", "event", current_event,
-		    "callbacks", fsm_event_callbacks) == -1) {
+		if (create_action(ctx, scanner, $2, "event-callback",
+		    IR_EVENT_CALLBACKS) == -1) {
 			free($2);
 			YYERROR;
 		}
@@ -415,8 +549,8 @@ event_callback_def:	EVENT_CALLBACK ID {
 	;
 
 event_precond_def:	EVENT_PRECOND ID {
-		if (create_action($2, "event-precondition", "event",
-		    current_event, "preconds", fsm_event_preconds) == -1) {
+		if (create_action(ctx, scanner, $2, "event-precondition",
+		    IR_EVENT_PRECONDS) == -1) {
 			free($2);
 			YYERROR;
 		}
@@ -433,22 +567,23 @@ banner_lines:		| banner_lines banner_line
 banner_line:		BANNER_LINE {
 		size_t llen = strlen($1);
 
-		if ((banner = realloc(banner, banner_len + llen + 1)) == NULL)
+		if ((ctx->banner = realloc(ctx->banner,
+		    ctx->banner_len + llen + 1)) == NULL)
 			errx(1, "realloc(banner, %zu) failed",
-			    banner_len + llen + 1);
-		memcpy(banner + banner_len, $1, llen + 1);
-		banner_len += llen;
+			    ctx->banner_len + llen + 1);
+		memcpy(ctx->banner + ctx->banner_len, $1, llen + 1);
+		ctx->banner_len += llen;
 		free($1);
 	}
 	;
 
 banner_end:		BANNER_END {
-		if (mdict_replace_ss(fsm_namespace, "source_banner",
-		    banner) == NULL)
+		if (mdict_replace_ss(ctx->ns, "source_banner",
+		    ctx->banner) == NULL)
 			errx(1, "mdict_replace_ss failed");
-		free(banner);
-		banner = NULL;
-		banner_len = 0;
+		free(ctx->banner);
+		ctx->banner = NULL;
+		ctx->banner_len = 0;
 	}
 	;
 number:			NUMBER {
@@ -458,12 +593,14 @@ number:			NUMBER {
 		errno = 0;
 		n = strtoul($1, &ep, 0);
 		if (*$1 == '\0' || *ep != '\0') {
-			yyerror("argument \"%s\" is not a valid number", $1);
+			yyerror(ctx, scanner,
+			    "argument \"%s\" is not a valid number", $1);
 			free($1);
 			YYERROR;
 		}
 		if ((errno == ERANGE && n == ULONG_MAX) || n > 0xffffffff) {
-			yyerror("numeric argument out of range", $1);
+			yyerror(ctx, scanner, "numeric argument out of range",
+			    $1);
 			free($1);
 			YYERROR;
 		}
@@ -474,13 +611,13 @@ number:			NUMBER {
 %%
 
 void
-yyerror(const char *fmt, ...)
+yyerror(struct cfsm_ctx *ctx, void *scanner, const char *fmt, ...)
 {
 	char fmtbuf[255];
 	va_list args;
 
 	snprintf(fmtbuf, sizeof(fmtbuf), "%s:%u %s near \"%s\"\n",
-	    in_path, lnum, fmt, yytext);
+	    ctx->in_path, ctx->lnum, fmt, yyget_text(scanner));
 	va_start(args, fmt);
 	vfprintf(stderr, fmtbuf, args);
 	va_end(args);
@@ -495,35 +632,32 @@ commacat(char *dst, const char *src, size_t len)
 }
 
 static const char *
-gen_cb_args(u_int argdef)
+gen_cb_args(u_int argdef, char *buf, size_t len)
 {
-	static char buf[256];
-
 	if (argdef == 0)
 		return "";
 	*buf = '\0';
 	if ((argdef & CB_ARG_EVENT) != 0)
-		commacat(buf, "ev", sizeof(buf));
+		commacat(buf, "ev", len);
 	if ((argdef & CB_ARG_OLD_STATE) != 0)
-		commacat(buf, "old_state", sizeof(buf));
+		commacat(buf, "old_state", len);
 	if ((argdef & CB_ARG_NEW_STATE) != 0)
-		commacat(buf, "new_state", sizeof(buf));
+		commacat(buf, "new_state", len);
 	if ((argdef & CB_ARG_CTX) != 0)
-		commacat(buf, "ctx", sizeof(buf));
+		commacat(buf, "ctx", len);
 
 	return buf;
 }
 
 static const char *
-gen_cb_args_proto(u_int argdef)
+gen_cb_args_proto(struct cfsm_ctx *ctx, u_int argdef, char *buf, size_t len)
 {
-	static char buf[512];
 	const char *state_enum, *event_enum;
 	struct mobject *tmp;
 
-	if ((tmp = mdict_item_s(fsm_namespace, "state_enum")) == NULL ||
+	if ((tmp = mdict_item_s(ctx->ns, "state_enum")) == NULL ||
 	    (state_enum = mstring_ptr(tmp)) == NULL ||
-	    (tmp = mdict_item_s(fsm_namespace, "event_enum")) == NULL ||
+	    (tmp = mdict_item_s(ctx->ns, "event_enum")) == NULL ||
 	    (event_enum = mstring_ptr(tmp)) == NULL)
 		errx(1, "Unable to retrieve event/state enum def");
 
@@ -531,94 +665,221 @@ gen_cb_args_proto(u_int argdef)
 		return "";
 	*buf = '\0';
 	if ((argdef & CB_ARG_EVENT) != 0) {
-		commacat(buf, "enum ", sizeof(buf));
-		strlcat(buf, event_enum, sizeof(buf));
-		strlcat(buf, " ev", sizeof(buf));
+		commacat(buf, "enum ", len);
+		strlcat(buf, event_enum, len);
+		strlcat(buf, " ev", len);
 	}
 	if ((argdef & CB_ARG_OLD_STATE) != 0) {
-		commacat(buf, "enum ", sizeof(buf));
-		strlcat(buf, state_enum, sizeof(buf));
-		strlcat(buf, " old_state", sizeof(buf));
+		commacat(buf, "enum ", len);
+		strlcat(buf, state_enum, len);
+		strlcat(buf, " old_state", len);
 	}
 	if ((argdef & CB_ARG_NEW_STATE) != 0) {
-		commacat(buf, "enum ", sizeof(buf));
-		strlcat(buf, state_enum, sizeof(buf));
-		strlcat(buf, " new_state", sizeof(buf));
+		commacat(buf, "enum ", len);
+		strlcat(buf, state_enum, len);
+		strlcat(buf, " new_state", len);
 	}
 	if ((argdef & CB_ARG_CTX) != 0)
-		commacat(buf, "void *ctx", sizeof(buf));
+		commacat(buf, "void *ctx", len);
 	return buf;
 }
 
-static struct mobject *
-get_or_create_event(char *name)
+static u_int
+get_or_create_event(struct cfsm_ctx *ctx, char *name)
 {
-	struct mobject *ret;
-
-	event_specified = 1;
-
-	ret = mdict_item_s(fsm_events, name);
-	if (ret == NULL) {
-		if (mdict_insert_sd(fsm_events, name) == NULL)
-			errx(1, "%s: mdict_item_s failed", __func__);
-		if ((ret = mdict_item_s(fsm_events, name)) == NULL)
-			errx(1, "%s: mdict_item_s failed", __func__);
-		if (mdict_insert_sd(ret, "preconds") == NULL ||
-		    mdict_insert_sd(ret, "callbacks") == NULL)
-			errx(1, "%s: set up event failed", __func__);
-		if (marray_append_s(fsm_events_array, name) == NULL)
-			errx(1, "%s: marray_append_s failed", __func__);
-	}
-	return ret;
+	ctx->event_specified = 1;
+	return ir_event_get_or_create(ctx->ir, name);
 }
 
+/* Record an explicit enum value for a state or event */
 static int
-create_action(char *name, const char *context, const char *block,
-    struct mobject *parent, const char *member, struct mobject *main_list)
+set_item_number(struct cfsm_ctx *ctx, void *scanner, int64_t *number,
+    const char *what, const char *name, u_int n)
 {
-	struct mobject *l;
-
-	if (parent == NULL) {
-		yyerror("\"%s\" outside %s block", context, block);
+	if (*number != -1) {
+		yyerror(ctx, scanner, "%s \"%s\" already numbered", what, name);
 		return -1;
 	}
-	if ((l = mdict_item_s(parent, member)) == NULL)
-		errx(1, "%s(%s): %s lacks %s", __func__, context,
-		    block, member);
-	if (mdict_replace_si(l, name, 1) == NULL)
-		errx(1, "%s(%s): mdict_replace_si(%p, %s, 1) failed",
-		    __func__, context, l, name);
-	if (mdict_replace_si(main_list, name, 1) == NULL)
-		errx(1, "%s(%s): mdict_replace_si(%p, %s, 1) failed",
-		    __func__, context, main_list, name);
+	*number = n;
 	return 0;
 }
 
+/*
+ * Give each state or event its enum value and return their IDs in value
+ * order. Explicitly numbered items keep their numbers and the rest take
+ * the lowest unused numbers in the order given. The values must run from
+ * zero without gaps, as they index the generated tables.
+ */
+static u_int *
+assign_numbers(struct cfsm_ctx *ctx, struct numbering *items, size_t n,
+    const char *what)
+{
+	struct numbering **by_number;
+	u_int *order;
+	size_t i, next;
+	int64_t num;
+
+	if ((by_number = calloc(n == 0 ? 1 : n, sizeof(*by_number))) == NULL ||
+	    (order = calloc(n == 0 ? 1 : n, sizeof(*order))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (i = 0; i < n; i++) {
+		if ((num = *items[i].number) < 0)
+			continue;
+		if ((size_t)num >= n)
+			errx(1, "%s: %s \"%s\" is numbered %lld, but only %zu "
+			    "%ss are defined and numbers may not leave gaps",
+			    ctx->in_path, what, items[i].name, (long long)num,
+			    n, what);
+		if (by_number[num] != NULL)
+			errx(1, "%s: %s \"%s\" and \"%s\" are both numbered "
+			    "%lld", ctx->in_path, what, by_number[num]->name,
+			    items[i].name, (long long)num);
+		by_number[num] = &items[i];
+	}
+	for (i = next = 0; i < n; i++) {
+		if (*items[i].number >= 0)
+			continue;
+		while (by_number[next] != NULL)
+			next++;
+		by_number[next] = &items[i];
+		*items[i].number = next;
+	}
+	for (i = 0; i < n; i++)
+		order[i] = by_number[i]->id;
+	free(by_number);
+	return order;
+}
+
+/* Add an action to the current state or event */
+static int
+create_action(struct cfsm_ctx *ctx, void *scanner, char *name,
+    const char *context, int which)
+{
+	struct ir_list *l;
+	u_int item;
+
+	if (which == IR_EVENT_CALLBACKS || which == IR_EVENT_PRECONDS) {
+		if ((item = ctx->current_event) == IR_NONE) {
+			yyerror(ctx, scanner, "\"%s\" outside event block",
+			    context);
+			return -1;
+		}
+		l = which == IR_EVENT_CALLBACKS ?
+		    &ctx->ir->events[item].callbacks :
+		    &ctx->ir->events[item].preconds;
+	} else {
+		if ((item = ctx->current_state) == IR_NONE) {
+			yyerror(ctx, scanner, "\"%s\" outside state block",
+			    context);
+			return -1;
+		}
+		switch (which) {
+		case IR_ENTRY_CALLBACKS:
+			l = &ctx->ir->states[item].entry_callbacks;
+			break;
+		case IR_ENTRY_PRECONDS:
+			l = &ctx->ir->states[item].entry_preconds;
+			break;
+		case IR_EXIT_CALLBACKS:
+			l = &ctx->ir->states[item].exit_callbacks;
+			break;
+		case IR_EXIT_PRECONDS:
+			l = &ctx->ir->states[item].exit_preconds;
+			break;
+		default:
+			errx(1, "%s(%d): bad action list %d",
+			    __func__, __LINE__, which);
+		}
+	}
+	ir_add_action(ctx->ir, l, which, name);
+	return 0;
+}
+
+/*
+ * List every distinct precondition function, each of which gets its own
+ * failure counter in the statistics.
+ */
+static void
+setup_stats_preconds(struct cfsm_ctx *ctx)
+{
+	static const int kinds[] = {
+		IR_EVENT_PRECONDS, IR_EXIT_PRECONDS, IR_ENTRY_PRECONDS
+	};
+	struct cfsm_ir *ir = ctx->ir;
+	struct mobject *preconds;
+	u_int seen = 0, id;
+	size_t i, j;
+
+	if ((preconds = mdict_item_s(ctx->ns, "stats_preconds")) == NULL)
+		errx(1, "%s(%d): namespace lacks stats_preconds",
+		    __func__, __LINE__);
+	for (i = 0; i < sizeof(kinds) / sizeof(*kinds); i++) {
+		for (j = 0; j < ir->lists[kinds[i]].n; j++) {
+			id = ir->lists[kinds[i]].ids[j];
+			/* Counted under the first kind of list to hold it */
+			if ((ir->names[id].lists & seen) != 0)
+				continue;
+			if (marray_append_s(preconds, IR_NAME(ir, id)) == NULL)
+				errx(1, "%s(%d): marray_append_s",
+				    __func__, __LINE__);
+		}
+		seen |= 1 << kinds[i];
+	}
+}
+
+/*
+ * Set up a compilation of the FSM at "in_path", whose generated source
+ * will include "header_name" (or the default header if NULL).
+ */
+struct cfsm_ctx *
+cfsm_ctx_new(const char *in_path, const char *header_name)
+{
+	struct cfsm_ctx *ctx;
+
+	if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	ctx->in_path = in_path;
+	if (header_name != NULL &&
+	    (ctx->header_name = strdup(header_name)) == NULL)
+		errx(1, "%s(%d): strdup", __func__, __LINE__);
+	ctx->current_state = ctx->current_event = IR_NONE;
+	ctx->timeout_event = IR_NONE;
+	setup_initial_namespace(ctx);
+	return ctx;
+}
+
 void
-setup_initial_namespace(void)
+cfsm_ctx_free(struct cfsm_ctx *ctx)
+{
+	mobject_free(ctx->ns);
+	ir_free(ctx->ir);
+	free(ctx->header_name);
+	free(ctx->banner);
+	free(ctx);
+}
+
+static void
+setup_initial_namespace(struct cfsm_ctx *ctx)
 {
 	u_int i;
 	char *guard;
 
 #define DEF_STRING(k, v) do { \
-		if (mdict_insert_ss(fsm_namespace, k, v) == NULL) \
+		if (mdict_insert_ss(ctx->ns, k, v) == NULL) \
 			errx(1, "Default set for \"%s\" failed", k); \
 	} while (0)
 #define DEF_DICT(k) do { \
-		if (mdict_insert_sd(fsm_namespace, k) == NULL) \
+		if (mdict_insert_sd(ctx->ns, k) == NULL) \
 			errx(1, "Default set for \"%s\" failed", k); \
 	} while (0)
 #define DEF_ARRAY(k) do { \
-		if (mdict_insert_sa(fsm_namespace, k) == NULL) \
+		if (mdict_insert_sa(ctx->ns, k) == NULL) \
 			errx(1, "Default set for \"%s\" failed", k); \
 	} while (0)
-#define DEF_GET(o, k) do { \
-		if ((o = mdict_item_s(fsm_namespace, k)) == NULL) \
-			errx(1, "Lookup for default \"%s\" failed", k); \
-	} while (0)
 
-	if ((fsm_namespace = mdict_new()) == NULL)
+	if ((ctx->ns = mdict_new()) == NULL)
 		errx(1, "%s(%d): mdict_new failed", __func__, __LINE__);
+	ctx->ir = ir_new();
 
 	/* Set our defaults */
 	DEF_STRING("source_banner", "");
@@ -630,7 +891,12 @@ setup_initial_namespace(void)
 	DEF_STRING("advance_func", DEFAULT_ADVANCE_FUNC);
 	DEF_STRING("state_ntop_func", DEFAULT_STATE_NTOP_FUNC);
 	DEF_STRING("event_ntop_func", DEFAULT_EVENT_NTOP_FUNC);
+	DEF_STRING("state_pton_func", DEFAULT_STATE_PTON_FUNC);
+	DEF_STRING("event_pton_func", DEFAULT_EVENT_PTON_FUNC);
 	DEF_STRING("current_state_func", DEFAULT_CURRENT_STATE_FUNC);
+	DEF_STRING("can_advance_func", DEFAULT_CAN_ADVANCE_FUNC);
+	DEF_STRING("valid_events_func", DEFAULT_VALID_EVENTS_FUNC);
+	DEF_STRING("strerror_func", DEFAULT_STRERROR_FUNC);
 
 	DEF_STRING("event_precond_args", "");
 	DEF_STRING("event_precond_args_proto", "void");
@@ -640,10 +906,17 @@ setup_initial_namespace(void)
 	DEF_STRING("event_cb_args_proto", "void");
 	DEF_STRING("trans_cb_args", "");
 	DEF_STRING("trans_cb_args_proto", "void");
+	DEF_STRING("event_precond_args_cxx", "");
+	DEF_STRING("trans_precond_args_cxx", "");
+	DEF_STRING("event_cb_args_cxx", "");
+	DEF_STRING("trans_cb_args_cxx", "");
 
 	DEF_ARRAY("events_array");
 	DEF_ARRAY("states_array");
+	DEF_ARRAY("events_ordered");
+	DEF_ARRAY("states_ordered");
 	DEF_ARRAY("initial_states");
+	DEF_ARRAY("state_aliases");
 	DEF_DICT("states");
 	DEF_DICT("events");
 	DEF_DICT("event_callbacks");
@@ -652,178 +925,343 @@ setup_initial_namespace(void)
 	DEF_DICT("transition_exit_callbacks");
 	DEF_DICT("transition_entry_preconds");
 	DEF_DICT("transition_exit_preconds");
-
-	DEF_GET(fsm_states_array, "states_array");
-	DEF_GET(fsm_events_array, "events_array");
-	DEF_GET(fsm_initial_states, "initial_states");
-	DEF_GET(fsm_states, "states");
-	DEF_GET(fsm_events, "events");
-	DEF_GET(fsm_event_callbacks, "event_callbacks");
-	DEF_GET(fsm_event_preconds, "event_preconds");
-	DEF_GET(fsm_trans_entry_callbacks, "transition_entry_callbacks");
-	DEF_GET(fsm_trans_entry_preconds, "transition_entry_preconds");
-	DEF_GET(fsm_trans_exit_callbacks, "transition_exit_callbacks");
-	DEF_GET(fsm_trans_exit_preconds, "transition_exit_preconds");
-
-	if (mdict_insert_si(fsm_namespace, "need_ctx", 0) == NULL)
+	DEF_ARRAY("transtable_rows");
+	DEF_ARRAY("transtable_base");
+	DEF_ARRAY("transtable_cells");
+	DEF_ARRAY("event_masks");
+	DEF_ARRAY("runtime_index");
+	DEF_ARRAY("runtime_transitions");
+	DEF_ARRAY("fused_transitions");
+	DEF_ARRAY("fused_ignored");
+	DEF_ARRAY("stats_preconds");
+
+	if (mdict_insert_si(ctx->ns, "need_ctx", 0) == NULL)
 		errx(1, "Default set for \"need_ctx\" failed");
-
-	if (header_name == NULL) {
+	if (mdict_insert_si(ctx->ns, "error_records", 0) == NULL)
+		errx(1, "Default set for \"error_records\" failed");
+	if (mdict_insert_si(ctx->ns, "compact_storage", 0) == NULL)
+		errx(1, "Default set for \"compact_storage\" failed");
+	if (mdict_insert_si(ctx->ns, "snapshot", 0) == NULL)
+		errx(1, "Default set for \"snapshot\" failed");
+	if (mdict_insert_si(ctx->ns, "minimise_states", 0) == NULL)
+		errx(1, "Default set for \"minimise_states\" failed");
+	if (mdict_insert_si(ctx->ns, "event_queue", 0) == NULL)
+		errx(1, "Default set for \"event_queue\" failed");
+	if (mdict_insert_si(ctx->ns, "mailbox", 0) == NULL)
+		errx(1, "Default set for \"mailbox\" failed");
+	if (mdict_insert_si(ctx->ns, "timeouts", 0) == NULL)
+		errx(1, "Default set for \"timeouts\" failed");
+	if (mdict_insert_si(ctx->ns, "table_mode", table_mode) == NULL)
+		errx(1, "Default set for \"table_mode\" failed");
+	if (mdict_insert_si(ctx->ns, "runtime_mode",
+	    runtime_mode) == NULL)
+		errx(1, "Default set for \"runtime_mode\" failed");
+	if (mdict_insert_si(ctx->ns, "fused_mode", fused_mode) == NULL)
+		errx(1, "Default set for \"fused_mode\" failed");
+	if (mdict_insert_si(ctx->ns, "table_sparse", 0) == NULL)
+		errx(1, "Default set for \"table_sparse\" failed");
+	if (mdict_insert_si(ctx->ns, "vector_mode", vector_mode) == NULL)
+		errx(1, "Default set for \"vector_mode\" failed");
+	if (mdict_insert_si(ctx->ns, "stats_mode", stats_mode) == NULL)
+		errx(1, "Default set for \"stats_mode\" failed");
+	if (mdict_insert_si(ctx->ns, "trace_mode", trace_mode) == NULL)
+		errx(1, "Default set for \"trace_mode\" failed");
+	if (mdict_insert_si(ctx->ns, "cxx_mode", cxx_mode) == NULL)
+		errx(1, "Default set for \"cxx_mode\" failed");
+	if (mdict_insert_si(ctx->ns, "instrumented",
+	    stats_mode || trace_mode) == NULL)
+		errx(1, "Default set for \"instrumented\" failed");
+
+	if (ctx->header_name == NULL) {
 		DEF_STRING("header_guard", DEFAULT_HEADER_GUARD);
 		DEF_STRING("header_name", DEFAULT_HEADER);
 	} else {
-		if ((guard = malloc(strlen(header_name) + 2)) == NULL)
+		if ((guard = malloc(strlen(ctx->header_name) + 2)) == NULL)
 			errx(1, "malloc failed");
 		guard[0] = '_';
-		for (i = 0; header_name[i] != '\0'; i++) {
-			if (isalnum(header_name[i]))
-				guard[i + 1] = toupper(header_name[i]);
+		for (i = 0; ctx->header_name[i] != '\0'; i++) {
+			if (isalnum(ctx->header_name[i]))
+				guard[i + 1] = toupper(ctx->header_name[i]);
 			else
 				guard[i + 1] = '_';
 		}
 		guard[i + 1] = '\0';
-		DEF_STRING("header_name", header_name);
+		DEF_STRING("header_name", ctx->header_name);
 		DEF_STRING("header_guard", guard);
 		free(guard);
 	}
 }
 
 void
-finalise_namespace(void)
+finalise_namespace(struct cfsm_ctx *ctx)
 {
-	size_t n;
+	struct cfsm_ir *ir = ctx->ir;
+	struct numbering *items;
+	struct ir_state *st;
+	struct ir_move *mv;
 	struct mobject *tmp;
-	struct miterator *siter, *niter;
-	struct miteritem *sitem, *nitem;
-	const char *state, *next_state;
-	int64_t indegree;
+	size_t i, j, n;
+	u_int next, *seen;
+	int timeouts = 0;
+	char buf[512];
 
 	/* Make sure we have at least two states */
-	if ((n = marray_len(fsm_states_array)) == 0)
-		errx(1, "No states defined");
-	if (n == 1)
-		errx(1, "Only one state defined");
-
-	if (!event_specified)
-		errx(1, "No events specified");
-
-	/* Set min and max valid states */
-	if ((tmp = marray_item(fsm_states_array, 0)) == NULL)
-		errx(1, "%s(%d): marray_item", __func__, __LINE__);
-	if ((tmp = mobject_deepcopy(tmp)) == NULL)
-		errx(1, "%s(%d): mobject_deepcopy", __func__, __LINE__);
-	if (mdict_insert_s(fsm_namespace, "min_state_valid", tmp) == NULL)
-		errx(1, "%s(%d): mdict_insert_s", __func__, __LINE__);
-	if ((tmp = marray_item(fsm_states_array, n - 1)) == NULL)
-		errx(1, "%s(%d): marray_item", __func__, __LINE__);
-	if ((tmp = mobject_deepcopy(tmp)) == NULL)
-		errx(1, "%s(%d): mobject_deepcopy", __func__, __LINE__);
-	if (mdict_insert_s(fsm_namespace, "max_state_valid", tmp) == NULL)
-		errx(1, "%s(%d): mdict_insert_s", __func__, __LINE__);
-
-	/* Set flag for multiple initial states */
-	if ((n = marray_len(fsm_initial_states)) == 0)
-		errx(1, "No initial state defined");
-	if (mdict_insert_si(fsm_namespace, "multiple_start_states",
-	    n > 1 ? 1 : 0) == NULL)
-		errx(1, "%s(%d): mdict_insert_s", __func__, __LINE__);
+	if (ir->nstates == 0)
+		errx(1, "%s: No states defined", ctx->in_path);
+	if (ir->nstates == 1)
+		errx(1, "%s: Only one state defined", ctx->in_path);
 
-	/* If FSM is event-driven, set min and max valid events */
-	n = marray_len(fsm_events_array);
-	if (n > 0) {
-		if ((tmp = marray_item(fsm_events_array, 0)) == NULL)
-			errx(1, "%s(%d): marray_item", __func__, __LINE__);
-		if ((tmp = mobject_deepcopy(tmp)) == NULL)
-			errx(1, "%s(%d): mobject_deepcopy", __func__, __LINE__);
-		if (mdict_insert_s(fsm_namespace, "min_event_valid",
-		    tmp) == NULL)
-			errx(1, "%s(%d): mdict_insert_s", __func__, __LINE__);
-		if ((tmp = marray_item(fsm_events_array, n - 1)) == NULL)
-			errx(1, "%s(%d): marray_item", __func__, __LINE__);
-		if ((tmp = mobject_deepcopy(tmp)) == NULL)
-			errx(1, "%s(%d): mobject_deepcopy", __func__, __LINE__);
-		if (mdict_insert_s(fsm_namespace, "max_event_valid",
-		    tmp) == NULL)
-			errx(1, "%s(%d): mdict_insert_s", __func__, __LINE__);
-	}
+	if (!ctx->event_specified)
+		errx(1, "%s: No events specified", ctx->in_path);
 
 	/* Set callback and precondition arguments and prototype signatures */
-	if (mdict_replace_ss(fsm_namespace, "event_precond_args",
-	    gen_cb_args(event_precond_args)) == NULL)
+	if (mdict_replace_ss(ctx->ns, "event_precond_args",
+	    gen_cb_args(ctx->event_precond_args, buf, sizeof(buf))) == NULL)
 		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
-	if (mdict_replace_ss(fsm_namespace, "event_precond_args_proto",
-	    gen_cb_args_proto(event_precond_args)) == NULL)
+	if (mdict_replace_ss(ctx->ns, "event_precond_args_proto",
+	    gen_cb_args_proto(ctx, ctx->event_precond_args,
+	    buf, sizeof(buf))) == NULL)
 		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
 
-	if (mdict_replace_ss(fsm_namespace, "trans_precond_args",
-	    gen_cb_args(trans_precond_args)) == NULL)
+	if (mdict_replace_ss(ctx->ns, "trans_precond_args",
+	    gen_cb_args(ctx->trans_precond_args, buf, sizeof(buf))) == NULL)
 		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
-	if (mdict_replace_ss(fsm_namespace, "trans_precond_args_proto",
-	    gen_cb_args_proto(trans_precond_args)) == NULL)
+	if (mdict_replace_ss(ctx->ns, "trans_precond_args_proto",
+	    gen_cb_args_proto(ctx, ctx->trans_precond_args,
+	    buf, sizeof(buf))) == NULL)
 		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
 
-	if (mdict_replace_ss(fsm_namespace, "event_cb_args",
-	    gen_cb_args(event_callback_args)) == NULL)
+	if (mdict_replace_ss(ctx->ns, "event_cb_args",
+	    gen_cb_args(ctx->event_callback_args, buf, sizeof(buf))) == NULL)
 		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
-	if (mdict_replace_ss(fsm_namespace, "event_cb_args_proto",
-	    gen_cb_args_proto(event_callback_args)) == NULL)
+	if (mdict_replace_ss(ctx->ns, "event_cb_args_proto",
+	    gen_cb_args_proto(ctx, ctx->event_callback_args,
+	    buf, sizeof(buf))) == NULL)
 		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
 
-	if (mdict_replace_ss(fsm_namespace, "trans_cb_args",
-	    gen_cb_args(trans_callback_args)) == NULL)
+	if (mdict_replace_ss(ctx->ns, "trans_cb_args",
+	    gen_cb_args(ctx->trans_callback_args, buf, sizeof(buf))) == NULL)
+		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
+	if (mdict_replace_ss(ctx->ns, "trans_cb_args_proto",
+	    gen_cb_args_proto(ctx, ctx->trans_callback_args,
+	    buf, sizeof(buf))) == NULL)
 		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
-	if (mdict_replace_ss(fsm_namespace, "trans_cb_args_proto",
-	    gen_cb_args_proto(trans_callback_args)) == NULL)
+
+	/* C++ callbacks are members of a functor, which replaces the ctx */
+	if (mdict_replace_ss(ctx->ns, "event_precond_args_cxx",
+	    gen_cb_args(ctx->event_precond_args & ~CB_ARG_CTX,
+	    buf, sizeof(buf))) == NULL ||
+	    mdict_replace_ss(ctx->ns, "trans_precond_args_cxx",
+	    gen_cb_args(ctx->trans_precond_args & ~CB_ARG_CTX,
+	    buf, sizeof(buf))) == NULL ||
+	    mdict_replace_ss(ctx->ns, "event_cb_args_cxx",
+	    gen_cb_args(ctx->event_callback_args & ~CB_ARG_CTX,
+	    buf, sizeof(buf))) == NULL ||
+	    mdict_replace_ss(ctx->ns, "trans_cb_args_cxx",
+	    gen_cb_args(ctx->trans_callback_args & ~CB_ARG_CTX,
+	    buf, sizeof(buf))) == NULL)
 		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
 
+	/* Timeouts become transitions on the timeout event */
+	for (i = 0; i < ir->nstates; i++) {
+		st = &ir->states[i];
+		if (st->timeout == 0)
+			continue;
+		if (ctx->timeout_event == IR_NONE)
+			errx(1, "%s: State \"%s\" has a timeout but there is "
+			    "no timeout-event", ctx->in_path,
+			    IR_NAME(ir, st->name));
+		for (j = 0; j < st->nmoves; j++) {
+			if (st->moves[j].event == ctx->timeout_event)
+				errx(1, "%s: State \"%s\" has both a timeout "
+				    "and a transition on \"%s\"", ctx->in_path,
+				    IR_NAME(ir, st->name),
+				    IR_EVENT_NAME(ir, ctx->timeout_event));
+		}
+		ir_state_move(ir, i, ctx->timeout_event,
+		    IR_NAME(ir, st->timeout_next));
+		timeouts = 1;
+	}
+	if (timeouts && (mdict_replace_si(ctx->ns, "timeouts", 1) == NULL ||
+	    mdict_insert_ss(ctx->ns, "timeout_event",
+	    IR_EVENT_NAME(ir, ctx->timeout_event)) == NULL))
+		errx(1, "%s(%d): set up timeouts failed", __func__, __LINE__);
+
 	/*
-	 * Walk next_states and update each state's indegree, checking
-	 * for nonexistent next-states.
+	 * Resolve each state's next states and update their indegree,
+	 * checking for nonexistent next-states. A state counts once towards
+	 * the indegree of each of its next states.
 	 */
-	if ((siter = mobject_getiter(fsm_states)) == NULL)
-		errx(1, "%s(%d): mobject_getiter", __func__, __LINE__);
-	while ((sitem = miterator_next(siter)) != NULL) {
-		if ((state = mstring_ptr(sitem->key)) == NULL)
-			errx(1, "%s(%d): fsm_states returned NULL key",
-			    __func__, __LINE__);
-		if ((tmp = mdict_item_s(sitem->value, "next_states")) == NULL)
-			errx(1, "%s(%d): mdict_item_s", __func__, __LINE__);
-		if ((niter = mobject_getiter(tmp)) == NULL)
-			errx(1, "%s(%d): mobject_getiter", __func__, __LINE__);
-		while ((nitem = miterator_next(niter)) != NULL) {
-			if ((next_state = mstring_ptr(nitem->key)) == NULL)
-				errx(1, "%s(%d): %s.next_states returned "
-				    "NULL key", __func__, __LINE__, state);
-			if ((tmp = mdict_item(fsm_states, nitem->key)) == NULL)
-				errx(1, "State \"%s\" references non-existent "
-				    "next state \"%s\"", state, next_state);
-			if ((tmp = mdict_item_s(tmp, "indegree")) == NULL)
-				errx(1, "State \"%s\" lacks indegree",
-				    next_state);
-			if (mint_add(tmp, 1) != 0)
-				errx(1, "%s(%d): %s mint_add", __func__,
-				    __LINE__, next_state);
+	if ((seen = calloc(ir->nstates == 0 ? 1 : ir->nstates,
+	    sizeof(*seen))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (i = 0; i < ir->nstates; i++) {
+		st = &ir->states[i];
+		for (j = 0; j < st->nmoves; j++) {
+			mv = &st->moves[j];
+			if (mv->next_name == IR_IGNORE) {
+				mv->next = IR_IGNORE;
+				continue;
+			}
+			if ((next = ir->names[mv->next_name].state) == IR_NONE)
+				errx(1, "%s: State \"%s\" references "
+				    "non-existent next state \"%s\"",
+				    ctx->in_path, IR_NAME(ir, st->name),
+				    IR_NAME(ir, mv->next_name));
+			mv->next = next;
+			if (seen[next] == i + 1)
+				continue;
+			seen[next] = i + 1;
+			ir->states[next].indegree++;
 		}
-		miterator_free(niter);
 	}
-	miterator_free(siter);
+	free(seen);
 
 	/* Now look for unreachable (indegree == 0) states */
-	if ((siter = mobject_getiter(fsm_states)) == NULL)
-		errx(1, "%s(%d): mobject_getiter", __func__, __LINE__);
-	while ((sitem = miterator_next(siter)) != NULL) {
-		if ((state = mstring_ptr(sitem->key)) == NULL)
-			errx(1, "%s(%d): fsm_states returned NULL key",
-			    __func__, __LINE__);
-		if ((tmp = mdict_item_s(sitem->value, "indegree")) == NULL)
-			errx(1, "State \"%s\" lacks indegree", state);
-		if ((indegree = mint_value(tmp)) > 0)
+	for (i = 0; i < ir->nstates; i++) {
+		st = &ir->states[i];
+		if (st->indegree == 0 && !st->initial)
+			errx(1, "%s: State \"%s\" is unreachable",
+			    ctx->in_path, IR_NAME(ir, st->name));
+	}
+
+	/* Optionally merge equivalent states */
+	if ((tmp = mdict_item_s(ctx->ns, "minimise_states")) == NULL)
+		errx(1, "%s(%d): namespace lacks minimise_states",
+		    __func__, __LINE__);
+	if (mint_value(tmp) != 0)
+		minimise_states(ir);
+
+	/*
+	 * Number states and events, then order them by number. Merged
+	 * states take the number of the state they were merged into.
+	 */
+	n = ir->nstates > ir->nevents ? ir->nstates : ir->nevents;
+	if ((items = calloc(n, sizeof(*items))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (i = n = 0; i < ir->nstates; i++) {
+		st = &ir->states[i];
+		if (st->alias_of != IR_NONE)
 			continue;
-		if ((tmp = mdict_item_s(sitem->value, "is_initial")) == NULL)
-			errx(1, "State \"%s\" lacks is_initial", state);
-		if (mint_value(tmp) != 1)
-			errx(1, "State \"%s\" is unreachable", state);
+		items[n].number = &st->number;
+		items[n].id = i;
+		items[n++].name = IR_NAME(ir, st->name);
+	}
+	ir->state_order = assign_numbers(ctx, items, n, "state");
+	ir->nstate_order = n;
+	for (i = 0; i < ir->nstates; i++) {
+		st = &ir->states[i];
+		if (st->alias_of != IR_NONE)
+			st->number = ir->states[st->alias_of].number;
+	}
+	for (i = 0; i < ir->nevents; i++) {
+		items[i].number = &ir->events[i].number;
+		items[i].id = i;
+		items[i].name = IR_NAME(ir, ir->events[i].name);
+	}
+	ir->event_order = assign_numbers(ctx, items, ir->nevents, "event");
+	free(items);
+
+	/* Set min and max valid states and events */
+	if (mdict_insert_ss(ctx->ns, "min_state_valid",
+	    IR_STATE_NAME(ir, ir->state_order[0])) == NULL ||
+	    mdict_insert_ss(ctx->ns, "max_state_valid",
+	    IR_STATE_NAME(ir, ir->state_order[ir->nstate_order - 1])) == NULL ||
+	    mdict_insert_ss(ctx->ns, "min_event_valid",
+	    IR_EVENT_NAME(ir, ir->event_order[0])) == NULL ||
+	    mdict_insert_ss(ctx->ns, "max_event_valid",
+	    IR_EVENT_NAME(ir, ir->event_order[ir->nevents - 1])) == NULL)
+		errx(1, "%s(%d): mdict_insert_ss", __func__, __LINE__);
+
+	/* Set flag for multiple initial states */
+	for (i = n = 0; i < ir->nstates; i++) {
+		st = &ir->states[i];
+		if (st->initial && st->alias_of == IR_NONE)
+			n++;
 	}
-	miterator_free(siter);
+	if (n == 0)
+		errx(1, "%s: No initial state defined", ctx->in_path);
+	if (mdict_insert_si(ctx->ns, "multiple_start_states",
+	    n > 1 ? 1 : 0) == NULL)
+		errx(1, "%s(%d): mdict_insert_s", __func__, __LINE__);
 
+	/* The vector kernel only moves states; it has nowhere to call out */
+	for (i = 0; vector_mode && i < IR_NLISTS; i++) {
+		if (ir->lists[i].n != 0)
+			errx(1, "%s: The vector kernel (-V) does not support "
+			    "callbacks or preconditions", ctx->in_path);
+	}
+	/* Timers are armed as the advance function changes state */
+	if (timeouts && vector_mode)
+		errx(1, "%s: The vector kernel (-V) does not support timeouts",
+		    ctx->in_path);
+	if (timeouts && runtime_mode)
+		errx(1, "%s: timeouts may not be used with the libcfsm "
+		    "runtime (-r)", ctx->in_path);
+	/* The C++ class holds nothing but its state and callbacks */
+	if (cxx_mode) {
+		if ((tmp = mdict_item_s(ctx->ns, "event_queue")) == NULL)
+			errx(1, "%s(%d): namespace lacks event_queue",
+			    __func__, __LINE__);
+		if (mint_value(tmp) != 0)
+			errx(1, "%s: event-queue may not be used with the C++ "
+			    "header (-C)", ctx->in_path);
+		if ((tmp = mdict_item_s(ctx->ns, "mailbox")) == NULL)
+			errx(1, "%s(%d): namespace lacks mailbox",
+			    __func__, __LINE__);
+		if (mint_value(tmp) != 0)
+			errx(1, "%s: mailbox may not be used with the C++ "
+			    "header (-C)", ctx->in_path);
+		if ((tmp = mdict_item_s(ctx->ns, "snapshot")) == NULL)
+			errx(1, "%s(%d): namespace lacks snapshot",
+			    __func__, __LINE__);
+		if (mint_value(tmp) != 0)
+			errx(1, "%s: snapshot may not be used with the C++ "
+			    "header (-C)", ctx->in_path);
+		if (timeouts)
+			errx(1, "%s: timeouts may not be used with the C++ "
+			    "header (-C)", ctx->in_path);
+	}
+
+	/* libcfsm updates the current state through an int pointer */
+	if ((tmp = mdict_item_s(ctx->ns, "compact_storage")) == NULL)
+		errx(1, "%s(%d): namespace lacks compact_storage",
+		    __func__, __LINE__);
+	if (runtime_mode && mint_value(tmp) != 0)
+		errx(1, "%s: compact-storage may not be used with the libcfsm "
+		    "runtime (-r)", ctx->in_path);
+	/* Dwell times need a timestamp in each instance */
+	if (stats_mode && mint_value(tmp) != 0)
+		errx(1, "%s: compact-storage may not be used with statistics "
+		    "(-S)", ctx->in_path);
+	/* Queues of events would make instances anything but compact */
+	if (mint_value(tmp) != 0) {
+		if ((tmp = mdict_item_s(ctx->ns, "event_queue")) == NULL)
+			errx(1, "%s(%d): namespace lacks event_queue",
+			    __func__, __LINE__);
+		if (mint_value(tmp) != 0)
+			errx(1, "%s: compact-storage may not be used with "
+			    "event-queue", ctx->in_path);
+		if ((tmp = mdict_item_s(ctx->ns, "mailbox")) == NULL)
+			errx(1, "%s(%d): namespace lacks mailbox",
+			    __func__, __LINE__);
+		if (mint_value(tmp) != 0)
+			errx(1, "%s: compact-storage may not be used with "
+			    "mailbox", ctx->in_path);
+		if (timeouts)
+			errx(1, "%s: compact-storage may not be used with "
+			    "timeouts", ctx->in_path);
+	}
+	if (stats_mode)
+		setup_stats_preconds(ctx);
+
+	/* Everything is checked; render it for the templates */
+	ir_render(ir, ctx->ns);
+	if (runtime_mode)
+		setup_tables(ctx->ns, ir, TABLE_RUNTIME);
+	else if (fused_mode)
+		setup_tables(ctx->ns, ir, TABLE_FUSED);
+	else
+		setup_tables(ctx->ns, ir, table_mode);
+	setup_name_hashes(ctx->ns, ir);
 }
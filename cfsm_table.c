@@ -0,0 +1,846 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* $Id$ */
+
+/*
+ * Construction of the tables derived from the state x event transition
+ * matrix: the per-state valid event masks and the next-state table used
+ * by the table-driven advance function. The matrix is derived from the
+ * parsed IR and the tables rendered into the namespace as C initialisers,
+ * the latter either densely or as a row-displaced comb vector for sparse
+ * machines. The matrix is only ever held as each state's row of valid
+ * cells, so that work and memory follow the number of transitions; only
+ * rendering a dense table visits every cell.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <err.h>
+
+#include "mobject.h"
+#include "strlcat.h"
+#include "strlcpy.h"
+
+#include "cfsm.h"
+#include "cfsm_ir.h"
+
+/* Local prototypes */
+void setup_tables(struct mobject *, struct cfsm_ir *, int);
+
+/* A valid cell of the transition table */
+struct ttcell {
+	size_t event;
+	int next;		/* Next state, or CELL_IGNORE */
+};
+
+/*
+ * Working representation of the transition table. States and events are
+ * numbered by their enum values, as assigned by the parser. Cells not in
+ * a state's row are CELL_INVALID.
+ */
+struct transtable {
+	struct cfsm_ir *ir;
+	size_t nstates, nevents, ncells;
+	const char **state_names;
+	const char **event_names;
+	u_int *state_ids;	/* IR state of each number */
+	u_int *event_ids;	/* IR event of each number */
+	struct ttcell *cells;	/* Valid cells, by state and then event */
+	size_t *row;		/* nstates + 1 offsets of each state's cells */
+};
+
+/* Special cell values */
+#define CELL_INVALID	(-1)
+#define CELL_IGNORE	(-2)
+
+static int
+ttcell_cmp(const void *a, const void *b)
+{
+	const struct ttcell *ca = a, *cb = b;
+
+	return ca->event < cb->event ? -1 : ca->event > cb->event;
+}
+
+static struct transtable *
+transtable_build(struct cfsm_ir *ir)
+{
+	struct transtable *tt;
+	struct ir_state *st;
+	struct ir_move *mv;
+	struct ttcell *c;
+	size_t s, e, i;
+
+	if ((tt = calloc(1, sizeof(*tt))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	tt->ir = ir;
+	tt->nstates = ir->nstate_order;
+	tt->nevents = ir->nevents;
+	tt->state_ids = ir->state_order;
+	tt->event_ids = ir->event_order;
+	if ((tt->state_names = calloc(tt->nstates == 0 ? 1 : tt->nstates,
+	    sizeof(*tt->state_names))) == NULL ||
+	    (tt->event_names = calloc(tt->nevents == 0 ? 1 : tt->nevents,
+	    sizeof(*tt->event_names))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (s = 0; s < tt->nstates; s++)
+		tt->state_names[s] = IR_STATE_NAME(ir, tt->state_ids[s]);
+	for (e = 0; e < tt->nevents; e++)
+		tt->event_names[e] = IR_EVENT_NAME(ir, tt->event_ids[e]);
+
+	if (tt->nstates == 0 || tt->nevents == 0 ||
+	    SIZE_MAX / tt->nstates < tt->nevents)
+		errx(1, "%s(%d): bad table dimensions", __func__, __LINE__);
+	for (s = 0; s < tt->nstates; s++)
+		tt->ncells += ir->states[tt->state_ids[s]].nmoves;
+	if ((tt->row = calloc(tt->nstates + 1, sizeof(*tt->row))) == NULL ||
+	    (tt->cells = calloc(tt->ncells == 0 ? 1 : tt->ncells,
+	    sizeof(*tt->cells))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+
+	for (s = 0; s < tt->nstates; s++) {
+		st = &ir->states[tt->state_ids[s]];
+		tt->row[s + 1] = tt->row[s] + st->nmoves;
+		for (i = 0; i < st->nmoves; i++) {
+			mv = &st->moves[i];
+			c = &tt->cells[tt->row[s] + i];
+			c->event = ir->events[mv->event].number;
+			/* Merged states share the number of their target */
+			if (mv->next == IR_IGNORE)
+				c->next = CELL_IGNORE;
+			else
+				c->next = ir->states[mv->next].number;
+		}
+		qsort(&tt->cells[tt->row[s]], st->nmoves, sizeof(*tt->cells),
+		    ttcell_cmp);
+	}
+
+	return tt;
+}
+
+static void
+transtable_free(struct transtable *tt)
+{
+	free(tt->state_names);
+	free(tt->event_names);
+	free(tt->cells);
+	free(tt->row);
+	free(tt);
+}
+
+/*
+ * Returns the cell for event "e" of state "s", given that "*pos" is the
+ * position in the row of the first valid cell with an event of at least
+ * "e". Visiting a row's events in order this way is linear in its length.
+ */
+static int
+row_cell(struct transtable *tt, size_t s, size_t e, size_t *pos)
+{
+	if (*pos < tt->row[s + 1] && tt->cells[*pos].event == e)
+		return tt->cells[(*pos)++].next;
+	return CELL_INVALID;
+}
+
+/* Pick the smallest unsigned type that can represent "n" distinct values */
+static const char *
+smallest_type(size_t n)
+{
+	if (n <= 0xff)
+		return "uint8_t";
+	if (n <= 0xffff)
+		return "uint16_t";
+	return "uint32_t";
+}
+
+static void
+set_number(struct mobject *ns, const char *key, size_t n)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%zu", n);
+	if (mdict_replace_ss(ns, key, buf) == NULL)
+		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
+}
+
+static const char *
+cell_name(struct transtable *tt, int cell)
+{
+	switch (cell) {
+	case CELL_INVALID:
+		return "_CFSM_TT_INVALID";
+	case CELL_IGNORE:
+		return "_CFSM_TT_IGNORE";
+	default:
+		return tt->state_names[cell];
+	}
+}
+
+static size_t
+type_size(size_t n)
+{
+	if (n <= 0xff)
+		return 1;
+	if (n <= 0xffff)
+		return 2;
+	return 4;
+}
+
+/*
+ * Pack the table rows into a single comb vector using row displacement
+ * (as yacc does for its parse tables). Each state is assigned a base
+ * offset such that none of its valid cells collide with those of
+ * previously placed states; a parallel check vector records which state
+ * owns each slot. Rows are placed densest first, into the lowest base
+ * that fits. Returns the length of the packed vector, which is padded so
+ * that base + event never runs off its end.
+ */
+struct packrow {
+	size_t state, count;
+};
+
+static int
+packrow_cmp(const void *a, const void *b)
+{
+	const struct packrow *ra = a, *rb = b;
+
+	/* Densest rows first; ties broken by state to keep output stable */
+	if (ra->count != rb->count)
+		return ra->count > rb->count ? -1 : 1;
+	return ra->state < rb->state ? -1 : (ra->state > rb->state);
+}
+
+static size_t
+transtable_pack(struct transtable *tt, size_t *base, int **ownerp)
+{
+	struct packrow *order;
+	size_t i, j, s, b, len, alloc, first_free, min_e;
+	int *owner;
+
+	if ((order = calloc(tt->nstates, sizeof(*order))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (s = 0; s < tt->nstates; s++) {
+		order[s].state = s;
+		order[s].count = tt->row[s + 1] - tt->row[s];
+	}
+	qsort(order, tt->nstates, sizeof(*order), packrow_cmp);
+
+	alloc = tt->nevents * 2;
+	if ((owner = malloc(alloc * sizeof(*owner))) == NULL)
+		errx(1, "%s(%d): malloc", __func__, __LINE__);
+	for (i = 0; i < alloc; i++)
+		owner[i] = -1;
+	len = first_free = 0;
+
+	for (i = 0; i < tt->nstates; i++) {
+		s = order[i].state;
+		base[s] = 0;
+		if (order[i].count == 0)
+			continue;
+		min_e = tt->cells[tt->row[s]].event;
+		/* No base below this can place the first cell in a free slot */
+		b = first_free > min_e ? first_free - min_e : 0;
+		for (;; b++) {
+			if (b + tt->nevents > alloc) {
+				if (SIZE_MAX / 2 / sizeof(*owner) < alloc)
+					errx(1, "%s(%d): transition table "
+					    "too large", __func__, __LINE__);
+				if ((owner = realloc(owner,
+				    alloc * 2 * sizeof(*owner))) == NULL)
+					errx(1, "%s(%d): realloc",
+					    __func__, __LINE__);
+				for (j = alloc; j < alloc * 2; j++)
+					owner[j] = -1;
+				alloc *= 2;
+			}
+			for (j = tt->row[s]; j < tt->row[s + 1]; j++) {
+				if (owner[b + tt->cells[j].event] != -1)
+					break;
+			}
+			if (j == tt->row[s + 1])
+				break;
+		}
+		base[s] = b;
+		for (j = tt->row[s]; j < tt->row[s + 1]; j++)
+			owner[b + tt->cells[j].event] = s;
+		if (b + tt->nevents > len)
+			len = b + tt->nevents;
+		while (first_free < alloc && owner[first_free] != -1)
+			first_free++;
+	}
+	/* All rows empty is impossible, but keep the vector non-empty */
+	if (len < tt->nevents)
+		len = tt->nevents;
+
+	free(order);
+	*ownerp = owner;
+	return len;
+}
+
+static void
+render_dense(struct mobject *ns, struct transtable *tt)
+{
+	struct mobject *rows, *row, *cells;
+	size_t s, e, pos;
+
+	if ((rows = mdict_item_s(ns, "transtable_rows")) == NULL)
+		errx(1, "%s(%d): namespace lacks transtable_rows",
+		    __func__, __LINE__);
+	for (s = 0; s < tt->nstates; s++) {
+		if ((row = mdict_new()) == NULL ||
+		    marray_append(rows, row) == -1)
+			errx(1, "%s(%d): mdict_new", __func__, __LINE__);
+		if (mdict_insert_ss(row, "state", tt->state_names[s]) == NULL ||
+		    (cells = mdict_insert_sa(row, "cells")) == NULL)
+			errx(1, "%s(%d): set up row failed",
+			    __func__, __LINE__);
+		for (pos = tt->row[s], e = 0; e < tt->nevents; e++) {
+			if (marray_append_s(cells, cell_name(tt,
+			    row_cell(tt, s, e, &pos))) == NULL)
+				errx(1, "%s(%d): marray_append_s",
+				    __func__, __LINE__);
+		}
+	}
+}
+
+static void
+render_sparse(struct mobject *ns, struct transtable *tt, size_t *base,
+    int *owner, size_t len)
+{
+	struct mobject *bases, *cells;
+	size_t s, i;
+	int *next;
+	char buf[256];
+
+	/* The next state held in each slot of the packed vector */
+	if ((next = calloc(len, sizeof(*next))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (s = 0; s < tt->nstates; s++) {
+		for (i = tt->row[s]; i < tt->row[s + 1]; i++)
+			next[base[s] + tt->cells[i].event] = tt->cells[i].next;
+	}
+
+	if ((bases = mdict_item_s(ns, "transtable_base")) == NULL ||
+	    (cells = mdict_item_s(ns, "transtable_cells")) == NULL)
+		errx(1, "%s(%d): namespace lacks transtable_base/cells",
+		    __func__, __LINE__);
+	for (s = 0; s < tt->nstates; s++) {
+		snprintf(buf, sizeof(buf), "%zu", base[s]);
+		if (marray_append_s(bases, buf) == NULL)
+			errx(1, "%s(%d): marray_append_s", __func__, __LINE__);
+	}
+	for (i = 0; i < len; i++) {
+		if (owner[i] == -1) {
+			snprintf(buf, sizeof(buf), "{ %s, %s }",
+			    cell_name(tt, CELL_INVALID),
+			    cell_name(tt, CELL_INVALID));
+		} else {
+			snprintf(buf, sizeof(buf), "{ %s, %s }",
+			    tt->state_names[owner[i]], cell_name(tt, next[i]));
+		}
+		if (marray_append_s(cells, buf) == NULL)
+			errx(1, "%s(%d): marray_append_s", __func__, __LINE__);
+	}
+	free(next);
+	set_number(ns, "transtable_len", len);
+	if (mdict_replace_ss(ns, "transtable_base_type",
+	    smallest_type(len)) == NULL)
+		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
+}
+
+/*
+ * Select storage types for the arrays of FSM states and events used by
+ * the vector kernel and note whether they are narrow enough for SIMD.
+ */
+static void
+render_vector_types(struct mobject *ns, struct transtable *tt)
+{
+	size_t svalues = tt->nstates + 2;
+
+	if (mdict_replace_ss(ns, "vector_event_type",
+	    smallest_type(tt->nevents)) == NULL)
+		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
+	if (mdict_replace_si(ns, "vector_state_narrow",
+	    type_size(svalues) == 1) == NULL ||
+	    mdict_replace_si(ns, "vector_event_narrow",
+	    type_size(tt->nevents) == 1) == NULL ||
+	    mdict_replace_si(ns, "vector_simd", type_size(svalues) <= 2 &&
+	    type_size(tt->nevents) <= 2) == NULL)
+		errx(1, "%s(%d): mdict_replace_si", __func__, __LINE__);
+}
+
+/* Returns the offset at which a member of "size" bytes lands after "off" */
+static size_t
+align_member(size_t off, size_t size)
+{
+	return (off + size - 1) / size * size;
+}
+
+/*
+ * Select the smallest storage types able to hold every state and event
+ * for compact instances, and work out the size that struct fsm will have
+ * when using them. The layout mirrors the compact struct in header.m.
+ */
+static void
+render_storage(struct mobject *ns, struct transtable *tt)
+{
+	struct mobject *tmp;
+	const char *fsm_struct;
+	size_t i, ssize, esize, off, inner, align;
+	char buf[256];
+
+	if (mdict_replace_ss(ns, "state_storage_type",
+	    smallest_type(tt->nstates - 1)) == NULL ||
+	    mdict_replace_ss(ns, "event_storage_type",
+	    smallest_type(tt->nevents - 1)) == NULL)
+		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
+	ssize = type_size(tt->nstates - 1);
+	esize = type_size(tt->nevents - 1);
+
+	/* current_state, then last_error {event, old, new, uint8_t reason} */
+	off = ssize;
+	align = ssize;
+	if ((tmp = mdict_item_s(ns, "error_records")) == NULL)
+		errx(1, "%s(%d): namespace lacks error_records",
+		    __func__, __LINE__);
+	if (mint_value(tmp) != 0) {
+		inner = align_member(0, esize) + esize;
+		inner = align_member(inner, ssize) + ssize;
+		inner = align_member(inner, ssize) + ssize + 1;
+		if (esize > align)
+			align = esize;
+		inner = align_member(inner, align);
+		off = align_member(off, align) + inner;
+	}
+	set_number(ns, "instance_size", align_member(off, align));
+
+	/* Name the size macro after the FSM struct */
+	if ((tmp = mdict_item_s(ns, "fsm_struct")) == NULL ||
+	    (fsm_struct = mstring_ptr(tmp)) == NULL)
+		errx(1, "%s(%d): Unable to retrieve fsm struct def",
+		    __func__, __LINE__);
+	for (i = 0; fsm_struct[i] != '\0' && i < sizeof(buf) - 1; i++)
+		buf[i] = toupper((u_char)fsm_struct[i]);
+	buf[i] = '\0';
+	strlcat(buf, "_INSTANCE_SIZE", sizeof(buf));
+	if (mdict_replace_ss(ns, "instance_size_define", buf) == NULL)
+		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
+}
+
+/* Mix "len" bytes into a 64-bit FNV-1a hash */
+static uint64_t
+fnv1a(uint64_t h, const void *p, size_t len)
+{
+	const u_char *s = p;
+
+	while (len-- > 0) {
+		h ^= *s++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static uint64_t
+fnv1a_u32(uint64_t h, uint32_t v)
+{
+	u_char b[4];
+
+	b[0] = v & 0xff;
+	b[1] = (v >> 8) & 0xff;
+	b[2] = (v >> 16) & 0xff;
+	b[3] = (v >> 24) & 0xff;
+	return fnv1a(h, b, sizeof(b));
+}
+
+/*
+ * Hash the states, events and transitions, as numbered, into a fingerprint
+ * that snapshots of instances are stamped with. Anything that changes
+ * what a stored state number means changes the fingerprint; names are
+ * included so that renumbering or renaming states is noticed too.
+ */
+static void
+render_fingerprint(struct mobject *ns, struct transtable *tt)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	const char *fsm_struct;
+	struct mobject *tmp;
+	size_t i, j;
+	char buf[256];
+
+	h = fnv1a_u32(h, tt->nstates);
+	h = fnv1a_u32(h, tt->nevents);
+	for (i = 0; i < tt->nstates; i++)
+		h = fnv1a(h, tt->state_names[i],
+		    strlen(tt->state_names[i]) + 1);
+	for (i = 0; i < tt->nevents; i++)
+		h = fnv1a(h, tt->event_names[i],
+		    strlen(tt->event_names[i]) + 1);
+	/* Each state's valid cells, all others being invalid */
+	for (i = 0; i < tt->nstates; i++) {
+		h = fnv1a_u32(h, (uint32_t)(tt->row[i + 1] - tt->row[i]));
+		for (j = tt->row[i]; j < tt->row[i + 1]; j++) {
+			h = fnv1a_u32(h, (uint32_t)tt->cells[j].event);
+			h = fnv1a_u32(h, (uint32_t)tt->cells[j].next);
+		}
+	}
+	snprintf(buf, sizeof(buf), "0x%016llxULL", (unsigned long long)h);
+	if (mdict_replace_ss(ns, "fingerprint", buf) == NULL)
+		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
+
+	if ((tmp = mdict_item_s(ns, "fsm_struct")) == NULL ||
+	    (fsm_struct = mstring_ptr(tmp)) == NULL)
+		errx(1, "%s(%d): Unable to retrieve fsm struct def",
+		    __func__, __LINE__);
+	for (i = 0; fsm_struct[i] != '\0' && i < sizeof(buf) - 1; i++)
+		buf[i] = toupper((u_char)fsm_struct[i]);
+	buf[i] = '\0';
+	strlcat(buf, "_FINGERPRINT", sizeof(buf));
+	if (mdict_replace_ss(ns, "fingerprint_define", buf) == NULL)
+		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
+}
+
+/*
+ * Render a packed bit vector of the events that each state accepts or
+ * ignores into "event_masks", as rows of 32-bit words.
+ */
+static void
+render_event_masks(struct mobject *ns, struct transtable *tt)
+{
+	struct mobject *masks, *row, *words, *tmp;
+	const char *event_enum;
+	size_t s, e, w, nwords, i;
+	uint32_t *mask;
+	char buf[256];
+
+	nwords = (tt->nevents + 31) / 32;
+	set_number(ns, "event_mask_words", nwords);
+
+	/* Name the word count macro after the event enum */
+	if ((tmp = mdict_item_s(ns, "event_enum")) == NULL ||
+	    (event_enum = mstring_ptr(tmp)) == NULL)
+		errx(1, "%s(%d): Unable to retrieve event enum def",
+		    __func__, __LINE__);
+	for (i = 0; event_enum[i] != '\0' && i < sizeof(buf) - 1; i++)
+		buf[i] = toupper((u_char)event_enum[i]);
+	buf[i] = '\0';
+	strlcat(buf, "_MASK_WORDS", sizeof(buf));
+	if (mdict_replace_ss(ns, "event_mask_words_define", buf) == NULL)
+		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
+
+	if ((masks = mdict_item_s(ns, "event_masks")) == NULL)
+		errx(1, "%s(%d): namespace lacks event_masks",
+		    __func__, __LINE__);
+	if ((mask = calloc(nwords, sizeof(*mask))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (s = 0; s < tt->nstates; s++) {
+		if ((row = mdict_new()) == NULL ||
+		    marray_append(masks, row) == -1)
+			errx(1, "%s(%d): mdict_new", __func__, __LINE__);
+		if (mdict_insert_ss(row, "state", tt->state_names[s]) == NULL ||
+		    (words = mdict_insert_sa(row, "words")) == NULL)
+			errx(1, "%s(%d): set up row failed",
+			    __func__, __LINE__);
+		memset(mask, 0, nwords * sizeof(*mask));
+		for (i = tt->row[s]; i < tt->row[s + 1]; i++) {
+			e = tt->cells[i].event;
+			mask[e / 32] |= 1U << (e % 32);
+		}
+		for (w = 0; w < nwords; w++) {
+			snprintf(buf, sizeof(buf), "0x%08x", mask[w]);
+			if (marray_append_s(words, buf) == NULL)
+				errx(1, "%s(%d): marray_append_s",
+				    __func__, __LINE__);
+		}
+	}
+	free(mask);
+}
+
+/*
+ * Set "key" in a runtime transition entry to the name of the generated
+ * list "list" for the state or event "name", or to NULL if "l" is empty.
+ */
+static void
+set_list_name(struct mobject *entry, const char *key, const char *fsm_struct,
+    const struct ir_list *l, const char *name, const char *list)
+{
+	char buf[1024];
+
+	if (l->n == 0)
+		strlcpy(buf, "NULL", sizeof(buf));
+	else if ((size_t)snprintf(buf, sizeof(buf), "_%s_%s_%s",
+	    fsm_struct, list, name) >= sizeof(buf))
+		errx(1, "%s(%d): name too long", __func__, __LINE__);
+	if (mdict_insert_ss(entry, key, buf) == NULL)
+		errx(1, "%s(%d): mdict_insert_ss", __func__, __LINE__);
+}
+
+/*
+ * Render the libcfsm transition index and per-transition entries. Each
+ * index cell is 0 for invalid events or one more than the position of
+ * the cell's entry in "runtime_transitions". The first entry is shared
+ * by all ignored events. Each entry names the generated lists of
+ * preconditions and callbacks that apply to the transition.
+ */
+static void
+render_runtime(struct mobject *ns, struct transtable *tt)
+{
+	struct mobject *rows, *row, *cells, *trans, *entry, *tmp;
+	struct ir_state *from, *to;
+	struct ir_event *ev;
+	const char *fsm_struct, *state, *event, *next;
+	size_t s, e, n, pos;
+	int cell;
+	char buf[32], comment[1024];
+
+	if ((rows = mdict_item_s(ns, "runtime_index")) == NULL ||
+	    (trans = mdict_item_s(ns, "runtime_transitions")) == NULL ||
+	    (tmp = mdict_item_s(ns, "fsm_struct")) == NULL ||
+	    (fsm_struct = mstring_ptr(tmp)) == NULL)
+		errx(1, "%s(%d): namespace incomplete", __func__, __LINE__);
+
+	if ((entry = mdict_new()) == NULL || marray_append(trans, entry) == -1)
+		errx(1, "%s(%d): mdict_new", __func__, __LINE__);
+	if (mdict_insert_ss(entry, "comment", "Ignored events") == NULL ||
+	    mdict_insert_ss(entry, "next", "CFSM_NEXT_IGNORE") == NULL ||
+	    mdict_insert_ss(entry, "event_preconds", "NULL") == NULL ||
+	    mdict_insert_ss(entry, "exit_preconds", "NULL") == NULL ||
+	    mdict_insert_ss(entry, "entry_preconds", "NULL") == NULL ||
+	    mdict_insert_ss(entry, "event_callbacks", "NULL") == NULL ||
+	    mdict_insert_ss(entry, "exit_callbacks", "NULL") == NULL ||
+	    mdict_insert_ss(entry, "entry_callbacks", "NULL") == NULL)
+		errx(1, "%s(%d): set up entry failed", __func__, __LINE__);
+
+	for (n = 1, s = 0; s < tt->nstates; s++) {
+		state = tt->state_names[s];
+		from = &tt->ir->states[tt->state_ids[s]];
+		if ((row = mdict_new()) == NULL ||
+		    marray_append(rows, row) == -1)
+			errx(1, "%s(%d): mdict_new", __func__, __LINE__);
+		if (mdict_insert_ss(row, "state", state) == NULL ||
+		    (cells = mdict_insert_sa(row, "cells")) == NULL)
+			errx(1, "%s(%d): set up row failed",
+			    __func__, __LINE__);
+		for (pos = tt->row[s], e = 0; e < tt->nevents; e++) {
+			cell = row_cell(tt, s, e, &pos);
+			if (cell == CELL_INVALID)
+				strlcpy(buf, "0", sizeof(buf));
+			else if (cell == CELL_IGNORE)
+				strlcpy(buf, "1", sizeof(buf));
+			else
+				snprintf(buf, sizeof(buf), "%zu", ++n);
+			if (marray_append_s(cells, buf) == NULL)
+				errx(1, "%s(%d): marray_append_s",
+				    __func__, __LINE__);
+			if (cell < 0)
+				continue;
+
+			event = tt->event_names[e];
+			next = tt->state_names[cell];
+			ev = &tt->ir->events[tt->event_ids[e]];
+			to = &tt->ir->states[tt->state_ids[cell]];
+			if ((entry = mdict_new()) == NULL ||
+			    marray_append(trans, entry) == -1)
+				errx(1, "%s(%d): mdict_new",
+				    __func__, __LINE__);
+			snprintf(comment, sizeof(comment), "%s: %s -> %s",
+			    state, event, next);
+			if (mdict_insert_ss(entry, "comment", comment) == NULL ||
+			    mdict_insert_ss(entry, "next", next) == NULL)
+				errx(1, "%s(%d): set up entry failed",
+				    __func__, __LINE__);
+			set_list_name(entry, "event_preconds", fsm_struct,
+			    &ev->preconds, event, "event_preconds");
+			set_list_name(entry, "exit_preconds", fsm_struct,
+			    &from->exit_preconds, state, "exit_preconds");
+			set_list_name(entry, "entry_preconds", fsm_struct,
+			    &to->entry_preconds, next, "entry_preconds");
+			set_list_name(entry, "event_callbacks", fsm_struct,
+			    &ev->callbacks, event, "event_callbacks");
+			set_list_name(entry, "exit_callbacks", fsm_struct,
+			    &from->exit_callbacks, state, "exit_callbacks");
+			set_list_name(entry, "entry_callbacks", fsm_struct,
+			    &to->entry_callbacks, next, "entry_callbacks");
+		}
+	}
+}
+
+/* Append the names in "l" to a new array "key" in a fused transition */
+static void
+copy_list(struct mobject *trans, const char *key, struct cfsm_ir *ir,
+    const struct ir_list *l)
+{
+	struct mobject *out;
+	size_t i;
+
+	if ((out = mdict_insert_sa(trans, key)) == NULL)
+		errx(1, "%s(%d): mdict_insert_sa", __func__, __LINE__);
+	for (i = 0; i < l->n; i++) {
+		if (marray_append_s(out, IR_NAME(ir, l->ids[i])) == NULL)
+			errx(1, "%s(%d): marray_append_s", __func__, __LINE__);
+	}
+}
+
+/*
+ * Render the (state, event) pairs for the fused advance function. Each
+ * transition in "fused_transitions" carries its own copies of the
+ * preconditions and callbacks that apply to it, so the template can emit
+ * them inline. Ignored pairs are listed in "fused_ignored".
+ */
+static void
+render_fused(struct mobject *ns, struct transtable *tt)
+{
+	struct mobject *fused, *ignored, *trans;
+	struct cfsm_ir *ir = tt->ir;
+	struct ir_state *from, *to;
+	struct ir_event *ev;
+	const char *state, *event, *next;
+	size_t s, e, i;
+	int cell, event_fail = 0, exit_fail = 0, entry_fail = 0;
+
+	if ((fused = mdict_item_s(ns, "fused_transitions")) == NULL ||
+	    (ignored = mdict_item_s(ns, "fused_ignored")) == NULL)
+		errx(1, "%s(%d): namespace incomplete", __func__, __LINE__);
+
+	for (s = 0; s < tt->nstates; s++) {
+		state = tt->state_names[s];
+		from = &ir->states[tt->state_ids[s]];
+		for (i = tt->row[s]; i < tt->row[s + 1]; i++) {
+			e = tt->cells[i].event;
+			cell = tt->cells[i].next;
+			event = tt->event_names[e];
+			if ((trans = mdict_new()) == NULL)
+				errx(1, "%s(%d): mdict_new",
+				    __func__, __LINE__);
+			if (mdict_insert_ss(trans, "state", state) == NULL ||
+			    mdict_insert_ss(trans, "event", event) == NULL)
+				errx(1, "%s(%d): mdict_insert_ss",
+				    __func__, __LINE__);
+			if (cell == CELL_IGNORE) {
+				if (marray_append(ignored, trans) == -1)
+					errx(1, "%s(%d): marray_append",
+					    __func__, __LINE__);
+				continue;
+			}
+			next = tt->state_names[cell];
+			ev = &ir->events[tt->event_ids[e]];
+			to = &ir->states[tt->state_ids[cell]];
+			if (mdict_insert_ss(trans, "next", next) == NULL ||
+			    marray_append(fused, trans) == -1)
+				errx(1, "%s(%d): set up transition failed",
+				    __func__, __LINE__);
+			copy_list(trans, "event_preconds", ir, &ev->preconds);
+			copy_list(trans, "exit_preconds", ir,
+			    &from->exit_preconds);
+			copy_list(trans, "entry_preconds", ir,
+			    &to->entry_preconds);
+			copy_list(trans, "event_callbacks", ir, &ev->callbacks);
+			copy_list(trans, "exit_callbacks", ir,
+			    &from->exit_callbacks);
+			copy_list(trans, "entry_callbacks", ir,
+			    &to->entry_callbacks);
+			event_fail |= ev->preconds.n != 0;
+			exit_fail |= from->exit_preconds.n != 0;
+			entry_fail |= to->entry_preconds.n != 0;
+		}
+	}
+
+	/* Only emit failure paths that some transition can reach */
+	if (mdict_insert_si(ns, "fused_event_precond_fail",
+	    event_fail) == NULL ||
+	    mdict_insert_si(ns, "fused_exit_precond_fail", exit_fail) == NULL ||
+	    mdict_insert_si(ns, "fused_entry_precond_fail", entry_fail) == NULL)
+		errx(1, "%s(%d): mdict_insert_si", __func__, __LINE__);
+}
+
+/*
+ * Build the transition matrix and render the tables derived from it into
+ * the namespace. The valid event masks are always generated. Unless mode
+ * is TABLE_NONE, the next-state table is also rendered, either as a dense
+ * array of "transtable_rows" or as a sparse comb vector in
+ * "transtable_base" and "transtable_cells". In TABLE_AUTO mode, the
+ * encoding that yields the smaller table is selected. TABLE_RUNTIME
+ * renders the libcfsm transition index and TABLE_FUSED the per-transition
+ * cases of the fused advance function instead.
+ */
+void
+setup_tables(struct mobject *ns, struct cfsm_ir *ir, int mode)
+{
+	struct transtable *tt;
+	size_t *base, len, nvalues, tsize, dense_size, sparse_size;
+	int *owner;
+
+	tt = transtable_build(ir);
+	set_number(ns, "num_states", tt->nstates);
+	set_number(ns, "num_events", tt->nevents);
+	render_event_masks(ns, tt);
+	render_storage(ns, tt);
+	render_fingerprint(ns, tt);
+	if (mode == TABLE_RUNTIME)
+		render_runtime(ns, tt);
+	else if (mode == TABLE_FUSED)
+		render_fused(ns, tt);
+	if (mode == TABLE_NONE || mode == TABLE_RUNTIME ||
+	    mode == TABLE_FUSED) {
+		transtable_free(tt);
+		return;
+	}
+
+	/* Leave room for the two sentinel values at the top of the type */
+	nvalues = tt->nstates + 2;
+	if (mdict_replace_ss(ns, "transtable_type",
+	    smallest_type(nvalues)) == NULL)
+		errx(1, "%s(%d): mdict_replace_ss", __func__, __LINE__);
+	tsize = type_size(nvalues);
+	if (nvalues <= 0xff)
+		nvalues = 0xff;
+	else if (nvalues <= 0xffff)
+		nvalues = 0xffff;
+	else
+		nvalues = 0xffffffff;
+	set_number(ns, "transtable_invalid", nvalues);
+	set_number(ns, "transtable_ignore", nvalues - 1);
+
+	if ((base = calloc(tt->nstates, sizeof(*base))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	owner = NULL;
+	len = 0;
+	if (mode != TABLE_DENSE) {
+		len = transtable_pack(tt, base, &owner);
+		if (mode == TABLE_AUTO) {
+			dense_size = tt->nstates * tt->nevents * tsize;
+			sparse_size = tt->nstates * type_size(len) +
+			    len * 2 * tsize;
+			if (sparse_size >= dense_size)
+				mode = TABLE_DENSE;
+		}
+	}
+	if (mode == TABLE_DENSE) {
+		render_dense(ns, tt);
+		render_vector_types(ns, tt);
+	} else {
+		render_sparse(ns, tt, base, owner, len);
+		if (mdict_replace_si(ns, "table_sparse", 1) == NULL)
+			errx(1, "%s(%d): mdict_replace_si", __func__, __LINE__);
+	}
+
+	free(base);
+	free(owner);
+	transtable_free(tt);
+}
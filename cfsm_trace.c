@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* $Id$ */
+
+/*
+ * Decoder for the trace dumps written by FSMs generated with -L. A dump
+ * is a header followed by fixed size records, in the byte order of the
+ * host that wrote it; see struct fsm_trace_header in header.m. Fields
+ * are read at fixed offsets rather than through a struct so that the
+ * layout does not depend on this compiler's padding.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <err.h>
+
+#include "mobject.h"
+
+#include "cfsm.h"
+#include "cfsm_ir.h"
+
+#define TRACE_MAGIC		"CFSMTRC1"
+#define TRACE_BYTE_ORDER	0x01020304
+#define TRACE_HEADER_LEN	48
+#define TRACE_RECORD_LEN	32	/* Minimum; later fields are ignored */
+
+static uint32_t
+get_u32(const u_char *p, int swap)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	if (swap) {
+		v = (v >> 24) | ((v >> 8) & 0xff00) |
+		    ((v << 8) & 0xff0000) | (v << 24);
+	}
+	return v;
+}
+
+static uint64_t
+get_u64(const u_char *p, int swap)
+{
+	uint64_t v;
+
+	if (swap) {
+		return ((uint64_t)get_u32(p, 1) << 32) |
+		    get_u32(p + 4, 1);
+	}
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* Decode the trace dump at "path" using the names from "ctx" */
+void
+decode_trace(struct cfsm_ctx *ctx, const char *path, FILE *out)
+{
+	struct cfsm_ir *ir = ctx->ir;
+	struct mobject *tmp;
+	u_char hdr[TRACE_HEADER_LEN], *rec;
+	const char *fingerprint;
+	uint32_t record_size, old_state, event, new_state;
+	uint64_t nrecords, dropped, i;
+	int swap;
+	FILE *f;
+
+	if ((f = fopen(path, "r")) == NULL)
+		err(1, "Could not open \"%s\" for reading", path);
+	if (fread(hdr, sizeof(hdr), 1, f) != 1)
+		errx(1, "%s: short trace header", path);
+	if (memcmp(hdr, TRACE_MAGIC, 8) != 0)
+		errx(1, "%s: not a cfsm trace dump", path);
+	if (get_u32(hdr + 8, 0) == TRACE_BYTE_ORDER)
+		swap = 0;
+	else if (get_u32(hdr + 8, 1) == TRACE_BYTE_ORDER)
+		swap = 1;
+	else
+		errx(1, "%s: unrecognised byte order", path);
+	record_size = get_u32(hdr + 12, swap);
+	if (record_size < TRACE_RECORD_LEN || record_size > 4096)
+		errx(1, "%s: bad record size %u", path, record_size);
+	if (get_u32(hdr + 16, swap) != ir->nstate_order ||
+	    get_u32(hdr + 20, swap) != ir->nevents) {
+		errx(1, "%s: trace has %u states and %u events but \"%s\" "
+		    "has %zu and %zu", path, get_u32(hdr + 16, swap),
+		    get_u32(hdr + 20, swap), ctx->in_path, ir->nstate_order,
+		    ir->nevents);
+	}
+	/* Same counts but different names or transitions */
+	if ((tmp = mdict_item_s(ctx->ns, "fingerprint")) == NULL ||
+	    (fingerprint = mstring_ptr(tmp)) == NULL)
+		errx(1, "%s(%d): namespace lacks fingerprint",
+		    __func__, __LINE__);
+	if (get_u64(hdr + 40, swap) != strtoull(fingerprint, NULL, 16))
+		errx(1, "%s: trace was not made by the FSM in \"%s\"",
+		    path, ctx->in_path);
+	nrecords = get_u64(hdr + 24, swap);
+	dropped = get_u64(hdr + 32, swap);
+
+	if ((rec = malloc(record_size)) == NULL)
+		errx(1, "%s(%d): malloc", __func__, __LINE__);
+	fprintf(out, "# records %llu dropped %llu\n",
+	    (unsigned long long)nrecords, (unsigned long long)dropped);
+	for (i = 0; i < nrecords; i++) {
+		if (fread(rec, record_size, 1, f) != 1)
+			errx(1, "%s: short record %llu", path,
+			    (unsigned long long)i);
+		old_state = get_u32(rec + 16, swap);
+		event = get_u32(rec + 20, swap);
+		new_state = get_u32(rec + 24, swap);
+		if (old_state >= ir->nstate_order || event >= ir->nevents ||
+		    new_state >= ir->nstate_order)
+			errx(1, "%s: bad record %llu", path,
+			    (unsigned long long)i);
+		fprintf(out, "%llu 0x%llx %s %s %s\n",
+		    (unsigned long long)get_u64(rec + 8, swap),
+		    (unsigned long long)get_u64(rec, swap),
+		    IR_STATE_NAME(ir, ir->state_order[old_state]),
+		    IR_EVENT_NAME(ir, ir->event_order[event]),
+		    IR_STATE_NAME(ir, ir->state_order[new_state]));
+	}
+	free(rec);
+	fclose(f);
+}
@@ -0,0 +1,352 @@
+{{if source_banner}}{{source_banner}}
+{{endif}}/*
+ * Automatically generated using the cfsm FSM compiler:
+ * http://www.mindrot.org/projects/cfsm/
+ */
+
+#ifndef {{header_guard}}
+#define {{header_guard}}
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Possible error return values
+ */
+#ifndef CFSM_OK
+# define CFSM_OK			0
+# define CFSM_ERR_INVALID_STATE		-1
+# define CFSM_ERR_INVALID_EVENT		-2
+# define CFSM_ERR_INVALID_TRANSITION	-3
+# define CFSM_ERR_PRECONDITION		-4
+#endif /* CFSM_OK */
+
+/*
+ * The valid states of the FSM
+ */
+enum class {{state_enum}} : std::{{state_storage_type}} {
+{{for state in states_ordered}}	{{state.value}},
+{{endfor}}{{if state_aliases}}	/* States merged into equivalent states */
+{{for alias in state_aliases}}	{{alias.value.name}} = {{alias.value.target}},
+{{endfor}}{{endif}}};
+
+/*
+ * Events that may cause state transitions in the FSM
+ */
+enum class {{event_enum}} : std::{{event_storage_type}} {
+{{for event in events_ordered}}	{{event.value}},
+{{endfor}}};
+
+/* Tables and helpers for the class below, all evaluated at compile time */
+namespace {{fsm_struct}}_detail {
+
+inline constexpr std::size_t num_states = {{num_states}};
+inline constexpr std::size_t num_events = {{num_events}};
+
+/* Next-state values in the transition table */
+enum : std::{{transtable_type}} {
+{{for state in states_ordered}}	{{state.value}},
+{{endfor}}	_CFSM_TT_IGNORE = {{transtable_ignore}},
+	_CFSM_TT_INVALID = {{transtable_invalid}}
+};
+
+/*
+ * Transition table, indexed by current state and event. Each cell holds
+ * the next state or one of the special values above.
+ */
+inline constexpr std::array<std::array<std::{{transtable_type}}, num_events>,
+    num_states> transtable = { {
+{{for row in transtable_rows}}	/* {{row.value.state}} */
+	{ { {{for cell in row.value.cells}}{{cell.value}}, {{endfor}}} },
+{{endfor}}} };
+
+/* State names, indexed by state */
+inline constexpr std::array<const char *, num_states> state_names = { {
+{{for state in states_ordered}}	"{{state.value}}",
+{{endfor}}} };
+
+/* Event names, indexed by event */
+inline constexpr std::array<const char *, num_events> event_names = { {
+{{for event in events_ordered}}	"{{event.value}}",
+{{endfor}}} };
+
+constexpr std::{{transtable_type}}
+lookup({{state_enum}} s, {{event_enum}} ev)
+{
+	return transtable[static_cast<std::size_t>(s)]
+	    [static_cast<std::size_t>(ev)];
+}
+
+/* Returns true if some state has "cell" as its next state for "ev" */
+constexpr bool
+any_state({{event_enum}} ev, std::{{transtable_type}} cell)
+{
+	for (std::size_t s = 0; s < num_states; s++) {
+		if (transtable[s][static_cast<std::size_t>(ev)] == cell)
+			return true;
+	}
+	return false;
+}
+
+/* Returns true if event "ev" is not invalid in at least one state */
+constexpr bool
+accepted_anywhere({{event_enum}} ev)
+{
+	for (std::size_t s = 0; s < num_states; s++) {
+		if (transtable[s][static_cast<std::size_t>(ev)] !=
+		    _CFSM_TT_INVALID)
+			return true;
+	}
+	return false;
+}
+
+} /* namespace {{fsm_struct}}_detail */
+
+/*
+ * Convert from the {{state_enum}} enumeration to a string. Will return
+ * nullptr if the state is not known.
+ */
+constexpr const char *
+to_string({{state_enum}} n)
+{
+	return static_cast<std::size_t>(n) < {{fsm_struct}}_detail::num_states ?
+	    {{fsm_struct}}_detail::state_names[static_cast<std::size_t>(n)] :
+	    nullptr;
+}
+
+/*
+ * Convert from the {{event_enum}} enumeration to a string. Will return
+ * nullptr if the event is not known.
+ */
+constexpr const char *
+to_string({{event_enum}} n)
+{
+	return static_cast<std::size_t>(n) < {{fsm_struct}}_detail::num_events ?
+	    {{fsm_struct}}_detail::event_names[static_cast<std::size_t>(n)] :
+	    nullptr;
+}
+
+/* Callbacks for FSMs that have no preconditions or callbacks */
+struct {{fsm_struct}}_no_callbacks {
+};
+
+/*
+ * The FSM object itself. Preconditions and callbacks are the members of
+ * "Callbacks" with the names given in the FSM definition, called on the
+ * copy held by the FSM, so that they may be inlined into advance(). Any
+ * state they need lives in the Callbacks object rather than behind a
+ * context pointer. As in the C output, preconditions return 0 if they
+ * are satisfied.
+ *
+ * Everything is constexpr, so an FSM whose callbacks are constexpr too
+ * may be run at compile time.
+ */
+template <typename Callbacks = {{fsm_struct}}_no_callbacks>
+class {{fsm_struct}} {
+public:
+	static constexpr std::size_t num_states = {{fsm_struct}}_detail::num_states;
+	static constexpr std::size_t num_events = {{fsm_struct}}_detail::num_events;
+
+	/* Create a FSM in starting state {{initial_states[0]}} */
+	constexpr explicit
+	{{fsm_struct}}(const Callbacks &cb = Callbacks())
+	    : state_({{state_enum}}::{{initial_states[0]}}), cb_(cb)
+	{
+	}
+{{if multiple_start_states}}
+	/*
+	 * Set the FSM's state to "initial_state", which must be one of its
+	 * starting states. Will return CFSM_OK on success or
+	 * CFSM_ERR_INVALID_STATE if it is not.
+	 */
+	constexpr int
+	reset({{state_enum}} initial_state)
+	{
+		switch (initial_state) {
+{{for s in initial_states}}		case {{state_enum}}::{{s.value}}:
+{{endfor}}			break;
+		default:
+			return CFSM_ERR_INVALID_STATE;
+		}
+		state_ = initial_state;
+		return CFSM_OK;
+	}
+{{else}}
+	/* Return the FSM to its starting state, {{initial_states[0]}} */
+	constexpr void
+	reset()
+	{
+		state_ = {{state_enum}}::{{initial_states[0]}};
+	}
+{{endif}}
+	/*
+	 * Returns the current state of the FSM.
+	 */
+	constexpr {{state_enum}}
+	current_state() const
+	{
+		return state_;
+	}
+
+	/*
+	 * Returns the callbacks object held by the FSM.
+	 */
+	constexpr Callbacks &
+	callbacks()
+	{
+		return cb_;
+	}
+
+	constexpr const Callbacks &
+	callbacks() const
+	{
+		return cb_;
+	}
+
+	/*
+	 * Returns true if event "ev" would be accepted or ignored by the FSM
+	 * in its current state, or false if it would be rejected as an
+	 * invalid transition. Preconditions are not evaluated, so advance()
+	 * may still fail with CFSM_ERR_PRECONDITION for an event that this
+	 * function allows.
+	 */
+	constexpr bool
+	can_advance({{event_enum}} ev) const
+	{
+		if (static_cast<std::size_t>(ev) >= num_events)
+			return false;
+		return {{fsm_struct}}_detail::lookup(state_, ev) !=
+		    {{fsm_struct}}_detail::_CFSM_TT_INVALID;
+	}
+
+	/*
+	 * Execute event "Ev", which is known at compile time, on the FSM.
+	 * Naming an event that no state accepts fails to compile, and the
+	 * test for an invalid transition or an ignored event is only made
+	 * if the event is invalid or ignored in some state.
+	 * Will return CFSM_OK on success or one of the CFSM_ERR_* codes on
+	 * failure.
+	 */
+	template <{{event_enum}} Ev>
+	constexpr int
+	advance()
+	{
+		static_assert(static_cast<std::size_t>(Ev) < num_events,
+		    "Unknown {{event_enum}}");
+		static_assert({{fsm_struct}}_detail::accepted_anywhere(Ev),
+		    "{{event_enum}} is not accepted in any state");
+		const std::{{transtable_type}} next =
+		    {{fsm_struct}}_detail::lookup(state_, Ev);
+
+		if constexpr ({{fsm_struct}}_detail::any_state(Ev,
+		    {{fsm_struct}}_detail::_CFSM_TT_INVALID)) {
+			if (next == {{fsm_struct}}_detail::_CFSM_TT_INVALID)
+				return CFSM_ERR_INVALID_TRANSITION;
+		}
+		if constexpr ({{fsm_struct}}_detail::any_state(Ev,
+		    {{fsm_struct}}_detail::_CFSM_TT_IGNORE)) {
+			if (next == {{fsm_struct}}_detail::_CFSM_TT_IGNORE)
+				return CFSM_OK;
+		}
+		return transition(Ev, state_, static_cast<{{state_enum}}>(next));
+	}
+
+	/*
+	 * Execute event "ev", which need not be known until run time, on the
+	 * FSM. Will return CFSM_OK on success or one of the CFSM_ERR_* codes
+	 * on failure.
+	 */
+	constexpr int
+	advance({{event_enum}} ev)
+	{
+		std::{{transtable_type}} next;
+
+		if (static_cast<std::size_t>(ev) >= num_events)
+			return CFSM_ERR_INVALID_EVENT;
+		next = {{fsm_struct}}_detail::lookup(state_, ev);
+		if (next == {{fsm_struct}}_detail::_CFSM_TT_INVALID)
+			return CFSM_ERR_INVALID_TRANSITION;
+		if (next == {{fsm_struct}}_detail::_CFSM_TT_IGNORE)
+			return CFSM_OK;
+		return transition(ev, state_, static_cast<{{state_enum}}>(next));
+	}
+
+private:
+	{{state_enum}} state_;
+	Callbacks cb_;
+
+	/*
+	 * Perform a valid transition from "old_state" to "new_state" caused
+	 * by event "ev": check preconditions, run callbacks and switch state.
+	 */
+	constexpr int
+	transition([[maybe_unused]] {{event_enum}} ev,
+	    [[maybe_unused]] {{state_enum}} old_state,
+	    [[maybe_unused]] {{state_enum}} new_state)
+	{
+{{if event_preconds}}
+		/* Event preconditions */
+		switch (ev) {
+{{for event in events}}{{if event.value.preconds}}		case {{event_enum}}::{{event.key}}:
+{{for precond in event.value.preconds}}			if (cb_.{{precond.key}}({{event_precond_args_cxx}}) != 0)
+				return CFSM_ERR_PRECONDITION;
+{{endfor}}			break;
+{{endif}}{{endfor}}		default:
+			break;
+		}
+{{endif}}{{if transition_exit_preconds}}
+		/* Current state exit preconditions */
+		switch (old_state) {
+{{for state in states}}{{if state.value.exit_preconds}}		case {{state_enum}}::{{state.key}}:
+{{for precond in state.value.exit_preconds}}			if (cb_.{{precond.key}}({{trans_precond_args_cxx}}) != 0)
+				return CFSM_ERR_PRECONDITION;
+{{endfor}}			break;
+{{endif}}{{endfor}}		default:
+			break;
+		}
+{{endif}}{{if transition_entry_preconds}}
+		/* Next state entry preconditions */
+		switch (new_state) {
+{{for state in states}}{{if state.value.entry_preconds}}		case {{state_enum}}::{{state.key}}:
+{{for precond in state.value.entry_preconds}}			if (cb_.{{precond.key}}({{trans_precond_args_cxx}}) != 0)
+				return CFSM_ERR_PRECONDITION;
+{{endfor}}			break;
+{{endif}}{{endfor}}		default:
+			break;
+		}
+{{endif}}{{if event_callbacks}}
+		/* Event callbacks */
+		switch (ev) {
+{{for event in events}}{{if event.value.callbacks}}		case {{event_enum}}::{{event.key}}:
+{{for cb in event.value.callbacks}}			cb_.{{cb.key}}({{event_cb_args_cxx}});
+{{endfor}}			break;
+{{endif}}{{endfor}}		default:
+			break;
+		}
+{{endif}}{{if transition_exit_callbacks}}
+		/* Current state exit callbacks */
+		switch (old_state) {
+{{for state in states}}{{if state.value.exit_callbacks}}		case {{state_enum}}::{{state.key}}:
+{{for cb in state.value.exit_callbacks}}			cb_.{{cb.key}}({{trans_cb_args_cxx}});
+{{endfor}}			break;
+{{endif}}{{endfor}}		default:
+			break;
+		}
+{{endif}}
+		/* Switch state now */
+		state_ = new_state;
+{{if transition_entry_callbacks}}
+		/* New state entry callbacks */
+		switch (new_state) {
+{{for state in states}}{{if state.value.entry_callbacks}}		case {{state_enum}}::{{state.key}}:
+{{for cb in state.value.entry_callbacks}}			cb_.{{cb.key}}({{trans_cb_args_cxx}});
+{{endfor}}			break;
+{{endif}}{{endfor}}		default:
+			break;
+		}
+{{endif}}		return CFSM_OK;
+	}
+};
+
+#endif /* {{header_guard}} */
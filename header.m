@@ -8,30 +8,114 @@
 #define {{header_guard}}
 
 #include <sys/types.h>
-
+#include <stdint.h>
+{{if instrumented}}#include <stdio.h>
+{{endif}}{{if runtime_mode}}
+#include <libcfsm.h>
+{{endif}}
 /*
  * The valid states of the FSM
  */
 enum {{state_enum}} {
-{{for state in states}}	{{state.key}},
-{{endfor}}};
+{{for state in states_ordered}}	{{state.value}},
+{{endfor}}{{if state_aliases}}	/* States merged into equivalent states */
+{{for alias in state_aliases}}	{{alias.value.name}} = {{alias.value.target}},
+{{endfor}}{{endif}}};
 
 /*
  * Events that may cause state transitions in the FSM
  */
 enum {{event_enum}} {
-{{for event in events}}	{{event.key}},
+{{for event in events_ordered}}	{{event.value}},
 {{endfor}}};
 
 /*
  * The FSM object itself.
  */
-struct {{fsm_struct}}_transtable;
-struct {{fsm_struct}} {
+{{if runtime_mode}}struct {{fsm_struct}} {
+	int current_state;		/* enum {{state_enum}}, shared with libcfsm */
+{{if event_queue}}	/* Events posted by {{fsm_struct}}_post(), awaiting execution */
+	struct {
+		enum {{event_enum}} events[{{event_queue}}];
+		uint16_t head;
+		uint16_t count;
+	} queue;
+{{endif}}{{if mailbox}}	/*
+	 * Events sent by {{fsm_struct}}_send(), awaiting {{fsm_struct}}_drain().
+	 * The producers' and the consumer's positions are kept apart.
+	 */
+	struct {
+		uint32_t tail;
+		struct {
+			uint32_t seq;
+			enum {{event_enum}} ev;
+		} slots[{{mailbox}}];
+		uint32_t head;
+	} mailbox;
+{{endif}}{{if error_records}}	/* The most recent failure, formatted by {{strerror_func}}() */
+	struct cfsm_error last_error;
+{{endif}}};
+{{else}}{{if compact_storage}}struct {{fsm_struct}} {
+	{{state_storage_type}} current_state;	/* enum {{state_enum}} */
+{{if error_records}}	/*
+	 * The most recent failure, formatted by {{strerror_func}}(). States
+	 * and events outside the storage types are recorded truncated.
+	 */
+	struct {
+		{{event_storage_type}} event;		/* enum {{event_enum}} */
+		{{state_storage_type}} old_state;	/* enum {{state_enum}} */
+		{{state_storage_type}} new_state;	/* enum {{state_enum}} */
+		uint8_t reason;
+	} last_error;
+{{endif}}};
+
+/*
+ * Compact instances hold only fixed-width integers, so cfsm knows their
+ * size. Compilation fails here if the compiler lays them out otherwise.
+ */
+#define {{instance_size_define}}	{{instance_size}}
+typedef char _{{fsm_struct}}_instance_size_check[
+    sizeof(struct {{fsm_struct}}) == {{instance_size_define}} ? 1 : -1];
+{{else}}struct {{fsm_struct}}_transtable;
+{{if timeouts}}struct {{fsm_struct}}_timers;
+{{endif}}struct {{fsm_struct}} {
 	enum {{state_enum}} current_state;
 	const struct {{fsm_struct}}_transtable *transition_table;
-};
-
+{{if stats_mode}}	uint64_t state_entered;		/* Clock ticks, for the statistics */
+{{endif}}{{if event_queue}}	/* Events posted by {{fsm_struct}}_post(), awaiting execution */
+	struct {
+		enum {{event_enum}} events[{{event_queue}}];
+		uint16_t head;
+		uint16_t count;
+	} queue;
+{{endif}}{{if mailbox}}	/*
+	 * Events sent by {{fsm_struct}}_send(), awaiting {{fsm_struct}}_drain().
+	 * The producers' and the consumer's positions are kept apart.
+	 */
+	struct {
+		uint32_t tail;
+		struct {
+			uint32_t seq;
+			enum {{event_enum}} ev;
+		} slots[{{mailbox}}];
+		uint32_t head;
+	} mailbox;
+{{endif}}{{if timeouts}}	/* The timer for the current state's timeout, if attached to a wheel */
+	struct {
+		struct {{fsm_struct}}_timers *wheel;
+		struct {{fsm_struct}} *next, **pprev;
+		uint64_t expires;
+{{if need_ctx}}		void *ctx;
+{{endif}}	} timer;
+{{endif}}{{if error_records}}	/* The most recent failure, formatted by {{strerror_func}}() */
+	struct {
+		enum {{state_enum}} old_state;
+		enum {{event_enum}} event;
+		enum {{state_enum}} new_state;
+		int reason;
+	} last_error;
+{{endif}}};
+{{endif}}{{endif}}
 /*
  * Possible error return values
  */
@@ -42,23 +126,45 @@ struct {{fsm_struct}} {
 # define CFSM_ERR_INVALID_TRANSITION	-3
 # define CFSM_ERR_PRECONDITION		-4
 #endif /* CFSM_OK */
-
+#ifndef CFSM_ERR_QUEUE_FULL
+# define CFSM_ERR_QUEUE_FULL		-5
+#endif /* CFSM_ERR_QUEUE_FULL */
+{{if error_records}}
+/*
+ * Reasons for a failure, as recorded in last_error.reason
+ */
+#ifndef CFSM_REASON_NONE
+# define CFSM_REASON_NONE		0
+# define CFSM_REASON_INVALID_START	1
+# define CFSM_REASON_INVALID_STATE	2
+# define CFSM_REASON_INVALID_EVENT	3
+# define CFSM_REASON_INVALID_TRANSITION	4
+# define CFSM_REASON_EVENT_PRECOND	5
+# define CFSM_REASON_EXIT_PRECOND	6
+# define CFSM_REASON_ENTRY_PRECOND	7
+#endif /* CFSM_REASON_NONE */
+{{endif}}
 {{if multiple_start_states}}/*
  * Initialise a FSM and set its starting state to "initial_state".
  * Will return 0 on success or a CFSM_ERR_* code on failure. 
- * If "errbuf" is not NULL, upto "errlen" bytes of error message
+{{if error_records}} * Failures are recorded in the FSM for {{strerror_func}}().
+ */
+int {{init_func}}(struct {{fsm_struct}} *fsm, enum {{state_enum}} initial_state);
+{{else}} * If "errbuf" is not NULL, upto "errlen" bytes of error message
  * will be copied into "errbuf" on failure.
  */
 int {{init_func}}(struct {{fsm_struct}} *fsm, enum {{state_enum}} initial_state,
     char *errbuf, size_t errlen);
-{{else}}/*
+{{endif}}{{else}}/*
  * Initialise a FSM and set its starting state to {{initial_states[0]}}
  * Will return 0 on success or a CFSM_ERR_* code on failure. 
- * If "errbuf" is not NULL, upto "errlen" bytes of error message
+{{if error_records}} */
+int {{init_func}}(struct {{fsm_struct}} *fsm);
+{{else}} * If "errbuf" is not NULL, upto "errlen" bytes of error message
  * will be copied into "errbuf" on failure.
  */
 int {{init_func}}(struct {{fsm_struct}} *fsm, char *errbuf, size_t errlen);
-{{endif}}
+{{endif}}{{endif}}
 
 /*
  * Execute a pre-defined event on the FSM that may trigger a transition.
@@ -67,12 +173,256 @@ int {{init_func}}(struct {{fsm_struct}} *fsm, char *errbuf, size_t errlen);
  * callback functions.
  *{{endif}}
  * Will return CFSM_OK on success or one of the CFSM_ERR_* codes on failure.
- * If "errbuf" is not NULL, upto "errlen" bytes of error message will be 
+{{if error_records}} * The details of a failure are recorded in the FSM and may be formatted
+ * later using {{strerror_func}}().
+ */
+int {{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev{{if need_ctx}},
+    void *ctx{{endif}});
+
+/*
+ * Format the most recent failure recorded in the FSM into "buf", which
+ * is "len" bytes long. Returns "buf".
+ */
+char *{{strerror_func}}(struct {{fsm_struct}} *fsm, char *buf, size_t len);
+{{else}} * If "errbuf" is not NULL, upto "errlen" bytes of error message will be 
  * copied into "errbuf" on failure.
  */
 int {{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
     {{if need_ctx}}void *ctx, {{endif}}char *errbuf, size_t errlen);
+{{endif}}{{if event_queue}}
+/*
+ * Queue event "ev" to be executed once the event being executed now has
+ * completed. Callbacks should use this rather than call {{advance_func}}()
+ * recursively. {{advance_func}}() and the batch and run functions execute
+ * queued events, in the order they were posted and including any posted
+ * in turn, before returning. If one fails, the events still queued are
+ * discarded and its failure is returned as if it were the caller's;
+ * {{advance_func}}_run() counts the event that posted it as consumed.
+ * Events posted outside a callback wait for the next advance. Returns
+ * CFSM_OK or CFSM_ERR_QUEUE_FULL if {{event_queue}} events are already queued.
+ */
+int {{fsm_struct}}_post(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev);
+{{endif}}
+/*
+ * Execute a batch of "n" events, applying evs[i] to the FSM fsms[i].
+{{if need_ctx}} * If "ctxs" is not NULL, ctxs[i] is passed as the context pointer for
+ * the i-th event, otherwise a NULL context is used.
+{{endif}} * The events are applied in array order, so an FSM may appear more than
+ * once in a batch. If "results" is not NULL, the CFSM_OK or CFSM_ERR_*
+ * return code for each event is stored in results[i]; no error messages
+ * are generated.{{if error_records}} Failures are still recorded in the FSM.{{endif}} Returns the number of
+ * events that failed.
+ */
+size_t {{advance_func}}_batch(struct {{fsm_struct}} **fsms,
+    const enum {{event_enum}} *evs, {{if need_ctx}}void **ctxs, {{endif}}int *results, size_t n);
+
+/*
+ * Execute a sequence of "n" events on a single FSM, stopping at the
+ * first failure.{{if need_ctx}} The "ctx" argument is passed to callbacks as for
+ * {{advance_func}}().{{endif}} Will return CFSM_OK if every event was accepted or
+ * the CFSM_ERR_* code of the first failure. If "consumed" is not NULL,
+ * it will be set to the number of events applied, which on failure is
+ * the index of the failing event. {{if error_records}}The failure is recorded in the FSM
+ * as for {{advance_func}}().{{else}}No error messages are generated; a
+ * failed event may be replayed through {{advance_func}}() to obtain one.{{endif}}
+ */
+int {{advance_func}}_run(struct {{fsm_struct}} *fsm, const enum {{event_enum}} *evs,
+    size_t n, {{if need_ctx}}void *ctx, {{endif}}size_t *consumed);
+{{if timeouts}}
+/*
+ * Timers for state timeouts are kept on a hierarchical timing wheel of
+ * CFSM_TIMER_LEVELS levels, each of CFSM_TIMER_SLOTS slots. A timer is
+ * armed or disarmed in constant time as a FSM enters or leaves a state
+ * with a timeout, and is cascaded to a finer level at most once per
+ * level before it expires. Times are in milliseconds from whatever
+ * epoch the caller chooses. A wheel and the FSMs attached to it may be
+ * used by only one thread at a time, even through {{advance_func}}_atomic().
+ */
+#ifndef CFSM_TIMER_LEVELS
+# define CFSM_TIMER_BITS		6	/* At most 6 */
+# define CFSM_TIMER_SLOTS		(1 << CFSM_TIMER_BITS)
+# define CFSM_TIMER_LEVELS		6
+#endif /* CFSM_TIMER_LEVELS */
+struct {{fsm_struct}}_timers {
+	uint64_t now;		/* Time the wheel has been advanced to */
+	size_t count;		/* Timers armed */
+	uint64_t occupied[CFSM_TIMER_LEVELS];	/* Slots that may hold timers */
+	struct {{fsm_struct}} *slots[CFSM_TIMER_LEVELS][CFSM_TIMER_SLOTS];
+};
+
+/*
+ * Initialise a timing wheel with the current time "now".
+ */
+void {{fsm_struct}}_timers_init(struct {{fsm_struct}}_timers *timers, uint64_t now);
+
+/*
+ * Attach a FSM to a timing wheel, arming a timer if its current state has
+ * a timeout. From then on, timers are armed and disarmed automatically
+ * as the FSM changes state, with each timeout counted from the wheel's
+ * time when the state was entered; a transition from a state to itself
+ * restarts its timer.{{if need_ctx}} "ctx" is the context pointer passed when a
+ * timeout is executed.{{endif}} A FSM must be detached before it is
+ * initialised again or freed.
+ */
+void {{fsm_struct}}_timers_attach(struct {{fsm_struct}} *fsm,
+    struct {{fsm_struct}}_timers *timers{{if need_ctx}}, void *ctx{{endif}});
+
+/*
+ * Detach a FSM from its timing wheel, disarming any timer.
+ */
+void {{fsm_struct}}_timers_detach(struct {{fsm_struct}} *fsm);
+
+/*
+ * Advance a timing wheel to time "now" and execute {{timeout_event}} on
+ * each FSM whose timeout has expired, through {{advance_func}}(). Expired
+ * timers are all collected before any event is executed, so callbacks may
+ * attach, detach and advance FSMs on the wheel. A FSM that refuses the
+ * event is left without a timer. Returns the number of timeout events
+ * executed.
+ */
+size_t {{fsm_struct}}_timers_advance(struct {{fsm_struct}}_timers *timers,
+    uint64_t now);
+{{endif}}{{if snapshot}}
+/*
+ * A snapshot of a population of FSMs is this header followed by one
+ * record of "record_size" bytes for each instance: {{if compact_storage}}the instance itself{{else}}its current state
+ * as a {{state_storage_type}}{{endif}}. It is in the byte order of the host that wrote it.
+ * The fingerprint is a hash of the FSM's states, events and transitions,
+ * so a snapshot is only accepted by code generated from an equivalent
+ * definition.
+ */
+#define {{fingerprint_define}}	{{fingerprint}}
+#ifndef CFSM_SNAPSHOT_MAGIC
+# define CFSM_SNAPSHOT_MAGIC		"CFSMSNP1"
+# define CFSM_SNAPSHOT_BYTE_ORDER	0x01020304
+#endif /* CFSM_SNAPSHOT_MAGIC */
+#ifndef CFSM_ERR_SNAPSHOT
+# define CFSM_ERR_SNAPSHOT		-6
+#endif /* CFSM_ERR_SNAPSHOT */
+struct {{fsm_struct}}_snapshot_header {
+	char magic[8];			/* CFSM_SNAPSHOT_MAGIC */
+	uint32_t byte_order;		/* CFSM_SNAPSHOT_BYTE_ORDER */
+	uint32_t record_size;
+	uint64_t fingerprint;		/* {{fingerprint_define}} */
+	uint64_t ninstances;
+};
+
+/*
+ * Returns the size in bytes of a snapshot of "n" instances, or 0 if it
+ * would not fit in a size_t.
+ */
+size_t {{fsm_struct}}_snapshot_size(size_t n);
+
+/*
+ * Write a snapshot of the "n" instances in "fsms" to "buf", which is
+ * "len" bytes long and aligned as malloc(3) or mmap(2) would align it.
+ * Only each instance's current state is saved{{if event_queue}}, not its queued events{{endif}}{{if mailbox}}, not its mailbox{{endif}}.
+ * Returns CFSM_OK, or CFSM_ERR_SNAPSHOT if "len" is less than
+ * {{fsm_struct}}_snapshot_size(n).
+ */
+int {{fsm_struct}}_snapshot(const struct {{fsm_struct}} *fsms, size_t n, void *buf,
+    size_t len);
+
+/*
+ * Check that the "len" bytes at "buf" hold a snapshot of this FSM written
+ * on a host of the same byte order, reading only its header. If "n" is
+ * not NULL, it is set to the number of instances in the snapshot. Returns
+ * CFSM_OK or CFSM_ERR_SNAPSHOT.
+ */
+int {{fsm_struct}}_snapshot_check(const void *buf, size_t len, size_t *n);
+{{if compact_storage}}
+/*
+ * Restore the snapshot of "len" bytes at "buf", which may be mapped from
+ * a file with mmap(2), without copying it: the instances are used where
+ * they lie in "buf" and may be advanced as soon as the header has been
+ * checked by {{fsm_struct}}_snapshot_check(). Returns the array of instances and
+ * sets "n" to their number, or returns NULL if the snapshot is not one
+ * of this FSM.
+ */
+struct {{fsm_struct}} *{{fsm_struct}}_restore(void *buf, size_t len, size_t *n);
+{{else}}
+/*
+ * Restore the states of the "n" instances in "fsms", which must already
+ * have been initialised, from the snapshot of "len" bytes at "buf".{{if timeouts}}
+ * The timers of instances attached to a timing wheel start again.{{endif}}
+ * Returns CFSM_OK, or CFSM_ERR_SNAPSHOT without changing any instance if
+ * the snapshot is not one of "n" instances of this FSM.
+ */
+int {{fsm_struct}}_restore(struct {{fsm_struct}} *fsms, size_t n, const void *buf,
+    size_t len);
+{{endif}}{{endif}}
+#if defined(__GNUC__)
+/*
+ * Execute an event on a FSM that other threads may be advancing at the
+ * same time, without locking. It returns as {{advance_func}}() does, but
+ * its preconditions and callbacks run differently:
+ *
+ *  - Preconditions are checked against the state as loaded, before the
+ *    transition is committed. If another thread commits first, the
+ *    transition is looked up and checked again from the state that
+ *    thread left, so preconditions may run more than once for one event
+ *    and must not have side effects.
+ *  - The new state is committed with a single compare-and-swap. Callbacks
+ *    run afterwards, only in the thread that committed the transition and
+ *    exactly once for it, in the usual order: event, exit and then entry.
+ *    Other threads may already have moved the FSM on by the time they
+ *    run, and a callback may itself advance the FSM.
+ *
+{{if error_records}} * Failures are not recorded in the FSM, as the record cannot be shared
+ * between threads; only the return code reports them.
+ *
+{{endif}} * All threads advancing the FSM concurrently must use this function;
+ * the others may be used once they have finished.{{if event_queue}} Its callbacks may not
+ * use {{fsm_struct}}_post(), as the queue is not shared safely.{{endif}}
+ */
+int {{advance_func}}_atomic(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev{{if need_ctx}},
+    void *ctx{{endif}}{{if error_records}}{{else}}, char *errbuf, size_t errlen{{endif}});
+{{if mailbox}}
+/*
+ * Send event "ev" to the FSM's mailbox. Any number of threads may send
+ * at once, and none ever waits for another or for the FSM: if the
+ * {{mailbox}} slots are all full then CFSM_ERR_QUEUE_FULL is returned
+ * at once and the event is not sent. Returns CFSM_OK otherwise.
+ */
+int {{fsm_struct}}_send(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev);
 
+/*
+ * Execute up to "max" events from the mailbox, in the order they were
+ * sent, through {{advance_func}}(){{if need_ctx}} with "ctx"{{endif}}. Only one thread may drain
+ * a FSM at a time and it must be the only one advancing it. A failed
+ * event does not stop the drain{{if error_records}}; the last failure is recorded in the FSM{{endif}}.
+ * If "results" is not NULL, it must have room for "max" entries and the
+ * CFSM_OK or CFSM_ERR_* return code of the i-th event executed is stored
+ * in results[i].
+ * Returns the number of events executed, whether accepted or not.
+ */
+size_t {{fsm_struct}}_drain(struct {{fsm_struct}} *fsm{{if need_ctx}}, void *ctx{{endif}}, int *results,
+    size_t max);
+{{endif}}#endif /* __GNUC__ */
+{{if vector_mode}}
+/*
+ * Storage types for structure-of-arrays FSM populations, where the
+ * current states of many FSMs are kept in one contiguous array rather
+ * than one struct {{fsm_struct}} each.
+ */
+typedef {{transtable_type}} {{fsm_struct}}_state_t;
+typedef {{vector_event_type}} {{fsm_struct}}_event_t;
+
+/*
+ * Apply evs[i] to the FSM whose current state is stored in states[i], for
+ * each of "n" elements. States that accept their event are advanced in
+ * place and ignored events leave the state unchanged. Elements with an
+ * invalid state or event, or whose event is not accepted in their state,
+ * are left unchanged and counted as failures; if "failed" is not NULL,
+ * failed[i] is set to 1 for these elements and 0 for the rest. Returns
+ * the number of failures.
+ *
+ * When compiled with AVX2 enabled (e.g. -mavx2), eight elements at a time
+ * are looked up in the transition table using vector gathers.
+ */
+size_t {{advance_func}}_vector({{fsm_struct}}_state_t *states,
+    const {{fsm_struct}}_event_t *evs, uint8_t *failed, size_t n);
+{{endif}}
 /*
  * Convert from the %(event_enum)s enumeration to a string. Will return
  * NULL if the event is not known.
@@ -86,6 +436,13 @@ const char *{{event_ntop_func}}(enum {{event_enum}});
  */
 const char *{{event_ntop_func}}_safe(enum {{event_enum}});
 
+/*
+ * Convert an event name to the {{event_enum}} enumeration, storing it in
+ * "ev" if it is not NULL. Will return 0 on success or -1 if the name is
+ * not a known event.
+ */
+int {{event_pton_func}}(const char *name, enum {{event_enum}} *ev);
+
 /*
  * Convert from the {{state_enum}} enumeration to a string. Will return
  * NULL if the state is not known.
@@ -99,9 +456,147 @@ const char *{{state_ntop_func}}(enum {{state_enum}} n);
  */
 const char *{{state_ntop_func}}_safe(enum {{state_enum}} n);
 
+/*
+ * Convert a state name to the {{state_enum}} enumeration, storing it in
+ * "state" if it is not NULL. Will return 0 on success or -1 if the name
+ * is not a known state.
+ */
+int {{state_pton_func}}(const char *name, enum {{state_enum}} *state);
+
 /*
  * Returns the current state of the FSM.
  */
 enum {{state_enum}} {{current_state_func}}(struct {{fsm_struct}} *fsm);
 
+/*
+ * Number of 32-bit words in the event masks returned by
+ * {{valid_events_func}}().
+ */
+#define {{event_mask_words_define}}	{{event_mask_words}}
+
+/*
+ * Returns a bit vector of the events that are accepted or ignored in the
+ * specified state, or NULL if the state is not known. Event "ev" is valid
+ * if bit (ev % 32) of word (ev / 32) is set, so a dispatcher may filter
+ * events with "mask[ev / 32] & (1U << (ev % 32))" rather than making a
+ * failing call to {{advance_func}}().
+ */
+const uint32_t *{{valid_events_func}}(enum {{state_enum}} state);
+
+/*
+ * Returns 1 if event "ev" would be accepted or ignored by the FSM in its
+ * current state, or 0 if it would be rejected as an invalid transition.
+ * Preconditions are not evaluated, so {{advance_func}}() may still fail
+ * with CFSM_ERR_PRECONDITION for an event that this function allows.
+ */
+int {{can_advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev);
+{{if stats_mode}}
+/*
+ * Failure counter indices for each precondition in {{fsm_struct}}_stats
+ */
+enum _{{fsm_struct}}_stats_precond {
+{{for pc in stats_preconds}}	_{{fsm_struct}}_pc_{{pc.value}},
+{{endfor}}	_{{fsm_struct}}_stats_npreconds
+};
+
+/*
+ * Statistics counted by the functions above. Each thread counts into
+ * its own copy, so that no atomic operations are needed. Times are in
+ * clock ticks, which are TSC cycles on x86 and nanoseconds elsewhere.
+ */
+struct {{fsm_struct}}_stats {
+	/* Events delivered in each state, whether accepted or not */
+	uint64_t events[{{num_states}}][{{num_events}}];
+	/* Entries into each state and ticks spent there before leaving */
+	uint64_t entries[{{num_states}}];
+	uint64_t ticks[{{num_states}}];
+{{if stats_preconds}}	/* Failures of each precondition */
+	uint64_t precond_failures[_{{fsm_struct}}_stats_npreconds];
+{{endif}}};
+
+/*
+ * Copy the calling thread's statistics into "stats".
+ */
+void {{fsm_struct}}_stats_snapshot(struct {{fsm_struct}}_stats *stats);
+
+/*
+ * Zero the calling thread's statistics.
+ */
+void {{fsm_struct}}_stats_reset(void);
+
+/*
+ * Add the statistics in "from" to those in "to", e.g. to combine
+ * snapshots taken by several threads.
+ */
+void {{fsm_struct}}_stats_merge(struct {{fsm_struct}}_stats *to,
+    const struct {{fsm_struct}}_stats *from);
+
+/*
+ * Write the non-zero counters in "stats" to "f", one per line as
+ * "state NAME entries N ticks N", "event STATE EVENT N" or
+ * "precondition-failure NAME N".
+ */
+void {{fsm_struct}}_stats_dump(const struct {{fsm_struct}}_stats *stats,
+    FILE *f);
+{{endif}}{{if trace_mode}}
+/*
+ * A transition recorded by the trace ring. The instance is the address
+ * of the struct {{fsm_struct}} and the timestamp is in clock ticks, which
+ * are TSC cycles on x86 and nanoseconds elsewhere.
+ */
+struct {{fsm_struct}}_trace_record {
+	uint64_t instance;
+	uint64_t timestamp;
+	uint32_t old_state;		/* enum {{state_enum}} */
+	uint32_t event;			/* enum {{event_enum}} */
+	uint32_t new_state;		/* enum {{state_enum}} */
+	uint32_t reserved;
+};
+
+/*
+ * A trace dump is this header followed by "nrecords" records, oldest
+ * first, all in the byte order of the host that wrote it. "cfsm -X"
+ * decodes dumps using the names from the FSM description, which must
+ * match the fingerprint ({{fingerprint_define}}) the dump was stamped with.
+ */
+{{if snapshot}}{{else}}#define {{fingerprint_define}}	{{fingerprint}}
+{{endif}}struct {{fsm_struct}}_trace_header {
+	char magic[8];			/* "CFSMTRC1", not NUL terminated */
+	uint32_t byte_order;		/* 0x01020304 */
+	uint32_t record_size;
+	uint32_t num_states;
+	uint32_t num_events;
+	uint64_t nrecords;
+	uint64_t dropped;		/* Older records no longer held */
+	uint64_t fingerprint;		/* {{fingerprint_define}} */
+};
+
+struct {{fsm_struct}}_trace;
+
+/*
+ * Start recording the transitions made by the calling thread into a new
+ * ring holding the most recent "nrecords" (rounded up to a power of two)
+ * of them. Returns the ring or NULL if it could not be allocated.
+ */
+struct {{fsm_struct}}_trace *{{fsm_struct}}_trace_start(size_t nrecords);
+
+/*
+ * Stop recording the calling thread's transitions. Returns the ring they
+ * were recorded into, which remains valid until freed, or NULL.
+ */
+struct {{fsm_struct}}_trace *{{fsm_struct}}_trace_stop(void);
+
+/*
+ * Free a trace ring. It must no longer be being recorded into.
+ */
+void {{fsm_struct}}_trace_free(struct {{fsm_struct}}_trace *t);
+
+/*
+ * Write the records held in "t" to "f" as a trace dump. This may be
+ * called from any thread, including while the ring is being recorded
+ * into; records overwritten during the dump are counted as dropped.
+ * Returns 0 on success or -1 on failure.
+ */
+int {{fsm_struct}}_trace_dump(struct {{fsm_struct}}_trace *t, FILE *f);
+{{endif}}
 #endif /* {{header_guard}} */
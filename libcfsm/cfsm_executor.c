@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* $Id$ */
+
+/*
+ * Executor that spreads the events for a population of FSM instances
+ * over a pool of worker threads.
+ *
+ * Instances are hashed by ID onto shards, several per worker. Each shard
+ * has a bounded multi-producer queue of events (the same sequence-number
+ * ring as the generated mailboxes) and a flag saying which worker, if
+ * any, is draining it. Workers drain the shards they own and, when those
+ * are empty, steal a batch from any other shard whose flag they can
+ * take. Only the holder of a shard's flag takes events off it, and it
+ * handles them in queue order, so the events of one instance are always
+ * handled one at a time and in the order they were submitted.
+ *
+ * Producers touch only the shard they submit to; there is no global
+ * queue or lock on the busy path. Idle workers sleep on a condition
+ * variable after a few empty passes, yielding the CPU between them, and
+ * producers only take its mutex when a worker is asleep.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "libcfsm.h"
+
+#if defined(__GNUC__)
+
+#define EXEC_CACHELINE		64
+#define EXEC_SHARDS_PER_WORKER	4
+#define EXEC_BATCH		64	/* Events per visit to a shard */
+#define EXEC_SPINS		16	/* Empty passes before sleeping */
+
+struct exec_slot {
+	uint64_t seq;
+	u_long id;
+	int ev;
+};
+
+/* Producers' and consumers' fields are kept on separate cache lines */
+struct exec_shard {
+	uint64_t tail __attribute__((aligned(EXEC_CACHELINE)));
+	int held __attribute__((aligned(EXEC_CACHELINE)));
+	uint64_t head;
+	struct exec_slot *slots;
+};
+
+struct exec_worker {
+	struct cfsm_executor *ex;
+	pthread_t thread;
+	u_int index;
+	u_int next_steal;		/* Shard to try stealing from first */
+};
+
+struct cfsm_executor {
+	cfsm_dispatch_fn dispatch;
+	void *arg;
+	u_int nworkers, nthreads;
+	u_int nshards, shard_bits;
+	uint64_t queue_len;
+	struct exec_shard *shards;
+	struct exec_worker *workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cv;		/* Signalled when there is work */
+	pthread_cond_t idle_cv;		/* Broadcast when a worker sleeps */
+	u_int sleeping;			/* Written under lock */
+	int stopping;			/* Written under lock */
+};
+
+static struct exec_shard *
+shard_of(struct cfsm_executor *ex, u_long id)
+{
+	/* Fibonacci hashing, so sequential IDs spread over the shards */
+	return &ex->shards[((uint64_t)id * 0x9e3779b97f4a7c15ULL) >>
+	    (64 - ex->shard_bits)];
+}
+
+/* Handle up to EXEC_BATCH events from a shard no other worker holds */
+static size_t
+drain_shard(struct cfsm_executor *ex, struct exec_shard *sh)
+{
+	struct exec_slot *slot;
+	uint64_t head;
+	u_long id;
+	size_t n;
+	int ev;
+
+	if (__atomic_load_n(&sh->head, __ATOMIC_RELAXED) ==
+	    __atomic_load_n(&sh->tail, __ATOMIC_RELAXED) ||
+	    __atomic_load_n(&sh->held, __ATOMIC_RELAXED) ||
+	    __atomic_exchange_n(&sh->held, 1, __ATOMIC_ACQUIRE))
+		return 0;
+	head = sh->head;
+	for (n = 0; n < EXEC_BATCH; n++, head++) {
+		slot = &sh->slots[head & (ex->queue_len - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + 1)
+			break;
+		id = slot->id;
+		ev = slot->ev;
+		/* Free the slot first, so dispatch may submit to this shard */
+		__atomic_store_n(&slot->seq, head + ex->queue_len,
+		    __ATOMIC_RELEASE);
+		ex->dispatch(ex->arg, id, ev);
+		/* Only now is the event counted as handled */
+		__atomic_store_n(&sh->head, head + 1, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&sh->held, 0, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* Returns 1 if a shard has events that no worker is handling */
+static int
+runnable(struct cfsm_executor *ex)
+{
+	struct exec_shard *sh;
+	u_int i;
+
+	for (i = 0; i < ex->nshards; i++) {
+		sh = &ex->shards[i];
+		if (__atomic_load_n(&sh->head, __ATOMIC_ACQUIRE) !=
+		    __atomic_load_n(&sh->tail, __ATOMIC_ACQUIRE) &&
+		    !__atomic_load_n(&sh->held, __ATOMIC_ACQUIRE))
+			return 1;
+	}
+	return 0;
+}
+
+/* Returns 1 if a shard has events that have not yet been handled */
+static int
+busy(struct cfsm_executor *ex)
+{
+	struct exec_shard *sh;
+	u_int i;
+
+	for (i = 0; i < ex->nshards; i++) {
+		sh = &ex->shards[i];
+		if (__atomic_load_n(&sh->head, __ATOMIC_ACQUIRE) !=
+		    __atomic_load_n(&sh->tail, __ATOMIC_ACQUIRE))
+			return 1;
+	}
+	return 0;
+}
+
+/* Sleep until there may be work; returns 0 if the worker should exit */
+static int
+worker_sleep(struct cfsm_executor *ex)
+{
+	int ret;
+
+	pthread_mutex_lock(&ex->lock);
+	__atomic_store_n(&ex->sleeping, ex->sleeping + 1, __ATOMIC_RELAXED);
+	/*
+	 * Pairs with the fence in cfsm_executor_submit(): either this
+	 * worker sees the new event or the producer sees it sleeping.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!ex->stopping && !runnable(ex)) {
+		pthread_cond_broadcast(&ex->idle_cv);
+		pthread_cond_wait(&ex->work_cv, &ex->lock);
+	}
+	__atomic_store_n(&ex->sleeping, ex->sleeping - 1, __ATOMIC_RELAXED);
+	ret = !ex->stopping;
+	pthread_mutex_unlock(&ex->lock);
+	return ret;
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct exec_worker *w = arg;
+	struct cfsm_executor *ex = w->ex;
+	u_int i, s, spins = 0;
+	size_t n;
+
+	for (;;) {
+		n = 0;
+		for (s = w->index; s < ex->nshards; s += ex->nworkers)
+			n += drain_shard(ex, &ex->shards[s]);
+		/* Nothing at home; help with one batch from elsewhere */
+		for (i = 0; n == 0 && i < ex->nshards; i++) {
+			s = w->next_steal++ & (ex->nshards - 1);
+			n = drain_shard(ex, &ex->shards[s]);
+		}
+		if (n != 0) {
+			spins = 0;
+			continue;
+		}
+		/* Give the CPU to producers or busy workers meanwhile */
+		if (++spins < EXEC_SPINS) {
+			sched_yield();
+			continue;
+		}
+		spins = 0;
+		if (!worker_sleep(ex))
+			break;
+	}
+	return NULL;
+}
+
+struct cfsm_executor *
+cfsm_executor_new(u_int nworkers, size_t queue_len, cfsm_dispatch_fn dispatch,
+    void *arg)
+{
+	struct cfsm_executor *ex;
+	uint64_t j;
+	void *p;
+	u_int i;
+	int r;
+
+	if (nworkers == 0 || nworkers > 65536 || queue_len == 0 ||
+	    queue_len > ((size_t)1 << 30) || dispatch == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((ex = calloc(1, sizeof(*ex))) == NULL)
+		return NULL;
+	ex->dispatch = dispatch;
+	ex->arg = arg;
+	ex->nworkers = nworkers;
+	/* A ring of one slot could not tell a full slot from a free one */
+	for (ex->queue_len = 2; ex->queue_len < queue_len; ex->queue_len <<= 1)
+		;
+	for (ex->shard_bits = 1; (1U << ex->shard_bits) <
+	    nworkers * EXEC_SHARDS_PER_WORKER; ex->shard_bits++)
+		;
+	ex->nshards = 1U << ex->shard_bits;
+
+	if ((r = posix_memalign(&p, EXEC_CACHELINE,
+	    ex->nshards * sizeof(*ex->shards))) != 0) {
+		free(ex);
+		errno = r;
+		return NULL;
+	}
+	ex->shards = p;
+	memset(ex->shards, 0, ex->nshards * sizeof(*ex->shards));
+	for (i = 0; i < ex->nshards; i++) {
+		if ((ex->shards[i].slots = calloc(ex->queue_len,
+		    sizeof(*ex->shards[i].slots))) == NULL)
+			goto fail;
+		for (j = 0; j < ex->queue_len; j++)
+			ex->shards[i].slots[j].seq = j;
+	}
+	if ((ex->workers = calloc(nworkers, sizeof(*ex->workers))) == NULL)
+		goto fail;
+	pthread_mutex_init(&ex->lock, NULL);
+	pthread_cond_init(&ex->work_cv, NULL);
+	pthread_cond_init(&ex->idle_cv, NULL);
+
+	for (i = 0; i < nworkers; i++) {
+		ex->workers[i].ex = ex;
+		ex->workers[i].index = i;
+		/* Start stealing from different places */
+		ex->workers[i].next_steal = i * EXEC_SHARDS_PER_WORKER + 1;
+		if ((r = pthread_create(&ex->workers[i].thread, NULL,
+		    worker_main, &ex->workers[i])) != 0) {
+			cfsm_executor_free(ex);
+			errno = r;
+			return NULL;
+		}
+		ex->nthreads++;
+	}
+	return ex;
+
+ fail:
+	r = errno;
+	for (i = 0; i < ex->nshards; i++)
+		free(ex->shards[i].slots);
+	free(ex->shards);
+	free(ex);
+	errno = r;
+	return NULL;
+}
+
+int
+cfsm_executor_submit(struct cfsm_executor *ex, u_long id, int ev)
+{
+	struct exec_shard *sh = shard_of(ex, id);
+	struct exec_slot *slot;
+	uint64_t pos, seq;
+
+	pos = __atomic_load_n(&sh->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &sh->slots[pos & (ex->queue_len - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			/* On failure, "pos" is updated to the current tail */
+			if (__atomic_compare_exchange_n(&sh->tail, &pos,
+			    pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((int64_t)(seq - pos) < 0)
+			return CFSM_ERR_QUEUE_FULL;
+		else
+			pos = __atomic_load_n(&sh->tail, __ATOMIC_RELAXED);
+	}
+	slot->id = id;
+	slot->ev = ev;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ex->sleeping, __ATOMIC_RELAXED) != 0) {
+		pthread_mutex_lock(&ex->lock);
+		pthread_cond_signal(&ex->work_cv);
+		pthread_mutex_unlock(&ex->lock);
+	}
+	return CFSM_OK;
+}
+
+void
+cfsm_executor_wait(struct cfsm_executor *ex)
+{
+	pthread_mutex_lock(&ex->lock);
+	while (busy(ex))
+		pthread_cond_wait(&ex->idle_cv, &ex->lock);
+	pthread_mutex_unlock(&ex->lock);
+}
+
+void
+cfsm_executor_free(struct cfsm_executor *ex)
+{
+	u_int i;
+
+	if (ex == NULL)
+		return;
+	if (ex->nthreads == ex->nworkers)
+		cfsm_executor_wait(ex);
+	pthread_mutex_lock(&ex->lock);
+	ex->stopping = 1;
+	pthread_cond_broadcast(&ex->work_cv);
+	pthread_mutex_unlock(&ex->lock);
+	for (i = 0; i < ex->nthreads; i++)
+		pthread_join(ex->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&ex->idle_cv);
+	pthread_cond_destroy(&ex->work_cv);
+	pthread_mutex_destroy(&ex->lock);
+	for (i = 0; i < ex->nshards; i++)
+		free(ex->shards[i].slots);
+	free(ex->shards);
+	free(ex->workers);
+	free(ex);
+}
+
+#endif /* __GNUC__ */
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* $Id$ */
+
+/*
+ * The hash behind the perfect hashes over state and event names. It is
+ * shared by cfsm, which builds the hashes and also uses it for its own
+ * name table, and libcfsm, which looks names up in them. The copy in
+ * source.m must be kept identical by hand.
+ */
+
+#ifndef _CFSM_NAME_HASH_H
+#define _CFSM_NAME_HASH_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ * 32-bit FNV-1a, with an optional seed replacing the offset basis. The
+ * low bits of FNV depend only on the low bits of each character, so the
+ * result is finally mixed to let every bit affect the slot.
+ */
+static inline uint32_t
+name_hash(uint32_t h, const char *s)
+{
+	if (h == 0)
+		h = 0x811c9dc5;
+	for (; *s != '\0'; s++)
+		h = (h ^ (u_char)*s) * 0x01000193;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	return h ^ (h >> 16);
+}
+
+#endif /* _CFSM_NAME_HASH_H */
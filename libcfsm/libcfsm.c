@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libcfsm.h"
+#include "cfsm_name_hash.h"
+
+static const char *
+state_ntop_safe(const struct cfsm_definition *def, int state)
+{
+	const char *r = cfsm_state_ntop(def, state);
+
+	return r == NULL ? "[INVALID]" : r;
+}
+
+static const char *
+event_ntop_safe(const struct cfsm_definition *def, int ev)
+{
+	const char *r = cfsm_event_ntop(def, ev);
+
+	return r == NULL ? "[INVALID]" : r;
+}
+
+/* Record and/or format a failure and return the matching CFSM_ERR_* */
+static int
+fail(const struct cfsm_definition *def, int reason, int old_state, int ev,
+    int new_state, struct cfsm_error *err, char *errbuf, size_t errlen)
+{
+	struct cfsm_error e;
+
+	e.old_state = old_state;
+	e.event = ev;
+	e.new_state = new_state;
+	e.reason = reason;
+	if (err != NULL)
+		*err = e;
+	if (errbuf != NULL && errlen > 0)
+		cfsm_strerror(def, &e, errbuf, errlen);
+	switch (reason) {
+	case CFSM_REASON_INVALID_START:
+	case CFSM_REASON_INVALID_STATE:
+		return CFSM_ERR_INVALID_STATE;
+	case CFSM_REASON_INVALID_EVENT:
+		return CFSM_ERR_INVALID_EVENT;
+	case CFSM_REASON_INVALID_TRANSITION:
+		return CFSM_ERR_INVALID_TRANSITION;
+	default:
+		return CFSM_ERR_PRECONDITION;
+	}
+}
+
+int
+cfsm_check_initial(const struct cfsm_definition *def, int initial_state,
+    struct cfsm_error *err, char *errbuf, size_t errlen)
+{
+	u_int i;
+
+	for (i = 0; i < def->ninitial; i++) {
+		if (def->initial_states[i] == initial_state)
+			return CFSM_OK;
+	}
+	return fail(def, CFSM_REASON_INVALID_START, initial_state, 0,
+	    initial_state, err, errbuf, errlen);
+}
+
+/* Check the preconditions of a valid transition from "old_state" */
+static int
+check_preconds(const struct cfsm_definition *def,
+    const struct cfsm_transition *t, int old_state, int ev, void *ctx,
+    struct cfsm_error *err, char *errbuf, size_t errlen)
+{
+	const cfsm_precond_fn *p;
+	int new_state = t->next_state;
+
+	if ((p = t->event_preconds) != NULL) {
+		for (; *p != NULL; p++) {
+			if ((*p)(ev, old_state, new_state, ctx) != 0)
+				return fail(def, CFSM_REASON_EVENT_PRECOND,
+				    old_state, ev, new_state,
+				    err, errbuf, errlen);
+		}
+	}
+	if ((p = t->exit_preconds) != NULL) {
+		for (; *p != NULL; p++) {
+			if ((*p)(ev, old_state, new_state, ctx) != 0)
+				return fail(def, CFSM_REASON_EXIT_PRECOND,
+				    old_state, ev, new_state,
+				    err, errbuf, errlen);
+		}
+	}
+	if ((p = t->entry_preconds) != NULL) {
+		for (; *p != NULL; p++) {
+			if ((*p)(ev, old_state, new_state, ctx) != 0)
+				return fail(def, CFSM_REASON_ENTRY_PRECOND,
+				    old_state, ev, new_state,
+				    err, errbuf, errlen);
+		}
+	}
+	return CFSM_OK;
+}
+
+static void
+run_callbacks(const cfsm_callback_fn *c, int ev, int old_state,
+    int new_state, void *ctx)
+{
+	if (c == NULL)
+		return;
+	for (; *c != NULL; c++)
+		(*c)(ev, old_state, new_state, ctx);
+}
+
+/*
+ * Perform a valid transition: check preconditions, run callbacks and
+ * switch state, in the same order as the generated advance functions.
+ */
+static int
+transition(const struct cfsm_definition *def, const struct cfsm_transition *t,
+    int *state, int ev, void *ctx, struct cfsm_error *err, char *errbuf,
+    size_t errlen)
+{
+	int old_state = *state, new_state = t->next_state, r;
+
+	if ((r = check_preconds(def, t, old_state, ev, ctx,
+	    err, errbuf, errlen)) != CFSM_OK)
+		return r;
+	run_callbacks(t->event_callbacks, ev, old_state, new_state, ctx);
+	run_callbacks(t->exit_callbacks, ev, old_state, new_state, ctx);
+
+	/* Switch state now */
+	*state = new_state;
+
+	run_callbacks(t->entry_callbacks, ev, old_state, new_state, ctx);
+	return CFSM_OK;
+}
+
+int
+cfsm_advance(const struct cfsm_definition *def, int *state, int ev,
+    void *ctx, struct cfsm_error *err, char *errbuf, size_t errlen)
+{
+	const struct cfsm_transition *t;
+	int old_state = *state;
+	uint32_t cell;
+
+	/* Sanity check states */
+	if (old_state < 0 || (u_int)old_state >= def->nstates) {
+		return fail(def, CFSM_REASON_INVALID_STATE, old_state, ev,
+		    old_state, err, errbuf, errlen);
+	}
+	if (ev < 0 || (u_int)ev >= def->nevents) {
+		return fail(def, CFSM_REASON_INVALID_EVENT, old_state, ev,
+		    old_state, err, errbuf, errlen);
+	}
+
+	/* Event validity checks */
+	cell = def->index[(size_t)old_state * def->nevents + ev];
+	if (cell == 0) {
+		return fail(def, CFSM_REASON_INVALID_TRANSITION, old_state, ev,
+		    old_state, err, errbuf, errlen);
+	}
+	t = &def->transitions[cell - 1];
+	if (t->next_state == CFSM_NEXT_IGNORE)
+		return CFSM_OK;
+
+	return transition(def, t, state, ev, ctx, err, errbuf, errlen);
+}
+
+#if defined(__GNUC__)
+int
+cfsm_advance_atomic(const struct cfsm_definition *def, int *state, int ev,
+    void *ctx, struct cfsm_error *err, char *errbuf, size_t errlen)
+{
+	const struct cfsm_transition *t;
+	int old_state, r;
+	uint32_t cell;
+
+	old_state = __atomic_load_n(state, __ATOMIC_ACQUIRE);
+	if (ev < 0 || (u_int)ev >= def->nevents) {
+		return fail(def, CFSM_REASON_INVALID_EVENT, old_state, ev,
+		    old_state, err, errbuf, errlen);
+	}
+	for (;;) {
+		if (old_state < 0 || (u_int)old_state >= def->nstates) {
+			return fail(def, CFSM_REASON_INVALID_STATE, old_state,
+			    ev, old_state, err, errbuf, errlen);
+		}
+		cell = def->index[(size_t)old_state * def->nevents + ev];
+		if (cell == 0) {
+			return fail(def, CFSM_REASON_INVALID_TRANSITION,
+			    old_state, ev, old_state, err, errbuf, errlen);
+		}
+		t = &def->transitions[cell - 1];
+		if (t->next_state == CFSM_NEXT_IGNORE)
+			return CFSM_OK;
+		if ((r = check_preconds(def, t, old_state, ev, ctx,
+		    err, errbuf, errlen)) != CFSM_OK)
+			return r;
+		/* On failure, old_state is updated to the current state */
+		if (__atomic_compare_exchange_n(state, &old_state,
+		    t->next_state, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	run_callbacks(t->event_callbacks, ev, old_state, t->next_state, ctx);
+	run_callbacks(t->exit_callbacks, ev, old_state, t->next_state, ctx);
+	run_callbacks(t->entry_callbacks, ev, old_state, t->next_state, ctx);
+	return CFSM_OK;
+}
+#endif /* __GNUC__ */
+
+const uint32_t *
+cfsm_valid_events(const struct cfsm_definition *def, int state)
+{
+	if (state < 0 || (u_int)state >= def->nstates)
+		return NULL;
+	return def->event_masks + (size_t)state * def->mask_words;
+}
+
+int
+cfsm_can_advance(const struct cfsm_definition *def, int state, int ev)
+{
+	const uint32_t *mask;
+
+	if ((mask = cfsm_valid_events(def, state)) == NULL ||
+	    ev < 0 || (u_int)ev >= def->nevents)
+		return 0;
+	return (mask[ev / 32] >> (ev % 32)) & 1;
+}
+
+const char *
+cfsm_state_ntop(const struct cfsm_definition *def, int state)
+{
+	if (state < 0 || (u_int)state >= def->nstates)
+		return NULL;
+	return def->state_names[state];
+}
+
+const char *
+cfsm_event_ntop(const struct cfsm_definition *def, int ev)
+{
+	if (ev < 0 || (u_int)ev >= def->nevents)
+		return NULL;
+	return def->event_names[ev];
+}
+
+static int
+name_lookup(const int32_t *disp, const int *slots, const char * const *names,
+    u_int n, const char *name, int *out)
+{
+	int32_t d;
+	size_t slot;
+
+	if (name == NULL)
+		return -1;
+	d = disp[name_hash(0, name) % n];
+	if (d < 0)
+		slot = (size_t)(-(int64_t)d - 1);
+	else
+		slot = name_hash((uint32_t)d, name) % n;
+	if (strcmp(name, names[slot]) != 0)
+		return -1;
+	if (out != NULL)
+		*out = slots[slot];
+	return 0;
+}
+
+int
+cfsm_state_pton(const struct cfsm_definition *def, const char *name,
+    int *out)
+{
+	return name_lookup(def->state_hash_disp, def->state_hash_slots,
+	    def->state_hash_names, def->state_hash_size, name, out);
+}
+
+int
+cfsm_event_pton(const struct cfsm_definition *def, const char *name,
+    int *out)
+{
+	return name_lookup(def->event_hash_disp, def->event_hash_slots,
+	    def->event_hash_names, def->event_hash_size, name, out);
+}
+
+char *
+cfsm_strerror(const struct cfsm_definition *def,
+    const struct cfsm_error *err, char *buf, size_t len)
+{
+	if (len == 0 || buf == NULL)
+		return buf;
+	switch (err->reason) {
+	case CFSM_REASON_NONE:
+		snprintf(buf, len, "No error");
+		break;
+	case CFSM_REASON_INVALID_START:
+		snprintf(buf, len, "State %s (%d) is not a valid start state",
+		    state_ntop_safe(def, err->old_state), err->old_state);
+		break;
+	case CFSM_REASON_INVALID_STATE:
+		snprintf(buf, len, "Invalid current_state (%d)",
+		    err->old_state);
+		break;
+	case CFSM_REASON_INVALID_EVENT:
+		snprintf(buf, len, "Invalid event (%d)", err->event);
+		break;
+	case CFSM_REASON_INVALID_TRANSITION:
+		snprintf(buf, len, "Invalid event %s in state %s",
+		    event_ntop_safe(def, err->event),
+		    state_ntop_safe(def, err->old_state));
+		break;
+	case CFSM_REASON_EVENT_PRECOND:
+		snprintf(buf, len, "Event %s entry precondition not satisfied",
+		    event_ntop_safe(def, err->event));
+		break;
+	case CFSM_REASON_EXIT_PRECOND:
+		snprintf(buf, len, "State %s exit precondition not satisfied",
+		    state_ntop_safe(def, err->old_state));
+		break;
+	case CFSM_REASON_ENTRY_PRECOND:
+		snprintf(buf, len, "State %s entry precondition not satisfied",
+		    state_ntop_safe(def, err->new_state));
+		break;
+	default:
+		snprintf(buf, len, "Unknown error reason (%d)", err->reason);
+		break;
+	}
+	return buf;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* $Id$ */
+
+/*
+ * Shared runtime for FSMs generated with "cfsm -r". The generated code
+ * holds only constant data describing the FSM and thin wrappers that
+ * call the functions below, so that many FSMs linked into one program
+ * share a single copy of the advance loop.
+ */
+
+#ifndef _LIBCFSM_H
+#define _LIBCFSM_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ * Possible error return values
+ */
+#ifndef CFSM_OK
+# define CFSM_OK			0
+# define CFSM_ERR_INVALID_STATE		-1
+# define CFSM_ERR_INVALID_EVENT		-2
+# define CFSM_ERR_INVALID_TRANSITION	-3
+# define CFSM_ERR_PRECONDITION		-4
+#endif /* CFSM_OK */
+#ifndef CFSM_ERR_QUEUE_FULL
+# define CFSM_ERR_QUEUE_FULL		-5
+#endif /* CFSM_ERR_QUEUE_FULL */
+
+/*
+ * Reasons for a failure, as recorded in struct cfsm_error
+ */
+#ifndef CFSM_REASON_NONE
+# define CFSM_REASON_NONE		0
+# define CFSM_REASON_INVALID_START	1
+# define CFSM_REASON_INVALID_STATE	2
+# define CFSM_REASON_INVALID_EVENT	3
+# define CFSM_REASON_INVALID_TRANSITION	4
+# define CFSM_REASON_EVENT_PRECOND	5
+# define CFSM_REASON_EXIT_PRECOND	6
+# define CFSM_REASON_ENTRY_PRECOND	7
+#endif /* CFSM_REASON_NONE */
+
+/* Next state of a transition entry for events that are ignored */
+#define CFSM_NEXT_IGNORE		-1
+
+/*
+ * Precondition and callback functions are called through small
+ * generated adapters that take every argument and pass on only those
+ * the user's function wants. Lists of them are NULL-terminated.
+ */
+typedef int (*cfsm_precond_fn)(int ev, int old_state, int new_state,
+    void *ctx);
+typedef void (*cfsm_callback_fn)(int ev, int old_state, int new_state,
+    void *ctx);
+
+/*
+ * Everything that happens for one (state, event) pair. Any of the lists
+ * may be NULL if empty.
+ */
+struct cfsm_transition {
+	int next_state;			/* or CFSM_NEXT_IGNORE */
+	const cfsm_precond_fn *event_preconds;
+	const cfsm_precond_fn *exit_preconds;
+	const cfsm_precond_fn *entry_preconds;
+	const cfsm_callback_fn *event_callbacks;
+	const cfsm_callback_fn *exit_callbacks;
+	const cfsm_callback_fn *entry_callbacks;
+};
+
+/*
+ * Constant description of an FSM, emitted by cfsm. The name hashes are
+ * minimal perfect hashes in the form described in cfsm_hash.c; the state
+ * hash also holds the names of states merged by minimisation, so it may
+ * be larger than nstates.
+ */
+struct cfsm_definition {
+	u_int nstates;
+	u_int nevents;
+	u_int ninitial;
+	u_int mask_words;		/* 32-bit words per event mask */
+	const int *initial_states;
+	const char * const *state_names;
+	const char * const *event_names;
+	u_int state_hash_size;
+	const int32_t *state_hash_disp;
+	const int *state_hash_slots;
+	const char * const *state_hash_names;
+	u_int event_hash_size;
+	const int32_t *event_hash_disp;
+	const int *event_hash_slots;
+	const char * const *event_hash_names;
+	const uint32_t *event_masks;	/* nstates x mask_words */
+	const uint32_t *index;		/* nstates x nevents, 0 = invalid */
+	const struct cfsm_transition *transitions; /* index - 1 */
+};
+
+/*
+ * Details of a failure
+ */
+struct cfsm_error {
+	int old_state;
+	int event;
+	int new_state;
+	int reason;
+};
+
+/*
+ * Check that "initial_state" is a valid start state. Returns CFSM_OK or
+ * a CFSM_ERR_* code. On failure, the details are stored in "err" and a
+ * message in "errbuf" if they are not NULL.
+ */
+int cfsm_check_initial(const struct cfsm_definition *def, int initial_state,
+    struct cfsm_error *err, char *errbuf, size_t errlen);
+
+/*
+ * Apply event "ev" to the FSM whose current state is "*state", updating
+ * it if the event causes a transition. "ctx" is passed to preconditions
+ * and callbacks. Returns and reports failures as cfsm_check_initial().
+ */
+int cfsm_advance(const struct cfsm_definition *def, int *state, int ev,
+    void *ctx, struct cfsm_error *err, char *errbuf, size_t errlen);
+
+#if defined(__GNUC__)
+/*
+ * As cfsm_advance(), but "*state" may be advanced by other threads at
+ * the same time. Preconditions are checked before the new state is
+ * committed with compare-and-swap, and checked again from the winning
+ * thread's state if that fails, so they may run more than once. All
+ * callbacks run once, after the commit, in the committing thread.
+ */
+int cfsm_advance_atomic(const struct cfsm_definition *def, int *state,
+    int ev, void *ctx, struct cfsm_error *err, char *errbuf, size_t errlen);
+#endif /* __GNUC__ */
+
+#if defined(__GNUC__)
+/*
+ * A pool of worker threads executing the events of a population of FSM
+ * instances, which are identified to it by number. Events for the same
+ * instance are handled one at a time, in the order they were submitted,
+ * but may be handled by different workers. The executor knows nothing
+ * of the FSMs themselves: "dispatch" is called with the "arg" given to
+ * cfsm_executor_new() to apply event "ev" to instance "id", typically
+ * through its generated advance function. It works with FSMs generated
+ * in any mode, not only with -r.
+ */
+typedef void (*cfsm_dispatch_fn)(void *arg, u_long id, int ev);
+
+struct cfsm_executor;
+
+/*
+ * Start an executor with "nworkers" threads. Each worker has a few
+ * shards of instances, with a queue of "queue_len" (rounded up to a
+ * power of two, and at least two) events each, and steals work from
+ * other shards when its own are empty. Returns NULL and sets errno on
+ * failure.
+ */
+struct cfsm_executor *cfsm_executor_new(u_int nworkers, size_t queue_len,
+    cfsm_dispatch_fn dispatch, void *arg);
+
+/*
+ * Submit event "ev" for instance "id". Any thread may submit, including
+ * the workers from within "dispatch", and none blocks: if the queue of
+ * the instance's shard is full, CFSM_ERR_QUEUE_FULL is returned and the
+ * event is not submitted. Returns CFSM_OK otherwise.
+ */
+int cfsm_executor_submit(struct cfsm_executor *ex, u_long id, int ev);
+
+/*
+ * Wait until every submitted event, including those submitted by
+ * "dispatch" meanwhile, has been handled.
+ */
+void cfsm_executor_wait(struct cfsm_executor *ex);
+
+/*
+ * Wait for every submitted event to be handled, then stop the workers
+ * and free the executor.
+ */
+void cfsm_executor_free(struct cfsm_executor *ex);
+#endif /* __GNUC__ */
+
+/*
+ * Returns the valid event bit vector for "state" or NULL if the state
+ * is not known.
+ */
+const uint32_t *cfsm_valid_events(const struct cfsm_definition *def,
+    int state);
+
+/*
+ * Returns 1 if "ev" is accepted or ignored in "state", 0 otherwise.
+ */
+int cfsm_can_advance(const struct cfsm_definition *def, int state, int ev);
+
+/*
+ * Convert between states or events and their names. The _ntop functions
+ * return NULL for unknown values and the _pton functions -1 for unknown
+ * names, storing the value in "*out" on success if it is not NULL.
+ */
+const char *cfsm_state_ntop(const struct cfsm_definition *def, int state);
+const char *cfsm_event_ntop(const struct cfsm_definition *def, int ev);
+int cfsm_state_pton(const struct cfsm_definition *def, const char *name,
+    int *out);
+int cfsm_event_pton(const struct cfsm_definition *def, const char *name,
+    int *out);
+
+/*
+ * Format a recorded failure into "buf", which is "len" bytes long.
+ * Returns "buf".
+ */
+char *cfsm_strerror(const struct cfsm_definition *def,
+    const struct cfsm_error *err, char *buf, size_t len);
+
+#endif /* _LIBCFSM_H */
@@ -0,0 +1,197 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+/*
+ * Measure the code that cfsm generates. For each machine shape given on
+ * the command line as states:events:transitions (the number of events
+ * each state accepts), a synthetic machine is generated and compiled in
+ * every output mode, and bench_driver times its advance function over
+ * uniform, skewed and adversarial event streams.
+ *
+ * One tab-separated line is printed per measurement, after a header
+ * line naming the columns, so that runs may be saved and compared
+ * between commits. Counts that are not available are printed as "NA".
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#define INPUT_PATH	"bench_adv_fsm.fsm"
+#define OUTPUT_PATH	"bench_adv_fsm.c"
+#define OBJECT_PATH	"bench_adv_fsm.o"
+#define DRIVER_PATH	"bench_adv"
+
+/* Output modes measured, and the names they are reported under */
+static const struct {
+	const char *name;
+	const char *flags;
+} modes[] = {
+	{ "switch",	"" },
+	{ "table",	"-T" },
+	{ "dense",	"-edense" },
+	{ "sparse",	"-esparse" },
+	{ "runtime",	"-r" },
+	{ "fused",	"-F" },
+};
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: advance_bench [-c cfsm] [-C cc] "
+	    "[-f cflags] [-l libcfsm_dir] [-n stream_length]\n"
+	    "    [-t template_dir] states:events:transitions ...\n");
+	exit(1);
+}
+
+static void
+generate(const char *path, u_long nstates, u_long nevents, u_long ntrans)
+{
+	FILE *f;
+	u_long s, j;
+	uint32_t x = 1;
+
+	if ((f = fopen(path, "w")) == NULL)
+		err(1, "fopen(\"%s\")", path);
+	fprintf(f, "precondition-function-args none\n");
+	fprintf(f, "transition-function-args none\n");
+	/* Number the events so bench_driver can generate them directly */
+	for (j = 0; j < nevents; j++)
+		fprintf(f, "event E%lu = %lu\n", j, j);
+	for (s = 0; s < nstates; s++) {
+		fprintf(f, "state S%lu\n", s);
+		if (s == 0)
+			fprintf(f, "\tinitial-state\n");
+		/* A run of events from a random start, leading anywhere */
+		x = x * 1103515245 + 12345;
+		for (j = 0; j < ntrans; j++) {
+			x = x * 1103515245 + 12345;
+			fprintf(f, "\ton-event E%lu -> S%lu\n",
+			    ((x >> 20) + j) % nevents, j == 0 ?
+			    (s + 1) % nstates : (u_long)(x >> 8) % nstates);
+		}
+	}
+	if (fclose(f) != 0)
+		err(1, "fclose");
+}
+
+/* Returns the size of the text segment of "path", or -1 if unknown */
+static long
+text_size(const char *path)
+{
+	FILE *p;
+	char cmd[1024], line[1024];
+	long ret = -1;
+
+	snprintf(cmd, sizeof(cmd), "size %s 2>/dev/null", path);
+	if ((p = popen(cmd, "r")) == NULL)
+		return -1;
+	/* Berkeley format: a header line, then "text data bss ..." */
+	if (fgets(line, sizeof(line), p) != NULL &&
+	    fgets(line, sizeof(line), p) != NULL)
+		ret = strtol(line, NULL, 10);
+	pclose(p);
+	return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *cfsm = "../cfsm", *tdir = "..", *cc = "cc";
+	const char *cflags = "-O2", *libdir = "../libcfsm";
+	u_long nstates, nevents, ntrans, nstream = 1000000;
+	char cmd[2048], line[256], stream[64], misses[64], size[32];
+	size_t i;
+	double ns;
+	long text;
+	FILE *p;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "C:c:f:l:n:t:")) != -1) {
+		switch (ch) {
+		case 'C':
+			cc = optarg;
+			break;
+		case 'c':
+			cfsm = optarg;
+			break;
+		case 'f':
+			cflags = optarg;
+			break;
+		case 'l':
+			libdir = optarg;
+			break;
+		case 'n':
+			nstream = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			tdir = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0 || nstream == 0)
+		usage();
+
+	printf("mode\tstates\tevents\ttransitions\tstream\tns_per_event\t"
+	    "branch_misses_per_event\ttext_bytes\n");
+	for (; argc > 0; argc--, argv++) {
+		if (sscanf(*argv, "%lu:%lu:%lu", &nstates, &nevents,
+		    &ntrans) != 3 || nstates < 2 || nevents == 0 ||
+		    ntrans == 0 || ntrans > nevents)
+			usage();
+		generate(INPUT_PATH, nstates, nevents, ntrans);
+		for (i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+			snprintf(cmd, sizeof(cmd), "%s -t%s -d %s -o %s %s "
+			    ">/dev/null 2>&1", cfsm, tdir, modes[i].flags,
+			    OUTPUT_PATH, INPUT_PATH);
+			if (system(cmd) != 0)
+				errx(1, "cfsm %s failed on %s", modes[i].flags,
+				    *argv);
+			snprintf(cmd, sizeof(cmd), "%s %s -I. -I%s -c %s && "
+			    "%s %s -I. -I%s -o %s bench_driver.c %s -L%s "
+			    "-lcfsm", cc, cflags, libdir, OUTPUT_PATH, cc,
+			    cflags, libdir, DRIVER_PATH, OBJECT_PATH, libdir);
+			if (system(cmd) != 0)
+				errx(1, "compiling %s failed", modes[i].name);
+			if ((text = text_size(OBJECT_PATH)) == -1)
+				snprintf(size, sizeof(size), "NA");
+			else
+				snprintf(size, sizeof(size), "%ld", text);
+
+			snprintf(cmd, sizeof(cmd), "./%s %lu %lu", DRIVER_PATH,
+			    nevents, nstream);
+			if ((p = popen(cmd, "r")) == NULL)
+				err(1, "popen");
+			while (fgets(line, sizeof(line), p) != NULL) {
+				if (sscanf(line, "%63s %lf %63s", stream, &ns,
+				    misses) != 3)
+					errx(1, "bad driver output: %s", line);
+				printf("%s\t%lu\t%lu\t%lu\t%s\t%.3f\t%s\t%s\n",
+				    modes[i].name, nstates, nevents, ntrans,
+				    stream, ns, misses, size);
+			}
+			if (pclose(p) != 0)
+				errx(1, "%s failed", DRIVER_PATH);
+			fflush(stdout);
+		}
+	}
+	unlink(INPUT_PATH);
+	unlink(OUTPUT_PATH);
+	unlink(OBJECT_PATH);
+	unlink("bench_adv_fsm.h");
+	unlink(DRIVER_PATH);
+	return 0;
+}
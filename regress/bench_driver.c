@@ -0,0 +1,206 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+/*
+ * Benchmark driver for advance_bench. It is linked against a synthetic
+ * FSM generated by advance_bench, with its events numbered 0 to n - 1,
+ * and times fsm_advance() over three streams of events:
+ *
+ *   uniform      every event equally likely
+ *   skewed       event i with probability proportional to 1 / (i + 1)
+ *   adversarial  nine in ten events are rejected by the current state
+ *
+ * No error messages are requested, so a rejected event costs only the
+ * lookup that rejects it. For each stream it prints a line of
+ * "stream ns/event misses/event", where misses are branch misses counted
+ * by perf_event_open(2) or "NA" if they cannot be counted.
+ */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+
+#ifdef __linux__
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+#endif
+
+#include "bench_adv_fsm.h"
+
+/* Stream events out of every ADVERSARIAL_VALID that are accepted */
+#define ADVERSARIAL_VALID	10
+
+static uint32_t rnd = 1;
+
+static uint32_t
+next_random(void)
+{
+	rnd = rnd * 1103515245 + 12345;
+	return rnd >> 8;
+}
+
+static int
+open_branch_misses(void)
+{
+#if defined(__linux__) && defined(__NR_perf_event_open)
+	struct perf_event_attr pe;
+
+	memset(&pe, 0, sizeof(pe));
+	pe.type = PERF_TYPE_HARDWARE;
+	pe.size = sizeof(pe);
+	pe.config = PERF_COUNT_HW_BRANCH_MISSES;
+	pe.disabled = 1;
+	pe.exclude_kernel = 1;
+	pe.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static void
+fill_uniform(enum fsm_event *evs, size_t n, u_int nevents)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		evs[i] = next_random() % nevents;
+}
+
+static void
+fill_skewed(enum fsm_event *evs, size_t n, u_int nevents)
+{
+	double *cdf, x;
+	size_t i;
+	u_int lo, hi, mid;
+
+	if ((cdf = calloc(nevents, sizeof(*cdf))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	for (i = 0, x = 0; i < nevents; i++)
+		cdf[i] = (x += 1.0 / (i + 1));
+	for (i = 0; i < n; i++) {
+		x = (next_random() / (double)(1 << 24)) * cdf[nevents - 1];
+		for (lo = 0, hi = nevents - 1; lo < hi; ) {
+			mid = (lo + hi) / 2;
+			if (cdf[mid] < x)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		evs[i] = lo;
+	}
+	free(cdf);
+}
+
+/*
+ * Mostly events that the FSM will reject in whatever state it has reached,
+ * worked out by running the stream on a separate instance first.
+ */
+static void
+fill_adversarial(enum fsm_event *evs, size_t n, u_int nevents)
+{
+	struct fsm f;
+	size_t i;
+	u_int tries;
+	int want;
+	enum fsm_event ev;
+
+	fsm_init(&f, NULL, 0);
+	for (i = 0; i < n; i++) {
+		want = next_random() % ADVERSARIAL_VALID == 0;
+		/* A state may accept every event, or none; give up then */
+		for (tries = 0; tries < 4 * nevents; tries++) {
+			ev = next_random() % nevents;
+			if (fsm_can_advance(&f, ev) == want)
+				break;
+		}
+		evs[i] = ev;
+		fsm_advance(&f, ev, NULL, 0);
+	}
+}
+
+static void
+run(const char *stream, const enum fsm_event *evs, size_t n, int perf_fd)
+{
+	struct fsm f;
+	struct timespec start, end;
+	uint64_t misses;
+	double ns;
+	size_t i;
+	int fail = 0;
+
+	fsm_init(&f, NULL, 0);
+	/* Warm the caches and predictors before anything is measured */
+	for (i = 0; i < n; i++)
+		fail += fsm_advance(&f, evs[i], NULL, 0) != 0;
+
+	fsm_init(&f, NULL, 0);
+	if (perf_fd != -1) {
+		ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++)
+		fail += fsm_advance(&f, evs[i], NULL, 0) != 0;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (perf_fd != -1) {
+		ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(perf_fd, &misses, sizeof(misses)) != sizeof(misses))
+			perf_fd = -1;
+	}
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 +
+	    (end.tv_nsec - start.tv_nsec);
+	printf("%s %.3f ", stream, ns / n);
+	if (perf_fd == -1)
+		printf("NA\n");
+	else
+		printf("%.4f\n", (double)misses / n);
+	/* Keep the failure count live so the loops are not optimised out */
+	if (fail < 0)
+		abort();
+}
+
+int
+main(int argc, char **argv)
+{
+	enum fsm_event *evs;
+	u_int nevents;
+	size_t n;
+	int perf_fd;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: bench_driver nevents stream_length\n");
+		exit(1);
+	}
+	nevents = strtoul(argv[1], NULL, 10);
+	n = strtoul(argv[2], NULL, 10);
+	if (nevents == 0 || n == 0)
+		errx(1, "bad arguments");
+	if ((evs = calloc(n, sizeof(*evs))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+	perf_fd = open_branch_misses();
+
+	fill_uniform(evs, n, nevents);
+	run("uniform", evs, n, perf_fd);
+	fill_skewed(evs, n, nevents);
+	run("skewed", evs, n, perf_fd);
+	fill_adversarial(evs, n, nevents);
+	run("adversarial", evs, n, perf_fd);
+
+	if (perf_fd != -1)
+		close(perf_fd);
+	free(evs);
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+/*
+ * Measure how long cfsm takes to compile synthetic machines of
+ * increasing size. Each state has a fixed number of transitions, the
+ * first of which leads to the next state so that every state is
+ * reachable; the rest go to pseudo-random states. One state in a hundred
+ * has an entry callback and one in a thousand an exit precondition.
+ * Varying the number of events (-e) with the transitions held constant
+ * shows whether cfsm's time or peak memory depend on states x events.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define INPUT_PATH	"bench_fsm.fsm"
+#define OUTPUT_PATH	"bench_fsm.c"
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: compile_bench [-c cfsm] [-t template_dir] "
+	    "[-e events] [-n transitions] states ...\n");
+	exit(1);
+}
+
+static void
+generate(const char *path, u_long nstates, u_long nevents, u_long ntrans)
+{
+	FILE *f;
+	u_long s, j, e;
+	uint32_t x = 1;
+
+	if ((f = fopen(path, "w")) == NULL)
+		err(1, "fopen(\"%s\")", path);
+	fprintf(f, "precondition-function-args none\n");
+	fprintf(f, "transition-function-args none\n");
+	for (s = 0; s < nstates; s++) {
+		fprintf(f, "state S%lu\n", s);
+		if (s == 0)
+			fprintf(f, "\tinitial-state\n");
+		if (s % 100 == 1)
+			fprintf(f, "\tonentry-func enter_%lu\n", s);
+		if (s % 1000 == 2)
+			fprintf(f, "\texit-precondition may_leave\n");
+		/* Consecutive events from a per-state start, so no repeats */
+		for (j = 0; j < ntrans; j++) {
+			e = (s * 7 + j) % nevents;
+			x = x * 1103515245 + 12345;
+			fprintf(f, "\ton-event E%lu -> S%lu\n", e,
+			    j == 0 ? (s + 1) % nstates : (u_long)(x >> 8) %
+			    nstates);
+		}
+	}
+	if (fclose(f) != 0)
+		err(1, "fclose");
+}
+
+/* Run cfsm on the input, returning its peak resident set size in KB */
+static long
+run_cfsm(const char *cfsm, const char *tdir)
+{
+	struct rusage ru;
+	pid_t pid;
+	int status, fd;
+	char targ[1024];
+
+	snprintf(targ, sizeof(targ), "-t%s", tdir);
+	switch (pid = fork()) {
+	case -1:
+		err(1, "fork");
+	case 0:
+		if ((fd = open("/dev/null", O_WRONLY)) == -1)
+			err(1, "open(\"/dev/null\")");
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		execl(cfsm, cfsm, targ, "-o", OUTPUT_PATH, INPUT_PATH,
+		    (char *)NULL);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) == -1)
+		err(1, "wait4");
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		return -1;
+	return ru.ru_maxrss;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *cfsm = "../cfsm", *tdir = "..";
+	u_long nstates, nevents = 64, ntrans = 10;
+	struct timeval start, end;
+	double secs;
+	long maxrss;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:e:n:t:")) != -1) {
+		switch (ch) {
+		case 'c':
+			cfsm = optarg;
+			break;
+		case 'e':
+			nevents = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			ntrans = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			tdir = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0 || nevents == 0 || ntrans == 0 || ntrans > nevents)
+		usage();
+
+	printf("%10s %8s %12s %10s %16s %12s\n", "states", "events",
+	    "transitions", "seconds", "usec/transition", "peak MB");
+	for (; argc > 0; argc--, argv++) {
+		if ((nstates = strtoul(*argv, NULL, 10)) < 2)
+			usage();
+		generate(INPUT_PATH, nstates, nevents, ntrans);
+		gettimeofday(&start, NULL);
+		if ((maxrss = run_cfsm(cfsm, tdir)) == -1)
+			errx(1, "cfsm failed on %lu states", nstates);
+		gettimeofday(&end, NULL);
+		secs = (end.tv_sec - start.tv_sec) +
+		    (end.tv_usec - start.tv_usec) / 1000000.0;
+		printf("%10lu %8lu %12lu %10.2f %16.3f %12.1f\n", nstates,
+		    nevents, nstates * ntrans, secs, secs * 1000000.0 /
+		    (nstates * ntrans), maxrss / 1024.0);
+		fflush(stdout);
+	}
+	unlink(INPUT_PATH);
+	unlink(OUTPUT_PATH);
+	unlink("bench_fsm.h");
+	return 0;
+}
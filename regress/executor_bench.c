@@ -0,0 +1,168 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+/*
+ * Measure the throughput of the libcfsm executor. A population of the
+ * t13 ring FSM is driven by a few producer threads, each submitting the
+ * events for its own share of the instances in order, and the executor
+ * is timed from the first submission until every event has been handled.
+ * This is repeated for each worker count given on the command line.
+ *
+ * One tab-separated line is printed per worker count, after a header
+ * line naming the columns, as for advance_bench.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <err.h>
+#include <pthread.h>
+
+#include "libcfsm.h"
+#include "t13_fsm.h"
+
+struct instance {
+	struct fsm fsm;
+	u_long failures;
+};
+
+static struct cfsm_executor *ex;
+static struct instance *instances;
+static u_long ninstances = 100000, nevents = 4000000, work;
+static u_int nproducers = 4;
+
+static const enum fsm_event ring[] = { AB, BC, CA };
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: executor_bench [-i instances] [-n events] "
+	    "[-p producers] [-q queue_len]\n    [-w work] workers ...\n");
+	exit(1);
+}
+
+static void
+dispatch(void *arg, u_long id, int ev)
+{
+	struct instance *in = &instances[id];
+	volatile u_long i;
+
+	if (fsm_advance(&in->fsm, ev, NULL, 0) != CFSM_OK)
+		in->failures++;
+	/* Stand in for whatever else a real callback would do */
+	for (i = 0; i < work; i++)
+		;
+}
+
+static void *
+produce(void *arg)
+{
+	u_long p = *(u_long *)arg, id, n, round;
+
+	for (n = p, round = 0; n < nevents; round++) {
+		for (id = p; id < ninstances && n < nevents;
+		    id += nproducers, n += nproducers) {
+			while (cfsm_executor_submit(ex, id,
+			    ring[round % 3]) != CFSM_OK)
+				sched_yield();
+		}
+	}
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t *threads;
+	u_long *ids, id, failures;
+	struct timespec start, end;
+	size_t queue_len = 1024;
+	u_int nworkers, i;
+	double ns;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "i:n:p:q:w:")) != -1) {
+		switch (ch) {
+		case 'i':
+			ninstances = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			nevents = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			nproducers = strtoul(optarg, NULL, 10);
+			break;
+		case 'q':
+			queue_len = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			work = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0 || ninstances == 0 || nevents == 0 ||
+	    nproducers == 0 || nproducers > ninstances || queue_len == 0)
+		usage();
+	if ((instances = calloc(ninstances, sizeof(*instances))) == NULL ||
+	    (threads = calloc(nproducers, sizeof(*threads))) == NULL ||
+	    (ids = calloc(nproducers, sizeof(*ids))) == NULL)
+		errx(1, "%s(%d): calloc", __func__, __LINE__);
+
+	printf("workers\tproducers\tinstances\tevents\tns_per_event\t"
+	    "events_per_sec\n");
+	for (; argc > 0; argc--, argv++) {
+		if ((nworkers = strtoul(*argv, NULL, 10)) == 0)
+			usage();
+		for (id = 0; id < ninstances; id++) {
+			memset(&instances[id], 0, sizeof(instances[id]));
+			fsm_init(&instances[id].fsm, NULL, 0);
+		}
+		if ((ex = cfsm_executor_new(nworkers, queue_len, dispatch,
+		    NULL)) == NULL)
+			err(1, "cfsm_executor_new");
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < nproducers; i++) {
+			ids[i] = i;
+			if (pthread_create(&threads[i], NULL, produce,
+			    &ids[i]) != 0)
+				errx(1, "pthread_create failed");
+		}
+		for (i = 0; i < nproducers; i++)
+			pthread_join(threads[i], NULL);
+		cfsm_executor_wait(ex);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		cfsm_executor_free(ex);
+
+		/* Events handled out of order would have been rejected */
+		for (id = 0, failures = 0; id < ninstances; id++)
+			failures += instances[id].failures;
+		if (failures != 0)
+			errx(1, "%lu events failed with %u workers",
+			    failures, nworkers);
+
+		ns = (end.tv_sec - start.tv_sec) * 1e9 +
+		    (end.tv_nsec - start.tv_nsec);
+		printf("%u\t%u\t%lu\t%lu\t%.3f\t%.0f\n", nworkers, nproducers,
+		    ninstances, nevents, ns / nevents, nevents / (ns / 1e9));
+		fflush(stdout);
+	}
+	free(ids);
+	free(threads);
+	free(instances);
+	return 0;
+}
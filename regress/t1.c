@@ -16,11 +16,31 @@
 int
 main(int argc, char **argv)
 {
-	struct fsm fsm;
+	struct fsm fsm, fsm2, *fsms[5];
+	enum fsm_event evs[5];
+	int results[5];
+	size_t consumed;
+	enum fsm_state state;
+	enum fsm_event ev;
 
 	assert(fsm_init(&fsm, NULL, 0) == CFSM_OK);
 	assert(fsm_current_state(&fsm) == T1);
 	assert(strcmp(fsm_state_ntop(fsm_current_state(&fsm)), "T1") == 0);
+	assert(fsm_state_pton("T3", &state) == 0 && state == T3);
+	assert(fsm_state_pton("T4", NULL) == 0);
+	assert(fsm_state_pton("T5", &state) == -1 && state == T3);
+	assert(fsm_state_pton("", NULL) == -1);
+	assert(fsm_state_pton(NULL, NULL) == -1);
+	assert(fsm_event_pton("T3_DONE2", &ev) == 0 && ev == T3_DONE2);
+	assert(fsm_event_pton("T3_DONE", NULL) == -1);
+	assert(strcmp(fsm_event_ntop(T3_DONE1), "T3_DONE1") == 0);
+	assert(fsm_can_advance(&fsm, T1_DONE) == 1);
+	assert(fsm_can_advance(&fsm, T2_DONE) == 0);
+	assert(fsm_can_advance(&fsm, 0xffff) == 0);
+	assert(FSM_EVENT_MASK_WORDS == 1);
+	assert(fsm_valid_events(T3)[0] == ((1 << T3_DONE1) | (1 << T3_DONE2)));
+	assert(fsm_valid_events(T4)[0] == 0);
+	assert(fsm_valid_events(0xffff) == NULL);
 	assert(fsm_advance(&fsm, T1_DONE, NULL, 0) == CFSM_OK);
 	assert(fsm_current_state(&fsm) == T2);
 	assert(strcmp(fsm_state_ntop(fsm_current_state(&fsm)), "T2") == 0);
@@ -39,5 +59,45 @@ main(int argc, char **argv)
 	assert(strcmp(fsm_state_ntop(fsm_current_state(&fsm)), "T4") == 0);
 	assert(fsm_advance(&fsm, T1_DONE, NULL, 0) == CFSM_ERR_INVALID_TRANSITION);
 	assert(fsm_current_state(&fsm) == T4);
+
+	/* Batches may mention the same FSM several times */
+	assert(fsm_init(&fsm, NULL, 0) == CFSM_OK);
+	assert(fsm_init(&fsm2, NULL, 0) == CFSM_OK);
+	fsms[0] = &fsm;  evs[0] = T1_DONE;
+	fsms[1] = &fsm2; evs[1] = T2_DONE;
+	fsms[2] = &fsm;  evs[2] = T2_DONE;
+	fsms[3] = &fsm2; evs[3] = T1_DONE;
+	fsms[4] = &fsm;  evs[4] = 0xffff;
+	assert(fsm_advance_batch(fsms, evs, results, 5) == 2);
+	assert(results[0] == CFSM_OK);
+	assert(results[1] == CFSM_ERR_INVALID_TRANSITION);
+	assert(results[2] == CFSM_OK);
+	assert(results[3] == CFSM_OK);
+	assert(results[4] == CFSM_ERR_INVALID_EVENT);
+	assert(fsm_current_state(&fsm) == T3);
+	assert(fsm_current_state(&fsm2) == T2);
+	assert(fsm_advance_batch(fsms, evs, NULL, 0) == 0);
+
+	/* Event sequences on a single FSM */
+	assert(fsm_init(&fsm, NULL, 0) == CFSM_OK);
+	evs[0] = T1_DONE;
+	evs[1] = T2_DONE;
+	evs[2] = T3_DONE1;
+	evs[3] = T2_DONE;
+	evs[4] = T3_DONE2;
+	assert(fsm_advance_run(&fsm, evs, 5, &consumed) == CFSM_OK);
+	assert(consumed == 5);
+	assert(fsm_current_state(&fsm) == T4);
+	assert(fsm_init(&fsm, NULL, 0) == CFSM_OK);
+	evs[2] = T1_DONE;
+	assert(fsm_advance_run(&fsm, evs, 5, &consumed) ==
+	    CFSM_ERR_INVALID_TRANSITION);
+	assert(consumed == 2);
+	assert(fsm_current_state(&fsm) == T3);
+	evs[0] = 0xffff;
+	assert(fsm_advance_run(&fsm, evs, 5, NULL) == CFSM_ERR_INVALID_EVENT);
+	assert(fsm_advance_run(&fsm, evs, 0, &consumed) == CFSM_OK);
+	assert(consumed == 0);
+	assert(fsm_current_state(&fsm) == T3);
 	return 0;
 }
@@ -0,0 +1,144 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "t10_fsm.h"
+
+#define NTHREADS	4
+#define NLOOPS		100000
+
+static struct fsm fsm;
+
+/* Order in which callbacks ran, for the single threaded checks */
+static char order[16];
+static int single = 1;
+
+static int may_acquire_ret = 0, release_on_entry = 0;
+static u_long nprecond, nentries;
+
+/* Only ever incremented while holding BUSY, so needs no atomics */
+static u_long held;
+
+void idle_exit(void);
+void busy_entry(void);
+void acquire_cb(void);
+int may_acquire(void);
+
+static void
+note(const char *what)
+{
+	size_t len = strlen(order);
+
+	if (single && len + strlen(what) < sizeof(order))
+		memcpy(order + len, what, strlen(what) + 1);
+}
+
+void
+idle_exit(void)
+{
+	note("x");
+}
+
+void
+busy_entry(void)
+{
+	note("n");
+	__atomic_fetch_add(&nentries, 1, __ATOMIC_RELAXED);
+	/* Callbacks run after the commit, so may advance the FSM again */
+	if (release_on_entry)
+		assert(fsm_advance_atomic(&fsm, RELEASE, NULL, 0) == CFSM_OK);
+}
+
+void
+acquire_cb(void)
+{
+	note("e");
+}
+
+int
+may_acquire(void)
+{
+	__atomic_fetch_add(&nprecond, 1, __ATOMIC_RELAXED);
+	return may_acquire_ret;
+}
+
+static void *
+contend(void *arg)
+{
+	u_long *acquired = arg;
+	int i, r;
+
+	for (i = 0; i < NLOOPS; i++) {
+		r = fsm_advance_atomic(&fsm, ACQUIRE, NULL, 0);
+		if (r != CFSM_OK) {
+			assert(r == CFSM_ERR_INVALID_TRANSITION);
+			continue;
+		}
+		held++;
+		(*acquired)++;
+		assert(fsm_advance_atomic(&fsm, RELEASE, NULL, 0) == CFSM_OK);
+	}
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t threads[NTHREADS];
+	u_long acquired[NTHREADS], total;
+	char errbuf[256];
+	int i;
+
+	assert(fsm_init(&fsm, NULL, 0) == CFSM_OK);
+
+	/* A failed precondition leaves the state and runs no callbacks */
+	may_acquire_ret = -1;
+	assert(fsm_advance_atomic(&fsm, ACQUIRE, errbuf, sizeof(errbuf)) ==
+	    CFSM_ERR_PRECONDITION);
+	assert(strcmp(errbuf, "State BUSY entry precondition not satisfied")
+	    == 0);
+	assert(fsm_current_state(&fsm) == IDLE && *order == '\0');
+	may_acquire_ret = 0;
+
+	/* Callbacks run once each, in the usual order */
+	assert(fsm_advance_atomic(&fsm, ACQUIRE, NULL, 0) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == BUSY);
+	assert(strcmp(order, "exn") == 0);
+	assert(fsm_advance_atomic(&fsm, ACQUIRE, errbuf, sizeof(errbuf)) ==
+	    CFSM_ERR_INVALID_TRANSITION);
+	assert(strcmp(errbuf, "Invalid event ACQUIRE in state BUSY") == 0);
+	assert(fsm_advance_atomic(&fsm, RELEASE, NULL, 0) == CFSM_OK);
+	assert(fsm_advance_atomic(&fsm, 99, NULL, 0) == CFSM_ERR_INVALID_EVENT);
+
+	release_on_entry = 1;
+	assert(fsm_advance_atomic(&fsm, ACQUIRE, NULL, 0) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == IDLE);
+	release_on_entry = 0;
+
+	/* BUSY is held by one thread at a time; no acquisition is lost */
+	single = 0;
+	nprecond = nentries = 0;
+	for (i = 0; i < NTHREADS; i++) {
+		acquired[i] = 0;
+		assert(pthread_create(&threads[i], NULL, contend,
+		    &acquired[i]) == 0);
+	}
+	for (i = 0, total = 0; i < NTHREADS; i++) {
+		assert(pthread_join(threads[i], NULL) == 0);
+		total += acquired[i];
+	}
+	assert(total > 0 && held == total && nentries == total);
+	assert(nprecond >= total);
+	assert(fsm_current_state(&fsm) == IDLE);
+	return 0;
+}
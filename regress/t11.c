@@ -0,0 +1,150 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "t11_fsm.h"
+
+/* What the entry callbacks post, ending with -1 */
+struct posts {
+	int working[4];
+	int done[4];
+};
+
+static int depth, max_depth, nentries;
+
+void working_entry(enum fsm_state, void *);
+void done_entry(enum fsm_state, void *);
+
+static void
+post_all(struct fsm *fsm, const int *evs)
+{
+	for (; *evs != -1; evs++)
+		assert(fsm_post(fsm, *evs) == CFSM_OK);
+}
+
+static void
+entered(void)
+{
+	nentries++;
+	if (++depth > max_depth)
+		max_depth = depth;
+}
+
+void
+working_entry(enum fsm_state new_state, void *ctx)
+{
+	struct fsm *fsm = ctx;
+	struct posts *p = (struct posts *)(fsm + 1);
+
+	entered();
+	assert(new_state == WORKING);
+	post_all(fsm, p->working);
+	depth--;
+}
+
+void
+done_entry(enum fsm_state new_state, void *ctx)
+{
+	struct fsm *fsm = ctx;
+	struct posts *p = (struct posts *)(fsm + 1);
+
+	entered();
+	assert(new_state == DONE);
+	post_all(fsm, p->done);
+	depth--;
+}
+
+int
+main(int argc, char **argv)
+{
+	/* The callbacks find the posts to make just after the FSM */
+	struct {
+		struct fsm fsm;
+		struct posts p;
+	} t;
+	struct fsm *fsm = &t.fsm, *fsms[2];
+	enum fsm_event evs[2];
+	void *ctxs[2];
+	int results[2];
+	char errbuf[256];
+	size_t consumed;
+
+	assert((void *)&t.p == (void *)(fsm + 1));
+	assert(fsm_init(fsm, NULL, 0) == CFSM_OK);
+
+	/* A posted event runs once the event that posted it completes */
+	t.p.working[0] = FINISH;
+	t.p.working[1] = -1;
+	t.p.done[0] = -1;
+	assert(fsm_advance(fsm, START, fsm, NULL, 0) == CFSM_OK);
+	assert(fsm_current_state(fsm) == DONE);
+	assert(nentries == 2 && max_depth == 1);
+
+	/* Events posted by posted events run too */
+	assert(fsm_advance(fsm, RESET, fsm, NULL, 0) == CFSM_OK);
+	t.p.done[0] = RESET;
+	t.p.done[1] = -1;
+	nentries = 0;
+	assert(fsm_advance(fsm, START, fsm, NULL, 0) == CFSM_OK);
+	assert(fsm_current_state(fsm) == IDLE);
+	assert(nentries == 2 && max_depth == 1);
+	t.p.done[0] = -1;
+
+	/*
+	 * A failing posted event is reported as the caller's and discards
+	 * the rest of the queue
+	 */
+	assert(fsm_advance(fsm, RESET, fsm, NULL, 0) == CFSM_OK);
+	t.p.working[0] = START;
+	t.p.working[1] = FINISH;
+	t.p.working[2] = -1;
+	assert(fsm_advance(fsm, START, fsm, errbuf, sizeof(errbuf)) ==
+	    CFSM_ERR_INVALID_TRANSITION);
+	assert(strcmp(errbuf, "Invalid event START in state WORKING") == 0);
+	assert(fsm_current_state(fsm) == WORKING);
+	assert(fsm_advance(fsm, RESET, fsm, NULL, 0) == CFSM_OK);
+	assert(fsm_current_state(fsm) == IDLE);
+
+	/* The queue is bounded; events posted outside wait for an advance */
+	assert(fsm_post(fsm, RESET) == CFSM_OK);
+	assert(fsm_post(fsm, RESET) == CFSM_OK);
+	assert(fsm_post(fsm, START) == CFSM_OK);
+	assert(fsm_post(fsm, FINISH) == CFSM_OK);
+	assert(fsm_post(fsm, RESET) == CFSM_ERR_QUEUE_FULL);
+	assert(fsm_current_state(fsm) == IDLE);
+	t.p.working[0] = -1;
+	assert(fsm_advance(fsm, RESET, fsm, NULL, 0) == CFSM_OK);
+	assert(fsm_current_state(fsm) == DONE);
+
+	/* As do the batch and run functions */
+	t.p.working[0] = FINISH;
+	t.p.working[1] = -1;
+	fsms[0] = fsms[1] = fsm;
+	ctxs[0] = ctxs[1] = fsm;
+	evs[0] = RESET;
+	evs[1] = START;
+	assert(fsm_advance_batch(fsms, evs, ctxs, results, 2) == 0);
+	assert(fsm_current_state(fsm) == DONE);
+	t.p.working[0] = -1;
+	evs[0] = RESET;
+	evs[1] = START;
+	assert(fsm_advance_run(fsm, evs, 2, fsm, &consumed) == CFSM_OK);
+	assert(consumed == 2 && fsm_current_state(fsm) == WORKING);
+	t.p.working[0] = START;
+	t.p.working[1] = -1;
+	assert(fsm_advance(fsm, RESET, fsm, NULL, 0) == CFSM_OK);
+	assert(fsm_advance_run(fsm, evs + 1, 1, fsm, &consumed) ==
+	    CFSM_ERR_INVALID_TRANSITION);
+	assert(consumed == 1 && fsm_current_state(fsm) == WORKING);
+	assert(max_depth == 1);
+	return 0;
+}
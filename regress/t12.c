@@ -0,0 +1,136 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "t12_fsm.h"
+
+#define NPRODUCERS	4
+#define NLOOPS		100000
+
+/* What the owner has received, passed to the callback as the context */
+struct received {
+	u_long count[NPRODUCERS];
+	int next[NPRODUCERS];		/* Event expected next, 0 = A, 1 = B */
+	char order[16];			/* First few events, as letters */
+};
+
+static struct fsm fsm;
+
+void received(enum fsm_event, void *);
+
+void
+received(enum fsm_event ev, void *ctx)
+{
+	struct received *r = ctx;
+	size_t len = strlen(r->order);
+
+	/* Events from each producer must arrive in the order they were sent */
+	assert(ev / 2 < NPRODUCERS);
+	assert(r->next[ev / 2] == (int)ev % 2);
+	r->next[ev / 2] = !r->next[ev / 2];
+	r->count[ev / 2]++;
+	if (len + 1 < sizeof(r->order)) {
+		r->order[len] = 'a' + ev;
+		r->order[len + 1] = '\0';
+	}
+}
+
+static void *
+produce(void *arg)
+{
+	u_int p = *(u_int *)arg;
+	int i, r;
+
+	for (i = 0; i < NLOOPS; i++) {
+		/* A full mailbox only ever fails the send; try again later */
+		while ((r = fsm_send(&fsm, 2 * p + i % 2)) != CFSM_OK) {
+			assert(r == CFSM_ERR_QUEUE_FULL);
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t threads[NPRODUCERS];
+	u_int ids[NPRODUCERS];
+	struct received r;
+	u_long total;
+	int i, results[4];
+
+	assert(fsm_init(&fsm, NULL, 0) == CFSM_OK);
+	memset(&r, 0, sizeof(r));
+	assert(fsm_drain(&fsm, &r, NULL, 100) == 0);
+
+	/* Events are executed in the order they were sent, up to "max" */
+	assert(fsm_send(&fsm, P0A) == CFSM_OK);
+	assert(fsm_send(&fsm, P1A) == CFSM_OK);
+	assert(fsm_send(&fsm, P0B) == CFSM_OK);
+	assert(fsm_drain(&fsm, &r, NULL, 2) == 2);
+	assert(strcmp(r.order, "ac") == 0);
+	assert(fsm_drain(&fsm, &r, NULL, 100) == 1);
+	assert(strcmp(r.order, "acb") == 0);
+
+	/* The mailbox holds 8 events; the ninth is refused, not waited for */
+	for (i = 0; i < 8; i++)
+		assert(fsm_send(&fsm, P2A + i % 2) == CFSM_OK);
+	assert(fsm_send(&fsm, P3A) == CFSM_ERR_QUEUE_FULL);
+	assert(fsm_drain(&fsm, &r, NULL, 100) == 8);
+	assert(r.count[2] == 8);
+
+	/* Failed events are counted and do not stop the drain */
+	assert(fsm_send(&fsm, STOP) == CFSM_OK);
+	assert(fsm_send(&fsm, STOP) == CFSM_OK);
+	assert(fsm_send(&fsm, START) == CFSM_OK);
+	assert(fsm_drain(&fsm, &r, NULL, 100) == 3);
+	assert(fsm_current_state(&fsm) == RUNNING);
+
+	/* The owner learns which events were rejected, and why */
+	assert(fsm_send(&fsm, START) == CFSM_OK);
+	assert(fsm_send(&fsm, STOP) == CFSM_OK);
+	assert(fsm_send(&fsm, P0A) == CFSM_OK);
+	assert(fsm_send(&fsm, START) == CFSM_OK);
+	for (i = 0; i < 4; i++)
+		results[i] = -100;
+	assert(fsm_drain(&fsm, &r, results, 3) == 3);
+	assert(results[0] == CFSM_ERR_INVALID_TRANSITION);
+	assert(results[1] == CFSM_OK);
+	assert(results[2] == CFSM_ERR_INVALID_TRANSITION);
+	assert(results[3] == -100);
+	assert(fsm_drain(&fsm, &r, results, 100) == 1);
+	assert(results[0] == CFSM_OK);
+	assert(fsm_current_state(&fsm) == RUNNING);
+
+	/* Producers never wait for the owner, which drains in batches */
+	memset(&r, 0, sizeof(r));
+	for (i = 0; i < NPRODUCERS; i++) {
+		ids[i] = i;
+		assert(pthread_create(&threads[i], NULL, produce,
+		    &ids[i]) == 0);
+	}
+	for (total = 0; total < NPRODUCERS * NLOOPS; ) {
+		if (fsm_drain(&fsm, &r, NULL, 5) == 0)
+			sched_yield();
+		for (i = 0, total = 0; i < NPRODUCERS; i++)
+			total += r.count[i];
+	}
+	for (i = 0; i < NPRODUCERS; i++) {
+		assert(pthread_join(threads[i], NULL) == 0);
+		assert(r.count[i] == NLOOPS && r.next[i] == 0);
+	}
+	assert(fsm_drain(&fsm, &r, NULL, 100) == 0);
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "libcfsm.h"
+#include "t13_fsm.h"
+
+#define NINSTANCES	1000
+#define NPRODUCERS	4
+#define NROUNDS		200
+
+struct instance {
+	struct fsm fsm;
+	int active;		/* Set while an event is being handled */
+	u_long handled;
+	u_long chained;		/* Events left to submit from dispatch */
+};
+
+static struct instance instances[NINSTANCES];
+static struct cfsm_executor *ex;
+static u_long failures;
+
+/* The events the instances accept, in the order they accept them */
+static const enum fsm_event ring[] = { AB, BC, CA };
+
+static void
+dispatch(void *arg, u_long id, int ev)
+{
+	struct instance *in = &instances[id];
+
+	assert(arg == instances && id < NINSTANCES);
+	/* Never more than one worker at a time on an instance */
+	assert(__atomic_exchange_n(&in->active, 1, __ATOMIC_RELAXED) == 0);
+	/* Events arriving out of order would be rejected */
+	if (fsm_advance(&in->fsm, ev, NULL, 0) != CFSM_OK)
+		__atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+	in->handled++;
+	if (in->chained > 0) {
+		in->chained--;
+		assert(cfsm_executor_submit(ex, id,
+		    ring[in->handled % 3]) == CFSM_OK);
+	}
+	__atomic_store_n(&in->active, 0, __ATOMIC_RELAXED);
+}
+
+static void
+submit(u_long id, int ev)
+{
+	int r;
+
+	/* A full queue only ever fails the submission; try again later */
+	while ((r = cfsm_executor_submit(ex, id, ev)) != CFSM_OK) {
+		assert(r == CFSM_ERR_QUEUE_FULL);
+		sched_yield();
+	}
+}
+
+static void *
+produce(void *arg)
+{
+	u_long p = *(u_long *)arg, id;
+	int i;
+
+	for (i = 0; i < NROUNDS; i++) {
+		for (id = p; id < NINSTANCES; id += NPRODUCERS)
+			submit(id, ring[i % 3]);
+	}
+	return NULL;
+}
+
+static void
+run(u_int nworkers, size_t queue_len)
+{
+	pthread_t threads[NPRODUCERS];
+	u_long ids[NPRODUCERS], id;
+	int i;
+
+	for (id = 0; id < NINSTANCES; id++) {
+		memset(&instances[id], 0, sizeof(instances[id]));
+		assert(fsm_init(&instances[id].fsm, NULL, 0) == CFSM_OK);
+	}
+	failures = 0;
+	assert((ex = cfsm_executor_new(nworkers, queue_len, dispatch,
+	    instances)) != NULL);
+
+	for (i = 0; i < NPRODUCERS; i++) {
+		ids[i] = i;
+		assert(pthread_create(&threads[i], NULL, produce,
+		    &ids[i]) == 0);
+	}
+	for (i = 0; i < NPRODUCERS; i++)
+		assert(pthread_join(threads[i], NULL) == 0);
+	cfsm_executor_wait(ex);
+	assert(failures == 0);
+	for (id = 0; id < NINSTANCES; id++) {
+		assert(instances[id].handled == NROUNDS);
+		assert(fsm_current_state(&instances[id].fsm) ==
+		    (enum fsm_state)(NROUNDS % 3));
+	}
+
+	/* Events submitted from dispatch are waited for too */
+	instances[0].chained = 5;
+	submit(0, ring[NROUNDS % 3]);
+	cfsm_executor_wait(ex);
+	assert(failures == 0 && instances[0].handled == NROUNDS + 6);
+
+	/* The executor may be reused after waiting, and freed busy */
+	for (id = 0; id < NINSTANCES; id++)
+		submit(id, ring[instances[id].handled % 3]);
+	cfsm_executor_free(ex);
+	assert(failures == 0);
+	for (id = 0; id < NINSTANCES; id++)
+		assert(instances[id].handled == NROUNDS + 1 + 6 * (id == 0));
+}
+
+int
+main(int argc, char **argv)
+{
+	assert(cfsm_executor_new(0, 16, dispatch, NULL) == NULL);
+
+	run(1, 16);
+	run(3, 1);
+	run(8, 64);
+	return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "t14_fsm.h"
+
+#define NINSTANCES	2000
+#define NSTEPS		20000
+
+/* What each instance expects, worked out independently of the wheel */
+struct model {
+	enum fsm_state state;
+	uint64_t expires;		/* 0 if no timer is armed */
+};
+
+static struct fsm fsms[NINSTANCES];
+static struct model models[NINSTANCES];
+static int released = 1;
+static uint32_t rnd = 1;
+
+int may_release(void *);
+
+int
+may_release(void *ctx)
+{
+	assert(ctx == &released);
+	return *(int *)ctx ? 0 : -1;
+}
+
+static uint32_t
+next_random(void)
+{
+	rnd = rnd * 1103515245 + 12345;
+	return rnd >> 8;
+}
+
+static uint64_t
+timeout_of(enum fsm_state s)
+{
+	switch (s) {
+	case CONNECTING:
+		return 30 * 1000;
+	case UP:
+		return 5 * 60 * 1000;
+	case HELD:
+		return 250;
+	case DORMANT:
+		return 36 * 60 * 60 * 1000ULL;
+	default:
+		return 0;
+	}
+}
+
+static enum fsm_state
+next_state(enum fsm_state s, enum fsm_event ev)
+{
+	switch (s) {
+	case IDLE:
+		return ev == CONNECT ? CONNECTING : ev == HOLD ? HELD :
+		    ev == SLEEP ? DORMANT : -1;
+	case CONNECTING:
+		return ev == CONNECTED ? UP : ev == CLOSE ? IDLE : -1;
+	case UP:
+		return ev == DATA ? UP : ev == CLOSE ? IDLE : -1;
+	case HELD:
+		return ev == CLOSE ? IDLE : -1;
+	case DORMANT:
+		return ev == CONNECT ? CONNECTING : -1;
+	default:
+		return -1;
+	}
+}
+
+static void
+single(void)
+{
+	struct fsm_timers timers;
+	struct fsm f;
+
+	fsm_timers_init(&timers, 1000);
+	fsm_init(&f, NULL, 0);
+	fsm_timers_attach(&f, &timers, &released);
+	assert(timers.count == 0);
+
+	/* A timeout fires exactly when it is due and not before */
+	assert(fsm_advance(&f, CONNECT, &released, NULL, 0) == CFSM_OK);
+	assert(timers.count == 1);
+	assert(fsm_timers_advance(&timers, 1000 + 29999) == 0);
+	assert(fsm_current_state(&f) == CONNECTING);
+	assert(fsm_timers_advance(&timers, 1000 + 30000) == 1);
+	assert(fsm_current_state(&f) == IDLE);
+	assert(timers.count == 0);
+
+	/* Leaving a state disarms its timer; re-entering it restarts it */
+	assert(fsm_advance(&f, CONNECT, &released, NULL, 0) == CFSM_OK);
+	assert(fsm_advance(&f, CONNECTED, &released, NULL, 0) == CFSM_OK);
+	assert(timers.count == 1);
+	assert(fsm_timers_advance(&timers, timers.now + 4 * 60 * 1000) == 0);
+	assert(fsm_advance(&f, DATA, &released, NULL, 0) == CFSM_OK);
+	assert(fsm_timers_advance(&timers, timers.now + 4 * 60 * 1000) == 0);
+	assert(fsm_current_state(&f) == UP);
+	assert(fsm_timers_advance(&timers, timers.now + 60 * 1000) == 1);
+	assert(fsm_current_state(&f) == IDLE);
+
+	/* A refused timeout leaves the FSM where it was, without a timer */
+	released = 0;
+	assert(fsm_advance(&f, HOLD, &released, NULL, 0) == CFSM_OK);
+	assert(fsm_timers_advance(&timers, timers.now + 250) == 1);
+	assert(fsm_current_state(&f) == HELD);
+	assert(timers.count == 0);
+	released = 1;
+	assert(fsm_advance(&f, CLOSE, &released, NULL, 0) == CFSM_OK);
+
+	/* Long timeouts start on the coarsest levels and cascade down */
+	assert(fsm_advance(&f, SLEEP, &released, NULL, 0) == CFSM_OK);
+	assert(fsm_timers_advance(&timers,
+	    timers.now + 36 * 60 * 60 * 1000ULL - 1) == 0);
+	assert(fsm_current_state(&f) == DORMANT);
+	assert(fsm_timers_advance(&timers, timers.now + 1) == 1);
+	assert(fsm_current_state(&f) == IDLE);
+
+	/* Detaching disarms */
+	assert(fsm_advance(&f, CONNECT, &released, NULL, 0) == CFSM_OK);
+	assert(timers.count == 1);
+	fsm_timers_detach(&f);
+	assert(timers.count == 0);
+	assert(fsm_timers_advance(&timers, timers.now + 60 * 1000) == 0);
+	assert(fsm_current_state(&f) == CONNECTING);
+}
+
+/* Drive a population at random and compare it against the model */
+static void
+population(void)
+{
+	static const enum fsm_event evs[] = {
+		CONNECT, CONNECTED, DATA, CLOSE, HOLD, SLEEP
+	};
+	struct fsm_timers timers;
+	size_t i, j, step, expected;
+	enum fsm_state next;
+	enum fsm_event ev;
+	uint64_t now = 123456789;
+
+	fsm_timers_init(&timers, now);
+	for (i = 0; i < NINSTANCES; i++) {
+		fsm_init(&fsms[i], NULL, 0);
+		fsm_timers_attach(&fsms[i], &timers, &released);
+		models[i].state = IDLE;
+		models[i].expires = 0;
+	}
+	for (step = 0; step < NSTEPS; step++) {
+		for (i = next_random() % 8; i > 0; i--) {
+			j = next_random() % NINSTANCES;
+			ev = evs[next_random() % 6];
+			next = next_state(models[j].state, ev);
+			assert(fsm_advance(&fsms[j], ev, &released,
+			    NULL, 0) == (next == (enum fsm_state)-1 ?
+			    CFSM_ERR_INVALID_TRANSITION : CFSM_OK));
+			if (next == (enum fsm_state)-1)
+				continue;
+			models[j].state = next;
+			models[j].expires = timeout_of(next) == 0 ? 0 :
+			    now + timeout_of(next);
+		}
+
+		/* Mostly short steps, with the occasional long gap */
+		if (next_random() % 100 == 0)
+			now += next_random() % (2 * 60 * 60 * 1000);
+		else
+			now += next_random() % 2000;
+		for (i = expected = 0; i < NINSTANCES; i++) {
+			if (models[i].expires == 0 || models[i].expires > now)
+				continue;
+			expected++;
+			models[i].state = IDLE;
+			models[i].expires = 0;
+		}
+		assert(fsm_timers_advance(&timers, now) == expected);
+		assert(timers.now == now);
+		for (i = 0; i < NINSTANCES; i++)
+			assert(fsm_current_state(&fsms[i]) == models[i].state);
+	}
+	for (i = 0; i < NINSTANCES; i++)
+		fsm_timers_detach(&fsms[i]);
+	assert(timers.count == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	single();
+	population();
+	return 0;
+}
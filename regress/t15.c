@@ -0,0 +1,125 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "t15_fsm.h"
+
+#define NINSTANCES	100000
+#define SNAPSHOT_PATH	"t15_snapshot"
+
+static struct fsm fsms[NINSTANCES];
+
+/* Each instance is left in a state that depends on its index */
+static enum fsm_state
+expected(size_t i)
+{
+	switch (i % 3) {
+	case 0:
+		return IDLE;
+	case 1:
+		return RUNNING;
+	default:
+		return PAUSED;
+	}
+}
+
+/* A copy of "snap" with its header altered must be rejected */
+static void
+reject(const u_char *snap, size_t len, size_t off, u_char x)
+{
+	u_char *copy;
+	size_t n = 1234;
+
+	assert((copy = malloc(len)) != NULL);
+	memcpy(copy, snap, len);
+	copy[off] ^= x;
+	assert(fsm_snapshot_check(copy, len, &n) == CFSM_ERR_SNAPSHOT);
+	assert(n == 1234);
+	assert(fsm_restore(copy, len, &n) == NULL);
+	free(copy);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct fsm_snapshot_header *h;
+	struct fsm *restored;
+	u_char *snap, *map;
+	size_t i, len, n;
+	int fd;
+
+	for (i = 0; i < NINSTANCES; i++) {
+		assert(fsm_init(&fsms[i]) == CFSM_OK);
+		if (i % 3 != 0)
+			assert(fsm_advance(&fsms[i], START) == CFSM_OK);
+		if (i % 3 == 2)
+			assert(fsm_advance(&fsms[i], PAUSE) == CFSM_OK);
+	}
+	/* Failures are part of a compact instance, so are kept too */
+	assert(fsm_advance(&fsms[0], STOP) == CFSM_ERR_INVALID_TRANSITION);
+
+	len = fsm_snapshot_size(NINSTANCES);
+	assert(len == sizeof(*h) + NINSTANCES * FSM_INSTANCE_SIZE);
+	assert(fsm_snapshot_size(SIZE_MAX) == 0);
+	assert((snap = malloc(len)) != NULL);
+	assert(fsm_snapshot(fsms, NINSTANCES, snap, len - 1) ==
+	    CFSM_ERR_SNAPSHOT);
+	assert(fsm_snapshot(fsms, NINSTANCES, snap, len) == CFSM_OK);
+	h = (struct fsm_snapshot_header *)snap;
+	assert(h->fingerprint == FSM_FINGERPRINT);
+	assert(h->ninstances == NINSTANCES);
+	assert(fsm_snapshot_check(snap, len, &n) == CFSM_OK);
+	assert(n == NINSTANCES);
+
+	/* Anything that does not match this FSM is refused from the header */
+	reject(snap, len, 0, 0xff);
+	reject(snap, len, offsetof(struct fsm_snapshot_header, byte_order),
+	    0x03);
+	reject(snap, len, offsetof(struct fsm_snapshot_header, record_size),
+	    0x10);
+	reject(snap, len, offsetof(struct fsm_snapshot_header, fingerprint),
+	    0x01);
+	reject(snap, len, offsetof(struct fsm_snapshot_header, ninstances) + 3,
+	    0x80);
+	assert(fsm_snapshot_check(snap, len - 1, NULL) == CFSM_ERR_SNAPSHOT);
+	assert(fsm_snapshot_check(snap, sizeof(*h) - 1, NULL) ==
+	    CFSM_ERR_SNAPSHOT);
+
+	/* Write it out, then map it back and use the instances in place */
+	assert((fd = open(SNAPSHOT_PATH, O_RDWR|O_CREAT|O_TRUNC, 0600)) != -1);
+	assert(write(fd, snap, len) == (ssize_t)len);
+	map = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	assert(map != MAP_FAILED);
+	close(fd);
+	unlink(SNAPSHOT_PATH);
+
+	assert((restored = fsm_restore(map, len, &n)) != NULL);
+	assert((u_char *)restored == map + sizeof(*h));
+	assert(n == NINSTANCES);
+	for (i = 0; i < n; i++)
+		assert(fsm_current_state(&restored[i]) == expected(i));
+	assert(memcmp(&restored[0].last_error, &fsms[0].last_error,
+	    sizeof(fsms[0].last_error)) == 0);
+	assert(fsm_advance(&restored[2], START) == CFSM_OK);
+	assert(fsm_current_state(&restored[2]) == RUNNING);
+	assert(fsm_current_state(&fsms[2]) == PAUSED);
+
+	munmap(map, len);
+	free(snap);
+	return 0;
+}
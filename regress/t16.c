@@ -0,0 +1,74 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "t16_fsm.h"
+
+#define NINSTANCES	1000
+
+static struct fsm before[NINSTANCES], after[NINSTANCES];
+
+int
+main(int argc, char **argv)
+{
+	struct fsm_snapshot_header *h;
+	u_char *snap;
+	size_t i, len, n;
+
+	for (i = 0; i < NINSTANCES; i++) {
+		assert(fsm_init(&before[i], NULL, 0) == CFSM_OK);
+		assert(fsm_init(&after[i], NULL, 0) == CFSM_OK);
+		if (i % 3 != 0)
+			assert(fsm_advance(&before[i], START,
+			    NULL, 0) == CFSM_OK);
+		if (i % 3 == 2)
+			assert(fsm_advance(&before[i], PAUSE,
+			    NULL, 0) == CFSM_OK);
+	}
+
+	/* Only the states are kept, packed into the smallest type */
+	len = fsm_snapshot_size(NINSTANCES);
+	assert(len == sizeof(*h) + NINSTANCES);
+	assert((snap = malloc(len)) != NULL);
+	assert(fsm_snapshot(before, NINSTANCES, snap, len) == CFSM_OK);
+	h = (struct fsm_snapshot_header *)snap;
+	assert(h->record_size == 1);
+	assert(fsm_snapshot_check(snap, len, &n) == CFSM_OK);
+	assert(n == NINSTANCES);
+
+	/* The count must match, and a bad state spoils the whole restore */
+	assert(fsm_restore(after, NINSTANCES - 1, snap, len) ==
+	    CFSM_ERR_SNAPSHOT);
+	snap[len - 1] = 3;
+	assert(fsm_restore(after, NINSTANCES, snap, len) ==
+	    CFSM_ERR_SNAPSHOT);
+	for (i = 0; i < NINSTANCES; i++)
+		assert(fsm_current_state(&after[i]) == IDLE);
+	snap[len - 1] = fsm_current_state(&before[NINSTANCES - 1]);
+	h->fingerprint ^= 1;
+	assert(fsm_restore(after, NINSTANCES, snap, len) ==
+	    CFSM_ERR_SNAPSHOT);
+	h->fingerprint ^= 1;
+
+	assert(fsm_restore(after, NINSTANCES, snap, len) == CFSM_OK);
+	for (i = 0; i < NINSTANCES; i++) {
+		assert(fsm_current_state(&after[i]) ==
+		    fsm_current_state(&before[i]));
+	}
+	assert(fsm_advance(&after[2], START, NULL, 0) == CFSM_OK);
+	assert(fsm_current_state(&after[2]) == RUNNING);
+
+	free(snap);
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <cassert>
+#include <cstring>
+
+#include "t17_fsm.hpp"
+
+/* Counts what the FSM called; preconditions are satisfied when 0 */
+struct counter {
+	int ticks = 0;
+	int idle_exits = 0;
+	int running_entries = 0;
+	int run_allowed = 1;
+	int stop_allowed = 1;
+
+	constexpr int
+	may_run(fsm_state new_state)
+	{
+		return new_state == fsm_state::RUNNING && run_allowed ? 0 : -1;
+	}
+
+	constexpr int
+	may_stop(fsm_event ev, fsm_state old_state)
+	{
+		return ev == fsm_event::STOP && old_state != fsm_state::DONE &&
+		    stop_allowed ? 0 : -1;
+	}
+
+	constexpr void
+	count_tick(fsm_event ev)
+	{
+		if (ev == fsm_event::TICK)
+			ticks++;
+	}
+
+	constexpr void
+	left_idle(fsm_state old_state, fsm_state new_state)
+	{
+		if (old_state == fsm_state::IDLE &&
+		    new_state == fsm_state::RUNNING)
+			idle_exits++;
+	}
+
+	constexpr void
+	entered_running(fsm_state old_state, fsm_state new_state)
+	{
+		if (new_state == fsm_state::RUNNING)
+			running_entries++;
+	}
+};
+
+/* Checks on the table itself, made by the compiler */
+static_assert(sizeof(fsm_state) == 1 && sizeof(fsm_event) == 1);
+static_assert(fsm<counter>::num_states == 5 &&
+    fsm<counter>::num_events == 6);
+static_assert(!fsm_detail::any_state(fsm_event::PING,
+    fsm_detail::_CFSM_TT_INVALID));
+static_assert(!fsm_detail::any_state(fsm_event::RESET,
+    fsm_detail::_CFSM_TT_IGNORE));
+static_assert(to_string(fsm_event::PAUSE)[0] == 'P' &&
+    to_string(static_cast<fsm_state>(5)) == nullptr);
+
+/* Run the FSM in the compiler, returning something of everything it did */
+static constexpr int
+compile_time_run(void)
+{
+	fsm<counter> f;
+
+	if (f.advance<fsm_event::START>() != CFSM_OK ||
+	    f.advance<fsm_event::TICK>() != CFSM_OK ||
+	    f.advance<fsm_event::TICK>() != CFSM_OK ||
+	    f.advance<fsm_event::PING>() != CFSM_OK ||
+	    f.advance<fsm_event::RESET>() != CFSM_ERR_INVALID_TRANSITION ||
+	    f.advance<fsm_event::STOP>() != CFSM_OK)
+		return -1;
+	return f.callbacks().ticks * 100 + f.callbacks().running_entries * 10 +
+	    static_cast<int>(f.current_state());
+}
+
+static_assert(compile_time_run() ==
+    2 * 100 + 3 * 10 + static_cast<int>(fsm_state::DONE));
+
+/* Advance by a compile-time event chosen at run time */
+static int
+advance_static(fsm<counter> &f, fsm_event ev)
+{
+	switch (ev) {
+	case fsm_event::START:
+		return f.advance<fsm_event::START>();
+	case fsm_event::STOP:
+		return f.advance<fsm_event::STOP>();
+	case fsm_event::PING:
+		return f.advance<fsm_event::PING>();
+	case fsm_event::PAUSE:
+		return f.advance<fsm_event::PAUSE>();
+	case fsm_event::TICK:
+		return f.advance<fsm_event::TICK>();
+	case fsm_event::RESET:
+		return f.advance<fsm_event::RESET>();
+	}
+	return CFSM_ERR_INVALID_EVENT;
+}
+
+/* Returns a FSM that has been moved to state number "s" */
+static fsm<counter>
+in_state(size_t s)
+{
+	fsm<counter> f;
+
+	switch (s) {
+	case 1:
+		assert(f.reset(fsm_state::STANDBY) == CFSM_OK);
+		break;
+	case 2:
+		assert(f.advance<fsm_event::START>() == CFSM_OK);
+		break;
+	case 3:
+		assert(f.advance<fsm_event::START>() == CFSM_OK);
+		assert(f.advance<fsm_event::PAUSE>() == CFSM_OK);
+		break;
+	case 4:
+		assert(f.advance<fsm_event::START>() == CFSM_OK);
+		assert(f.advance<fsm_event::STOP>() == CFSM_OK);
+		break;
+	}
+	assert(f.current_state() == static_cast<fsm_state>(s));
+	return f;
+}
+
+/*
+ * Both advance functions must do the same in every state, for every
+ * event and whether or not the preconditions are satisfied.
+ */
+static void
+compare(void)
+{
+	fsm<counter> a, b;
+	size_t s, e, p;
+	int r;
+
+	for (s = 0; s < fsm<counter>::num_states; s++) {
+		for (e = 0; e < fsm<counter>::num_events; e++) {
+			for (p = 0; p < 4; p++) {
+				a = in_state(s);
+				a.callbacks().run_allowed = (p & 1) != 0;
+				a.callbacks().stop_allowed = (p & 2) != 0;
+				b = a;
+				r = a.advance(static_cast<fsm_event>(e));
+				assert(advance_static(b,
+				    static_cast<fsm_event>(e)) == r);
+				assert(a.current_state() == b.current_state());
+				assert(a.callbacks().ticks == b.callbacks().ticks);
+				assert(a.callbacks().idle_exits ==
+				    b.callbacks().idle_exits);
+				assert(a.callbacks().running_entries ==
+				    b.callbacks().running_entries);
+			}
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	fsm<counter> f;
+
+	/* Starting states */
+	assert(f.current_state() == fsm_state::IDLE);
+	assert(f.reset(fsm_state::STANDBY) == CFSM_OK);
+	assert(f.current_state() == fsm_state::STANDBY);
+	assert(f.reset(fsm_state::RUNNING) == CFSM_ERR_INVALID_STATE);
+	assert(f.current_state() == fsm_state::STANDBY);
+	assert(f.reset(fsm_state::IDLE) == CFSM_OK);
+
+	/* Names */
+	assert(strcmp(to_string(fsm_state::RUNNING), "RUNNING") == 0);
+	assert(strcmp(to_string(fsm_event::RESET), "RESET") == 0);
+	assert(to_string(static_cast<fsm_state>(5)) == nullptr);
+	assert(to_string(static_cast<fsm_event>(6)) == nullptr);
+
+	/* Ignored and invalid events */
+	assert(f.advance(fsm_event::STOP) == CFSM_OK);
+	assert(f.current_state() == fsm_state::IDLE);
+	assert(f.advance(fsm_event::PAUSE) == CFSM_ERR_INVALID_TRANSITION);
+	assert(f.advance(static_cast<fsm_event>(6)) == CFSM_ERR_INVALID_EVENT);
+	assert(f.can_advance(fsm_event::START));
+	assert(f.can_advance(fsm_event::PING));
+	assert(!f.can_advance(fsm_event::TICK));
+	assert(!f.can_advance(static_cast<fsm_event>(6)));
+
+	/* Preconditions and callbacks */
+	f.callbacks().run_allowed = 0;
+	assert(f.advance<fsm_event::START>() == CFSM_ERR_PRECONDITION);
+	assert(f.current_state() == fsm_state::IDLE);
+	assert(f.callbacks().idle_exits == 0);
+	f.callbacks().run_allowed = 1;
+	assert(f.advance<fsm_event::START>() == CFSM_OK);
+	assert(f.current_state() == fsm_state::RUNNING);
+	assert(f.callbacks().idle_exits == 1);
+	assert(f.callbacks().running_entries == 1);
+	assert(f.advance<fsm_event::TICK>() == CFSM_OK);
+	assert(f.advance(fsm_event::TICK) == CFSM_OK);
+	assert(f.callbacks().ticks == 2);
+	assert(f.callbacks().running_entries == 3);
+	f.callbacks().stop_allowed = 0;
+	assert(f.advance<fsm_event::STOP>() == CFSM_ERR_PRECONDITION);
+	assert(f.current_state() == fsm_state::RUNNING);
+	f.callbacks().stop_allowed = 1;
+	assert(f.advance<fsm_event::PAUSE>() == CFSM_OK);
+	assert(f.advance<fsm_event::PAUSE>() == CFSM_OK);
+	assert(f.current_state() == fsm_state::PAUSED);
+	assert(f.advance<fsm_event::STOP>() == CFSM_OK);
+	assert(f.advance<fsm_event::RESET>() == CFSM_OK);
+	assert(f.current_state() == fsm_state::IDLE);
+
+	compare();
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "t18_fsm.h"
+
+int
+main(int argc, char **argv)
+{
+	struct fsm fsm;
+	enum fsm_state s;
+	enum fsm_event ev;
+	char name[8], errbuf[128];
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		snprintf(name, sizeof(name), "S%d", i);
+		assert(strcmp(fsm_state_ntop(i), name) == 0);
+		assert(fsm_state_pton(name, &s) == 0 && s == (enum fsm_state)i);
+		snprintf(name, sizeof(name), "E%d", i);
+		assert(strcmp(fsm_event_ntop(i), name) == 0);
+		assert(fsm_event_pton(name, &ev) == 0 && ev == (enum fsm_event)i);
+		/* States and events share no names */
+		assert(fsm_state_pton(name, &s) == -1);
+	}
+	assert(fsm_state_ntop(16) == NULL);
+	assert(fsm_event_ntop(16) == NULL);
+
+	/* Near misses */
+	assert(fsm_event_pton("E16", &ev) == -1);
+	assert(fsm_event_pton("E", &ev) == -1);
+	assert(fsm_event_pton("e0", &ev) == -1);
+	assert(fsm_event_pton("E00", &ev) == -1);
+	assert(fsm_event_pton("", &ev) == -1);
+	assert(fsm_state_pton("S1 ", &s) == -1);
+
+	/* Go around the ring, looking each event up by name */
+	assert(fsm_init(&fsm, errbuf, sizeof(errbuf)) == CFSM_OK);
+	for (i = 0; i < 32; i++) {
+		snprintf(name, sizeof(name), "E%d", i % 16);
+		assert(fsm_event_pton(name, &ev) == 0);
+		assert(fsm_advance(&fsm, ev, errbuf, sizeof(errbuf)) ==
+		    CFSM_OK);
+		assert(fsm_current_state(&fsm) ==
+		    (enum fsm_state)((i + 1) % 16));
+	}
+
+	return 0;
+}
@@ -37,6 +37,8 @@ int
 main(int argc, char **argv)
 {
 	struct fsm fsm;
+	enum fsm_event evs[4];
+	size_t consumed;
 
 	/* T1b -> T2 - expect fail */
 	assert(fsm_init(&fsm, T1b, NULL, 0) == CFSM_OK);
@@ -137,5 +139,21 @@ main(int argc, char **argv)
 	assert(t3_exit_pre_visited == 3);
 	assert(t3_entry_pre_visited == 3);
 
+	/* Event sequence stops at the T3 -> T4 precondition failure */
+	evs[0] = T3_DONE1;
+	evs[1] = T2_DONE;
+	evs[2] = T3_DONE3;
+	evs[3] = T3_DONE2;
+	assert(fsm_advance_run(&fsm, evs, 4, NULL, &consumed) ==
+	    CFSM_ERR_PRECONDITION);
+	assert(consumed == 2);
+	assert(fsm_current_state(&fsm) == T3);
+	assert(t2_enter_visited == 3);
+	assert(t3_enter_visited == 4);
+	assert(t4_entry_pre_visited == 2);
+	assert(fsm_advance_run(&fsm, evs + 3, 1, NULL, &consumed) == CFSM_OK);
+	assert(consumed == 1);
+	assert(t3_enter_visited == 5);
+
 	return 0;
 }
@@ -0,0 +1,71 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "t4_fsm.h"
+
+#define N	37	/* Not a multiple of the vector width */
+
+int
+main(int argc, char **argv)
+{
+	struct fsm fsm;
+	fsm_state_t states[N], before[N];
+	fsm_event_t evs[N];
+	uint8_t failed[N];
+	size_t i, nfailed;
+	int r;
+
+#if defined(__AVX2__) && defined(__GNUC__)
+	/* Built for the AVX2 kernel, but this CPU cannot run it */
+	if (!__builtin_cpu_supports("avx2"))
+		return 0;
+#endif
+
+	/* A mix of every state and event plus some out of range values */
+	for (i = 0; i < N; i++) {
+		states[i] = (i * 7) % 5;
+		evs[i] = (i * 3) % 4;
+	}
+	memcpy(before, states, sizeof(before));
+	memset(failed, 0xff, sizeof(failed));
+	nfailed = fsm_advance_vector(states, evs, failed, N);
+
+	/* Check each element against the ordinary advance function */
+	for (i = 0; i < N; i++) {
+		if (before[i] > PAUSED || evs[i] > PAUSE) {
+			assert(failed[i] == 1);
+			assert(states[i] == before[i]);
+			nfailed--;
+			continue;
+		}
+		assert(fsm_init(&fsm, NULL, 0) == CFSM_OK);
+		fsm.current_state = before[i];
+		r = fsm_advance(&fsm, evs[i], NULL, 0);
+		assert(failed[i] == (r != CFSM_OK));
+		assert(states[i] == fsm.current_state);
+		if (r != CFSM_OK)
+			nfailed--;
+	}
+	assert(nfailed == 0);
+
+	/* "failed" is optional */
+	states[0] = IDLE;
+	evs[0] = START;
+	states[1] = RUNNING;
+	evs[1] = START;
+	assert(fsm_advance_vector(states, evs, NULL, 2) == 1);
+	assert(states[0] == RUNNING);
+	assert(states[1] == RUNNING);
+	assert(fsm_advance_vector(states, evs, NULL, 0) == 0);
+	return 0;
+}
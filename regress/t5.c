@@ -0,0 +1,104 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "t5_fsm.h"
+
+/* Preconditions fail when passed a non-NULL context */
+int
+t1b_exit_pre(enum fsm_state c, enum fsm_state n, void *ctx)
+{
+	return ctx == NULL ? 0 : -1;
+}
+
+int
+t2_entry_pre(enum fsm_state c, enum fsm_state n, void *ctx)
+{
+	return ctx == NULL ? 0 : -1;
+}
+
+int
+t3_done_pre(enum fsm_event ev, void *ctx)
+{
+	return ctx == NULL ? 0 : -1;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct fsm fsm;
+	enum fsm_event evs[3];
+	char buf[128];
+	size_t consumed;
+	int fail = 1;
+
+	assert(fsm_init(&fsm, T2) == CFSM_ERR_INVALID_STATE);
+	assert(fsm.last_error.reason == CFSM_REASON_INVALID_START);
+	assert(strcmp(fsm_strerror(&fsm, buf, sizeof(buf)),
+	    "State T2 (2) is not a valid start state") == 0);
+
+	assert(fsm_init(&fsm, T1b) == CFSM_OK);
+	assert(fsm.last_error.reason == CFSM_REASON_NONE);
+	assert(strcmp(fsm_strerror(&fsm, buf, sizeof(buf)), "No error") == 0);
+	assert(fsm_advance(&fsm, T1_DONE, &fail) == CFSM_ERR_PRECONDITION);
+	assert(fsm.last_error.reason == CFSM_REASON_EXIT_PRECOND);
+	assert(fsm.last_error.old_state == T1b);
+	assert(fsm.last_error.event == T1_DONE);
+	assert(fsm.last_error.new_state == T2);
+	assert(strcmp(fsm_strerror(&fsm, buf, sizeof(buf)),
+	    "State T1b exit precondition not satisfied") == 0);
+
+	assert(fsm_advance(&fsm, T2_DONE, NULL) == CFSM_ERR_INVALID_TRANSITION);
+	assert(fsm.last_error.reason == CFSM_REASON_INVALID_TRANSITION);
+	assert(strcmp(fsm_strerror(&fsm, buf, sizeof(buf)),
+	    "Invalid event T2_DONE in state T1b") == 0);
+
+	/* Successful events leave the last failure in place */
+	assert(fsm_advance(&fsm, T1_DONE, NULL) == CFSM_OK);
+	assert(fsm.last_error.reason == CFSM_REASON_INVALID_TRANSITION);
+
+	assert(fsm_advance(&fsm, 0xffff, NULL) == CFSM_ERR_INVALID_EVENT);
+	assert(strcmp(fsm_strerror(&fsm, buf, sizeof(buf)),
+	    "Invalid event (65535)") == 0);
+
+	assert(fsm_advance(&fsm, T2_DONE, NULL) == CFSM_OK);
+	assert(fsm_advance(&fsm, T3_DONE, &fail) == CFSM_ERR_PRECONDITION);
+	assert(fsm.last_error.reason == CFSM_REASON_EVENT_PRECOND);
+	assert(strcmp(fsm_strerror(&fsm, buf, sizeof(buf)),
+	    "Event T3_DONE entry precondition not satisfied") == 0);
+
+	/* Truncation */
+	assert(strcmp(fsm_strerror(&fsm, buf, 6), "Event") == 0);
+
+	/* Batches and runs record failures too */
+	assert(fsm_init(&fsm, T1a) == CFSM_OK);
+	evs[0] = T1_DONE;
+	evs[1] = T2_DONE;
+	evs[2] = T1_DONE;
+	assert(fsm_advance_run(&fsm, evs, 3, NULL, &consumed) ==
+	    CFSM_ERR_INVALID_TRANSITION);
+	assert(consumed == 2);
+	assert(strcmp(fsm_strerror(&fsm, buf, sizeof(buf)),
+	    "Invalid event T1_DONE in state T3") == 0);
+	assert(fsm_init(&fsm, T1a) == CFSM_OK);
+	assert(fsm_advance_run(&fsm, evs, 1, &fail, NULL) ==
+	    CFSM_ERR_PRECONDITION);
+	assert(strcmp(fsm_strerror(&fsm, buf, sizeof(buf)),
+	    "State T2 entry precondition not satisfied") == 0);
+
+	fsm.current_state = 0xffff;
+	assert(fsm_strerror(&fsm, buf, 0) == buf);
+	assert(fsm_advance(&fsm, T1_DONE, NULL) == CFSM_ERR_INVALID_STATE);
+	assert(strcmp(fsm_strerror(&fsm, buf, sizeof(buf)),
+	    "Invalid current_state (65535)") == 0);
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "t6_fsm.h"
+
+int
+main(int argc, char **argv)
+{
+	struct fsm fsm;
+	enum fsm_state s;
+	enum fsm_event evs[4];
+	char errbuf[128];
+	size_t consumed;
+
+	/* Explicit numbers are kept, the rest fill the gaps in order */
+	assert(ACTIVE == 0);
+	assert(OPENING == 1);
+	assert(IDLE == 2);
+	assert(CLOSE == 0);
+	assert(OPEN == 1);
+	assert(OPENED == 2);
+
+	/* Three states fit in a byte and there is no table pointer */
+	assert(sizeof(struct fsm) == FSM_INSTANCE_SIZE);
+	assert(FSM_INSTANCE_SIZE == 1);
+
+	assert(strcmp(fsm_state_ntop(IDLE), "IDLE") == 0);
+	assert(strcmp(fsm_state_ntop(ACTIVE), "ACTIVE") == 0);
+	assert(strcmp(fsm_event_ntop(OPENED), "OPENED") == 0);
+	assert(fsm_state_pton("OPENING", &s) == 0 && s == OPENING);
+	assert(fsm_state_ntop(3) == NULL);
+
+	assert(fsm_init(&fsm, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == IDLE);
+	assert(fsm_can_advance(&fsm, OPEN));
+	assert(!fsm_can_advance(&fsm, CLOSE));
+	assert(fsm_valid_events(ACTIVE)[0] == ((1 << CLOSE) | (1 << OPENED)));
+
+	assert(fsm_advance(&fsm, CLOSE, errbuf, sizeof(errbuf)) ==
+	    CFSM_ERR_INVALID_TRANSITION);
+	assert(strcmp(errbuf, "Invalid event CLOSE in state IDLE") == 0);
+	assert(fsm_advance(&fsm, OPEN, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == OPENING);
+	assert(fsm_advance(&fsm, OPENED, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == ACTIVE);
+	assert(fsm_advance(&fsm, OPENED, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == ACTIVE);
+
+	evs[0] = CLOSE;
+	evs[1] = OPEN;
+	evs[2] = CLOSE;
+	evs[3] = OPEN;
+	assert(fsm_advance_run(&fsm, evs, 4, &consumed) == CFSM_OK);
+	assert(consumed == 4);
+	assert(fsm_current_state(&fsm) == OPENING);
+
+	/* Out of range states are still caught in the narrow storage */
+	fsm.current_state = 200;
+	assert(fsm_advance(&fsm, OPEN, errbuf, sizeof(errbuf)) ==
+	    CFSM_ERR_INVALID_STATE);
+	assert(strcmp(errbuf, "Invalid current_state (200)") == 0);
+
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "t7_fsm.h"
+
+static int held_count = 0;
+
+void held_enter(enum fsm_state new_state);
+
+void
+held_enter(enum fsm_state new_state)
+{
+	assert(new_state == HELD || new_state == REHELD);
+	held_count++;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct fsm fsm;
+	enum fsm_state s;
+	char errbuf[128];
+
+	/* Equivalent states are merged into the first one declared */
+	assert(REDIALLING == DIALLING);
+	assert(ONLINE2 == ONLINE);
+	assert(HELD_AGAIN == HELD);
+
+	/* States that differ in what they ignore are kept apart */
+	assert(REHELD != HELD);
+	assert(fsm_state_ntop(REHELD + 1) == NULL);
+
+	/* The merged names still convert, but only one way */
+	assert(strcmp(fsm_state_ntop(REDIALLING), "DIALLING") == 0);
+	assert(fsm_state_pton("REDIALLING", &s) == 0 && s == DIALLING);
+	assert(fsm_state_pton("ONLINE2", &s) == 0 && s == ONLINE);
+	assert(fsm_state_pton("HELD_AGAIN", &s) == 0 && s == HELD);
+	assert(fsm_state_pton("REHELD", &s) == 0 && s == REHELD);
+	assert(fsm_state_pton("ONLINE3", &s) == -1);
+
+	assert(fsm_init(&fsm, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_advance(&fsm, DIAL, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_advance(&fsm, UP, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == ONLINE);
+	assert(fsm_advance(&fsm, DOWN, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == REDIALLING);
+	assert(fsm_advance(&fsm, UP, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_advance(&fsm, HOLD, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == HELD);
+	assert(held_count == 1);
+	assert(fsm_advance(&fsm, HOLD, errbuf, sizeof(errbuf)) ==
+	    CFSM_ERR_INVALID_TRANSITION);
+	assert(strcmp(errbuf, "Invalid event HOLD in state HELD") == 0);
+	assert(fsm_advance(&fsm, UP, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_advance(&fsm, PARK, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == REHELD);
+	assert(held_count == 2);
+	assert(fsm_advance(&fsm, HOLD, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == REHELD);
+	assert(fsm_advance(&fsm, DOWN, errbuf, sizeof(errbuf)) == CFSM_OK);
+	assert(fsm_current_state(&fsm) == IDLE);
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "t8_fsm.h"
+
+static int start_ok_ret = 0, may_start_ret = 0, may_stop_ret = 0;
+
+int start_ok(void);
+int may_start(void);
+int may_stop(void);
+
+int
+start_ok(void)
+{
+	return start_ok_ret;
+}
+
+int
+may_start(void)
+{
+	return may_start_ret;
+}
+
+int
+may_stop(void)
+{
+	return may_stop_ret;
+}
+
+/* Advances on another thread are counted there, not here */
+static void *
+other_thread(void *arg)
+{
+	struct fsm_stats *stats = arg;
+	struct fsm fsm;
+
+	assert(fsm_init(&fsm, NULL, 0) == CFSM_OK);
+	assert(fsm_advance(&fsm, START, NULL, 0) == CFSM_OK);
+	assert(fsm_advance(&fsm, STOP, NULL, 0) == CFSM_OK);
+	fsm_stats_snapshot(stats);
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct fsm fsm;
+	struct fsm_stats stats, other;
+	struct timespec ts = { 0, 1000000 };
+	pthread_t thread;
+
+	assert(fsm_init(&fsm, NULL, 0) == CFSM_OK);
+	nanosleep(&ts, NULL);
+	assert(fsm_advance(&fsm, POKE, NULL, 0) == CFSM_OK);
+	assert(fsm_advance(&fsm, STOP, NULL, 0) ==
+	    CFSM_ERR_INVALID_TRANSITION);
+	start_ok_ret = -1;
+	assert(fsm_advance(&fsm, START, NULL, 0) == CFSM_ERR_PRECONDITION);
+	start_ok_ret = 0;
+	may_start_ret = -1;
+	assert(fsm_advance(&fsm, START, NULL, 0) == CFSM_ERR_PRECONDITION);
+	may_start_ret = 0;
+	assert(fsm_advance(&fsm, START, NULL, 0) == CFSM_OK);
+	may_stop_ret = -1;
+	assert(fsm_advance(&fsm, STOP, NULL, 0) == CFSM_ERR_PRECONDITION);
+	may_stop_ret = 0;
+	assert(fsm_advance(&fsm, STOP, NULL, 0) == CFSM_OK);
+
+	fsm_stats_snapshot(&stats);
+	assert(stats.events[IDLE][POKE] == 1);
+	assert(stats.events[IDLE][STOP] == 1);
+	assert(stats.events[IDLE][START] == 3);
+	assert(stats.events[BUSY][STOP] == 2);
+	assert(stats.events[BUSY][START] == 0);
+	assert(stats.entries[IDLE] == 2);
+	assert(stats.entries[BUSY] == 1);
+	assert(stats.ticks[IDLE] > 0);
+	assert(stats.ticks[BUSY] > 0);
+	assert(stats.precond_failures[_fsm_pc_start_ok] == 1);
+	assert(stats.precond_failures[_fsm_pc_may_start] == 1);
+	assert(stats.precond_failures[_fsm_pc_may_stop] == 1);
+
+	/* Each thread has its own counters, which may be merged */
+	assert(pthread_create(&thread, NULL, other_thread, &other) == 0);
+	assert(pthread_join(thread, NULL) == 0);
+	assert(other.entries[IDLE] == 2);
+	assert(other.events[IDLE][POKE] == 0);
+	fsm_stats_merge(&stats, &other);
+	assert(stats.entries[IDLE] == 4);
+	assert(stats.entries[BUSY] == 2);
+	assert(stats.events[BUSY][STOP] == 3);
+
+	fsm_stats_reset();
+	fsm_stats_snapshot(&stats);
+	assert(stats.entries[IDLE] == 0);
+	assert(stats.precond_failures[_fsm_pc_may_stop] == 0);
+
+	return 0;
+}
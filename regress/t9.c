@@ -0,0 +1,119 @@
+/*
+ * This file is in the public domain
+ * agent 2026-10-18
+ */
+
+/* $Id$ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "t9_fsm.h"
+
+#define DUMP_PATH	"t9_trace.dump"
+
+/* Transitions made on another thread are not recorded in this one's ring */
+static void *
+other_thread(void *arg)
+{
+	struct fsm fsm;
+
+	assert(fsm_trace_stop() == NULL);
+	assert(fsm_init(&fsm, NULL, 0) == CFSM_OK);
+	assert(fsm_advance(&fsm, NEXT, NULL, 0) == CFSM_OK);
+	assert(fsm_advance(&fsm, NEXT, NULL, 0) == CFSM_OK);
+	return NULL;
+}
+
+/* Dump "t" and read back its header and up to "max" records */
+static void
+dump(struct fsm_trace *t, struct fsm_trace_header *h,
+    struct fsm_trace_record *r, size_t max)
+{
+	FILE *f;
+
+	assert((f = fopen(DUMP_PATH, "w")) != NULL);
+	assert(fsm_trace_dump(t, f) == 0);
+	assert(fclose(f) == 0);
+	assert((f = fopen(DUMP_PATH, "r")) != NULL);
+	assert(fread(h, sizeof(*h), 1, f) == 1);
+	assert(h->nrecords <= max);
+	assert(fread(r, sizeof(*r), h->nrecords, f) == h->nrecords);
+	assert(fgetc(f) == EOF);
+	fclose(f);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct fsm a, b;
+	struct fsm_trace *t;
+	struct fsm_trace_header h;
+	struct fsm_trace_record r[8];
+	pthread_t thread;
+	size_t i;
+
+	/* Nothing is recorded until tracing starts */
+	assert(fsm_trace_stop() == NULL);
+	assert(fsm_init(&a, NULL, 0) == CFSM_OK);
+	assert(fsm_init(&b, NULL, 0) == CFSM_OK);
+	assert(fsm_advance(&a, NEXT, NULL, 0) == CFSM_OK);
+
+	/* Three records round up to four */
+	assert(fsm_trace_start(0) == NULL);
+	assert((t = fsm_trace_start(3)) != NULL);
+	dump(t, &h, r, 8);
+	assert(memcmp(h.magic, "CFSMTRC1", sizeof(h.magic)) == 0);
+	assert(h.byte_order == 0x01020304);
+	assert(h.record_size == sizeof(struct fsm_trace_record));
+	assert(h.num_states == 3 && h.num_events == 3);
+	assert(h.nrecords == 0 && h.dropped == 0);
+
+	assert(pthread_create(&thread, NULL, other_thread, NULL) == 0);
+	assert(pthread_join(thread, NULL) == 0);
+
+	/* Ignored and rejected events are not transitions */
+	assert(fsm_advance(&a, NEXT, NULL, 0) == CFSM_OK);	/* 1 */
+	assert(fsm_advance(&a, NOP, NULL, 0) == CFSM_OK);
+	assert(fsm_advance(&a, RESET, NULL, 0) == CFSM_OK);	/* 2 */
+	assert(fsm_advance(&a, RESET, NULL, 0) ==
+	    CFSM_ERR_INVALID_TRANSITION);
+	assert(fsm_advance(&b, NEXT, NULL, 0) == CFSM_OK);	/* 3 */
+	dump(t, &h, r, 8);
+	assert(h.nrecords == 3 && h.dropped == 0);
+	assert(r[0].instance == (uintptr_t)&a);
+	assert(r[0].old_state == TWO && r[0].event == NEXT &&
+	    r[0].new_state == THREE);
+	assert(r[1].old_state == THREE && r[1].event == RESET &&
+	    r[1].new_state == ONE);
+	assert(r[2].instance == (uintptr_t)&b);
+	assert(r[2].old_state == ONE && r[2].new_state == TWO);
+
+	/* Wrap around, keeping the four most recent */
+	assert(fsm_advance(&b, NEXT, NULL, 0) == CFSM_OK);	/* 4 */
+	assert(fsm_advance(&b, NEXT, NULL, 0) == CFSM_OK);	/* 5 */
+	assert(fsm_advance(&b, RESET, NULL, 0) == CFSM_OK);	/* 6 */
+	assert(fsm_trace_stop() == t);
+	assert(fsm_advance(&b, NEXT, NULL, 0) == CFSM_OK);
+	dump(t, &h, r, 8);
+	assert(h.nrecords == 4 && h.dropped == 2);
+	for (i = 0; i < 4; i++) {
+		assert(r[i].instance == (uintptr_t)&b);
+		assert(i == 0 || r[i].timestamp >= r[i - 1].timestamp);
+	}
+	assert(r[0].old_state == ONE && r[0].event == NEXT &&
+	    r[0].new_state == TWO);
+	assert(r[2].old_state == THREE && r[2].event == NEXT &&
+	    r[2].new_state == THREE);
+	assert(r[3].old_state == THREE && r[3].event == RESET &&
+	    r[3].new_state == ONE);
+
+	/* The dump is left behind for "make trace" to decode */
+	fsm_trace_free(t);
+	return 0;
+}
@@ -138,6 +138,10 @@ main(int argc, char **argv)
 	    "STATE_A") == 0);
 
 	assert(myfsm_init(&fsm, NULL, 0) == CFSM_OK);
+	assert(myfsm_can_advance(&fsm, A_DONE) == 1);
+	assert(myfsm_can_advance(&fsm, C_DONE1) == 1); /* ignored */
+	assert(myfsm_can_advance(&fsm, G_DONE1) == 0);
+	assert(myfsm_valid_events(STATE_A) != NULL);
 	assert(myfsm_advance(&fsm, G_DONE1, NULL,
 	    NULL, 0) == CFSM_ERR_INVALID_TRANSITION);
 	assert(myfsm_current(&fsm) == STATE_A);
@@ -0,0 +1,575 @@
+{{if source_banner}}{{source_banner}}
+{{endif}}/*
+ * Automatically generated using the cfsm FSM compiler:
+ * http://www.mindrot.org/projects/cfsm/
+ *
+ * This file contains only the description of the FSM and thin wrappers
+ * around the libcfsm runtime, which must be linked in as well.
+ */
+
+#include <sys/types.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <libcfsm.h>
+
+#include "{{header_name}}"
+
+{{if transition_entry_callbacks}}/* Prototypes for state transition entry callbacks */
+{{for cb in transition_entry_callbacks}}void {{cb.key}}({{trans_cb_args_proto}});
+{{endfor}}
+{{endif}}{{if transition_exit_callbacks}}/* Prototypes for state transition exit callbacks */
+{{for cb in transition_exit_callbacks}}void {{cb.key}}({{trans_cb_args_proto}});
+{{endfor}}
+{{endif}}{{if transition_entry_preconds}}/* Prototypes for state entry precondition checks */
+{{for cb in transition_entry_preconds}}int {{cb.key}}({{trans_precond_args_proto}});
+{{endfor}}
+{{endif}}{{if transition_exit_preconds}}/* Prototypes for state exit precondition checks */
+{{for cb in transition_exit_preconds}}int {{cb.key}}({{trans_precond_args_proto}});
+{{endfor}}
+{{endif}}{{if event_callbacks}}/* Prototypes for event callback functions */
+{{for cb in event_callbacks}}void {{cb.key}}({{event_cb_args_proto}});
+{{endfor}}
+{{endif}}{{if event_preconds}}/* Prototypes for event precondition checks */
+{{for cb in event_preconds}}int {{cb.key}}({{event_precond_args_proto}});
+{{endfor}}
+{{endif}}/*
+ * Adapters and lists may go unused for states that are never entered
+ * or left, or events that never cause a transition.
+ */
+#if defined(__GNUC__)
+# define _CFSM_UNUSED	__attribute__((__unused__))
+#else
+# define _CFSM_UNUSED
+#endif
+
+/*
+ * Adapters from the libcfsm calling convention to the arguments that each
+ * precondition and callback wants.
+ */
+{{for cb in transition_entry_preconds}}static int _CFSM_UNUSED
+_{{fsm_struct}}_entry_pre_{{cb.key}}(int ev, int old_state, int new_state, void *ctx)
+{
+	return {{cb.key}}({{trans_precond_args}});
+}
+
+{{endfor}}{{for cb in transition_exit_preconds}}static int _CFSM_UNUSED
+_{{fsm_struct}}_exit_pre_{{cb.key}}(int ev, int old_state, int new_state, void *ctx)
+{
+	return {{cb.key}}({{trans_precond_args}});
+}
+
+{{endfor}}{{for cb in event_preconds}}static int _CFSM_UNUSED
+_{{fsm_struct}}_event_pre_{{cb.key}}(int ev, int old_state, int new_state, void *ctx)
+{
+	return {{cb.key}}({{event_precond_args}});
+}
+
+{{endfor}}{{for cb in transition_entry_callbacks}}static void _CFSM_UNUSED
+_{{fsm_struct}}_entry_cb_{{cb.key}}(int ev, int old_state, int new_state, void *ctx)
+{
+	{{cb.key}}({{trans_cb_args}});
+}
+
+{{endfor}}{{for cb in transition_exit_callbacks}}static void _CFSM_UNUSED
+_{{fsm_struct}}_exit_cb_{{cb.key}}(int ev, int old_state, int new_state, void *ctx)
+{
+	{{cb.key}}({{trans_cb_args}});
+}
+
+{{endfor}}{{for cb in event_callbacks}}static void _CFSM_UNUSED
+_{{fsm_struct}}_event_cb_{{cb.key}}(int ev, int old_state, int new_state, void *ctx)
+{
+	{{cb.key}}({{event_cb_args}});
+}
+
+{{endfor}}/* Per-state and per-event precondition and callback lists */
+{{for state in states}}{{if state.value.exit_preconds}}static const cfsm_precond_fn _CFSM_UNUSED _{{fsm_struct}}_exit_preconds_{{state.key}}[] = {
+{{for p in state.value.exit_preconds}}	_{{fsm_struct}}_exit_pre_{{p.key}},
+{{endfor}}	NULL
+};
+{{endif}}{{if state.value.entry_preconds}}static const cfsm_precond_fn _CFSM_UNUSED _{{fsm_struct}}_entry_preconds_{{state.key}}[] = {
+{{for p in state.value.entry_preconds}}	_{{fsm_struct}}_entry_pre_{{p.key}},
+{{endfor}}	NULL
+};
+{{endif}}{{if state.value.exit_callbacks}}static const cfsm_callback_fn _CFSM_UNUSED _{{fsm_struct}}_exit_callbacks_{{state.key}}[] = {
+{{for cb in state.value.exit_callbacks}}	_{{fsm_struct}}_exit_cb_{{cb.key}},
+{{endfor}}	NULL
+};
+{{endif}}{{if state.value.entry_callbacks}}static const cfsm_callback_fn _CFSM_UNUSED _{{fsm_struct}}_entry_callbacks_{{state.key}}[] = {
+{{for cb in state.value.entry_callbacks}}	_{{fsm_struct}}_entry_cb_{{cb.key}},
+{{endfor}}	NULL
+};
+{{endif}}{{endfor}}{{for event in events}}{{if event.value.preconds}}static const cfsm_precond_fn _CFSM_UNUSED _{{fsm_struct}}_event_preconds_{{event.key}}[] = {
+{{for p in event.value.preconds}}	_{{fsm_struct}}_event_pre_{{p.key}},
+{{endfor}}	NULL
+};
+{{endif}}{{if event.value.callbacks}}static const cfsm_callback_fn _CFSM_UNUSED _{{fsm_struct}}_event_callbacks_{{event.key}}[] = {
+{{for cb in event.value.callbacks}}	_{{fsm_struct}}_event_cb_{{cb.key}},
+{{endfor}}	NULL
+};
+{{endif}}{{endfor}}
+/*
+ * Transition entries: next state, then event, exit and entry
+ * preconditions, then event, exit and entry callbacks.
+ */
+static const struct cfsm_transition _{{fsm_struct}}_transitions[] = {
+{{for t in runtime_transitions}}	/* {{t.value.comment}} */
+	{ {{t.value.next}}, {{t.value.event_preconds}}, {{t.value.exit_preconds}},
+	  {{t.value.entry_preconds}}, {{t.value.event_callbacks}},
+	  {{t.value.exit_callbacks}}, {{t.value.entry_callbacks}} },
+{{endfor}}};
+
+/*
+ * Transition entry for each state and event, plus one. Zero marks events
+ * that are not valid in the state.
+ */
+static const uint32_t _{{fsm_struct}}_index[{{num_states}}][{{num_events}}] = {
+{{for row in runtime_index}}	/* {{row.value.state}} */
+	{ {{for cell in row.value.cells}}{{cell.value}}, {{endfor}}},
+{{endfor}}};
+
+/* Events accepted or ignored in each state, as a packed bit vector */
+static const uint32_t _{{fsm_struct}}_event_masks[{{num_states}}][{{event_mask_words_define}}] = {
+{{for row in event_masks}}	/* {{row.value.state}} */
+	{ {{for word in row.value.words}}{{word.value}}, {{endfor}}},
+{{endfor}}};
+
+static const int _{{fsm_struct}}_initial_states[] = {
+{{for s in initial_states}}	{{s.value}},
+{{endfor}}};
+
+/* State and event names, indexed by state or event */
+static const char * const _{{fsm_struct}}_state_names[] = {
+{{for state in states_ordered}}	"{{state.value}}",
+{{endfor}}};
+static const char * const _{{fsm_struct}}_event_names[] = {
+{{for event in events_ordered}}	"{{event.value}}",
+{{endfor}}};
+
+/*
+ * Minimal perfect hashes from names to states and events, with the name
+ * found in each slot. Names of merged states hash to slots of their own.
+ */
+static const int32_t _{{fsm_struct}}_state_hash_disp[] = {
+{{for d in state_hash_disp}}	{{d.value}},
+{{endfor}}};
+static const int _{{fsm_struct}}_state_hash_slots[] = {
+{{for s in state_hash_slots}}	{{s.value}},
+{{endfor}}};
+static const char * const _{{fsm_struct}}_state_hash_names[] = {
+{{for s in state_hash_slots}}	"{{s.value}}",
+{{endfor}}};
+static const int32_t _{{fsm_struct}}_event_hash_disp[] = {
+{{for d in event_hash_disp}}	{{d.value}},
+{{endfor}}};
+static const int _{{fsm_struct}}_event_hash_slots[] = {
+{{for e in event_hash_slots}}	{{e.value}},
+{{endfor}}};
+static const char * const _{{fsm_struct}}_event_hash_names[] = {
+{{for e in event_hash_slots}}	"{{e.value}}",
+{{endfor}}};
+
+static const struct cfsm_definition _{{fsm_struct}}_definition = {
+	{{num_states}},
+	{{num_events}},
+	sizeof(_{{fsm_struct}}_initial_states) /
+	    sizeof(_{{fsm_struct}}_initial_states[0]),
+	{{event_mask_words_define}},
+	_{{fsm_struct}}_initial_states,
+	_{{fsm_struct}}_state_names,
+	_{{fsm_struct}}_event_names,
+	{{state_hash_size}},
+	_{{fsm_struct}}_state_hash_disp,
+	_{{fsm_struct}}_state_hash_slots,
+	_{{fsm_struct}}_state_hash_names,
+	{{event_hash_size}},
+	_{{fsm_struct}}_event_hash_disp,
+	_{{fsm_struct}}_event_hash_slots,
+	_{{fsm_struct}}_event_hash_names,
+	&_{{fsm_struct}}_event_masks[0][0],
+	&_{{fsm_struct}}_index[0][0],
+	_{{fsm_struct}}_transitions,
+};
+
+const char *
+{{state_ntop_func}}(enum {{state_enum}} n)
+{
+	return cfsm_state_ntop(&_{{fsm_struct}}_definition, n);
+}
+
+const char *
+{{state_ntop_func}}_safe(enum {{state_enum}} n)
+{
+	const char *r = {{state_ntop_func}}(n);
+
+	return r == NULL ? "[INVALID]" : r;
+}
+
+const char *
+{{event_ntop_func}}(enum {{event_enum}} n)
+{
+	return cfsm_event_ntop(&_{{fsm_struct}}_definition, n);
+}
+
+const char *
+{{event_ntop_func}}_safe(enum {{event_enum}} n)
+{
+	const char *r = {{event_ntop_func}}(n);
+
+	return r == NULL ? "[INVALID]" : r;
+}
+
+int
+{{state_pton_func}}(const char *name, enum {{state_enum}} *state)
+{
+	int s;
+
+	if (cfsm_state_pton(&_{{fsm_struct}}_definition, name, &s) != 0)
+		return -1;
+	if (state != NULL)
+		*state = s;
+	return 0;
+}
+
+int
+{{event_pton_func}}(const char *name, enum {{event_enum}} *ev)
+{
+	int e;
+
+	if (cfsm_event_pton(&_{{fsm_struct}}_definition, name, &e) != 0)
+		return -1;
+	if (ev != NULL)
+		*ev = e;
+	return 0;
+}
+
+{{if multiple_start_states}}int
+{{init_func}}(struct {{fsm_struct}} *fsm, enum {{state_enum}} initial_state{{if error_records}}{{else}},
+    char *errbuf, size_t errlen{{endif}})
+{
+	int r;
+{{if mailbox}}	size_t i;
+{{endif}}
+	if ((r = cfsm_check_initial(&_{{fsm_struct}}_definition, initial_state,
+	    {{if error_records}}&fsm->last_error, NULL, 0{{else}}NULL, errbuf, errlen{{endif}})) != CFSM_OK)
+		return r;
+	bzero(fsm, sizeof(*fsm));
+	fsm->current_state = initial_state;
+{{if mailbox}}	for (i = 0; i < {{mailbox}}; i++)
+		fsm->mailbox.slots[i].seq = i;
+{{endif}}	return CFSM_OK;
+}{{else}}int
+{{init_func}}(struct {{fsm_struct}} *fsm{{if error_records}}{{else}}, char *errbuf, size_t errlen{{endif}})
+{
+{{if mailbox}}	size_t i;
+
+{{endif}}	bzero(fsm, sizeof(*fsm));
+	fsm->current_state = {{initial_states[0]}};
+{{if mailbox}}	for (i = 0; i < {{mailbox}}; i++)
+		fsm->mailbox.slots[i].seq = i;
+{{endif}}	return CFSM_OK;
+}{{endif}}
+
+enum {{state_enum}}
+{{current_state_func}}(struct {{fsm_struct}} *fsm)
+{
+	return fsm->current_state;
+}
+
+const uint32_t *
+{{valid_events_func}}(enum {{state_enum}} state)
+{
+	return cfsm_valid_events(&_{{fsm_struct}}_definition, state);
+}
+
+int
+{{can_advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev)
+{
+	return cfsm_can_advance(&_{{fsm_struct}}_definition,
+	    fsm->current_state, ev);
+}
+{{if event_queue}}
+int
+{{fsm_struct}}_post(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev)
+{
+	if (fsm->queue.count >= {{event_queue}})
+		return CFSM_ERR_QUEUE_FULL;
+	fsm->queue.events[(fsm->queue.head + fsm->queue.count) %
+	    {{event_queue}}] = ev;
+	fsm->queue.count++;
+	return CFSM_OK;
+}
+
+/*
+ * Execute posted events in the order they were posted until none are
+ * left. If one fails, the rest are discarded and its failure returned.
+ */
+static int
+_{{advance_func}}_drain(struct {{fsm_struct}} *fsm, void *ctx, char *errbuf,
+    size_t errlen)
+{
+	enum {{event_enum}} ev;
+	int r;
+
+	while (fsm->queue.count > 0) {
+		ev = fsm->queue.events[fsm->queue.head];
+		fsm->queue.head = (fsm->queue.head + 1) % {{event_queue}};
+		fsm->queue.count--;
+		if ((r = cfsm_advance(&_{{fsm_struct}}_definition,
+		    &fsm->current_state, ev, ctx,
+		    {{if error_records}}&fsm->last_error{{else}}NULL{{endif}}, errbuf, errlen)) != CFSM_OK) {
+			fsm->queue.count = 0;
+			return r;
+		}
+	}
+	return CFSM_OK;
+}
+{{endif}}{{if error_records}}
+char *
+{{strerror_func}}(struct {{fsm_struct}} *fsm, char *buf, size_t len)
+{
+	return cfsm_strerror(&_{{fsm_struct}}_definition, &fsm->last_error,
+	    buf, len);
+}
+
+int
+{{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev{{if need_ctx}},
+    void *ctx{{endif}})
+{
+{{if event_queue}}	int r;
+
+	if ((r = cfsm_advance(&_{{fsm_struct}}_definition, &fsm->current_state,
+	    ev, {{if need_ctx}}ctx{{else}}NULL{{endif}}, &fsm->last_error, NULL, 0)) != CFSM_OK)
+		return r;
+	return _{{advance_func}}_drain(fsm, {{if need_ctx}}ctx{{else}}NULL{{endif}}, NULL, 0);
+{{else}}	return cfsm_advance(&_{{fsm_struct}}_definition, &fsm->current_state,
+	    ev, {{if need_ctx}}ctx{{else}}NULL{{endif}}, &fsm->last_error, NULL, 0);
+{{endif}}}
+{{else}}
+int
+{{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
+    {{if need_ctx}}void *ctx, {{endif}}char *errbuf, size_t errlen)
+{
+{{if event_queue}}	int r;
+
+	if ((r = cfsm_advance(&_{{fsm_struct}}_definition, &fsm->current_state,
+	    ev, {{if need_ctx}}ctx{{else}}NULL{{endif}}, NULL, errbuf, errlen)) != CFSM_OK)
+		return r;
+	return _{{advance_func}}_drain(fsm, {{if need_ctx}}ctx{{else}}NULL{{endif}}, errbuf, errlen);
+{{else}}	return cfsm_advance(&_{{fsm_struct}}_definition, &fsm->current_state,
+	    ev, {{if need_ctx}}ctx{{else}}NULL{{endif}}, NULL, errbuf, errlen);
+{{endif}}}
+{{endif}}
+#if defined(__GNUC__)
+int
+{{advance_func}}_atomic(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev{{if need_ctx}},
+    void *ctx{{endif}}{{if error_records}}{{else}}, char *errbuf, size_t errlen{{endif}})
+{
+	return cfsm_advance_atomic(&_{{fsm_struct}}_definition,
+	    &fsm->current_state, ev, {{if need_ctx}}ctx{{else}}NULL{{endif}}, NULL, {{if error_records}}NULL, 0{{else}}errbuf, errlen{{endif}});
+}
+#endif /* __GNUC__ */
+{{if mailbox}}
+#if defined(__GNUC__)
+/*
+ * The mailbox is a bounded queue after Dmitry Vyukov's. Each slot has a
+ * sequence number saying whose turn it is: the slot for position "pos"
+ * is free for the producer that claims "pos" while its sequence is
+ * "pos", holds an event for the consumer once it is "pos + 1" and is
+ * made "pos + {{mailbox}}" again, ready for the next lap, once drained.
+ */
+int
+{{fsm_struct}}_send(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev)
+{
+	uint32_t pos, seq;
+
+	pos = __atomic_load_n(&fsm->mailbox.tail, __ATOMIC_RELAXED);
+	for (;;) {
+		seq = __atomic_load_n(
+		    &fsm->mailbox.slots[pos & ({{mailbox}} - 1)].seq,
+		    __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			/* On failure, "pos" is updated to the current tail */
+			if (__atomic_compare_exchange_n(&fsm->mailbox.tail,
+			    &pos, pos + 1, 1, __ATOMIC_RELAXED,
+			    __ATOMIC_RELAXED))
+				break;
+		} else if ((int32_t)(seq - pos) < 0)
+			return CFSM_ERR_QUEUE_FULL;
+		else
+			pos = __atomic_load_n(&fsm->mailbox.tail,
+			    __ATOMIC_RELAXED);
+	}
+	fsm->mailbox.slots[pos & ({{mailbox}} - 1)].ev = ev;
+	__atomic_store_n(&fsm->mailbox.slots[pos & ({{mailbox}} - 1)].seq,
+	    pos + 1, __ATOMIC_RELEASE);
+	return CFSM_OK;
+}
+
+size_t
+{{fsm_struct}}_drain(struct {{fsm_struct}} *fsm{{if need_ctx}}, void *ctx{{endif}}, int *results,
+    size_t max)
+{
+	enum {{event_enum}} ev;
+	uint32_t pos;
+	size_t n;
+	int r;
+
+	for (n = 0; n < max; n++) {
+		pos = fsm->mailbox.head;
+		if (__atomic_load_n(&fsm->mailbox.slots[pos & ({{mailbox}} - 1)].seq,
+		    __ATOMIC_ACQUIRE) != pos + 1)
+			break;
+		ev = fsm->mailbox.slots[pos & ({{mailbox}} - 1)].ev;
+		/* Hand the slot back before running any callbacks */
+		__atomic_store_n(&fsm->mailbox.slots[pos & ({{mailbox}} - 1)].seq,
+		    pos + {{mailbox}}, __ATOMIC_RELEASE);
+		fsm->mailbox.head = pos + 1;
+		r = {{advance_func}}(fsm, ev{{if need_ctx}}, ctx{{endif}}{{if error_records}}{{else}}, NULL, 0{{endif}});
+		if (results != NULL)
+			results[n] = r;
+	}
+	return n;
+}
+#endif /* __GNUC__ */
+{{endif}}
+size_t
+{{advance_func}}_batch(struct {{fsm_struct}} **fsms, const enum {{event_enum}} *evs,
+    {{if need_ctx}}void **ctxs, {{endif}}int *results, size_t n)
+{
+	size_t i, nfailed = 0;
+	int r;
+
+	for (i = 0; i < n; i++) {
+		r = cfsm_advance(&_{{fsm_struct}}_definition,
+		    &fsms[i]->current_state, evs[i],
+		    {{if need_ctx}}ctxs == NULL ? NULL : ctxs[i]{{else}}NULL{{endif}},
+		    {{if error_records}}&fsms[i]->last_error{{else}}NULL{{endif}}, NULL, 0);
+{{if event_queue}}		if (r == CFSM_OK) {
+			r = _{{advance_func}}_drain(fsms[i],
+			    {{if need_ctx}}ctxs == NULL ? NULL : ctxs[i]{{else}}NULL{{endif}}, NULL, 0);
+		}
+{{endif}}		if (r != CFSM_OK)
+			nfailed++;
+		if (results != NULL)
+			results[i] = r;
+	}
+	return nfailed;
+}
+
+int
+{{advance_func}}_run(struct {{fsm_struct}} *fsm, const enum {{event_enum}} *evs,
+    size_t n, {{if need_ctx}}void *ctx, {{endif}}size_t *consumed)
+{
+	size_t i;
+	int r = CFSM_OK;
+
+	for (i = 0; i < n; i++) {
+		if ((r = cfsm_advance(&_{{fsm_struct}}_definition,
+		    &fsm->current_state, evs[i], {{if need_ctx}}ctx{{else}}NULL{{endif}},
+		    {{if error_records}}&fsm->last_error{{else}}NULL{{endif}}, NULL, 0)) != CFSM_OK)
+			break;
+{{if event_queue}}		if ((r = _{{advance_func}}_drain(fsm, {{if need_ctx}}ctx{{else}}NULL{{endif}},
+		    NULL, 0)) != CFSM_OK) {
+			i++;
+			break;
+		}
+{{endif}}	}
+	if (consumed != NULL)
+		*consumed = i;
+	return r;
+}
+{{if snapshot}}
+/*
+ * Snapshots hold {{if compact_storage}}whole compact instances{{else}}the current state of each instance{{endif}} as records
+ * of _{{fsm_struct}}_record_t, after the header.
+ */
+{{if compact_storage}}typedef struct {{fsm_struct}} _{{fsm_struct}}_record_t;
+{{else}}typedef {{state_storage_type}} _{{fsm_struct}}_record_t;
+{{endif}}
+size_t
+{{fsm_struct}}_snapshot_size(size_t n)
+{
+	if (n > (SIZE_MAX - sizeof(struct {{fsm_struct}}_snapshot_header)) /
+	    sizeof(_{{fsm_struct}}_record_t))
+		return 0;
+	return sizeof(struct {{fsm_struct}}_snapshot_header) +
+	    n * sizeof(_{{fsm_struct}}_record_t);
+}
+
+int
+{{fsm_struct}}_snapshot(const struct {{fsm_struct}} *fsms, size_t n, void *buf,
+    size_t len)
+{
+	struct {{fsm_struct}}_snapshot_header *h = buf;
+	_{{fsm_struct}}_record_t *records = (_{{fsm_struct}}_record_t *)(h + 1);
+{{if compact_storage}}{{else}}	size_t i;
+{{endif}}	size_t need = {{fsm_struct}}_snapshot_size(n);
+
+	if (need == 0 || len < need)
+		return CFSM_ERR_SNAPSHOT;
+	memcpy(h->magic, CFSM_SNAPSHOT_MAGIC, sizeof(h->magic));
+	h->byte_order = CFSM_SNAPSHOT_BYTE_ORDER;
+	h->record_size = sizeof(*records);
+	h->fingerprint = {{fingerprint_define}};
+	h->ninstances = n;
+{{if compact_storage}}	memcpy(records, fsms, n * sizeof(*records));
+{{else}}	for (i = 0; i < n; i++)
+		records[i] = fsms[i].current_state;
+{{endif}}	return CFSM_OK;
+}
+
+int
+{{fsm_struct}}_snapshot_check(const void *buf, size_t len, size_t *n)
+{
+	const struct {{fsm_struct}}_snapshot_header *h = buf;
+
+	/* Only the header is read, however large the snapshot */
+	if (len < sizeof(*h) ||
+	    memcmp(h->magic, CFSM_SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->byte_order != CFSM_SNAPSHOT_BYTE_ORDER ||
+	    h->fingerprint != {{fingerprint_define}} ||
+	    h->record_size != sizeof(_{{fsm_struct}}_record_t) ||
+	    h->ninstances > (len - sizeof(*h)) /
+	    sizeof(_{{fsm_struct}}_record_t))
+		return CFSM_ERR_SNAPSHOT;
+	if (n != NULL)
+		*n = h->ninstances;
+	return CFSM_OK;
+}
+{{if compact_storage}}
+struct {{fsm_struct}} *
+{{fsm_struct}}_restore(void *buf, size_t len, size_t *n)
+{
+	if ({{fsm_struct}}_snapshot_check(buf, len, n) != CFSM_OK)
+		return NULL;
+	return (struct {{fsm_struct}} *)
+	    ((struct {{fsm_struct}}_snapshot_header *)buf + 1);
+}
+{{else}}
+int
+{{fsm_struct}}_restore(struct {{fsm_struct}} *fsms, size_t n, const void *buf,
+    size_t len)
+{
+	const _{{fsm_struct}}_record_t *records = (const _{{fsm_struct}}_record_t *)
+	    ((const struct {{fsm_struct}}_snapshot_header *)buf + 1);
+	size_t i, count;
+
+	if ({{fsm_struct}}_snapshot_check(buf, len, &count) != CFSM_OK ||
+	    count != n)
+		return CFSM_ERR_SNAPSHOT;
+	/* Check every state first, so nothing is changed on failure */
+	for (i = 0; i < n; i++) {
+		if (records[i] >= {{num_states}})
+			return CFSM_ERR_SNAPSHOT;
+	}
+	for (i = 0; i < n; i++) {
+		fsms[i].current_state = records[i];
+	}
+	return CFSM_OK;
+}
+{{endif}}{{endif}}
\ No newline at end of file
@@ -9,7 +9,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-
+#include <stdint.h>
+{{if instrumented}}#include <time.h>
+{{endif}}{{if vector_mode}}#if defined(__AVX2__)
+# include <immintrin.h>
+#endif
+{{endif}}
 #include "{{header_name}}"
 
 {{if transition_entry_callbacks}}/* Prototypes for state transition entry callbacks */
@@ -30,7 +35,55 @@
 {{endif}}{{if event_preconds}}/* Prototypes for event precondition checks */
 {{for cb in event_preconds}}int {{cb.key}}({{event_precond_args_proto}});
 {{endfor}}
-{{endif}}static int
+{{endif}}{{if table_mode}}/* Special next-state values in the transition table */
+#define _CFSM_TT_IGNORE		{{transtable_ignore}}
+#define _CFSM_TT_INVALID	{{transtable_invalid}}
+
+{{if table_sparse}}/*
+ * Row-displaced ("comb vector") transition table. The cells for a state
+ * start at base[state] and are indexed by event. A cell is only valid if
+ * its check field matches the current state; all other events are
+ * invalid transitions.
+ */
+struct {{fsm_struct}}_transtable {
+	{{transtable_base_type}} base[{{num_states}}];
+	struct {
+		{{transtable_type}} check;
+		{{transtable_type}} next;
+	} cells[{{transtable_len}}];
+};
+
+static const struct {{fsm_struct}}_transtable _{{fsm_struct}}_transtable = {
+	{ {{for b in transtable_base}}{{b.value}}, {{endfor}}},
+	{
+{{for cell in transtable_cells}}		{{cell.value}},
+{{endfor}}	}
+};
+{{else}}/*
+ * Transition table, indexed by current state and event. Each cell holds
+ * the next state or one of the special values above.
+ */
+struct {{fsm_struct}}_transtable {
+	{{transtable_type}} next[{{num_states}}][{{num_events}}];
+{{if vector_mode}}	/* Keeps 32-bit vector gathers of the last cells in bounds */
+	{{transtable_type}} pad[4];
+{{endif}}};
+
+static const struct {{fsm_struct}}_transtable _{{fsm_struct}}_transtable = {
+	{
+{{for row in transtable_rows}}		/* {{row.value.state}} */
+		{ {{for cell in row.value.cells}}{{cell.value}}, {{endfor}}},
+{{endfor}}	},
+{{if vector_mode}}	{ 0 },
+{{endif}}};
+{{endif}}
+{{endif}}/* Events accepted or ignored in each state, as a packed bit vector */
+static const uint32_t _{{fsm_struct}}_event_masks[{{num_states}}][{{event_mask_words_define}}] = {
+{{for row in event_masks}}	/* {{row.value.state}} */
+	{ {{for word in row.value.words}}{{word.value}}, {{endfor}}},
+{{endfor}}};
+
+static int
 _is_{{state_enum}}_valid(enum {{state_enum}} n)
 {
 	if (!(n >= {{min_state_valid}} && n <= {{max_state_valid}}))
@@ -38,16 +91,80 @@ _is_{{state_enum}}_valid(enum {{state_enum}} n)
 	return 0;
 }
 
+/* State names, indexed by state */
+static const char * const _{{fsm_struct}}_state_names[] = {
+{{for state in states_ordered}}	"{{state.value}}",
+{{endfor}}};
+
+/*
+ * Minimal perfect hash from state names to states, computed by cfsm. A
+ * name's hash picks a displacement which is either a seed to rehash the
+ * name with or, if negative, -(slot + 1). Names of merged states hash to
+ * slots of their own.
+ */
+static const int32_t _{{fsm_struct}}_state_hash_disp[] = {
+{{for d in state_hash_disp}}	{{d.value}},
+{{endfor}}};
+static const enum {{state_enum}} _{{fsm_struct}}_state_hash_slots[] = {
+{{for s in state_hash_slots}}	{{s.value}},
+{{endfor}}};
+static const char * const _{{fsm_struct}}_state_hash_names[] = {
+{{for s in state_hash_slots}}	"{{s.value}}",
+{{endfor}}};
+
+/* Event names, indexed by event */
+static const char * const _{{fsm_struct}}_event_names[] = {
+{{for event in events_ordered}}	"{{event.value}}",
+{{endfor}}};
+
+/* Minimal perfect hash from event names to events, as for states */
+static const int32_t _{{fsm_struct}}_event_hash_disp[] = {
+{{for d in event_hash_disp}}	{{d.value}},
+{{endfor}}};
+static const enum {{event_enum}} _{{fsm_struct}}_event_hash_slots[] = {
+{{for e in event_hash_slots}}	{{e.value}},
+{{endfor}}};
+static const char * const _{{fsm_struct}}_event_hash_names[] = {
+{{for e in event_hash_slots}}	"{{e.value}}",
+{{endfor}}};
+
+/*
+ * 32-bit FNV-1a, with an optional seed replacing the offset basis. The
+ * low bits of FNV depend only on the low bits of each character, so the
+ * result is finally mixed to let every bit affect the slot. This must
+ * match name_hash() in libcfsm/cfsm_name_hash.h.
+ */
+static uint32_t
+_{{fsm_struct}}_name_hash(uint32_t h, const char *s)
+{
+	if (h == 0)
+		h = 0x811c9dc5;
+	for (; *s != '\0'; s++)
+		h = (h ^ (u_char)*s) * 0x01000193;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	return h ^ (h >> 16);
+}
+
+/* Returns the perfect hash slot for "name", which may still not match */
+static size_t
+_{{fsm_struct}}_name_slot(const int32_t *disp, size_t n, const char *name)
+{
+	int32_t d = disp[_{{fsm_struct}}_name_hash(0, name) % n];
+
+	if (d < 0)
+		return (size_t)(-(int64_t)d - 1);
+	return _{{fsm_struct}}_name_hash((uint32_t)d, name) % n;
+}
+
 const char *
 {{state_ntop_func}}(enum {{state_enum}} n)
 {
-	const char *state_names[] = {
-{{for state in states}}		"{{state.key}}",
-{{endfor}}	};
-
 	if (_is_{{state_enum}}_valid(n) != 0)
 		return NULL;
-	return state_names[n];
+	return _{{fsm_struct}}_state_names[n];
 }
 
 const char *
@@ -69,13 +186,9 @@ _is_{{event_enum}}_valid(enum {{event_enum}} n)
 const char *
 {{event_ntop_func}}(enum {{event_enum}} n)
 {
-	const char *event_names[] = {
-{{for event in events_array}}		"{{event.value}}",
-{{endfor}}	};
-
 	if (_is_{{event_enum}}_valid(n) != 0)
 		return NULL;
-	return event_names[n];
+	return _{{fsm_struct}}_event_names[n];
 }
 
 const char *
@@ -86,30 +199,564 @@ const char *
 	return r == NULL ? "[INVALID]" : r;
 }
 
-{{if multiple_start_states}}int
-{{init_func}}(struct {{fsm_struct}} *fsm, enum {{state_enum}} initial_state, char *errbuf, size_t errlen)
+int
+{{state_pton_func}}(const char *name, enum {{state_enum}} *state)
+{
+	size_t slot;
+
+	if (name == NULL)
+		return -1;
+	slot = _{{fsm_struct}}_name_slot(_{{fsm_struct}}_state_hash_disp,
+	    {{state_hash_size}}, name);
+	if (strcmp(name, _{{fsm_struct}}_state_hash_names[slot]) != 0)
+		return -1;
+	if (state != NULL)
+		*state = _{{fsm_struct}}_state_hash_slots[slot];
+	return 0;
+}
+
+int
+{{event_pton_func}}(const char *name, enum {{event_enum}} *ev)
+{
+	size_t slot;
+
+	if (name == NULL)
+		return -1;
+	slot = _{{fsm_struct}}_name_slot(_{{fsm_struct}}_event_hash_disp,
+	    {{event_hash_size}}, name);
+	if (strcmp(name, _{{fsm_struct}}_event_hash_names[slot]) != 0)
+		return -1;
+	if (ev != NULL)
+		*ev = _{{fsm_struct}}_event_hash_slots[slot];
+	return 0;
+}
+
+{{if instrumented}}#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+# define _CFSM_THREAD		_Thread_local
+#else
+# define _CFSM_THREAD		__thread
+#endif
+
+/*
+ * Returns the time in clock ticks: TSC cycles on x86, where they are
+ * cheap to read, and nanoseconds elsewhere.
+ */
+static inline uint64_t
+_{{fsm_struct}}_clock(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+{{endif}}{{if stats_mode}}/* Statistics counted by this thread */
+static _CFSM_THREAD struct {{fsm_struct}}_stats _{{fsm_struct}}_stats;
+{{if stats_preconds}}
+/* Precondition names, in the order of their failure counters */
+static const char * const _{{fsm_struct}}_stats_precond_names[] = {
+{{for pc in stats_preconds}}	"{{pc.value}}",
+{{endfor}}};
+{{endif}}
+/* Count a move from "old_state" to "new_state", which may be the same */
+static inline void
+_{{fsm_struct}}_stats_move(struct {{fsm_struct}} *fsm,
+    enum {{state_enum}} old_state, enum {{state_enum}} new_state)
+{
+	uint64_t now = _{{fsm_struct}}_clock();
+
+	_{{fsm_struct}}_stats.ticks[old_state] += now - fsm->state_entered;
+	_{{fsm_struct}}_stats.entries[new_state]++;
+	fsm->state_entered = now;
+}
+
+void
+{{fsm_struct}}_stats_snapshot(struct {{fsm_struct}}_stats *stats)
+{
+	memcpy(stats, &_{{fsm_struct}}_stats, sizeof(*stats));
+}
+
+void
+{{fsm_struct}}_stats_reset(void)
+{
+	memset(&_{{fsm_struct}}_stats, 0, sizeof(_{{fsm_struct}}_stats));
+}
+
+void
+{{fsm_struct}}_stats_merge(struct {{fsm_struct}}_stats *to,
+    const struct {{fsm_struct}}_stats *from)
+{
+	size_t i, j;
+
+	for (i = 0; i < {{num_states}}; i++) {
+		for (j = 0; j < {{num_events}}; j++)
+			to->events[i][j] += from->events[i][j];
+		to->entries[i] += from->entries[i];
+		to->ticks[i] += from->ticks[i];
+	}
+{{if stats_preconds}}	for (i = 0; i < _{{fsm_struct}}_stats_npreconds; i++)
+		to->precond_failures[i] += from->precond_failures[i];
+{{endif}}}
+
+void
+{{fsm_struct}}_stats_dump(const struct {{fsm_struct}}_stats *stats, FILE *f)
+{
+	size_t i, j;
+
+	for (i = 0; i < {{num_states}}; i++) {
+		if (stats->entries[i] != 0 || stats->ticks[i] != 0) {
+			fprintf(f, "state %s entries %llu ticks %llu\n",
+			    {{state_ntop_func}}_safe(i),
+			    (unsigned long long)stats->entries[i],
+			    (unsigned long long)stats->ticks[i]);
+		}
+		for (j = 0; j < {{num_events}}; j++) {
+			if (stats->events[i][j] == 0)
+				continue;
+			fprintf(f, "event %s %s %llu\n",
+			    {{state_ntop_func}}_safe(i),
+			    {{event_ntop_func}}_safe(j),
+			    (unsigned long long)stats->events[i][j]);
+		}
+	}
+{{if stats_preconds}}	for (i = 0; i < _{{fsm_struct}}_stats_npreconds; i++) {
+		if (stats->precond_failures[i] == 0)
+			continue;
+		fprintf(f, "precondition-failure %s %llu\n",
+		    _{{fsm_struct}}_stats_precond_names[i],
+		    (unsigned long long)stats->precond_failures[i]);
+	}
+{{endif}}}
+
+{{endif}}{{if trace_mode}}#if defined(__GNUC__)
+# define _CFSM_UNLIKELY(x)		__builtin_expect(!!(x), 0)
+# define _CFSM_LOAD_ACQUIRE(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+# define _CFSM_STORE_RELEASE(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+# define _CFSM_FENCE_ACQUIRE()		__atomic_thread_fence(__ATOMIC_ACQUIRE)
+# define _CFSM_FENCE_RELEASE()		__atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+# define _CFSM_UNLIKELY(x)		(x)
+# define _CFSM_LOAD_ACQUIRE(p)		(*(volatile uint64_t *)(p))
+# define _CFSM_STORE_RELEASE(p, v)	(*(volatile uint64_t *)(p) = (v))
+# define _CFSM_FENCE_ACQUIRE()
+# define _CFSM_FENCE_RELEASE()
+#endif
+
+/*
+ * A ring of the most recent transitions made by one thread. Only that
+ * thread writes records. "claimed" counts the records it has started to
+ * write and "head" those it has finished, so a reader can tell which
+ * slot, if any, is being overwritten.
+ */
+struct {{fsm_struct}}_trace {
+	uint64_t claimed;
+	uint64_t head;
+	uint64_t mask;			/* Number of records - 1 */
+	struct {{fsm_struct}}_trace_record *records;
+};
+
+/* The ring this thread records into, or NULL if it is not tracing */
+static _CFSM_THREAD struct {{fsm_struct}}_trace *_{{fsm_struct}}_trace;
+
+/* Kept out of line, so tracing costs disabled callers only a branch */
+static void
+_{{fsm_struct}}_trace_record(struct {{fsm_struct}} *fsm,
+    enum {{state_enum}} old_state, enum {{event_enum}} ev,
+    enum {{state_enum}} new_state)
+{
+	struct {{fsm_struct}}_trace *t = _{{fsm_struct}}_trace;
+	struct {{fsm_struct}}_trace_record *r = &t->records[t->head & t->mask];
+
+	_CFSM_STORE_RELEASE(&t->claimed, t->head + 1);
+	_CFSM_FENCE_RELEASE();
+	r->instance = (uint64_t)(uintptr_t)fsm;
+	r->timestamp = _{{fsm_struct}}_clock();
+	r->old_state = old_state;
+	r->event = ev;
+	r->new_state = new_state;
+	r->reserved = 0;
+	_CFSM_STORE_RELEASE(&t->head, t->head + 1);
+}
+
+struct {{fsm_struct}}_trace *
+{{fsm_struct}}_trace_start(size_t nrecords)
+{
+	struct {{fsm_struct}}_trace *t;
+	size_t n;
+
+	if (nrecords == 0 || nrecords > SIZE_MAX / 2 /
+	    sizeof(struct {{fsm_struct}}_trace_record))
+		return NULL;
+	/* A power of two, so that the ring is indexed with a mask */
+	for (n = 1; n < nrecords; n <<= 1)
+		;
+	if ((t = calloc(1, sizeof(*t))) == NULL)
+		return NULL;
+	if ((t->records = calloc(n, sizeof(*t->records))) == NULL) {
+		free(t);
+		return NULL;
+	}
+	t->mask = n - 1;
+	_{{fsm_struct}}_trace = t;
+	return t;
+}
+
+struct {{fsm_struct}}_trace *
+{{fsm_struct}}_trace_stop(void)
+{
+	struct {{fsm_struct}}_trace *t = _{{fsm_struct}}_trace;
+
+	_{{fsm_struct}}_trace = NULL;
+	return t;
+}
+
+void
+{{fsm_struct}}_trace_free(struct {{fsm_struct}}_trace *t)
+{
+	if (t == NULL)
+		return;
+	free(t->records);
+	free(t);
+}
+
+int
+{{fsm_struct}}_trace_dump(struct {{fsm_struct}}_trace *t, FILE *f)
+{
+	struct {{fsm_struct}}_trace_header h;
+	struct {{fsm_struct}}_trace_record *copy;
+	uint64_t head, first, valid, n = t->mask + 1, i;
+	int r = 0;
+
+	if ((copy = calloc(n, sizeof(*copy))) == NULL)
+		return -1;
+	head = _CFSM_LOAD_ACQUIRE(&t->head);
+	first = head > n ? head - n : 0;
+	for (i = first; i < head; i++)
+		copy[i - first] = t->records[i & t->mask];
+
+	/*
+	 * The owning thread may have kept going meanwhile. A record is
+	 * intact unless a later one that shares its slot has been started.
+	 */
+	_CFSM_FENCE_ACQUIRE();
+	valid = _CFSM_LOAD_ACQUIRE(&t->claimed);
+	valid = valid > n ? valid - n : 0;
+	if (valid < first)
+		valid = first;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "CFSMTRC1", sizeof(h.magic));
+	h.byte_order = 0x01020304;
+	h.record_size = sizeof(*copy);
+	h.num_states = {{num_states}};
+	h.num_events = {{num_events}};
+	h.nrecords = head > valid ? head - valid : 0;
+	h.dropped = head - h.nrecords;
+	h.fingerprint = {{fingerprint_define}};
+	if (fwrite(&h, sizeof(h), 1, f) != 1 || (h.nrecords > 0 &&
+	    fwrite(copy + (valid - first), sizeof(*copy), h.nrecords,
+	    f) != h.nrecords))
+		r = -1;
+	free(copy);
+	return r;
+}
+
+{{endif}}{{if error_records}}/*
+ * Record a failure in the FSM and return the matching CFSM_ERR_* code
+ */
+static int
+_{{fsm_struct}}_error(struct {{fsm_struct}} *fsm, int reason,
+    enum {{state_enum}} old_state, enum {{event_enum}} ev,
+    enum {{state_enum}} new_state)
+{
+	fsm->last_error.old_state = old_state;
+	fsm->last_error.event = ev;
+	fsm->last_error.new_state = new_state;
+	fsm->last_error.reason = reason;
+	switch (reason) {
+	case CFSM_REASON_INVALID_START:
+	case CFSM_REASON_INVALID_STATE:
+		return CFSM_ERR_INVALID_STATE;
+	case CFSM_REASON_INVALID_EVENT:
+		return CFSM_ERR_INVALID_EVENT;
+	case CFSM_REASON_INVALID_TRANSITION:
+		return CFSM_ERR_INVALID_TRANSITION;
+	default:
+		return CFSM_ERR_PRECONDITION;
+	}
+}
+
+char *
+{{strerror_func}}(struct {{fsm_struct}} *fsm, char *buf, size_t len)
+{
+	if (len == 0 || buf == NULL)
+		return buf;
+	switch (fsm->last_error.reason) {
+	case CFSM_REASON_NONE:
+		snprintf(buf, len, "No error");
+		break;
+	case CFSM_REASON_INVALID_START:
+		snprintf(buf, len, "State %s (%d) is not a valid start state",
+		    {{state_ntop_func}}_safe(fsm->last_error.old_state),
+		    fsm->last_error.old_state);
+		break;
+	case CFSM_REASON_INVALID_STATE:
+		snprintf(buf, len, "Invalid current_state (%d)",
+		    fsm->last_error.old_state);
+		break;
+	case CFSM_REASON_INVALID_EVENT:
+		snprintf(buf, len, "Invalid event (%d)", fsm->last_error.event);
+		break;
+	case CFSM_REASON_INVALID_TRANSITION:
+		snprintf(buf, len, "Invalid event %s in state %s",
+		    {{event_ntop_func}}_safe(fsm->last_error.event),
+		    {{state_ntop_func}}_safe(fsm->last_error.old_state));
+		break;
+	case CFSM_REASON_EVENT_PRECOND:
+		snprintf(buf, len, "Event %s entry precondition not satisfied",
+		    {{event_ntop_func}}_safe(fsm->last_error.event));
+		break;
+	case CFSM_REASON_EXIT_PRECOND:
+		snprintf(buf, len, "State %s exit precondition not satisfied",
+		    {{state_ntop_func}}_safe(fsm->last_error.old_state));
+		break;
+	case CFSM_REASON_ENTRY_PRECOND:
+		snprintf(buf, len, "State %s entry precondition not satisfied",
+		    {{state_ntop_func}}_safe(fsm->last_error.new_state));
+		break;
+	default:
+		snprintf(buf, len, "Unknown error reason (%d)",
+		    fsm->last_error.reason);
+		break;
+	}
+	return buf;
+}
+
+{{endif}}{{if timeouts}}/* Timeout of each state in milliseconds, or 0 if it has none */
+static inline uint32_t
+_{{fsm_struct}}_state_timeout(enum {{state_enum}} state)
+{
+	switch (state) {
+{{for state in states}}{{if state.value.timeout}}	case {{state.key}}:
+		return {{state.value.timeout}};
+{{endif}}{{endfor}}	default:
+		return 0;
+	}
+}
+
+/*
+ * Put a timer in the slot of the finest level that reaches its expiry
+ * time. Level "l" holds timers due in less than CFSM_TIMER_SLOTS ^ (l + 1)
+ * ticks, in the slot for their expiry time's CFSM_TIMER_BITS bits at that
+ * level, so each slot of a level above the first is cascaded down
+ * exactly when the first of its timers falls within reach of the level
+ * below.
+ */
+static void
+_{{fsm_struct}}_timer_link(struct {{fsm_struct}}_timers *timers,
+    struct {{fsm_struct}} *fsm)
+{
+	uint64_t delta = fsm->timer.expires - timers->now;
+	struct {{fsm_struct}} **slot;
+	u_int l, i;
+
+	for (l = 0; l < CFSM_TIMER_LEVELS - 1 &&
+	    (delta >> (CFSM_TIMER_BITS * (l + 1))) != 0; l++)
+		;
+	i = (fsm->timer.expires >> (CFSM_TIMER_BITS * l)) &
+	    (CFSM_TIMER_SLOTS - 1);
+	slot = &timers->slots[l][i];
+	timers->occupied[l] |= (uint64_t)1 << i;
+	if ((fsm->timer.next = *slot) != NULL)
+		fsm->timer.next->timer.pprev = &fsm->timer.next;
+	fsm->timer.pprev = slot;
+	*slot = fsm;
+}
+
+/*
+ * Returns the next tick after the wheel's time at which a slot of level
+ * "l" that may hold timers is due: to expire for the first level, or to
+ * be cascaded for the others. Returns UINT64_MAX if no slot is occupied.
+ */
+static uint64_t
+_{{fsm_struct}}_timer_next(struct {{fsm_struct}}_timers *timers, u_int l)
+{
+	uint64_t base = timers->now >> (CFSM_TIMER_BITS * l);
+	u_int k;
+
+	if (timers->occupied[l] == 0)
+		return UINT64_MAX;
+	for (k = 1; k < CFSM_TIMER_SLOTS; k++) {
+		if ((timers->occupied[l] >> ((base + k) &
+		    (CFSM_TIMER_SLOTS - 1))) & 1)
+			break;
+	}
+	return (base + k) << (CFSM_TIMER_BITS * l);
+}
+
+/* Disarm a FSM's timer, whether on the wheel or waiting to be executed */
+static void
+_{{fsm_struct}}_timer_unlink(struct {{fsm_struct}} *fsm)
+{
+	if (fsm->timer.pprev == NULL)
+		return;
+	if ((*fsm->timer.pprev = fsm->timer.next) != NULL)
+		fsm->timer.next->timer.pprev = fsm->timer.pprev;
+	fsm->timer.pprev = NULL;
+	fsm->timer.wheel->count--;
+}
+
+/* Rearm the timer of a FSM as it enters "state" */
+static inline void
+_{{fsm_struct}}_timer_enter(struct {{fsm_struct}} *fsm,
+    enum {{state_enum}} state)
+{
+	struct {{fsm_struct}}_timers *timers = fsm->timer.wheel;
+	uint32_t timeout;
+
+	if (timers == NULL)
+		return;
+	_{{fsm_struct}}_timer_unlink(fsm);
+	if ((timeout = _{{fsm_struct}}_state_timeout(state)) == 0)
+		return;
+	fsm->timer.expires = timers->now + timeout;
+	_{{fsm_struct}}_timer_link(timers, fsm);
+	timers->count++;
+}
+
+void
+{{fsm_struct}}_timers_init(struct {{fsm_struct}}_timers *timers, uint64_t now)
+{
+	bzero(timers, sizeof(*timers));
+	timers->now = now;
+}
+
+void
+{{fsm_struct}}_timers_attach(struct {{fsm_struct}} *fsm,
+    struct {{fsm_struct}}_timers *timers{{if need_ctx}}, void *ctx{{endif}})
+{
+	{{fsm_struct}}_timers_detach(fsm);
+	fsm->timer.wheel = timers;
+{{if need_ctx}}	fsm->timer.ctx = ctx;
+{{endif}}	_{{fsm_struct}}_timer_enter(fsm, fsm->current_state);
+}
+
+void
+{{fsm_struct}}_timers_detach(struct {{fsm_struct}} *fsm)
+{
+	_{{fsm_struct}}_timer_unlink(fsm);
+	fsm->timer.wheel = NULL;
+}
+
+size_t
+{{fsm_struct}}_timers_advance(struct {{fsm_struct}}_timers *timers,
+    uint64_t now)
+{
+	struct {{fsm_struct}} *fired = NULL, **tail = &fired, *fsm, *next;
+	struct {{fsm_struct}} **slot;
+	uint64_t tick, t;
+	size_t nfired = 0, n = 0;
+	u_int l, i;
+
+	/*
+	 * Visit each tick up to "now" at which an occupied slot is due,
+	 * skipping the rest, until no timer is left on the wheel.
+	 */
+	while (timers->count > nfired) {
+		for (l = 0, tick = UINT64_MAX; l < CFSM_TIMER_LEVELS; l++) {
+			if ((t = _{{fsm_struct}}_timer_next(timers, l)) < tick)
+				tick = t;
+		}
+		if (tick > now)
+			break;
+		timers->now = tick;
+		for (l = 1; l < CFSM_TIMER_LEVELS && ((timers->now >>
+		    (CFSM_TIMER_BITS * (l - 1))) & (CFSM_TIMER_SLOTS - 1)) == 0;
+		    l++) {
+			i = (timers->now >> (CFSM_TIMER_BITS * l)) &
+			    (CFSM_TIMER_SLOTS - 1);
+			slot = &timers->slots[l][i];
+			timers->occupied[l] &= ~((uint64_t)1 << i);
+			for (fsm = *slot, *slot = NULL; fsm != NULL; fsm = next) {
+				next = fsm->timer.next;
+				_{{fsm_struct}}_timer_link(timers, fsm);
+			}
+		}
+		/* Everything left in this slot expires now */
+		i = timers->now & (CFSM_TIMER_SLOTS - 1);
+		slot = &timers->slots[0][i];
+		timers->occupied[0] &= ~((uint64_t)1 << i);
+		if ((fsm = *slot) == NULL)
+			continue;
+		*slot = NULL;
+		fsm->timer.pprev = tail;
+		*tail = fsm;
+		for (; fsm != NULL; fsm = fsm->timer.next) {
+			tail = &fsm->timer.next;
+			nfired++;
+		}
+	}
+	if (timers->now < now)
+		timers->now = now;
+
+	/* Callbacks may disarm timers that have not been executed yet */
+	while ((fsm = fired) != NULL) {
+		if ((fired = fsm->timer.next) != NULL)
+			fired->timer.pprev = &fired;
+		fsm->timer.pprev = NULL;
+		timers->count--;
+		{{advance_func}}(fsm, {{timeout_event}}{{if need_ctx}}, fsm->timer.ctx{{endif}}{{if error_records}}{{else}},
+		    NULL, 0{{endif}});
+		n++;
+	}
+	return n;
+}
+
+{{endif}}{{if multiple_start_states}}int
+{{init_func}}(struct {{fsm_struct}} *fsm, enum {{state_enum}} initial_state{{if error_records}}{{else}},
+    char *errbuf, size_t errlen{{endif}})
 {
-	switch (initial_state) {
+{{if mailbox}}	size_t i;
+
+{{endif}}	switch (initial_state) {
 {{for s in initial_states}}	case {{s.value}}:
 {{endfor}}		break;
 	default:
-		if (errlen > 0 && errbuf != NULL) {
+{{if error_records}}		return _{{fsm_struct}}_error(fsm, CFSM_REASON_INVALID_START,
+		    initial_state, 0, initial_state);
+{{else}}		if (errlen > 0 && errbuf != NULL) {
 			snprintf(errbuf, errlen,
 			    "State %s (%d) is not a valid start state",
 			    {{state_ntop_func}}_safe(initial_state),
 			    initial_state);
 		}
 		return CFSM_ERR_INVALID_STATE;
-	}
+{{endif}}	}
 	bzero(fsm, sizeof(*fsm));
 	fsm->current_state = initial_state;
-	return CFSM_OK;
+{{if mailbox}}	for (i = 0; i < {{mailbox}}; i++)
+		fsm->mailbox.slots[i].seq = i;
+{{endif}}{{if stats_mode}}	fsm->state_entered = _{{fsm_struct}}_clock();
+	_{{fsm_struct}}_stats.entries[initial_state]++;
+{{endif}}{{if table_mode}}{{if compact_storage}}{{else}}	fsm->transition_table = &_{{fsm_struct}}_transtable;
+{{endif}}{{endif}}	return CFSM_OK;
 }{{else}}int
-{{init_func}}(struct {{fsm_struct}} *fsm, char *errbuf, size_t errlen)
+{{init_func}}(struct {{fsm_struct}} *fsm{{if error_records}}{{else}}, char *errbuf, size_t errlen{{endif}})
 {
-	bzero(fsm, sizeof(*fsm));
+{{if mailbox}}	size_t i;
+
+{{endif}}	bzero(fsm, sizeof(*fsm));
 	fsm->current_state = {{initial_states[0]}};
-	return CFSM_OK;
+{{if mailbox}}	for (i = 0; i < {{mailbox}}; i++)
+		fsm->mailbox.slots[i].seq = i;
+{{endif}}{{if stats_mode}}	fsm->state_entered = _{{fsm_struct}}_clock();
+	_{{fsm_struct}}_stats.entries[{{initial_states[0]}}]++;
+{{endif}}{{if table_mode}}{{if compact_storage}}{{else}}	fsm->transition_table = &_{{fsm_struct}}_transtable;
+{{endif}}{{endif}}	return CFSM_OK;
 }{{endif}}
 
 enum {{state_enum}}
@@ -118,45 +765,84 @@ enum {{state_enum}}
 	return fsm->current_state;
 }
 
-int {{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
-    {{if need_ctx}}void *ctx, {{endif}}char *errbuf, size_t errlen)
+const uint32_t *
+{{valid_events_func}}(enum {{state_enum}} state)
 {
-	enum {{state_enum}} old_state = fsm->current_state;
-	enum {{state_enum}} new_state;
+	if (_is_{{state_enum}}_valid(state) != 0)
+		return NULL;
+	return _{{fsm_struct}}_event_masks[state];
+}
 
-	/* Sanity check states */
-	if (_is_{{state_enum}}_valid(fsm->current_state) != 0) {
-		if (errlen > 0 && errbuf != NULL) {
-			snprintf(errbuf, errlen, "Invalid current_state (%d)",
-			    fsm->current_state);
-		}
-		return CFSM_ERR_INVALID_STATE;
-	}
-	if (_is_{{event_enum}}_valid(ev) != 0) {
-		if (errlen > 0 && errbuf != NULL)
-			snprintf(errbuf, errlen, "Invalid event (%d)", ev);
-		return CFSM_ERR_INVALID_EVENT;
-	}
+int
+{{can_advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev)
+{
+	const uint32_t *mask;
 
-	/* Event validity checks */
-	switch(old_state) {
+	if ((mask = {{valid_events_func}}(fsm->current_state)) == NULL ||
+	    _is_{{event_enum}}_valid(ev) != 0)
+		return 0;
+	return (mask[ev / 32] >> (ev % 32)) & 1;
+}
+
+/*
+ * Look up the transition for event "ev" in state "old_state". Returns 0
+ * and sets "new_state" if the event causes a transition, 1 if the event
+ * is ignored in this state or -1 if it is not valid in this state. The
+ * state and event must already have been checked for validity.
+ */
+static inline int
+_{{fsm_struct}}_lookup(struct {{fsm_struct}} *fsm, enum {{state_enum}} old_state,
+    enum {{event_enum}} ev, enum {{state_enum}} *new_state)
+{
+{{if table_mode}}	const struct {{fsm_struct}}_transtable *tt = {{if compact_storage}}&_{{fsm_struct}}_transtable{{else}}fsm->transition_table{{endif}};
+	{{transtable_type}} next;
+{{if table_sparse}}	size_t cell;
+
+	cell = tt->base[old_state] + ev;
+	if (tt->cells[cell].check != old_state)
+		return -1;
+	next = tt->cells[cell].next;
+{{else}}
+	next = tt->next[old_state][ev];
+{{endif}}	if (next >= _CFSM_TT_IGNORE)
+		return next == _CFSM_TT_IGNORE ? 1 : -1;
+	*new_state = next;
+	return 0;
+{{else}}	switch(old_state) {
 {{for state in states}}	case {{state.key}}:
 {{if state.value.events}}		switch (ev) {
 {{for event in state.value.events}}		case {{event.key}}:
-{{if event.value}}			new_state = {{event.value}};
-			break;{{else}}			return 0;{{endif}}
+{{if event.value}}			*new_state = {{event.value}};
+			return 0;{{else}}			return 1;{{endif}}
 {{endfor}}		default:
-			goto bad_event;
+			return -1;
 		}
-		break;
-{{else}}		goto bad_event;
+{{else}}		return -1;
 {{endif}}{{endfor}}	}
+	return -1;
+{{endif}}}
+
+/*
+ * Check the preconditions of a valid transition from "old_state" to
+ * "new_state" caused by event "ev". Returns CFSM_OK if they are all
+ * satisfied or CFSM_ERR_PRECONDITION if one is not.{{if error_records}} The failure is
+ * recorded in "fsm" unless it is NULL.{{endif}}
+ */
+static inline int
+_{{advance_func}}_preconds(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
+    enum {{state_enum}} old_state, enum {{state_enum}} new_state{{if need_ctx}},
+    void *ctx{{endif}}{{if error_records}}{{else}}, char *errbuf, size_t errlen{{endif}})
+{
 {{if event_preconds}}
 	/* Event preconditions */
 	switch(ev) {
 {{for event in events}}{{if event.value.preconds}}	case {{event.key}}:
-{{for precond in event.value.preconds}}		if ({{precond.key}}({{event_precond_args}}) != 0)
+{{for precond in event.value.preconds}}		if ({{precond.key}}({{event_precond_args}}) != 0){{if stats_mode}} {
+			_{{fsm_struct}}_stats.precond_failures[
+			    _{{fsm_struct}}_pc_{{precond.key}}]++;
 			goto event_precond_fail;
+		}{{else}}
+			goto event_precond_fail;{{endif}}
 {{endfor}}		break;
 {{endif}}{{endfor}}	default:
 		break;
@@ -165,8 +851,12 @@ int {{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
 	/* Current state exit preconditions */
 	switch(old_state) {
 {{for state in states}}{{if state.value.exit_preconds}}	case {{state.key}}:
-{{for precond in state.value.exit_preconds}}		if ({{precond.key}}({{trans_precond_args}}) != 0)
+{{for precond in state.value.exit_preconds}}		if ({{precond.key}}({{trans_precond_args}}) != 0){{if stats_mode}} {
+			_{{fsm_struct}}_stats.precond_failures[
+			    _{{fsm_struct}}_pc_{{precond.key}}]++;
 			goto exit_precond_fail;
+		}{{else}}
+			goto exit_precond_fail;{{endif}}
 {{endfor}}		break;
 {{endif}}{{endfor}}	default:
 		break;
@@ -175,13 +865,66 @@ int {{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
 	/* Next state entry preconditions */
 	switch(new_state) {
 {{for state in states}}{{if state.value.entry_preconds}}	case {{state.key}}:
-{{for precond in state.value.entry_preconds}}		if ({{precond.key}}({{trans_precond_args}}) != 0)
+{{for precond in state.value.entry_preconds}}		if ({{precond.key}}({{trans_precond_args}}) != 0){{if stats_mode}} {
+			_{{fsm_struct}}_stats.precond_failures[
+			    _{{fsm_struct}}_pc_{{precond.key}}]++;
 			goto entry_precond_fail;
+		}{{else}}
+			goto entry_precond_fail;{{endif}}
 {{endfor}}		break;
 {{endif}}{{endfor}}	default:
 		break;
 	}
-{{endif}}{{if event_callbacks}}
+{{endif}}
+	return CFSM_OK;
+{{if transition_entry_preconds}}
+ entry_precond_fail:
+{{if error_records}}	if (fsm == NULL)
+		return CFSM_ERR_PRECONDITION;
+	return _{{fsm_struct}}_error(fsm, CFSM_REASON_ENTRY_PRECOND,
+	    old_state, ev, new_state);
+{{else}}	if (errlen > 0 && errbuf != NULL) {
+		snprintf(errbuf, errlen,
+		    "State %s entry precondition not satisfied",
+		    {{state_ntop_func}}_safe(new_state));
+	}
+	return CFSM_ERR_PRECONDITION;
+{{endif}}{{endif}}{{if transition_exit_preconds}}
+ exit_precond_fail:
+{{if error_records}}	if (fsm == NULL)
+		return CFSM_ERR_PRECONDITION;
+	return _{{fsm_struct}}_error(fsm, CFSM_REASON_EXIT_PRECOND,
+	    old_state, ev, new_state);
+{{else}}	if (errlen > 0 && errbuf != NULL) {
+		snprintf(errbuf, errlen,
+		    "State %s exit precondition not satisfied",
+		    {{state_ntop_func}}_safe(old_state));
+	}
+	return CFSM_ERR_PRECONDITION;
+{{endif}}{{endif}}{{if event_preconds}}
+ event_precond_fail:
+{{if error_records}}	if (fsm == NULL)
+		return CFSM_ERR_PRECONDITION;
+	return _{{fsm_struct}}_error(fsm, CFSM_REASON_EVENT_PRECOND,
+	    old_state, ev, new_state);
+{{else}}	if (errlen > 0 && errbuf != NULL) {
+		snprintf(errbuf, errlen,
+		    "Event %s entry precondition not satisfied",
+		    {{event_ntop_func}}_safe(ev));
+	}
+	return CFSM_ERR_PRECONDITION;
+{{endif}}{{endif}}
+}
+
+/*
+ * Run the callbacks that precede the switch to "new_state": those of the
+ * event and then the exit callbacks of "old_state".
+ */
+static inline void
+_{{advance_func}}_leave(enum {{event_enum}} ev, enum {{state_enum}} old_state,
+    enum {{state_enum}} new_state{{if need_ctx}}, void *ctx{{endif}})
+{
+{{if event_callbacks}}
 	/* Event callbacks */
 	switch(ev) {
 {{for event in events}}{{if event.value.callbacks}}	case {{event.key}}:
@@ -199,9 +942,13 @@ int {{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
 {{endif}}{{endfor}}	default:
 		break;
 	}
-{{endif}}
-	/* Switch state now */
-	fsm->current_state = new_state;
+{{endif}}}
+
+/* Run the entry callbacks of "new_state", once it has been switched to */
+static inline void
+_{{advance_func}}_enter(enum {{event_enum}} ev, enum {{state_enum}} old_state,
+    enum {{state_enum}} new_state{{if need_ctx}}, void *ctx{{endif}})
+{
 {{if transition_entry_callbacks}}
 	/* New state entry callbacks */
 	switch(new_state) {
@@ -211,39 +958,682 @@ int {{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
 {{endif}}{{endfor}}	default:
 		break;
 	}
+{{endif}}}
+
+/*
+ * Perform a valid transition from "old_state" to "new_state" caused by
+ * event "ev": check preconditions, run callbacks and switch state.
+ */
+static int
+_{{advance_func}}_transition(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
+    enum {{state_enum}} old_state, enum {{state_enum}} new_state{{if need_ctx}},
+    void *ctx{{endif}}{{if error_records}}{{else}}, char *errbuf, size_t errlen{{endif}})
+{
+	int r;
+
+	if ((r = _{{advance_func}}_preconds(fsm, ev, old_state, new_state{{if need_ctx}},
+	    ctx{{endif}}{{if error_records}}{{else}}, errbuf, errlen{{endif}})) != CFSM_OK)
+		return r;
+	_{{advance_func}}_leave(ev, old_state, new_state{{if need_ctx}}, ctx{{endif}});
+
+	/* Switch state now */
+{{if stats_mode}}	_{{fsm_struct}}_stats_move(fsm, old_state, new_state);
+{{endif}}{{if trace_mode}}	if (_CFSM_UNLIKELY(_{{fsm_struct}}_trace != NULL))
+		_{{fsm_struct}}_trace_record(fsm, old_state, ev, new_state);
+{{endif}}	fsm->current_state = new_state;
+{{if timeouts}}	_{{fsm_struct}}_timer_enter(fsm, new_state);
 {{endif}}
+	_{{advance_func}}_enter(ev, old_state, new_state{{if need_ctx}}, ctx{{endif}});
 	return CFSM_OK;
-{{if transition_entry_preconds}}
+}
+
+{{if fused_mode}}/*
+ * Advance the FSM from "old_state" by event "ev" with a single dispatch on
+ * the (state, event) pair. Each transition has its own case holding only
+ * the preconditions and callbacks that apply to it. The state and event
+ * must already have been checked for validity.
+ */
+#define _CFSM_FUSED(s, e)	((s) * {{num_events}} + (e))
+
+static int
+_{{advance_func}}_fused(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
+    enum {{state_enum}} old_state{{if need_ctx}}, void *ctx{{endif}}{{if error_records}}{{else}},
+    char *errbuf, size_t errlen{{endif}})
+{
+{{if fused_transitions}}	enum {{state_enum}} new_state;
+
+{{endif}}	switch (_CFSM_FUSED(old_state, ev)) {
+{{for t in fused_transitions}}	case _CFSM_FUSED({{t.value.state}}, {{t.value.event}}):
+		new_state = {{t.value.next}};
+{{for precond in t.value.event_preconds}}		if ({{precond.value}}({{event_precond_args}}) != 0){{if stats_mode}} {
+			_{{fsm_struct}}_stats.precond_failures[
+			    _{{fsm_struct}}_pc_{{precond.value}}]++;
+			goto event_precond_fail;
+		}{{else}}
+			goto event_precond_fail;{{endif}}
+{{endfor}}{{for precond in t.value.exit_preconds}}		if ({{precond.value}}({{trans_precond_args}}) != 0){{if stats_mode}} {
+			_{{fsm_struct}}_stats.precond_failures[
+			    _{{fsm_struct}}_pc_{{precond.value}}]++;
+			goto exit_precond_fail;
+		}{{else}}
+			goto exit_precond_fail;{{endif}}
+{{endfor}}{{for precond in t.value.entry_preconds}}		if ({{precond.value}}({{trans_precond_args}}) != 0){{if stats_mode}} {
+			_{{fsm_struct}}_stats.precond_failures[
+			    _{{fsm_struct}}_pc_{{precond.value}}]++;
+			goto entry_precond_fail;
+		}{{else}}
+			goto entry_precond_fail;{{endif}}
+{{endfor}}{{for cb in t.value.event_callbacks}}		{{cb.value}}({{event_cb_args}});
+{{endfor}}{{for cb in t.value.exit_callbacks}}		{{cb.value}}({{trans_cb_args}});
+{{endfor}}{{if stats_mode}}		_{{fsm_struct}}_stats_move(fsm, old_state, new_state);
+{{endif}}{{if trace_mode}}		if (_CFSM_UNLIKELY(_{{fsm_struct}}_trace != NULL))
+			_{{fsm_struct}}_trace_record(fsm, old_state, ev,
+			    new_state);
+{{endif}}		fsm->current_state = new_state;
+{{if timeouts}}		_{{fsm_struct}}_timer_enter(fsm, new_state);
+{{endif}}{{for cb in t.value.entry_callbacks}}		{{cb.value}}({{trans_cb_args}});
+{{endfor}}		return CFSM_OK;
+{{endfor}}{{if fused_ignored}}{{for t in fused_ignored}}	case _CFSM_FUSED({{t.value.state}}, {{t.value.event}}):
+{{endfor}}		return CFSM_OK;
+{{endif}}	default:
+{{if error_records}}		return _{{fsm_struct}}_error(fsm,
+		    CFSM_REASON_INVALID_TRANSITION, old_state, ev, old_state);
+{{else}}		if (errlen > 0 && errbuf != NULL) {
+			snprintf(errbuf, errlen,
+			    "Invalid event %s in state %s",
+			    {{event_ntop_func}}_safe(ev),
+			    {{state_ntop_func}}_safe(fsm->current_state));
+		}
+		return CFSM_ERR_INVALID_TRANSITION;
+{{endif}}	}
+{{if fused_entry_precond_fail}}
  entry_precond_fail:
-	if (errlen > 0 && errbuf != NULL) {
+{{if error_records}}	return _{{fsm_struct}}_error(fsm, CFSM_REASON_ENTRY_PRECOND,
+	    old_state, ev, new_state);
+{{else}}	if (errlen > 0 && errbuf != NULL) {
 		snprintf(errbuf, errlen,
 		    "State %s entry precondition not satisfied",
 		    {{state_ntop_func}}_safe(new_state));
 	}
 	return CFSM_ERR_PRECONDITION;
-{{endif}}{{if transition_exit_preconds}}
+{{endif}}{{endif}}{{if fused_exit_precond_fail}}
  exit_precond_fail:
-	if (errlen > 0 && errbuf != NULL) {
+{{if error_records}}	return _{{fsm_struct}}_error(fsm, CFSM_REASON_EXIT_PRECOND,
+	    old_state, ev, new_state);
+{{else}}	if (errlen > 0 && errbuf != NULL) {
 		snprintf(errbuf, errlen,
 		    "State %s exit precondition not satisfied",
 		    {{state_ntop_func}}_safe(fsm->current_state));
 	}
 	return CFSM_ERR_PRECONDITION;
-{{endif}}{{if event_preconds}}
+{{endif}}{{endif}}{{if fused_event_precond_fail}}
  event_precond_fail:
-	if (errlen > 0 && errbuf != NULL) {
+{{if error_records}}	return _{{fsm_struct}}_error(fsm, CFSM_REASON_EVENT_PRECOND,
+	    old_state, ev, new_state);
+{{else}}	if (errlen > 0 && errbuf != NULL) {
 		snprintf(errbuf, errlen,
 		    "Event %s entry precondition not satisfied",
 		    {{event_ntop_func}}_safe(ev));
 	}
 	return CFSM_ERR_PRECONDITION;
+{{endif}}{{endif}}}
+
+{{endif}}{{if error_records}}{{if event_queue}}static int
+_{{advance_func}}_step{{else}}int {{advance_func}}{{endif}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev{{if need_ctx}},
+    void *ctx{{endif}})
+{
+	enum {{state_enum}} old_state = fsm->current_state;
+{{if fused_mode}}{{else}}	enum {{state_enum}} new_state;
 {{endif}}
- bad_event:
-	if (errlen > 0 && errbuf != NULL) {
-		snprintf(errbuf, errlen,
-		    "Invalid event %s in state %s",
-		    {{event_ntop_func}}_safe(ev),
-		    {{state_ntop_func}}_safe(fsm->current_state));
+	/* Sanity check states */
+	if (_is_{{state_enum}}_valid(old_state) != 0) {
+		return _{{fsm_struct}}_error(fsm, CFSM_REASON_INVALID_STATE,
+		    old_state, ev, old_state);
+	}
+	if (_is_{{event_enum}}_valid(ev) != 0) {
+		return _{{fsm_struct}}_error(fsm, CFSM_REASON_INVALID_EVENT,
+		    old_state, ev, old_state);
 	}
-	return CFSM_ERR_INVALID_TRANSITION;
+{{if stats_mode}}	_{{fsm_struct}}_stats.events[old_state][ev]++;
+{{endif}}{{if fused_mode}}
+	return _{{advance_func}}_fused(fsm, ev, old_state{{if need_ctx}}, ctx{{endif}});
+{{else}}
+	/* Event validity checks */
+	switch (_{{fsm_struct}}_lookup(fsm, old_state, ev, &new_state)) {
+	case 0:
+		break;
+	case 1:
+		return CFSM_OK;
+	default:
+		return _{{fsm_struct}}_error(fsm,
+		    CFSM_REASON_INVALID_TRANSITION, old_state, ev, old_state);
+	}
+
+	return _{{advance_func}}_transition(fsm, ev, old_state, new_state{{if need_ctx}},
+	    ctx{{endif}});
+{{endif}}}
+{{else}}{{if event_queue}}static int
+_{{advance_func}}_step{{else}}int {{advance_func}}{{endif}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
+    {{if need_ctx}}void *ctx, {{endif}}char *errbuf, size_t errlen)
+{
+	enum {{state_enum}} old_state = fsm->current_state;
+{{if fused_mode}}{{else}}	enum {{state_enum}} new_state;
+{{endif}}
+	/* Sanity check states */
+	if (_is_{{state_enum}}_valid(fsm->current_state) != 0) {
+		if (errlen > 0 && errbuf != NULL) {
+			snprintf(errbuf, errlen, "Invalid current_state (%d)",
+			    fsm->current_state);
+		}
+		return CFSM_ERR_INVALID_STATE;
+	}
+	if (_is_{{event_enum}}_valid(ev) != 0) {
+		if (errlen > 0 && errbuf != NULL)
+			snprintf(errbuf, errlen, "Invalid event (%d)", ev);
+		return CFSM_ERR_INVALID_EVENT;
+	}
+{{if stats_mode}}	_{{fsm_struct}}_stats.events[old_state][ev]++;
+{{endif}}{{if fused_mode}}
+	return _{{advance_func}}_fused(fsm, ev, old_state,
+	    {{if need_ctx}}ctx, {{endif}}errbuf, errlen);
+{{else}}
+	/* Event validity checks */
+	switch (_{{fsm_struct}}_lookup(fsm, old_state, ev, &new_state)) {
+	case 0:
+		break;
+	case 1:
+		return CFSM_OK;
+	default:
+		if (errlen > 0 && errbuf != NULL) {
+			snprintf(errbuf, errlen,
+			    "Invalid event %s in state %s",
+			    {{event_ntop_func}}_safe(ev),
+			    {{state_ntop_func}}_safe(fsm->current_state));
+		}
+		return CFSM_ERR_INVALID_TRANSITION;
+	}
+
+	return _{{advance_func}}_transition(fsm, ev, old_state, new_state,
+	    {{if need_ctx}}ctx, {{endif}}errbuf, errlen);
+{{endif}}}
+{{endif}}{{if event_queue}}
+int
+{{fsm_struct}}_post(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev)
+{
+	if (fsm->queue.count >= {{event_queue}})
+		return CFSM_ERR_QUEUE_FULL;
+	fsm->queue.events[(fsm->queue.head + fsm->queue.count) %
+	    {{event_queue}}] = ev;
+	fsm->queue.count++;
+	return CFSM_OK;
+}
+
+/*
+ * Execute posted events in the order they were posted until none are
+ * left; their callbacks may post more as they go. If one fails, the rest
+ * are discarded and its failure returned.
+ */
+static int
+_{{advance_func}}_drain(struct {{fsm_struct}} *fsm{{if need_ctx}}, void *ctx{{endif}}{{if error_records}}{{else}},
+    char *errbuf, size_t errlen{{endif}})
+{
+	enum {{event_enum}} ev;
+	int r;
+
+	while (fsm->queue.count > 0) {
+		ev = fsm->queue.events[fsm->queue.head];
+		fsm->queue.head = (fsm->queue.head + 1) % {{event_queue}};
+		fsm->queue.count--;
+		if ((r = _{{advance_func}}_step(fsm, ev{{if need_ctx}}, ctx{{endif}}{{if error_records}}{{else}},
+		    errbuf, errlen{{endif}})) != CFSM_OK) {
+			fsm->queue.count = 0;
+			return r;
+		}
+	}
+	return CFSM_OK;
+}
+
+{{if error_records}}int {{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev{{if need_ctx}},
+    void *ctx{{endif}})
+{{else}}int {{advance_func}}(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev,
+    {{if need_ctx}}void *ctx, {{endif}}char *errbuf, size_t errlen)
+{{endif}}{
+	int r;
+
+	/* Callbacks post events rather than recursing, so this never nests */
+	if ((r = _{{advance_func}}_step(fsm, ev{{if need_ctx}}, ctx{{endif}}{{if error_records}}{{else}},
+	    errbuf, errlen{{endif}})) != CFSM_OK)
+		return r;
+	return _{{advance_func}}_drain(fsm{{if need_ctx}}, ctx{{endif}}{{if error_records}}{{else}}, errbuf,
+	    errlen{{endif}});
+}
+{{endif}}
+#if defined(__GNUC__)
+/*
+ * Every pass checks preconditions against the state it loaded and then
+ * tries to commit with compare-and-swap; losing the race to another
+ * thread means starting again from the state that thread left. Only the
+ * winning pass runs callbacks, all of them after the commit.
+ */
+int
+{{advance_func}}_atomic(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev{{if need_ctx}},
+    void *ctx{{endif}}{{if error_records}}{{else}}, char *errbuf, size_t errlen{{endif}})
+{
+	{{if compact_storage}}{{state_storage_type}}{{else}}enum {{state_enum}}{{endif}} cur;
+	enum {{state_enum}} old_state, new_state;
+{{if stats_mode}}	uint64_t now;
+{{endif}}	int r;
+
+	cur = __atomic_load_n(&fsm->current_state, __ATOMIC_ACQUIRE);
+	if (_is_{{event_enum}}_valid(ev) != 0) {
+{{if error_records}}{{else}}		if (errlen > 0 && errbuf != NULL)
+			snprintf(errbuf, errlen, "Invalid event (%d)", ev);
+{{endif}}		return CFSM_ERR_INVALID_EVENT;
+	}
+	for (;;) {
+		old_state = cur;
+		if (_is_{{state_enum}}_valid(old_state) != 0) {
+{{if error_records}}{{else}}			if (errlen > 0 && errbuf != NULL) {
+				snprintf(errbuf, errlen,
+				    "Invalid current_state (%d)", old_state);
+			}
+{{endif}}			return CFSM_ERR_INVALID_STATE;
+		}
+{{if stats_mode}}		_{{fsm_struct}}_stats.events[old_state][ev]++;
+{{endif}}		switch (_{{fsm_struct}}_lookup(fsm, old_state, ev, &new_state)) {
+		case 0:
+			break;
+		case 1:
+			return CFSM_OK;
+		default:
+{{if error_records}}{{else}}			if (errlen > 0 && errbuf != NULL) {
+				snprintf(errbuf, errlen,
+				    "Invalid event %s in state %s",
+				    {{event_ntop_func}}_safe(ev),
+				    {{state_ntop_func}}_safe(old_state));
+			}
+{{endif}}			return CFSM_ERR_INVALID_TRANSITION;
+		}
+		if ((r = _{{advance_func}}_preconds({{if error_records}}NULL{{else}}fsm{{endif}}, ev, old_state,
+		    new_state{{if need_ctx}}, ctx{{endif}}{{if error_records}}{{else}}, errbuf, errlen{{endif}})) != CFSM_OK)
+			return r;
+		if (__atomic_compare_exchange_n(&fsm->current_state, &cur,
+		    new_state, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			break;
+{{if stats_mode}}		/* A pass that lost the race was not an arrival */
+		_{{fsm_struct}}_stats.events[old_state][ev]--;
+{{endif}}	}
+
+{{if stats_mode}}	now = _{{fsm_struct}}_clock();
+	_{{fsm_struct}}_stats.ticks[old_state] += now -
+	    __atomic_exchange_n(&fsm->state_entered, now, __ATOMIC_RELAXED);
+	_{{fsm_struct}}_stats.entries[new_state]++;
+{{endif}}{{if trace_mode}}	if (_CFSM_UNLIKELY(_{{fsm_struct}}_trace != NULL))
+		_{{fsm_struct}}_trace_record(fsm, old_state, ev, new_state);
+{{endif}}{{if timeouts}}	_{{fsm_struct}}_timer_enter(fsm, new_state);
+{{endif}}	_{{advance_func}}_leave(ev, old_state, new_state{{if need_ctx}}, ctx{{endif}});
+	_{{advance_func}}_enter(ev, old_state, new_state{{if need_ctx}}, ctx{{endif}});
+	return CFSM_OK;
+}
+#endif /* __GNUC__ */
+
+{{if mailbox}}#if defined(__GNUC__)
+/*
+ * The mailbox is a bounded queue after Dmitry Vyukov's. Each slot has a
+ * sequence number saying whose turn it is: the slot for position "pos"
+ * is free for the producer that claims "pos" while its sequence is
+ * "pos", holds an event for the consumer once it is "pos + 1" and is
+ * made "pos + {{mailbox}}" again, ready for the next lap, once drained.
+ */
+int
+{{fsm_struct}}_send(struct {{fsm_struct}} *fsm, enum {{event_enum}} ev)
+{
+	uint32_t pos, seq;
+
+	pos = __atomic_load_n(&fsm->mailbox.tail, __ATOMIC_RELAXED);
+	for (;;) {
+		seq = __atomic_load_n(
+		    &fsm->mailbox.slots[pos & ({{mailbox}} - 1)].seq,
+		    __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			/* On failure, "pos" is updated to the current tail */
+			if (__atomic_compare_exchange_n(&fsm->mailbox.tail,
+			    &pos, pos + 1, 1, __ATOMIC_RELAXED,
+			    __ATOMIC_RELAXED))
+				break;
+		} else if ((int32_t)(seq - pos) < 0)
+			return CFSM_ERR_QUEUE_FULL;
+		else
+			pos = __atomic_load_n(&fsm->mailbox.tail,
+			    __ATOMIC_RELAXED);
+	}
+	fsm->mailbox.slots[pos & ({{mailbox}} - 1)].ev = ev;
+	__atomic_store_n(&fsm->mailbox.slots[pos & ({{mailbox}} - 1)].seq,
+	    pos + 1, __ATOMIC_RELEASE);
+	return CFSM_OK;
+}
+
+size_t
+{{fsm_struct}}_drain(struct {{fsm_struct}} *fsm{{if need_ctx}}, void *ctx{{endif}}, int *results,
+    size_t max)
+{
+	enum {{event_enum}} ev;
+	uint32_t pos;
+	size_t n;
+	int r;
+
+	for (n = 0; n < max; n++) {
+		pos = fsm->mailbox.head;
+		if (__atomic_load_n(&fsm->mailbox.slots[pos & ({{mailbox}} - 1)].seq,
+		    __ATOMIC_ACQUIRE) != pos + 1)
+			break;
+		ev = fsm->mailbox.slots[pos & ({{mailbox}} - 1)].ev;
+		/* Hand the slot back before running any callbacks */
+		__atomic_store_n(&fsm->mailbox.slots[pos & ({{mailbox}} - 1)].seq,
+		    pos + {{mailbox}}, __ATOMIC_RELEASE);
+		fsm->mailbox.head = pos + 1;
+		r = {{advance_func}}(fsm, ev{{if need_ctx}}, ctx{{endif}}{{if error_records}}{{else}}, NULL, 0{{endif}});
+		if (results != NULL)
+			results[n] = r;
+	}
+	return n;
+}
+#endif /* __GNUC__ */
+
+{{endif}}/* Number of instances ahead of the current one to prefetch in batches */
+#define _CFSM_BATCH_PREFETCH	8
+#if defined(__GNUC__)
+# define _CFSM_PREFETCH(p)	__builtin_prefetch(p)
+#else
+# define _CFSM_PREFETCH(p)
+#endif
+
+size_t
+{{advance_func}}_batch(struct {{fsm_struct}} **fsms, const enum {{event_enum}} *evs,
+    {{if need_ctx}}void **ctxs, {{endif}}int *results, size_t n)
+{
+	struct {{fsm_struct}} *fsm;
+	enum {{state_enum}} old_state{{if fused_mode}}{{else}}, new_state{{endif}};
+	size_t i, nfailed = 0;
+	int r;
+
+	for (i = 0; i < n; i++) {
+		if (i + _CFSM_BATCH_PREFETCH < n)
+			_CFSM_PREFETCH(fsms[i + _CFSM_BATCH_PREFETCH]);
+		fsm = fsms[i];
+		old_state = fsm->current_state;
+{{if error_records}}		if (_is_{{state_enum}}_valid(old_state) != 0) {
+			r = _{{fsm_struct}}_error(fsm, CFSM_REASON_INVALID_STATE,
+			    old_state, evs[i], old_state);
+		} else if (_is_{{event_enum}}_valid(evs[i]) != 0) {
+			r = _{{fsm_struct}}_error(fsm, CFSM_REASON_INVALID_EVENT,
+			    old_state, evs[i], old_state);
+		} else {
+{{else}}		if (_is_{{state_enum}}_valid(old_state) != 0)
+			r = CFSM_ERR_INVALID_STATE;
+		else if (_is_{{event_enum}}_valid(evs[i]) != 0)
+			r = CFSM_ERR_INVALID_EVENT;
+		else {
+{{endif}}{{if stats_mode}}			_{{fsm_struct}}_stats.events[old_state][evs[i]]++;
+{{endif}}{{if fused_mode}}
+			r = _{{advance_func}}_fused(fsm, evs[i], old_state{{if need_ctx}},
+			    ctxs == NULL ? NULL : ctxs[i]{{endif}}{{if error_records}}{{else}}, NULL, 0{{endif}});
+{{else}}
+			switch (_{{fsm_struct}}_lookup(fsm, old_state, evs[i],
+			    &new_state)) {
+			case 0:
+				/* Preconditions and callbacks run out of line */
+				r = _{{advance_func}}_transition(fsm, evs[i],
+				    old_state, new_state{{if need_ctx}},
+				    ctxs == NULL ? NULL : ctxs[i]{{endif}}{{if error_records}}{{else}}, NULL, 0{{endif}});
+				break;
+			case 1:
+				r = CFSM_OK;
+				break;
+			default:
+{{if error_records}}				r = _{{fsm_struct}}_error(fsm,
+				    CFSM_REASON_INVALID_TRANSITION, old_state,
+				    evs[i], old_state);
+{{else}}				r = CFSM_ERR_INVALID_TRANSITION;
+{{endif}}				break;
+			}
+{{endif}}		}
+{{if event_queue}}		if (r == CFSM_OK)
+			r = _{{advance_func}}_drain(fsm{{if need_ctx}},
+			    ctxs == NULL ? NULL : ctxs[i]{{endif}}{{if error_records}}{{else}}, NULL, 0{{endif}});
+{{endif}}		if (r != CFSM_OK)
+			nfailed++;
+		if (results != NULL)
+			results[i] = r;
+	}
+	return nfailed;
+}
+
+/*
+ * Each state has its own dispatch block below, and a transition jumps
+ * straight to the block for the next state rather than returning to the
+ * caller or to the top of a loop.
+ */
+int
+{{advance_func}}_run(struct {{fsm_struct}} *fsm, const enum {{event_enum}} *evs,
+    size_t n, {{if need_ctx}}void *ctx, {{endif}}size_t *consumed)
+{
+	size_t i = 0;
+	int r = CFSM_OK;
+
+{{if event_queue}} dispatch:
+{{endif}}	switch (fsm->current_state) {
+{{for state in states}}	case {{state.key}}:
+		goto state_{{state.key}};
+{{endfor}}	default:
+{{if error_records}}		r = _{{fsm_struct}}_error(fsm, CFSM_REASON_INVALID_STATE,
+		    fsm->current_state, n > 0 ? evs[0] : 0, fsm->current_state);
+{{else}}		r = CFSM_ERR_INVALID_STATE;
+{{endif}}		goto out;
+	}
+{{for state in states}}
+ state_{{state.key}}:
+	if (i >= n)
+		goto out;
+{{if stats_mode}}	if (_is_{{event_enum}}_valid(evs[i]) == 0)
+		_{{fsm_struct}}_stats.events[{{state.key}}][evs[i]]++;
+{{endif}}	switch (evs[i]) {
+{{for event in state.value.events}}	case {{event.key}}:
+{{if event.value}}		if ((r = _{{advance_func}}_transition(fsm, evs[i], {{state.key}},
+		    {{event.value}}{{if need_ctx}}, ctx{{endif}}{{if error_records}}{{else}}, NULL, 0{{endif}})) != CFSM_OK)
+			goto out;
+		i++;
+{{if event_queue}}		if (fsm->queue.count > 0)
+			goto drain;
+{{endif}}		goto state_{{event.value}};
+{{else}}		i++;
+		goto state_{{state.key}};
+{{endif}}{{endfor}}	default:
+{{if error_records}}		r = _{{fsm_struct}}_error(fsm,
+		    _is_{{event_enum}}_valid(evs[i]) == 0 ?
+		    CFSM_REASON_INVALID_TRANSITION : CFSM_REASON_INVALID_EVENT,
+		    {{state.key}}, evs[i], {{state.key}});
+{{else}}		r = _is_{{event_enum}}_valid(evs[i]) == 0 ?
+		    CFSM_ERR_INVALID_TRANSITION : CFSM_ERR_INVALID_EVENT;
+{{endif}}		goto out;
+	}
+{{endfor}}{{if event_queue}}
+	/* Posted events may leave the FSM in any state */
+ drain:
+	if ((r = _{{advance_func}}_drain(fsm{{if need_ctx}}, ctx{{endif}}{{if error_records}}{{else}}, NULL,
+	    0{{endif}})) != CFSM_OK)
+		goto out;
+	goto dispatch;
+{{endif}}
+ out:
+	if (consumed != NULL)
+		*consumed = i;
+	return r;
+}
+{{if vector_mode}}
+size_t
+{{advance_func}}_vector({{fsm_struct}}_state_t *states,
+    const {{fsm_struct}}_event_t *evs, uint8_t *failed, size_t n)
+{
+	const {{transtable_type}} *next = &_{{fsm_struct}}_transtable.next[0][0];
+	size_t i = 0, nfailed = 0;
+	{{transtable_type}} cell;
+{{if vector_simd}}#if defined(__AVX2__)
+	const __m256i num_states = _mm256_set1_epi32({{num_states}});
+	const __m256i num_events = _mm256_set1_epi32({{num_events}});
+	const __m256i invalid = _mm256_set1_epi32(_CFSM_TT_INVALID);
+	const __m256i below_ignore = _mm256_set1_epi32(_CFSM_TT_IGNORE - 1);
+	const __m256i ones = _mm256_set1_epi32(-1);
+	__m256i vs, ve, ok, idx, vn, bad, keep;
+	__m128i packed;
+	int j, mask;
+
+	for (; i + 8 <= n; i += 8) {
+{{if vector_state_narrow}}		vs = _mm256_cvtepu8_epi32(
+		    _mm_loadl_epi64((const __m128i *)(states + i)));
+{{else}}		vs = _mm256_cvtepu16_epi32(
+		    _mm_loadu_si128((const __m128i *)(states + i)));
+{{endif}}{{if vector_event_narrow}}		ve = _mm256_cvtepu8_epi32(
+		    _mm_loadl_epi64((const __m128i *)(evs + i)));
+{{else}}		ve = _mm256_cvtepu16_epi32(
+		    _mm_loadu_si128((const __m128i *)(evs + i)));
+{{endif}}
+		/* Lanes with out of range states or events look up cell 0 */
+		ok = _mm256_and_si256(_mm256_cmpgt_epi32(num_states, vs),
+		    _mm256_cmpgt_epi32(num_events, ve));
+		idx = _mm256_and_si256(ok, _mm256_add_epi32(
+		    _mm256_mullo_epi32(vs, num_events), ve));
+		vn = _mm256_and_si256(invalid, _mm256_i32gather_epi32(
+		    (const int *)next, idx, sizeof(*next)));
+
+		/* Failed and ignored lanes keep their current state */
+		bad = _mm256_or_si256(_mm256_xor_si256(ok, ones),
+		    _mm256_cmpeq_epi32(vn, invalid));
+		keep = _mm256_or_si256(bad,
+		    _mm256_cmpgt_epi32(vn, below_ignore));
+		vn = _mm256_blendv_epi8(vn, vs, keep);
+
+		/* Narrow the 32-bit lanes back to the state storage type */
+		packed = _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+		    _mm256_packus_epi32(vn, vn), 0x08));
+{{if vector_state_narrow}}		_mm_storel_epi64((__m128i *)(states + i),
+		    _mm_packus_epi16(packed, packed));
+{{else}}		_mm_storeu_si128((__m128i *)(states + i), packed);
+{{endif}}
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(bad));
+		nfailed += __builtin_popcount(mask);
+		if (failed != NULL) {
+			for (j = 0; j < 8; j++)
+				failed[i + j] = (mask >> j) & 1;
+		}
+	}
+#endif
+{{endif}}
+	/* Scalar fallback, also used for the tail of the arrays */
+	for (; i < n; i++) {
+		if (states[i] >= {{num_states}} || evs[i] >= {{num_events}} ||
+		    (cell = next[states[i] * {{num_events}} + evs[i]]) ==
+		    _CFSM_TT_INVALID) {
+			nfailed++;
+			if (failed != NULL)
+				failed[i] = 1;
+			continue;
+		}
+		if (cell != _CFSM_TT_IGNORE)
+			states[i] = cell;
+		if (failed != NULL)
+			failed[i] = 0;
+	}
+	return nfailed;
+}
+{{endif}}{{if snapshot}}
+/*
+ * Snapshots hold {{if compact_storage}}whole compact instances{{else}}the current state of each instance{{endif}} as records
+ * of _{{fsm_struct}}_record_t, after the header.
+ */
+{{if compact_storage}}typedef struct {{fsm_struct}} _{{fsm_struct}}_record_t;
+{{else}}typedef {{state_storage_type}} _{{fsm_struct}}_record_t;
+{{endif}}
+size_t
+{{fsm_struct}}_snapshot_size(size_t n)
+{
+	if (n > (SIZE_MAX - sizeof(struct {{fsm_struct}}_snapshot_header)) /
+	    sizeof(_{{fsm_struct}}_record_t))
+		return 0;
+	return sizeof(struct {{fsm_struct}}_snapshot_header) +
+	    n * sizeof(_{{fsm_struct}}_record_t);
+}
+
+int
+{{fsm_struct}}_snapshot(const struct {{fsm_struct}} *fsms, size_t n, void *buf,
+    size_t len)
+{
+	struct {{fsm_struct}}_snapshot_header *h = buf;
+	_{{fsm_struct}}_record_t *records = (_{{fsm_struct}}_record_t *)(h + 1);
+{{if compact_storage}}{{else}}	size_t i;
+{{endif}}	size_t need = {{fsm_struct}}_snapshot_size(n);
+
+	if (need == 0 || len < need)
+		return CFSM_ERR_SNAPSHOT;
+	memcpy(h->magic, CFSM_SNAPSHOT_MAGIC, sizeof(h->magic));
+	h->byte_order = CFSM_SNAPSHOT_BYTE_ORDER;
+	h->record_size = sizeof(*records);
+	h->fingerprint = {{fingerprint_define}};
+	h->ninstances = n;
+{{if compact_storage}}	memcpy(records, fsms, n * sizeof(*records));
+{{else}}	for (i = 0; i < n; i++)
+		records[i] = fsms[i].current_state;
+{{endif}}	return CFSM_OK;
+}
+
+int
+{{fsm_struct}}_snapshot_check(const void *buf, size_t len, size_t *n)
+{
+	const struct {{fsm_struct}}_snapshot_header *h = buf;
+
+	/* Only the header is read, however large the snapshot */
+	if (len < sizeof(*h) ||
+	    memcmp(h->magic, CFSM_SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->byte_order != CFSM_SNAPSHOT_BYTE_ORDER ||
+	    h->fingerprint != {{fingerprint_define}} ||
+	    h->record_size != sizeof(_{{fsm_struct}}_record_t) ||
+	    h->ninstances > (len - sizeof(*h)) /
+	    sizeof(_{{fsm_struct}}_record_t))
+		return CFSM_ERR_SNAPSHOT;
+	if (n != NULL)
+		*n = h->ninstances;
+	return CFSM_OK;
+}
+{{if compact_storage}}
+struct {{fsm_struct}} *
+{{fsm_struct}}_restore(void *buf, size_t len, size_t *n)
+{
+	if ({{fsm_struct}}_snapshot_check(buf, len, n) != CFSM_OK)
+		return NULL;
+	return (struct {{fsm_struct}} *)
+	    ((struct {{fsm_struct}}_snapshot_header *)buf + 1);
+}
+{{else}}
+int
+{{fsm_struct}}_restore(struct {{fsm_struct}} *fsms, size_t n, const void *buf,
+    size_t len)
+{
+	const _{{fsm_struct}}_record_t *records = (const _{{fsm_struct}}_record_t *)
+	    ((const struct {{fsm_struct}}_snapshot_header *)buf + 1);
+	size_t i, count;
+
+	if ({{fsm_struct}}_snapshot_check(buf, len, &count) != CFSM_OK ||
+	    count != n)
+		return CFSM_ERR_SNAPSHOT;
+	/* Check every state first, so nothing is changed on failure */
+	for (i = 0; i < n; i++) {
+		if (records[i] >= {{num_states}})
+			return CFSM_ERR_SNAPSHOT;
+	}
+	for (i = 0; i < n; i++) {
+		fsms[i].current_state = records[i];
+{{if timeouts}}		_{{fsm_struct}}_timer_enter(&fsms[i], records[i]);
+{{endif}}	}
+	return CFSM_OK;
 }
+{{endif}}{{endif}}
\ No newline at end of file